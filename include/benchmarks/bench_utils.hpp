@@ -0,0 +1,110 @@
+#pragma once
+
+#include <signal.h>
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+
+#include <atomic>
+#include <filesystem>
+#include <future>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include "tests/test_utils.hpp"
+
+namespace bench_utils
+{
+  using test_utils::forked_server;
+  using test_utils::local_server_options;
+  using test_utils::make_temp_dir;
+  using test_utils::write_random_file;
+
+  /**
+   * @brief Counts the system calls made by a forked_server, from a thread tracing every thread of it with ptrace()
+   *
+   * Only the tracer thread can let go of a tracee, so the server is killed when the counter is destroyed. Tracing
+   * slows the server down, timings taken meanwhile mean nothing.
+   */
+  class syscall_counter
+  {
+  public:
+    explicit syscall_counter(const forked_server &server) :
+        _pid(server.pid()), _count(0)
+    {
+      std::promise<bool> attached;
+      auto               ready = attached.get_future();
+      _tracer                  = std::thread([this, &attached]() { trace(attached); });
+      if (!ready.get())
+      {
+        _tracer.join();
+        throw std::runtime_error("Failed to trace the server");
+      }
+    }
+
+    syscall_counter(const syscall_counter &) = delete;
+    syscall_counter &operator=(const syscall_counter &) = delete;
+
+    ~syscall_counter()
+    {
+      kill(_pid, SIGKILL);
+      _tracer.join();
+    }
+
+    uint64_t count() const
+    {
+      return _count.load();
+    }
+
+  private:
+    void trace(std::promise<bool> &attached)
+    {
+      // Interrupted once attached, so that they can be resumed to stop at every system call
+      for (const auto &task : std::filesystem::directory_iterator("/proc/" + std::to_string(_pid) + "/task"))
+      {
+        const pid_t tid = std::stoi(task.path().filename().string());
+        if (ptrace(PTRACE_SEIZE, tid, nullptr, PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE) < 0 ||
+            ptrace(PTRACE_INTERRUPT, tid, nullptr, nullptr) < 0)
+        {
+          attached.set_value(false);
+          return;
+        }
+      }
+      attached.set_value(true);
+
+      int   status = 0;
+      pid_t tid    = 0;
+      while ((tid = waitpid(-1, &status, __WALL)) > 0)
+      {
+        if (WIFEXITED(status) || WIFSIGNALED(status))
+        {
+          if (tid == _pid)
+          {
+            break;
+          }
+          continue;
+        }
+
+        int signal = 0;
+        if (WSTOPSIG(status) == (SIGTRAP | 0x80))
+        {
+          struct __ptrace_syscall_info info;
+          if (ptrace(PTRACE_GET_SYSCALL_INFO, tid, sizeof(info), &info) > 0 && info.op == PTRACE_SYSCALL_INFO_ENTRY)
+          {
+            ++_count;
+          }
+        }
+        else if ((status >> 16) == 0)
+        {
+          // Signal delivery stop, passed on to the server
+          signal = WSTOPSIG(status);
+        }
+        ptrace(PTRACE_SYSCALL, tid, nullptr, signal);
+      }
+    }
+
+    const pid_t           _pid;
+    std::atomic<uint64_t> _count;
+    std::thread           _tracer;
+  };
+} // namespace bench_utils
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <optional>
 #include <string>
 
 #include "common/tftp.hpp"
@@ -8,8 +9,15 @@
 namespace tftp_client
 {
   bool send_file(const std::string &filename, const std::string &tftp_server,
-                 const tftp::mode_t mode = tftp::mode_t::OCTET, const std::string &local_interface = "");
+                 const tftp::mode_t mode = tftp::mode_t::OCTET, const std::string &local_interface = "",
+                 const uint16_t port = 69);
   bool get_file(const std::string &filename, const std::string &tftp_server,
-                const tftp::mode_t mode = tftp::mode_t::OCTET, const std::string &local_interface = "");
+                const tftp::mode_t mode = tftp::mode_t::OCTET, const std::string &local_interface = "",
+                const uint16_t port = 69, const uint16_t window_size = 1,
+                const std::optional<uint16_t> rollover   = std::nullopt,
+                const size_t                  block_size = tftp::DATA_PKT_DATA_MAX_SIZE);
+  bool get_file_multicast(const std::string &filename, const std::string &tftp_server,
+                          const std::string &local_interface = "", const uint16_t port = 69,
+                          const std::string &local_filename = "");
 
 }; // namespace tftp_client
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "common/file_cache.hpp"
+#include "common/tftp.hpp"
+#include "common/tftp_read_file.hpp"
+
+/**
+ * @brief Server wide, size bounded cache of fully formed DATA datagrams shared by all sessions and workers
+ *
+ * Datagrams are cached in runs of consecutive blocks keyed by (file, block size, transfer mode, run index), each
+ * datagram complete with its header and block number so a session sends it as is. The file part of the key is the
+ * file_cache key, a file that is modified gets new entries, and inserting the runs of a new version of a file drops
+ * those of the old one. Netascii runs are cached already encoded.
+ *
+ * Runs are immutable and reference counted like file_cache chunks, least recently used runs are evicted first. A
+ * session missing on a run reads it with read_run(), which leaves the reader where the run ends, and inserts it. Each
+ * run also records that position so a session that got the previous run from the cache can carry on reading from it.
+ * All members but read_run() are thread safe.
+ */
+class datagram_cache
+{
+public:
+  static const size_t RUN_BYTES = 64 * 1024;
+
+  struct key_t
+  {
+    file_cache::key_t file;
+    size_t            block_size;
+    tftp::mode_t      mode;
+    uint16_t          rollover = 0; // Block number following 65535, it is in the datagrams' headers
+
+    bool operator==(const key_t &other) const;
+  };
+
+  struct run_t
+  {
+    std::vector<char>          datagrams;   // DATA datagrams back to back, all packet_size bytes but the file's last
+    size_t                     packet_size; // Header and a full block
+    size_t                     count;       // Datagrams in the run
+    bool                       last;        // The run holds the file's last block
+    bool                       error;       // Reading the run failed, the run is not cached
+    tftp_read_file::position_t end;         // Where the file's reader is after the run
+
+    std::string_view datagram(const size_t index) const;
+  };
+
+  struct stats_t
+  {
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+    size_t invalidations;
+    size_t cached_bytes;
+  };
+
+  using run_ptr = std::shared_ptr<const run_t>;
+
+  explicit datagram_cache(const size_t capacity_bytes);
+  datagram_cache(const datagram_cache &) = delete;
+  datagram_cache(datagram_cache &&)      = delete;
+  datagram_cache &operator=(const datagram_cache &) = delete;
+  datagram_cache &operator=(datagram_cache &&) = delete;
+
+  run_ptr find(const key_t &key, const size_t run_index);
+  run_ptr insert(const key_t &key, const size_t run_index, run_t run);
+  size_t  capacity() const;
+  stats_t stats() const;
+
+  static size_t blocks_per_run(const size_t block_size);
+  static run_t  read_run(tftp_read_file &file, const size_t block_size, const size_t run_index,
+                         const uint16_t rollover = 0);
+
+private:
+  struct run_key_t
+  {
+    key_t  key;
+    size_t index;
+
+    bool operator==(const run_key_t &other) const;
+  };
+
+  struct run_key_hash
+  {
+    size_t operator()(const run_key_t &key) const;
+  };
+
+  struct file_id_t
+  {
+    dev_t dev;
+    ino_t ino;
+
+    bool operator==(const file_id_t &other) const;
+  };
+
+  struct file_id_hash
+  {
+    size_t operator()(const file_id_t &id) const;
+  };
+
+  struct file_entry_t
+  {
+    file_cache::key_t version; // Newest version of the file cached
+    size_t            runs;
+  };
+
+  using lru_list_t = std::list<std::pair<run_key_t, run_ptr>>;
+
+  const size_t                                                      _capacity;
+  mutable std::mutex                                                _mutex;
+  lru_list_t                                                        _lru;
+  std::unordered_map<run_key_t, lru_list_t::iterator, run_key_hash> _index;
+  std::unordered_map<file_id_t, file_entry_t, file_id_hash>         _files;
+  stats_t                                                           _stats;
+
+  static size_t run_bytes(const run_t &run);
+
+  void erase(const lru_list_t::iterator iter);
+  void invalidate(const file_id_t &id);
+  void evict();
+};
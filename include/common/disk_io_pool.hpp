@@ -0,0 +1,71 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Fixed set of threads running blocking file I/O on behalf of the event loops
+ *
+ * Jobs are queued in a bounded FIFO and run by the first free thread. try_submit() fails instead of blocking when the
+ * queue is full. On destruction, jobs already queued still run before the threads are joined.
+ */
+class disk_io_pool
+{
+public:
+  disk_io_pool(const size_t num_threads, const size_t max_queued);
+  disk_io_pool(const disk_io_pool &) = delete;
+  disk_io_pool(disk_io_pool &&)      = delete;
+  disk_io_pool &operator=(const disk_io_pool &) = delete;
+  disk_io_pool &operator=(disk_io_pool &&) = delete;
+  ~disk_io_pool();
+
+  bool   try_submit(std::function<void()> job);
+  size_t num_threads() const;
+
+private:
+  const size_t                      _max_queued;
+  std::mutex                        _mutex;
+  std::condition_variable           _cv;
+  std::deque<std::function<void()>> _jobs;
+  bool                              _stopping;
+  std::vector<std::thread>          _threads;
+
+  void run();
+};
+
+/**
+ * @brief An event loop's connection to a disk_io_pool
+ *
+ * submit() runs a job on the pool, its completion is queued back here and fd(), an eventfd, becomes readable. The
+ * completion is queued even if the job throws, the job is expected to record its own errors for the completion. The
+ * owning event loop polls fd() and calls run_completions(), so completions always run on the event loop's thread.
+ * Must outlive the jobs submitted through it, i.e. be destroyed after the pool.
+ */
+class disk_io_channel
+{
+public:
+  explicit disk_io_channel(disk_io_pool &pool);
+  disk_io_channel(const disk_io_channel &) = delete;
+  disk_io_channel(disk_io_channel &&)      = delete;
+  disk_io_channel &operator=(const disk_io_channel &) = delete;
+  disk_io_channel &operator=(disk_io_channel &&) = delete;
+  ~disk_io_channel();
+
+  bool   submit(std::function<void()> job, std::function<void()> on_complete);
+  int    fd() const;
+  size_t run_completions();
+
+private:
+  disk_io_pool                      &_pool;
+  int                                _event_fd;
+  std::mutex                         _mutex;
+  std::vector<std::function<void()>> _completions;
+  std::vector<std::function<void()>> _running;
+
+  void post(std::function<void()> completion);
+};
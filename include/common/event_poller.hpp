@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include <vector>
+
+/**
+ * @brief Readiness notification interface used by the server event loop
+ *
+ * Semantics follow level triggered epoll: a registered fd is reported every wait() while it is ready for the
+ * requested events, until its interest is modified or it is removed. Event bits are the EPOLLIN / EPOLLOUT / EPOLLERR /
+ * EPOLLHUP values, data is returned untouched with each event.
+ *
+ * A backend may also do the socket I/O itself. After receive_datagrams(fd) succeeds, EPOLLIN on fd is reported once a
+ * datagram has been received, the event carrying the datagram, which stays valid until the next wait(). Sends passed
+ * to queue_send() go out with the next wait(), they must not be waited for and their buffers must stay unchanged until
+ * then, or until the fd is removed.
+ *
+ * A backend may read files as well. A read passed to queue_read() is submitted with the next wait() and reported by a
+ * later one as an event with no event bits, carrying the read's data and result.
+ */
+class event_poller
+{
+public:
+  enum class backend_t
+  {
+    EPOLL,
+    IO_URING
+  };
+
+  struct event_t
+  {
+    uint32_t         events;
+    uint64_t         data;
+    std::string_view datagram; // Received by the poller, see receive_datagrams()
+    int32_t          result;   // Bytes read or -errno, see queue_read()
+  };
+
+  virtual ~event_poller() = default;
+
+  virtual void add(const int fd, const uint32_t events, const uint64_t data)    = 0;
+  virtual void modify(const int fd, const uint32_t events, const uint64_t data) = 0;
+  virtual void remove(const int fd)                                             = 0;
+  virtual int  wait(event_t *events, const int max_events, const int timeout_ms) = 0;
+
+  virtual bool receive_datagrams(const int fd);
+  virtual bool queue_send(const int fd, const char *data, const size_t size);
+  virtual bool queue_read(const int fd, const struct iovec *iov, const size_t count, const uint64_t offset,
+                          const uint64_t data, std::shared_ptr<const void> keep_alive);
+
+  virtual backend_t backend() const = 0;
+
+  static std::unique_ptr<event_poller> create(const backend_t backend, const size_t max_fds);
+
+  static std::optional<backend_t> string_to_backend(const std::string &name);
+  static std::string              backend_to_string(const backend_t backend);
+};
+
+/**
+ * @brief event_poller on top of epoll
+ */
+class epoll_poller : public event_poller
+{
+public:
+  epoll_poller();
+  epoll_poller(const epoll_poller &) = delete;
+  epoll_poller(epoll_poller &&)      = delete;
+  epoll_poller &operator=(const epoll_poller &) = delete;
+  epoll_poller &operator=(epoll_poller &&) = delete;
+  ~epoll_poller() override;
+
+  void      add(const int fd, const uint32_t events, const uint64_t data) override;
+  void      modify(const int fd, const uint32_t events, const uint64_t data) override;
+  void      remove(const int fd) override;
+  int       wait(event_t *events, const int max_events, const int timeout_ms) override;
+  backend_t backend() const override;
+
+private:
+  int                             _epoll_fd;
+  std::vector<struct epoll_event> _epoll_events;
+};
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief Server wide, size bounded cache of file contents shared by all sessions and workers
+ *
+ * Files are cached in fixed size chunks keyed by (device, inode, mtime, size) so a file that is replaced or modified
+ * gets new entries instead of stale data. Chunks are immutable and reference counted, a reader keeps the chunk it is
+ * copying from alive even if it is evicted meanwhile, so the memory cap applies to what the cache itself holds.
+ * Least recently used chunks are evicted first.
+ *
+ * Readers look a chunk up with find() and, on a miss, read it from disk themselves and insert() it, so no disk I/O
+ * happens under the lock. All members are thread safe. Two readers missing on the same chunk at once may both read
+ * it, the first one inserted wins.
+ */
+class file_cache
+{
+public:
+  static const size_t DEFAULT_CHUNK_SIZE = 64 * 1024;
+
+  struct key_t
+  {
+    dev_t    dev;
+    ino_t    ino;
+    int64_t  mtime_ns;
+    uint64_t size;
+
+    bool operator==(const key_t &other) const;
+  };
+
+  struct stats_t
+  {
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+    size_t cached_bytes;
+    size_t disk_read_bytes;
+  };
+
+  using chunk_ptr = std::shared_ptr<const std::vector<char>>;
+
+  explicit file_cache(const size_t capacity_bytes, const size_t chunk_size = DEFAULT_CHUNK_SIZE);
+  file_cache(const file_cache &) = delete;
+  file_cache(file_cache &&)      = delete;
+  file_cache &operator=(const file_cache &) = delete;
+  file_cache &operator=(file_cache &&) = delete;
+
+  chunk_ptr find(const key_t &key, const size_t index);
+  chunk_ptr insert(const key_t &key, const size_t index, std::vector<char> data);
+  size_t    chunk_size() const;
+  size_t    capacity() const;
+  stats_t   stats() const;
+
+  static key_t make_key(const struct stat &st);
+
+private:
+  struct chunk_key_t
+  {
+    key_t  file;
+    size_t index;
+
+    bool operator==(const chunk_key_t &other) const;
+  };
+
+  struct chunk_key_hash
+  {
+    size_t operator()(const chunk_key_t &key) const;
+  };
+
+  using lru_list_t = std::list<std::pair<chunk_key_t, chunk_ptr>>;
+
+  const size_t                                                          _capacity;
+  const size_t                                                          _chunk_size;
+  mutable std::mutex                                                    _mutex;
+  lru_list_t                                                            _lru;
+  std::unordered_map<chunk_key_t, lru_list_t::iterator, chunk_key_hash> _index;
+  stats_t                                                               _stats;
+
+  void evict();
+};
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+/**
+ * @brief Read only memory mapping of a whole file
+ *
+ * The file is mapped once when opened and stays mapped until the object is destroyed, so pointers into data() can be
+ * handed to the kernel for zero copy sends. An empty file maps to a null data() with size() 0. The mapping holds no
+ * descriptor open, a file can also be mapped from a descriptor the caller keeps, such as one shared through an
+ * open_file_table.
+ *
+ * Touching a page of the mapping past the end of a file truncated since it was mapped raises SIGBUS, copy_out() copies
+ * from the mapping and reports that as a failure instead. The kernel reports it as EFAULT when it sends from there.
+ */
+class mapped_file
+{
+public:
+  mapped_file();
+  explicit mapped_file(const std::string &filename);
+  mapped_file(const mapped_file &) = delete;
+  mapped_file(mapped_file &&)      = delete;
+  mapped_file &operator=(const mapped_file &) = delete;
+  mapped_file &operator=(mapped_file &&) = delete;
+  ~mapped_file();
+
+  void        open(const std::string &filename);
+  void        open(const int fd, const size_t size_bytes);
+  bool        is_open() const;
+  const char *data() const;
+  size_t      size() const;
+  void        prefetch(const size_t offset, const size_t size_bytes) const;
+  bool        copy_out(char *dest, const size_t offset, const size_t size_bytes) const;
+
+private:
+  bool        _open;
+  const char *_data;
+  size_t      _size;
+};
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "common/file_cache.hpp"
+
+/**
+ * @brief Server wide, size bounded cache of what validating a request needs to know about the requested path
+ *
+ * One lookup returns the path's canonical form, whether it is inside the server root, whether it exists, its size and
+ * file_cache key and, for a readable regular file, an open descriptor to it. The root is made canonical once, when the
+ * cache is created, so the containment check is worked out when an entry is resolved and not per request.
+ *
+ * With inotify available, the directories from the root down to each cached path are watched and entries are dropped
+ * as soon as the files they describe are created, removed, renamed or modified. Pending events are applied at the
+ * start of every lookup, so a lookup never returns an entry for a file changed before it began. Entries reached
+ * through a symbolic link, and all entries when inotify is not available, are resolved again once they are ttl_ms
+ * old. invalidate() drops an entry straight away, for changes the server makes itself.
+ *
+ * Like file_cache, paths are resolved without holding the lock and the entries handed out are immutable and
+ * reference counted, an entry's descriptor stays open until the last holder lets go of it. All members are thread
+ * safe.
+ */
+class metadata_cache
+{
+public:
+  static constexpr uint32_t DEFAULT_TTL_MS = 1000;
+
+  struct entry_t
+  {
+    std::filesystem::path canonical; // Absolute, with symbolic links resolved
+    bool                  in_root;
+    bool                  exists;
+    bool                  regular;
+    uint64_t              size;
+    file_cache::key_t     key;
+    int                   fd; // Read only, -1 unless a regular file inside the root that could be opened
+    uint64_t              resolved_us;
+    bool                  watched; // Kept up to date by inotify, no ttl
+
+    entry_t();
+    entry_t(const entry_t &)            = delete;
+    entry_t &operator=(const entry_t &) = delete;
+    ~entry_t();
+  };
+
+  struct stats_t
+  {
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+    size_t invalidations;
+    size_t entries;
+  };
+
+  using entry_ptr = std::shared_ptr<const entry_t>;
+
+  metadata_cache(const std::filesystem::path &root, const size_t max_entries, const uint32_t ttl_ms = DEFAULT_TTL_MS,
+                 const bool use_inotify = true);
+  metadata_cache(const metadata_cache &) = delete;
+  metadata_cache(metadata_cache &&)      = delete;
+  metadata_cache &operator=(const metadata_cache &) = delete;
+  metadata_cache &operator=(metadata_cache &&) = delete;
+  ~metadata_cache();
+
+  entry_ptr lookup(const std::string &filename);
+  void      invalidate(const std::string &filename);
+  void      clear();
+  bool      watching() const;
+  stats_t   stats() const;
+
+  static entry_ptr   resolve(const std::filesystem::path &root, const std::string &filename);
+  static std::string open_path(const entry_t &entry, const std::string &filename);
+
+private:
+  using lru_list_t = std::list<std::pair<std::string, entry_ptr>>;
+
+  const std::filesystem::path                           _root;
+  const size_t                                          _max_entries;
+  const uint64_t                                        _ttl_us;
+  int                                                   _inotify_fd;
+  mutable std::mutex                                    _mutex;
+  lru_list_t                                            _lru;
+  std::unordered_map<std::string, lru_list_t::iterator> _index;
+  std::unordered_map<int, std::filesystem::path>        _watches; // Watch descriptor to directory
+  std::unordered_map<std::string, int>                  _watched_dirs;
+  uint64_t                                              _generation; // Bumped by every change seen
+  stats_t                                               _stats;
+
+  bool watch(const std::filesystem::path &path);
+  void apply_events();
+  void invalidate_under(const std::filesystem::path &path);
+  void erase(const lru_list_t::iterator iter);
+  void evict();
+};
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+/**
+ * @brief netascii transcoding kernels writing into caller provided buffers
+ *
+ * encode() turns LF into CR LF and CR into CR NUL, decode() reverses it and throws std::runtime_error on a CR that is
+ * not followed by LF or NUL. Vector implementations scan 16 (SSE2) or 32 (AVX2) bytes at a time for CR / LF and copy
+ * blocks without any straight through. The AVX2 kernels expand / contract blocks that do contain them with byte
+ * shuffles, 8 bytes at a time. The best implementation the CPU supports is picked at runtime, the scalar one is used
+ * on other architectures.
+ */
+namespace netascii
+{
+  enum class isa_t
+  {
+    SCALAR,
+    SSE2,
+    AVX2
+  };
+
+  /**
+   * @brief Worst case size of encode()'s output, every byte is a CR or LF
+   */
+  inline size_t max_encoded_size(const size_t size)
+  {
+    return 2 * size;
+  }
+
+  size_t encode(const char *src, const size_t size, char *dest);
+  size_t decode(const char *src, const size_t size, char *dest);
+  size_t encode(const isa_t isa, const char *src, const size_t size, char *dest);
+  size_t decode(const isa_t isa, const char *src, const size_t size, char *dest);
+
+  isa_t       active_isa();
+  bool        isa_supported(const isa_t isa);
+  std::string isa_to_string(const isa_t isa);
+} // namespace netascii
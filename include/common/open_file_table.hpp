@@ -0,0 +1,83 @@
+#pragma once
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+/**
+ * @brief Server wide table of the files open for reading, one read only descriptor per inode shared by its readers
+ *
+ * acquire() stats the path and, if a reader already has that inode open, hands out the same descriptor. Readers read
+ * at their own offsets with pread(), so sharing a descriptor does not share a file position. Descriptors are reference
+ * counted and closed when the last reader lets go of theirs, the table itself only keeps weak references. Hundreds of
+ * sessions reading the same file then cost one descriptor instead of one FILE and its buffer each.
+ *
+ * A file that is replaced gets a new inode and so a new descriptor, readers of the old one keep reading the old file.
+ * All members are thread safe, a descriptor may outlive the table.
+ */
+class open_file_table
+{
+public:
+  struct open_file_t
+  {
+    int   fd;
+    dev_t dev;
+    ino_t ino;
+
+    open_file_t(const int descriptor, const struct stat &st);
+    open_file_t(const open_file_t &)            = delete;
+    open_file_t &operator=(const open_file_t &) = delete;
+    ~open_file_t();
+  };
+
+  struct stats_t
+  {
+    size_t opens;      // Descriptors opened
+    size_t shares;     // Acquires served with a descriptor already open
+    size_t open_files; // Descriptors open now
+  };
+
+  using file_ptr = std::shared_ptr<const open_file_t>;
+
+  open_file_table();
+  open_file_table(const open_file_table &) = delete;
+  open_file_table(open_file_table &&)      = delete;
+  open_file_table &operator=(const open_file_table &) = delete;
+  open_file_table &operator=(open_file_table &&) = delete;
+
+  file_ptr acquire(const std::string &filename, struct stat &st);
+  stats_t  stats() const;
+
+  static file_ptr open(const std::string &filename, struct stat &st);
+
+private:
+  struct file_id_t
+  {
+    dev_t dev;
+    ino_t ino;
+
+    bool operator==(const file_id_t &other) const;
+  };
+
+  struct file_id_hash
+  {
+    size_t operator()(const file_id_t &id) const;
+  };
+
+  struct state_t
+  {
+    std::mutex                                                                    mutex;
+    std::unordered_map<file_id_t, std::weak_ptr<const open_file_t>, file_id_hash> files;
+    stats_t                                                                       stats;
+  };
+
+  // Shared with the descriptors, the last reader of a file removes it from the table
+  std::shared_ptr<state_t> _state;
+
+  static int open_descriptor(const std::string &filename, struct stat &st);
+};
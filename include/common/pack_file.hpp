@@ -0,0 +1,75 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+
+/**
+ * @brief Read only archive of many small files, mapped once and served from memory by path
+ *
+ * A pack is built offline from a directory tree with build() (the tftp_pack tool) and opened by the server, which
+ * then serves the files in it without a path walk, open or close per request. Paths are looked up in a hash index in
+ * O(1), a lookup only touches the index slots it probes, the path and the file's data.
+ *
+ * Format, all integers little endian:
+ *
+ *   header, 48 bytes at offset 0
+ *     char[8]  magic        "TFTPPACK"
+ *     uint32   version      1
+ *     uint32   reserved     0
+ *     uint64   entry_count  Number of files
+ *     uint64   slot_count   Size of the index, a power of two at least twice entry_count
+ *     uint64   slots_offset Offset of the index
+ *     uint64   pack_size    Size of the whole pack, a truncated pack is refused
+ *   index, slot_count slots of 40 bytes at slots_offset
+ *     uint64   hash         FNV-1a 64 of the path, 0 for an empty slot (a path hashing to 0 is stored as 1)
+ *     uint64   name_offset  Offset of the path
+ *     uint64   data_offset  Offset of the file's contents
+ *     uint64   data_size    Size of the file
+ *     uint32   name_size    Size of the path
+ *     uint32   reserved     0
+ *   paths and file contents, anywhere after the index
+ *
+ * A path goes in the slot at hash modulo slot_count or, if that is taken, the next free one after it (linear probing).
+ * Paths are relative to the packed directory, '/' separated and lexically normal ("boot/grub.cfg"), requests are
+ * normalised the same way before they are looked up, so "./boot//grub.cfg" finds it too and paths climbing out of the
+ * tree find nothing.
+ */
+class pack_file
+{
+public:
+  static const uint32_t VERSION = 1;
+
+  struct stats_t
+  {
+    size_t files;
+    size_t bytes;
+  };
+
+  explicit pack_file(const std::string &filename);
+  pack_file(const pack_file &) = delete;
+  pack_file(pack_file &&)      = delete;
+  pack_file &operator=(const pack_file &) = delete;
+  pack_file &operator=(pack_file &&) = delete;
+  ~pack_file();
+
+  std::optional<std::string_view> find(const std::string &filename) const;
+  size_t                          size() const;
+  uint64_t                        entry_count() const;
+
+  static stats_t     build(const std::filesystem::path &dir, const std::filesystem::path &pack);
+  static std::string normalise(const std::string &filename);
+  static uint64_t    hash(const std::string_view name);
+
+private:
+  const char *_data;
+  size_t      _size;
+  uint64_t    _entry_count;
+  uint64_t    _slot_count;
+  uint64_t    _slots_offset;
+};
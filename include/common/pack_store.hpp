@@ -0,0 +1,54 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "common/pack_file.hpp"
+
+/**
+ * @brief The pack_file currently at a path, swapped for the new one when the path is replaced
+ *
+ * current() checks, at most every RECHECK_MS, whether the path now names another file, as it does once tftp_pack has
+ * renamed a new pack over it, and if so opens that one. Sessions hold on to the pack they started with, the old
+ * mapping goes away when the last of them finishes, so a swap never changes a transfer under way. A new pack that
+ * fails to open is logged and the current one kept. All members are thread safe.
+ */
+class pack_store
+{
+public:
+  static const uint32_t RECHECK_MS = 1000;
+
+  explicit pack_store(const std::string &path);
+  pack_store(const pack_store &) = delete;
+  pack_store(pack_store &&)      = delete;
+  pack_store &operator=(const pack_store &) = delete;
+  pack_store &operator=(pack_store &&) = delete;
+
+  std::shared_ptr<const pack_file> current();
+  bool                             reload();
+  size_t                           swaps() const;
+
+private:
+  struct identity_t
+  {
+    dev_t   dev;
+    ino_t   ino;
+    int64_t mtime_ns;
+    off_t   size;
+
+    bool operator==(const identity_t &other) const;
+  };
+
+  const std::string                _path;
+  mutable std::mutex               _mutex;
+  std::shared_ptr<const pack_file> _pack;
+  identity_t                       _identity;
+  uint64_t                         _checked_us;
+  size_t                           _swaps;
+
+  bool load(const bool initial);
+};
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include <random>
+
+/**
+ * @brief Round trip time estimator and retransmission timeout in the style of RFC 6298
+ *
+ * Samples are in microseconds, timeouts in milliseconds to match the timer wheel. Until the first sample arrives the
+ * timeout is the initial value. Each backoff() doubles the timeout up to the maximum, the next sample clears the
+ * backoff. Callers should follow Karn's algorithm and only sample packets that were not retransmitted.
+ *
+ * next_timeout_ms() adds up to 1/8 of random jitter so sessions that lost packets together do not retransmit together.
+ */
+class rtt_estimator
+{
+public:
+  rtt_estimator(const uint32_t initial_rto_ms, const uint32_t min_rto_ms, const uint32_t max_rto_ms,
+                const uint32_t seed = std::minstd_rand::default_seed);
+
+  void     add_sample(const uint64_t rtt_us);
+  void     backoff();
+  uint32_t rto_ms() const;
+  uint32_t next_timeout_ms();
+  bool     has_samples() const;
+  uint64_t srtt_us() const;
+  uint64_t rttvar_us() const;
+
+  static uint64_t steady_clock_us();
+
+private:
+  uint32_t         _min_rto_ms;
+  uint32_t         _max_rto_ms;
+  uint32_t         _base_rto_ms;
+  uint8_t          _backoff_shift;
+  bool             _has_samples;
+  uint64_t         _srtt_us;
+  uint64_t         _rttvar_us;
+  std::minstd_rand _rng;
+};
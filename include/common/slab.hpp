@@ -0,0 +1,152 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <utility>
+
+/**
+ * @brief Fixed capacity pool of objects addressed by generation tagged handles
+ *
+ * All slots are allocated up front. Free slots are kept on a free list so emplace() and release() are O(1). A handle
+ * packs the slot index with the slot's generation, which is bumped on every release, so a handle to a released object
+ * is detected by get() rather than aliasing whatever reuses the slot. Handles fit in epoll_event.data.u64.
+ *
+ * Generations wrap at GENERATION_BITS, so the TAG_BITS at the top of a handle are never set and the owner may tag
+ * handles with them, as long as it strips the tag again before get() or release().
+ */
+template <typename T>
+class slab
+{
+public:
+  using handle_t = uint64_t;
+
+  static constexpr handle_t INVALID_HANDLE  = ~handle_t(0);
+  static constexpr unsigned GENERATION_BITS = 30;
+  static constexpr handle_t TAG_BITS        = ~((handle_t(1) << (32 + GENERATION_BITS)) - 1);
+
+  explicit slab(const size_t capacity) :
+      _slots(new slot_t[capacity]), _capacity(capacity), _size(0), _free_head(NO_SLOT)
+  {
+    if (capacity >= NO_SLOT)
+    {
+      throw std::invalid_argument("Slab capacity too large");
+    }
+    for (size_t i = capacity; i > 0; --i)
+    {
+      _slots[i - 1].next_free = _free_head;
+      _free_head              = static_cast<uint32_t>(i - 1);
+    }
+  }
+
+  slab(const slab &) = delete;
+  slab(slab &&)      = delete;
+  slab &operator=(const slab &) = delete;
+  slab &operator=(slab &&) = delete;
+
+  ~slab()
+  {
+    for (size_t i = 0; i < _capacity; ++i)
+    {
+      if (_slots[i].live)
+      {
+        object(i)->~T();
+      }
+    }
+  }
+
+  /**
+   * @brief Constructs an object in a free slot and returns its handle. Throws if the slab is full
+   */
+  template <typename... Args>
+  handle_t emplace(Args &&...args)
+  {
+    if (_free_head == NO_SLOT)
+    {
+      throw std::length_error("Slab is full");
+    }
+    const uint32_t index = _free_head;
+    slot_t        &slot  = _slots[index];
+    new (slot.storage) T(std::forward<Args>(args)...);
+    _free_head = slot.next_free;
+    slot.live  = true;
+    ++_size;
+    return make_handle(index, slot.generation);
+  }
+
+  /**
+   * @brief Returns the object for a handle, or nullptr if it has been released
+   */
+  T *get(const handle_t handle)
+  {
+    const uint64_t index = handle & 0xFFFFFFFF;
+    if ((index >= _capacity) || !_slots[index].live || (_slots[index].generation != (handle >> 32)))
+    {
+      return nullptr;
+    }
+    return object(index);
+  }
+
+  /**
+   * @brief Destroys the object and returns its slot to the free list. Stale handles are ignored
+   */
+  void release(const handle_t handle)
+  {
+    if (get(handle) == nullptr)
+    {
+      return;
+    }
+    const uint32_t index = handle & 0xFFFFFFFF;
+    slot_t        &slot  = _slots[index];
+    object(index)->~T();
+    slot.live       = false;
+    slot.generation = (slot.generation + 1) & GENERATION_MASK;
+    slot.next_free  = _free_head;
+    _free_head      = index;
+    --_size;
+  }
+
+  size_t size() const
+  {
+    return _size;
+  }
+
+  size_t capacity() const
+  {
+    return _capacity;
+  }
+
+  bool full() const
+  {
+    return _size == _capacity;
+  }
+
+private:
+  static const uint32_t NO_SLOT         = ~uint32_t(0);
+  static const uint32_t GENERATION_MASK = (uint32_t(1) << GENERATION_BITS) - 1;
+
+  struct slot_t
+  {
+    alignas(T) unsigned char storage[sizeof(T)];
+    uint32_t generation = 0;
+    uint32_t next_free  = NO_SLOT;
+    bool     live       = false;
+  };
+
+  std::unique_ptr<slot_t[]> _slots;
+  size_t                    _capacity;
+  size_t                    _size;
+  uint32_t                  _free_head;
+
+  T *object(const size_t index)
+  {
+    return std::launder(reinterpret_cast<T *>(_slots[index].storage));
+  }
+
+  static handle_t make_handle(const uint32_t index, const uint32_t generation)
+  {
+    return (static_cast<handle_t>(generation) << 32) | index;
+  }
+};
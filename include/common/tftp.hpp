@@ -1,16 +1,23 @@
 #pragma once
 
+#include <array>
 #include <cstddef>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace tftp
 {
 
-  static const size_t DATA_PKT_MAX_SIZE      = 516;
-  static const size_t DATA_PKT_DATA_MAX_SIZE = 512;
-  static const size_t ACK_PKT_MAX_SIZE       = 4;
+  static const size_t   DATA_PKT_MAX_SIZE      = 516;
+  static const size_t   DATA_PKT_DATA_MAX_SIZE = 512;
+  static const size_t   ACK_PKT_MAX_SIZE       = 4;
+  static const size_t   DATA_PKT_HEADER_SIZE   = 4;
+  static const uint16_t MAX_BLOCK_NUMBER       = 65535;
+  static const size_t   MIN_BLOCK_SIZE         = 8;     // RFC 2348 blksize range
+  static const size_t   MAX_BLOCK_SIZE         = 65464;
+  static const size_t   IPV4_UDP_HEADER_SIZE   = 28;    // IPv4 header without options and UDP header
 
   enum class packet_t : uint8_t
   {
@@ -86,8 +93,51 @@ namespace tftp
     uint16_t    error_code;
   };
 
+  /**
+   * @brief Data packet decoded without copying, data points into the buffer it was decoded from
+   */
+  struct data_packet_view_t
+  {
+    std::string_view data;
+    uint16_t         block_number;
+  };
+
+  /**
+   * @brief Error packet decoded without copying, error_msg points into the buffer it was decoded from
+   */
+  struct error_packet_view_t
+  {
+    std::string_view error_msg;
+    uint16_t         error_code;
+  };
+
+  /**
+   * @brief DATA packet buffer that keeps room for the header in front of the payload
+   *
+   * File data is read straight into payload() and the header is patched in place, so a block is never copied to put
+   * its header in front of it. data() / size() is the whole packet as sent on the wire, and can be resent as is.
+   */
+  class data_packet_buffer
+  {
+  public:
+    data_packet_buffer();
+
+    char       *payload();
+    const char *payload() const;
+    size_t      payload_size() const;
+    void        resize_payload(const size_t size);
+    void        set_block_number(const uint16_t block_number);
+    uint16_t    block_number() const;
+    const char *data() const;
+    size_t      size() const;
+
+  private:
+    std::vector<char> _buffer;
+  };
+
   std::vector<char> serialise_rw_packet(const rw_packet_t &packet);
   std::vector<char> serialise_data_packet(const data_packet_t &packet);
+  std::array<char, DATA_PKT_HEADER_SIZE> serialise_data_header(const uint16_t block_number);
   std::vector<char> serialise_ack_packet(const ack_packet_t &packet);
   std::vector<char> serialise_error_packet(const error_packet_t &packet);
   std::vector<char> serialise_oack_packet(const oack_packet_t &packet);
@@ -98,6 +148,26 @@ namespace tftp
   std::optional<error_packet_t> deserialise_error_packet(const std::vector<char> &data);
   std::optional<oack_packet_t>  deserialise_oack_packet(const std::vector<char> &data);
 
+  // Allocation free codec for the transfer loop. encode_* write into a caller provided buffer and return the packet
+  // size, or 0 if the buffer is too small. decode_* return views into the packet buffer.
+  size_t encode_data_packet(const uint16_t block_number, const std::string_view payload, char *buffer,
+                            const size_t buffer_size);
+  size_t encode_ack_packet(const uint16_t block_number, char *buffer, const size_t buffer_size);
+  size_t encode_error_packet(const uint16_t error_code, const std::string_view error_msg, char *buffer,
+                             const size_t buffer_size);
+
+  std::optional<data_packet_view_t>  decode_data_packet(const std::string_view packet);
+  std::optional<ack_packet_t>        decode_ack_packet(const std::string_view packet);
+  std::optional<error_packet_view_t> decode_error_packet(const std::string_view packet);
+
+  // Block numbers of transfers longer than 65535 blocks roll over to 0, or to 1 if the rollover option asks for it
+  uint16_t next_block_number(const uint16_t block_number, const uint16_t rollover = 0);
+  uint16_t previous_block_number(const uint16_t block_number, const uint16_t rollover = 0);
+  uint16_t block_distance(const uint16_t from, const uint16_t to, const uint16_t rollover = 0);
+  uint16_t block_number_at(const uint64_t index, const uint16_t rollover = 0);
+
+  size_t block_size_for_mtu(const int mtu);
+
   std::optional<mode_t> string_to_mode_t(std::string mode_str);
   std::string           mode_t_to_string(const mode_t mode);
 
@@ -1,29 +1,97 @@
 #pragma once
 
-#include <stdio.h>
+#include <memory>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <vector>
 
+#include "file_cache.hpp"
+#include "mapped_file.hpp"
+#include "open_file_table.hpp"
 #include "tftp.hpp"
 
+/**
+ * @brief Reads a file block by block for a read transfer, converting to netascii if required
+ *
+ * The file is read with pread() at the reader's own position. When opened with an open_file_table the descriptor is
+ * shared with every other reader of the same file and closed once the last of them is done.
+ *
+ * With mmap_min_bytes set, files of at least that size are mapped instead and blocks are copied out of the mapping,
+ * with no system call per block. mapping() then gives octet transfers the file's bytes to send from directly. Small
+ * files are still read with pread(), mapping and unmapping them costs more than reading them. A mapped file that
+ * shrinks during the transfer sets error() rather than raising SIGBUS.
+ *
+ * A reader can also be opened on bytes already in memory, such as a file in a pack_file, which it then encodes like a
+ * file without any file I/O.
+ *
+ * When opened with a file_cache the file contents come from the cache and the file is only opened, and read, for the
+ * chunks that are not cached yet. A hot file is then served with no disk reads at all.
+ *
+ * The file is advised as read sequentially when it is opened. prefetch() asks the kernel to start reading the bytes
+ * after the current position, so later reads find them in the page cache instead of waiting for the disk.
+ *
+ * position() and seek() save and restore where the transfer is, including encoded netascii bytes that did not fit the
+ * last block, so a transfer can carry on from blocks built by another reader of the same file.
+ */
 class tftp_read_file
 {
 public:
+  struct position_t
+  {
+    uint64_t    offset;   // Bytes of the file read
+    std::string overflow; // Encoded bytes read but not yet handed out
+  };
+
   tftp_read_file();
-  tftp_read_file(const std::string &filename, const tftp::mode_t mode);
+  tftp_read_file(const std::string &filename, const tftp::mode_t mode, file_cache *cache = nullptr,
+                 open_file_table *files = nullptr, const uint64_t mmap_min_bytes = 0);
   tftp_read_file(const tftp_read_file &t) = delete;
   tftp_read_file(tftp_read_file &&t)      = delete;
   tftp_read_file &operator=(const tftp_read_file &) = delete;
   tftp_read_file &operator=(tftp_read_file &&) = delete;
   ~tftp_read_file();
 
-  void open(const std::string &filename, const tftp::mode_t mode);
+  void open(const std::string &filename, const tftp::mode_t mode, file_cache *cache = nullptr,
+            open_file_table *files = nullptr, const uint64_t mmap_min_bytes = 0);
+  void open(std::shared_ptr<const char> data, const size_t size_bytes, const tftp::mode_t mode);
   void read_in_to(std::vector<char> &ret, const size_t size_bytes);
+  void read_in_to(tftp::data_packet_buffer &packet, const size_t size_bytes);
+  size_t read_in_to(char *dest, const size_t size_bytes);
+  void prefetch(const size_t size_bytes);
   bool eof() const;
   bool error() const;
 
+  const file_cache::key_t        &key() const;
+  std::optional<std::string_view> mapping() const;
+  open_file_table::file_ptr       descriptor() const;
+  position_t                      position() const;
+  void                            seek(const position_t &position);
+
 private:
-  FILE             *_fd;
-  tftp::mode_t      _mode;
-  std::vector<char> _overflow_buffer;
-};
\ No newline at end of file
+  open_file_table::file_ptr   _file;
+  mapped_file                 _map;
+  tftp::mode_t                _mode;
+  std::vector<char>           _overflow_buffer;
+  std::vector<char>           _netascii_buffer;
+  std::string                 _filename;
+  file_cache                 *_cache;
+  open_file_table            *_files;
+  std::shared_ptr<const char> _memory;
+  size_t                      _memory_size;
+  file_cache::key_t           _key;
+  file_cache::chunk_ptr       _chunk;
+  size_t                      _chunk_index;
+  uint64_t                    _position;
+  uint64_t                    _advised_to;
+  bool                        _eof;
+  bool                        _error;
+
+  size_t read_block(char *dest, const size_t size_bytes);
+  size_t read_from_file(char *dest, const size_t size_bytes);
+  size_t pread_fully(char *dest, const size_t size_bytes, const uint64_t offset);
+  size_t read_from_cache(char *dest, const size_t size_bytes);
+  size_t read_from_memory(char *dest, const size_t size_bytes);
+  size_t read_from_map(char *dest, const size_t size_bytes);
+  bool   load_chunk(const size_t index);
+};
@@ -1,28 +1,70 @@
 #pragma once
 
-#include <stdio.h>
+#include <cstdint>
+#include <optional>
 #include <string>
 #include <vector>
 
 #include "tftp.hpp"
 
+/**
+ * @brief Writes the blocks of a write transfer to a file, converting from netascii if required
+ *
+ * Blocks are gathered into WRITE_BATCH_BYTES and written with one pwrite() each, so every write but the last starts
+ * and ends on a batch boundary. preallocate() reserves the announced size up front so a large upload is laid out in
+ * one piece and runs out of space before, not during, the transfer. close() writes what is left, syncs the data as
+ * the sync policy asks and trims the file to what was written.
+ */
 class tftp_write_file
 {
 public:
+  enum class sync_t
+  {
+    NONE,     // Left to the kernel
+    ON_CLOSE, // fdatasync() on close
+    INTERVAL  // fdatasync() every interval_bytes and on close
+  };
+
+  struct sync_policy_t
+  {
+    sync_t   sync;
+    uint64_t interval_bytes; // INTERVAL only
+  };
+
+  static const size_t WRITE_BATCH_BYTES = 256 * 1024;
+
   tftp_write_file();
-  tftp_write_file(const std::string &filename, const tftp::mode_t mode);
+  tftp_write_file(const std::string &filename, const tftp::mode_t mode, const sync_policy_t &sync_policy = {});
   tftp_write_file(const tftp_write_file &t) = delete;
   tftp_write_file(tftp_write_file &&t)      = delete;
   tftp_write_file &operator=(const tftp_write_file &) = delete;
   tftp_write_file &operator=(tftp_write_file &&) = delete;
   ~tftp_write_file();
 
-  void open(const std::string &filename, const tftp::mode_t mode);
+  void open(const std::string &filename, const tftp::mode_t mode, const sync_policy_t &sync_policy = {});
+  bool preallocate(const uint64_t size_bytes);
   void write(const std::vector<char> &data);
-  bool eof() const;
+  void write(const char *data, const size_t size);
+  void flush();
+  void close();
   bool error() const;
+  bool disk_full() const;
+
+  static std::optional<sync_policy_t> string_to_sync_policy(const std::string &name);
+  static std::string                  sync_policy_to_string(const sync_policy_t &policy);
 
 private:
-  FILE        *_fd;
-  tftp::mode_t _mode;
-};
\ No newline at end of file
+  int               _fd;
+  tftp::mode_t      _mode;
+  sync_policy_t     _sync_policy;
+  std::vector<char> _native_buffer;
+  std::vector<char> _batch;
+  size_t            _batch_size;
+  uint64_t          _offset;
+  uint64_t          _unsynced;
+  uint64_t          _allocated;
+  int               _errno;
+
+  void append(const char *data, const size_t size);
+  void sync();
+};
@@ -1,22 +1,39 @@
 #pragma once
 
-#include <time.h>
+#include <cstdint>
+#include <functional>
 
+#include "common/timer_wheel.hpp"
+
+/**
+ * @brief One-shot timer scheduled on a timer_wheel
+ *
+ * The timer is a handle in to the wheel, it owns no kernel resources. When it expires the wheel calls the expiry
+ * callback (if set), has_expired() then returns true until it is next read or re-armed.
+ */
 class timer
 {
 public:
-  timer();
+  explicit timer(timer_wheel &wheel);
   timer(const timer &) = delete;
   timer(timer &&)      = delete;
   timer &operator=(const timer &) = delete;
   timer &operator=(timer &&) = delete;
   ~timer();
 
-  void arm_timer(const time_t seconds);
+  void set_callback(std::function<void()> on_expiry);
+  void arm_timer(const uint64_t timeout_ms);
   void disarm_timer();
   bool has_expired();
-  int  fd() const;
+  bool is_armed() const;
 
 private:
-  int _fd;
-};
\ No newline at end of file
+  friend class timer_wheel;
+
+  timer_wheel::node_t   _node;
+  timer_wheel          &_wheel;
+  std::function<void()> _on_expiry;
+  uint64_t              _expiry_ms;
+  bool                  _armed;
+  bool                  _expired;
+};
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+class timer;
+
+/**
+ * @brief Hierarchical timer wheel with millisecond resolution
+ *
+ * Four levels: 256 one-millisecond slots, then three levels of 64 slots each covering 64 times the span of the level
+ * below (~18.6 hours in total, longer timeouts are clamped). Arming and cancelling a timer is O(1), timers in the upper
+ * levels are cascaded down as the wheel turns. One wheel is owned by each event loop and is driven by advance(), the
+ * loop uses next_timeout_ms() as its poll timeout.
+ */
+class timer_wheel
+{
+public:
+  using clock_fn = std::function<uint64_t()>;
+
+  explicit timer_wheel(clock_fn clock = steady_clock_ms);
+  timer_wheel(const timer_wheel &) = delete;
+  timer_wheel(timer_wheel &&)      = delete;
+  timer_wheel &operator=(const timer_wheel &) = delete;
+  timer_wheel &operator=(timer_wheel &&) = delete;
+  ~timer_wheel();
+
+  void     advance();
+  int      next_timeout_ms(const int max_timeout_ms) const;
+  uint64_t now_ms() const;
+  size_t   size() const;
+
+  static uint64_t steady_clock_ms();
+
+private:
+  friend class timer;
+
+  struct node_t
+  {
+    node_t *prev;
+    node_t *next;
+    timer  *owner;
+  };
+
+  static constexpr size_t   LEVEL0_BITS  = 8;
+  static constexpr size_t   LEVELN_BITS  = 6;
+  static constexpr size_t   LEVEL0_SIZE  = 1 << LEVEL0_BITS;
+  static constexpr size_t   LEVELN_SIZE  = 1 << LEVELN_BITS;
+  static constexpr size_t   NUM_LEVELN   = 3;
+  static constexpr size_t   LEVEL0_MASK  = LEVEL0_SIZE - 1;
+  static constexpr size_t   LEVELN_MASK  = LEVELN_SIZE - 1;
+  static constexpr uint64_t MAX_DELTA_MS = (uint64_t(1) << (LEVEL0_BITS + NUM_LEVELN * LEVELN_BITS)) - 1;
+
+  clock_fn                                                _clock;
+  uint64_t                                                _current_ms;
+  size_t                                                  _size;
+  std::array<node_t, LEVEL0_SIZE>                         _level0;
+  std::array<std::array<node_t, LEVELN_SIZE>, NUM_LEVELN> _levels;
+
+  void schedule(timer &t, const uint64_t expiry_ms);
+  void cancel(timer &t);
+  void insert(timer &t);
+  void cascade(const size_t level, const size_t index);
+  void expire(node_t &slot);
+
+  static void list_init(node_t &head);
+  static bool list_empty(const node_t &head);
+  static void list_push_back(node_t &head, node_t &node);
+  static void list_unlink(node_t &node);
+  static void list_splice(node_t &from, node_t &to);
+};
@@ -1,8 +1,69 @@
 #pragma once
 
+#include <deque>
+#include <netinet/in.h>
 #include <string>
+#include <sys/socket.h>
+#include <sys/uio.h>
 #include <vector>
 
+/**
+ * @brief Reusable receive buffers for udp_connection::recv_batch()
+ *
+ * Buffers, iovecs and address storage are allocated once, each recv_batch() fills up to capacity() datagrams and
+ * keeps the raw source address of each.
+ */
+class datagram_batch
+{
+public:
+  datagram_batch(const size_t capacity, const size_t max_datagram_size);
+  datagram_batch(const datagram_batch &) = delete;
+  datagram_batch(datagram_batch &&)      = delete;
+  datagram_batch &operator=(const datagram_batch &) = delete;
+  datagram_batch &operator=(datagram_batch &&) = delete;
+
+  size_t                    size() const;
+  size_t                    capacity() const;
+  const std::vector<char>  &data(const size_t index) const;
+  const struct sockaddr_in &address(const size_t index) const;
+
+private:
+  friend class udp_connection;
+
+  size_t                          _size;
+  size_t                          _max_datagram_size;
+  std::vector<std::vector<char>>  _buffers;
+  std::vector<struct iovec>       _iovecs;
+  std::vector<struct sockaddr_in> _addresses;
+  std::vector<struct mmsghdr>     _headers;
+};
+
+/**
+ * @brief Zero copy sends completed since the last call to udp_connection::recv_zerocopy_completions()
+ *
+ * copied_bytes counts the completed bytes the kernel copied after all, e.g. on loopback or when the device lacks
+ * scatter-gather support.
+ */
+struct zerocopy_completions_t
+{
+  size_t sends;
+  size_t bytes;
+  size_t copied_bytes;
+};
+
+/**
+ * @brief One datagram for udp_connection::send_batch(), a header followed by a payload from a separate buffer
+ *
+ * Either may be empty, the buffers are only referenced and must outlive the call.
+ */
+struct datagram_view_t
+{
+  const char *header;
+  size_t      header_len;
+  const char *payload;
+  size_t      payload_len;
+};
+
 class udp_connection
 {
 public:
@@ -13,14 +74,31 @@ public:
   udp_connection &operator=(udp_connection &&) = delete;
   ~udp_connection();
 
-  void              bind(const std::string &ip_address, const uint16_t port_num);
-  void              connect(const std::string &ip_address, const uint16_t port_num);
-  void              connect(const struct sockaddr_in sa);
-  ssize_t           send(const std::vector<char> &data);
-  std::vector<char> recv(const size_t size);
-  ssize_t           send_to(const std::string &ip_address, const uint16_t port_num, const std::vector<char> &data);
-  std::vector<char> recv_from(std::string &ip_address, uint16_t &port_num, const size_t size);
-  void              set_non_blocking(const bool enable);
+  void                   bind(const std::string &ip_address, const uint16_t port_num);
+  void                   connect(const std::string &ip_address, const uint16_t port_num);
+  void                   connect(const struct sockaddr_in sa);
+  ssize_t                send(const std::vector<char> &data);
+  ssize_t                send(const char *data, const size_t size);
+  std::vector<char>      recv(const size_t size);
+  size_t                 recv(char *buffer, const size_t size);
+  ssize_t                send_to(const std::string &ip_address, const uint16_t port_num, const std::vector<char> &data);
+  ssize_t                send_to(const struct sockaddr_in &sa, const char *data, const size_t size);
+  std::vector<char>      recv_from(std::string &ip_address, uint16_t &port_num, const size_t size);
+  size_t                 recv_from(char *buffer, const size_t size, struct sockaddr_in &sa);
+  size_t                 recv_batch(datagram_batch &batch);
+  int                    send_batch(const datagram_view_t *datagrams, const size_t count, const bool zerocopy = false);
+  ssize_t                send_gather(const char *header, const size_t header_len, const char *payload,
+                                     const size_t payload_len, const bool zerocopy);
+  zerocopy_completions_t recv_zerocopy_completions();
+  size_t                 zerocopy_pending() const;
+  bool                   enable_zerocopy();
+  int                    socket_error();
+  void                   set_non_blocking(const bool enable);
+  void                   set_reuse_port(const bool enable);
+  void                   set_reuse_address(const bool enable);
+  void                   set_receive_buffer(const size_t bytes);
+  void                   set_multicast_interface(const std::string &ip_address);
+  void                   join_multicast_group(const struct in_addr group, const std::string &ip_address);
 
   int sd() const
   {
@@ -28,5 +106,8 @@ public:
   }
 
 private:
-  int _sd;
-};
\ No newline at end of file
+  int                         _sd;
+  std::vector<struct iovec>   _send_iovecs;
+  std::vector<struct mmsghdr> _send_headers;
+  std::deque<size_t>          _zerocopy_pending;
+};
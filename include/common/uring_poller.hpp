@@ -0,0 +1,112 @@
+#pragma once
+
+#include <linux/io_uring.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "common/event_poller.hpp"
+
+/**
+ * @brief event_poller on top of io_uring poll requests
+ *
+ * Interest changes are not applied with a syscall each like epoll_ctl(), they are queued as IORING_OP_POLL_ADD /
+ * IORING_OP_POLL_REMOVE entries and submitted together with the wait for completions in a single io_uring_enter(),
+ * so a loop iteration costs one syscall however many sessions changed direction. Poll requests are one-shot, a fired
+ * fd is re-armed on the next wait() to give the same level triggered behaviour as epoll.
+ *
+ * With receive_datagrams() the fd's input is not polled for, an IORING_OP_RECV into a buffer owned by the poller is kept
+ * armed instead, and the datagram received comes back with the EPOLLIN event. The recv is re-armed on the wait() after
+ * the datagram was reported, a datagram received while the fd is not polled for EPOLLIN is held until it is. Sends
+ * queued with queue_send() are IORING_OP_SEND entries submitted with the next wait. They use MSG_DONTWAIT, so the
+ * kernel never holds on to the caller's buffer past that io_uring_enter(), a send that finds the socket buffer full is
+ * dropped like a datagram lost on the way. A session receiving and sending this way costs no syscall of its own per
+ * packet, every session of the loop shares the one io_uring_enter() per iteration.
+ *
+ * Reads queued with queue_read() are IORING_OP_READV entries submitted with the next wait the same way, so a session
+ * reading its file through the poller costs no pread() either. The caller's keep_alive is held until the read's
+ * completion has been reaped, and the destructor waits for reads still in flight, the kernel may be writing to them.
+ *
+ * Uses the raw syscalls, requires IORING_FEAT_EXT_ARG (Linux 5.11) for the wait timeout.
+ */
+class uring_poller : public event_poller
+{
+public:
+  explicit uring_poller(const size_t max_fds);
+  uring_poller(const uring_poller &) = delete;
+  uring_poller(uring_poller &&)      = delete;
+  uring_poller &operator=(const uring_poller &) = delete;
+  uring_poller &operator=(uring_poller &&) = delete;
+  ~uring_poller() override;
+
+  void      add(const int fd, const uint32_t events, const uint64_t data) override;
+  void      modify(const int fd, const uint32_t events, const uint64_t data) override;
+  void      remove(const int fd) override;
+  int       wait(event_t *events, const int max_events, const int timeout_ms) override;
+  bool      receive_datagrams(const int fd) override;
+  bool      queue_send(const int fd, const char *data, const size_t size) override;
+  bool      queue_read(const int fd, const struct iovec *iov, const size_t count, const uint64_t offset,
+                       const uint64_t data, std::shared_ptr<const void> keep_alive) override;
+  backend_t backend() const override;
+
+  static const size_t MAX_DATAGRAM_SIZE = 65536;
+
+private:
+  struct registration_t
+  {
+    uint64_t          data;
+    uint32_t          events;
+    uint32_t          generation;
+    uint32_t          recv_generation;
+    bool              active;
+    bool              in_flight;
+    bool              pending_arm;
+    bool              receiving; // Input is received by the poller rather than polled for
+    bool              recv_in_flight;
+    bool              held;         // A received datagram, or error, is waiting to be reported
+    bool              sends_queued; // Sends have been queued since the fd was added
+    int               recv_result;  // Size of the datagram held in buffer, or -errno
+    std::vector<char> buffer;       // Only ever allocated once, the kernel may still write to it after remove()
+  };
+
+  struct read_t
+  {
+    uint64_t                    data;
+    std::shared_ptr<const void> keep_alive; // Held while the read is in flight
+  };
+
+  int                         _ring_fd;
+  void                       *_ring_ptr;
+  size_t                      _ring_size;
+  struct io_uring_sqe        *_sqes;
+  size_t                      _sqes_size;
+  unsigned                   *_sq_head;
+  unsigned                   *_sq_tail;
+  unsigned                   *_sq_mask;
+  unsigned                   *_sq_array;
+  unsigned                   *_cq_head;
+  unsigned                   *_cq_tail;
+  unsigned                   *_cq_mask;
+  struct io_uring_cqe        *_cqes;
+  unsigned                    _sq_entries;
+  unsigned                    _to_submit;
+  std::vector<registration_t> _registrations;
+  std::vector<int>            _pending_arms;
+  std::vector<int>            _held; // fds holding a received datagram
+  std::vector<read_t>         _reads;
+  std::vector<uint32_t>       _free_reads; // Entries of _reads not in flight
+
+  registration_t &registration(const int fd);
+  uint32_t        poll_mask(const registration_t &reg, const uint32_t events) const;
+  bool            report_ready(const registration_t &reg) const;
+  void            queue_arm(const int fd);
+  void            queue_poll_add(const int fd, registration_t &reg);
+  void            queue_poll_remove(const int fd, registration_t &reg);
+  void            queue_recv(const int fd, registration_t &reg);
+  void            queue_recv_cancel(const int fd, registration_t &reg);
+  io_uring_sqe   *next_sqe();
+  int             enter(const unsigned to_submit, const unsigned min_complete, const unsigned flags,
+                        const int timeout_ms);
+};
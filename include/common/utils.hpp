@@ -58,6 +58,8 @@ namespace utils
 
   size_t get_file_size(const char *fname);
 
+  std::optional<uint64_t> get_free_space(const char *path);
+
   inline std::string sockaddr_to_str(const struct sockaddr_in &sa)
   {
     std::ostringstream oss;
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <netinet/in.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Server wide pool of the multicast addresses handed out to RFC 2090 multicast transfers
+ *
+ * All transfers share one group address, each running transfer is given its own port out of count ports starting
+ * at the configured one, so clients of one transfer do not receive the blocks of another. A port is handed back with
+ * release() once its transfer has finished. All members are thread safe.
+ */
+class multicast_address_pool
+{
+public:
+  static const uint16_t DEFAULT_PORTS = 64;
+
+  explicit multicast_address_pool(const std::string &group, const uint16_t count = DEFAULT_PORTS);
+  multicast_address_pool(const multicast_address_pool &) = delete;
+  multicast_address_pool(multicast_address_pool &&)      = delete;
+  multicast_address_pool &operator=(const multicast_address_pool &) = delete;
+  multicast_address_pool &operator=(multicast_address_pool &&) = delete;
+
+  std::optional<struct sockaddr_in> acquire();
+  void                              release(const struct sockaddr_in &address);
+  size_t                            available() const;
+  struct sockaddr_in                first_address() const;
+
+private:
+  mutable std::mutex    _mutex;
+  struct in_addr        _group;
+  uint16_t              _first_port;
+  std::vector<uint16_t> _free_ports;
+};
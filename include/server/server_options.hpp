@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "common/event_poller.hpp"
+#include "common/tftp_write_file.hpp"
+
+/**
+ * @brief Settings of a tftp_server, parsed once from the command line and handed down to its workers and sessions
+ *
+ * The defaults are those of a server started with only a root and an interface. Cache sizes of 0 turn the cache off.
+ */
+struct server_options
+{
+  std::string                    server_root;                              // Served from and written to
+  std::string                    interface;                                // Address to bind to, all if empty
+  uint16_t                       port                   = 69;
+  size_t                         max_clients            = 100;             // Shared out between the workers
+  size_t                         workers                = 1;               // Event loop threads
+  event_poller::backend_t        backend                = event_poller::backend_t::EPOLL;
+  bool                           zero_copy              = false;           // Octet reads sent with MSG_ZEROCOPY
+  size_t                         cache_bytes            = 0;               // file_cache shared by all sessions
+  size_t                         io_threads             = 0;               // Disk I/O pool, I/O on the workers if 0
+  size_t                         prefetch_blocks        = PREFETCH_BLOCKS; // Read ahead, at least a window
+  tftp_write_file::sync_policy_t sync_policy            = {tftp_write_file::sync_t::NONE, 0};
+  size_t                         datagram_cache_bytes   = 0;               // datagram_cache shared by all sessions
+  size_t                         metadata_cache_entries = 0;               // Paths whose checks are cached
+  std::string                    pack_path;                                // Served before the root, none if empty
+  uint64_t                       mmap_min_bytes         = 0;               // Files this large are mapped, none if 0
+  std::string                    multicast_group;                          // address:port of multicast reads, or off
+  bool                           allow_fragmentation    = false;           // blksize is not held to the path MTU
+  uint16_t                       dup_ack_threshold      = 0;               // Duplicate ACKs that resend, off if 0
+
+  static constexpr size_t PREFETCH_BLOCKS = 8;
+};
@@ -3,30 +3,50 @@
 #include <arpa/inet.h>
 #include <queue>
 #include <string>
+#include <unordered_set>
 #include <vector>
 
 #include "common/tftp.hpp"
 #include "common/udp_connection.hpp"
 
+/**
+ * @brief Receives the read and write requests arriving on the server's port and queues them for the worker
+ *
+ * A client that hears nothing back in time sends its request again, by then the first one has usually started a
+ * session already. Requests repeating one from the same client address and port, for the same file and operation,
+ * are dropped while the first one is queued or its session is running, the session's retransmit timer resends its
+ * first packet to the client anyway. The worker hands the request's key back with session_ended() once the session is
+ * closed, from then on the same request starts a new session. Multicast reads are always passed on, a member of a
+ * group asks for its OACK again by repeating its request.
+ */
 class tftp_connection_handler
 {
 public:
-  explicit tftp_connection_handler(const std::string &addr = "", const uint16_t port = 0);
+  explicit tftp_connection_handler(const std::string &addr = "", const uint16_t port = 0, const bool reuse_port = false);
 
   struct request_t
   {
-    request_t(const tftp::rw_packet_t &req, const sockaddr_in cl) :
-        request(req), client(cl){};
+    request_t(tftp::rw_packet_t req, const sockaddr_in cl, std::string k = "") :
+        request(std::move(req)), client(cl), key(std::move(k)){};
     tftp::rw_packet_t request;
     sockaddr_in       client;
+    std::string       key; // Repeats are dropped until it is handed to session_ended(), empty if they are not
   };
 
   int       sd() const;
   void      handle_read();
   bool      requests_pending() const;
   request_t get_request();
+  size_t    duplicates() const;
+  void      session_ended(const std::string &key);
+  void      refuse(const request_t &request, const tftp::error_packet_t &error);
 
 private:
-  udp_connection        _udp;
-  std::queue<request_t> _request_queue;
+  udp_connection                  _udp;
+  datagram_batch                  _batch;
+  std::queue<request_t>           _request_queue;
+  std::unordered_set<std::string> _sessions; // Keys of the requests queued or being served
+  size_t                          _duplicates;
+
+  static std::string request_key(const tftp::rw_packet_t &request, const sockaddr_in &client);
 };
\ No newline at end of file
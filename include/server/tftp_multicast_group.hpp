@@ -0,0 +1,130 @@
+#pragma once
+
+#include <arpa/inet.h>
+#include <deque>
+#include <functional>
+#include <string_view>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <spdlog/logger.h>
+
+#include "common/metadata_cache.hpp"
+#include "common/open_file_table.hpp"
+#include "common/rtt_estimator.hpp"
+#include "common/tftp.hpp"
+#include "common/tftp_read_file.hpp"
+#include "common/timer.hpp"
+#include "common/udp_connection.hpp"
+#include "server/multicast_address_pool.hpp"
+
+/**
+ * @brief One RFC 2090 multicast read, sending a file to every client that asked for it with the multicast option
+ *
+ * Clients reading the same file with the same block size while the group runs join it rather than starting a session
+ * of their own. Blocks are sent once to the group's multicast address, taken from the multicast_address_pool, and
+ * every member picks them up, so the server sends each block once however many clients are reading.
+ *
+ * The longest standing member is the master client, told so with mc=1 in its OACK, the others get mc=0. Only the
+ * master acknowledges, an ACK of block n has block n + 1 sent next. A member that joined late has missed the blocks
+ * sent before it joined, when it becomes master it acknowledges the block before the first one it is missing and the
+ * transfer carries on from there. A member acknowledging the last block has the whole file and leaves the group, as
+ * does one sending an ERROR. When the master leaves, the next member is promoted with an OACK with mc=1.
+ *
+ * Like tftp_server_connection, the retransmit timeout adapts to the master's round trip times, a master silent for
+ * MAX_TIMEOUTS times the default timeout is dropped and the next member promoted. The group is finished once its last
+ * member has left, and hands its address back to the pool.
+ *
+ * Like sessions, the group keeps its DATA packets within the MTU of the route they take, unless allow_fragmentation
+ * is set.
+ *
+ * Blocks are numbered with 16 bits and never wrap, files of more than 65535 blocks are not sent by multicast. Only
+ * octet transfers are, a netascii block depends on the blocks before it.
+ */
+class tftp_multicast_group
+{
+public:
+  tftp_multicast_group(const tftp::rw_packet_t &request, multicast_address_pool &pool,
+                       const std::string &local_interface, timer_wheel &wheel, metadata_cache *metadata = nullptr,
+                       open_file_table *files = nullptr, const uint64_t mmap_min_bytes = 0,
+                       const bool allow_fragmentation = false);
+  ~tftp_multicast_group();
+  tftp_multicast_group()                             = delete;
+  tftp_multicast_group(const tftp_multicast_group &) = delete;
+  tftp_multicast_group(tftp_multicast_group &&)      = delete;
+  tftp_multicast_group &operator=(const tftp_multicast_group &) = delete;
+  tftp_multicast_group &operator=(tftp_multicast_group &&) = delete;
+
+  int                       sd() const;
+  const std::string        &key() const;
+  const struct sockaddr_in &address() const;
+  void                      set_timeout_callback(std::function<void()> on_timeout);
+  void                      join(const tftp::rw_packet_t &request, const struct sockaddr_in &client);
+  void                      handle_read();
+  void                      handle_write();
+
+  bool   is_finished() const;
+  bool   wait_for_write() const;
+  size_t members() const;
+
+  struct stats_t
+  {
+    size_t clients;     // Clients that joined
+    size_t blocks_sent; // DATA packets sent to the group, including retransmits
+  };
+
+  const stats_t &stats() const;
+
+  static bool        is_multicast_request(const tftp::rw_packet_t &request);
+  static std::string group_key(const tftp::rw_packet_t &request);
+
+  static const uint8_t MAX_TIMEOUTS = 3;
+
+private:
+  struct member_t
+  {
+    struct sockaddr_in client;
+    std::string        client_str;
+    bool               blksize; // Options to answer in its OACK, multicast always is
+    bool               tsize;
+    bool               oack_pending;
+  };
+
+  std::shared_ptr<spdlog::logger> _logger;
+  multicast_address_pool         &_pool;
+  udp_connection                  _udp;
+  struct sockaddr_in              _address;
+  std::string                     _address_str;
+  std::string                     _option_prefix; // "address,port," of the multicast option
+  std::string                     _key;
+  std::string                     _filename;
+  tftp_read_file                  _file_reader;
+  uint64_t                        _file_size;
+  size_t                          _block_size;
+  uint16_t                        _total_blocks;
+  std::deque<member_t>            _members; // The front member is the master
+  bool                            _master_acked; // The master has acknowledged since it was told it is master
+  uint64_t                        _last_reply_us;
+  tftp::data_packet_buffer        _packet;
+  bool                            _packet_loaded;
+  bool                            _data_pending;
+  uint64_t                        _sent_us;
+  uint8_t                         _transmissions;
+  std::vector<char>               _recv_buffer;
+  tftp::error_packet_t            _error_pkt;
+  bool                            _error_pending;
+  bool                            _finished;
+  rtt_estimator                   _rtt;
+  timer                           _timer;
+  stats_t                         _stats;
+
+  void   handle_packet(const struct sockaddr_in &from, const std::string_view packet);
+  void   handle_ack(const size_t index, const uint16_t block_number);
+  void   leave(const size_t index);
+  void   promote();
+  void   handle_timeout();
+  bool   load_block(const uint16_t block_number);
+  bool   send_oack(member_t &member, const bool master);
+  size_t find_member(const struct sockaddr_in &client) const;
+};
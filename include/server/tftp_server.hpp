@@ -1,30 +1,50 @@
 #pragma once
 
 #include <atomic>
-#include <list>
+#include <memory>
 #include <string>
+#include <vector>
 
-#include "server/tftp_connection_handler.hpp"
-#include "server/tftp_server_connection.hpp"
+#include "server/server_options.hpp"
+#include "server/tftp_server_worker.hpp"
 
+/**
+ * @brief The TFTP server, runs server_options::workers tftp_server_worker event loops
+ *
+ * With cache_bytes set, the workers share a file_cache of that size for the contents of files being read, with
+ * datagram_cache_bytes set a datagram_cache of that size for the DATA datagrams sent and with metadata_cache_entries
+ * set a metadata_cache of that many paths for checking requests. With io_threads set, session file I/O runs on a
+ * disk_io_pool of that many threads shared by the workers. Sessions reading the same file share one descriptor to it.
+ * With pack_path set, reads are served from the pack_file at that path first, a new pack renamed over it is swapped
+ * in without a restart. With multicast_group set, as "address:port", reads asking for the multicast option are sent
+ * to that multicast address, each running file on its own port counting up from the given one. The other options are
+ * handed down to the sessions, see server_options.
+ */
 class tftp_server
 {
 public:
-  tftp_server(const std::string &server_root, const std::string &local_interface, const int port_num, const size_t max_clients);
+  explicit tftp_server(const server_options &options);
   ~tftp_server();
 
   void start();
   void stop();
 
-private:
-  std::string                       _server_root;
-  int                               _epoll_fd;
-  size_t                            _max_clients;
-  std::atomic_bool                  _exit_requested;
-  tftp_connection_handler           _conn_handler;
-  std::list<tftp_server_connection> _client_connections;
+  const file_cache      *cache() const;
+  const datagram_cache  *datagrams() const;
+  const metadata_cache  *metadata() const;
+  const open_file_table *files() const;
+  pack_store            *packs();
 
-  void epoll_ctl_add(const int fd, const uint32_t events, void *data);
-  void epoll_ctl_mod(const int fd, struct epoll_event *ev);
-  void epoll_ctl_del(const int fd);
-};
\ No newline at end of file
+private:
+  std::string                                      _server_root;
+  std::atomic_bool                                 _exit_requested;
+  std::unique_ptr<file_cache>                      _cache;
+  std::unique_ptr<datagram_cache>                  _datagrams;
+  std::unique_ptr<metadata_cache>                  _metadata;
+  open_file_table                                  _files;
+  std::unique_ptr<pack_store>                      _packs;
+  std::unique_ptr<multicast_address_pool>          _multicast;
+  std::vector<std::unique_ptr<tftp_server_worker>> _workers;
+  // Destroyed before the workers, queued jobs post their completions to the workers' channels
+  std::unique_ptr<disk_io_pool> _io_pool;
+};
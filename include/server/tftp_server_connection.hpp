@@ -1,22 +1,68 @@
 #pragma once
 
 #include <arpa/inet.h>
+#include <array>
+#include <functional>
 #include <memory>
 #include <optional>
 #include <string>
+#include <string_view>
+#include <vector>
 
 #include <spdlog/logger.h>
 
+#include "common/datagram_cache.hpp"
+#include "common/disk_io_pool.hpp"
+#include "common/event_poller.hpp"
+#include "common/file_cache.hpp"
+#include "common/mapped_file.hpp"
+#include "common/metadata_cache.hpp"
+#include "common/pack_store.hpp"
+#include "common/rtt_estimator.hpp"
 #include "common/tftp.hpp"
 #include "common/tftp_read_file.hpp"
 #include "common/tftp_write_file.hpp"
 #include "common/timer.hpp"
 #include "common/udp_connection.hpp"
+#include "server/server_options.hpp"
 
+/**
+ * @brief A single client session of the server, serving one read or write request on a socket of its own
+ *
+ * Read transfers send up to windowsize (RFC 7440) DATA blocks before waiting for an ACK. An ACK acknowledges every
+ * block up to its block number and slides the window on, one inside the window has sending resume after the block it
+ * acknowledges. Answering duplicate ACKs with a resend is what makes every block go out twice from then on (the
+ * Sorcerer's Apprentice Syndrome, RFC 1123 4.2.3.1), so only a retransmit timeout resends the window, or
+ * dup_ack_threshold duplicate ACKs in a row if it is set. The session is dropped once the client has been silent for
+ * MAX_TIMEOUTS times the negotiated timeout.
+ *
+ * Reads are sent from the pack_store's current pack, from a mapping of the file with zero_copy, or through
+ * tftp_read_file, behind which sit the caches, the open_file_table and the mapping of files of mmap_min_bytes or
+ * more. The members below say what each of them changes.
+ */
 class tftp_server_connection
 {
 public:
-  tftp_server_connection(const tftp::rw_packet_t &request, struct sockaddr_in &client_address);
+  /**
+   * @brief Server wide state sessions work with, each of it optional, shared_t{} has none of it
+   *
+   * With io, file I/O of reads through tftp_read_file and of writes runs on the worker's disk I/O pool rather than the
+   * event loop. Reads are fetched a batch ahead, writes are written behind the ACKs and the final ACK is only sent once
+   * everything has been written. A session whose data is not ready parks (wait_for_io()) until the worker hands it the
+   * completion with handle_io_complete().
+   */
+  struct shared_t
+  {
+    file_cache      *cache;     // Chunks of reads through tftp_read_file
+    disk_io_channel *io;        // The worker's channel to the disk I/O pool
+    datagram_cache  *datagrams; // Whole DATA datagrams, a cached block is one send() with no read or encoding
+    metadata_cache  *metadata;  // Checks of requested paths, reads open the very file that was checked
+    open_file_table *files;     // One descriptor per file shared by every session reading it
+    pack_store      *packs;     // Packed files are sent from the pack's mapping with no path checks or file I/O
+  };
+
+  tftp_server_connection(const tftp::rw_packet_t &request, struct sockaddr_in &client_address, timer_wheel &wheel,
+                         const server_options &options = {}, const shared_t &shared = {});
   ~tftp_server_connection();
   tftp_server_connection()                               = delete;
   tftp_server_connection(const tftp_server_connection &) = delete;
@@ -25,17 +71,48 @@ public:
   tftp_server_connection &operator=(tftp_server_connection &&) = delete;
 
   int  sd() const;
-  int  timer_fd() const;
-  void handle_read();
+  void set_timeout_callback(std::function<void()> on_timeout);
+  void set_io_callback(std::function<void()> on_io_complete);
+  void set_poller_io(event_poller *poller, const uint64_t read_data = 0);
+  void handle_read(const std::string_view received = {});
   void handle_write();
+  void handle_error();
+  void handle_io_complete();
+  void handle_read_complete(const int32_t result);
 
   void set_finished(const bool finished);
   bool is_finished() const;
   bool wait_for_read() const;
   bool wait_for_write() const;
+  bool wait_for_io() const;
+  bool poller_io() const;
 
   const struct sockaddr_in &client() const;
 
+  struct copy_stats_t
+  {
+    size_t payload_bytes; // DATA payload bytes sent, including retransmits
+    size_t copied_bytes;  // Payload bytes copied on the way, by file reads into userspace or by the kernel on send
+  };
+
+  const copy_stats_t &copy_stats() const;
+
+  struct disk_stats_t
+  {
+    size_t   waits;   // Blocking file reads and writes on the event loop, and times parked waiting for the pool
+    uint64_t wait_us; // Time spent in them
+  };
+
+  const disk_stats_t &disk_stats() const;
+
+  struct ack_stats_t
+  {
+    size_t duplicate_acks;         // ACKs acknowledging no new block while blocks were outstanding
+    size_t suppressed_retransmits; // Duplicate ACKs and ACKs inside the window not answered with a resend
+  };
+
+  const ack_stats_t &ack_stats() const;
+
   enum class state_t
   {
     SEND_ACK,
@@ -49,28 +126,108 @@ public:
   static std::string state_to_string(const state_t state);
 
 private:
-  std::shared_ptr<spdlog::logger> _logger;
-  udp_connection                  _udp;
-  const tftp::packet_t            _type;
-  tftp_read_file                  _file_reader;
-  tftp_write_file                 _file_writer;
-  struct sockaddr_in              _client;
-  std::string                     _client_str;
-  tftp::data_packet_t             _data_pkt;
-  tftp::error_packet_t            _error_pkt;
-  bool                            _finished;
-  bool                            _final_ack;
-  bool                            _pkt_ready;
-  state_t                         _state;
-  uint8_t                         _timeout_s;
-  uint8_t                         _timeout_count;
-  uint16_t                        _block_number;
-  size_t                          _block_size;
-  tftp::oack_packet_t             _oack_packet;
-  timer                           _timer;
+  struct read_ahead_t;
+  struct write_behind_t;
+  struct datagram_source_t;
+
+  struct window_slot_t
+  {
+    tftp::data_packet_buffer                     packet; // Whole DATA packet, unless sent from a mapping or cache
+    datagram_cache::run_ptr                      run;    // Keeps the cached datagram alive
+    uint16_t                                     block_number;
+    std::array<char, tftp::DATA_PKT_HEADER_SIZE> header;   // DATA header sent ahead of a block from the file mapping
+    const char                                  *datagram; // Whole DATA packet to send, unused for the file mapping
+    size_t                                       datagram_len;
+    const char                                  *payload;
+    size_t                                       payload_len;
+    uint64_t                                     sent_us;
+    uint8_t                                      transmissions;
+  };
+
+  std::shared_ptr<spdlog::logger>          _logger;
+  udp_connection                           _udp;
+  const tftp::packet_t                     _type;
+  tftp_read_file                           _file_reader;
+  mapped_file                              _file_map;
+  std::string_view                         _mapped; // File mapping or packed file blocks are sent from
+  bool                                     _send_mapped;
+  size_t                                   _file_offset;
+  tftp_write_file                          _file_writer; // Space taken up front from tsize, synced as sync_policy asks
+  std::optional<uint64_t>                  _transfer_size;
+  struct sockaddr_in                       _client;
+  std::string                              _client_str;
+  std::vector<window_slot_t>               _window;
+  std::vector<datagram_view_t>             _send_views;       // Unsent blocks of the window, sent with one sendmmsg()
+  std::vector<char>                        _recv_buffer;      // Sized from the negotiated blksize, decoded in place
+  std::array<char, tftp::ACK_PKT_MAX_SIZE> _ack_buffer;       // Referenced by a queued send until the poller submits it
+  event_poller                            *_poller_io;        // Receives and sends the DATA / ACK packets if set
+  uint64_t                                 _poller_read_data; // Carried by the reads the poller does for the session
+  tftp::error_packet_t                     _error_pkt;
+  bool                                     _finished;
+  bool                                     _final_ack;
+  state_t                                  _state;
+  uint32_t                                 _timeout_ms;
+  uint64_t                                 _last_reply_us;
+  uint64_t                                 _ack_sent_us;
+  uint8_t                                  _ack_transmissions;
+  size_t                                   _retransmits;
+  const uint16_t                           _dup_ack_threshold; // Duplicate ACKs in a row that resend, never if 0
+  uint16_t                                 _dup_acks;          // Duplicate ACKs in a row
+  ack_stats_t                              _ack_stats;
+  rtt_estimator                            _rtt; // Retransmit timeout, bounded by the negotiated timeout
+  uint16_t                                 _block_number;
+  uint16_t                                 _last_acked;
+  uint16_t                                 _rollover; // Block number following 65535
+  uint16_t                                 _window_size;
+  size_t                                   _window_head;
+  size_t                                   _window_count;
+  size_t                                   _window_sent;
+  size_t                                   _block_size;          // Held to the path MTU of the connected socket
+  const bool                               _allow_fragmentation; // blksize is not held to the path MTU
+  tftp::oack_packet_t                      _oack_packet;
+  timer                                    _timer;
+  const bool                               _zero_copy;    // Octet reads sent with MSG_ZEROCOPY, see handle_error()
+  bool                                     _msg_zerocopy; // Cleared once the kernel reports copying anyway
+  copy_stats_t                             _copy_stats;
+  disk_io_channel                         *_io;
+  std::function<void()>                    _on_io_complete;
+  std::shared_ptr<read_ahead_t>            _read_ahead;
+  std::shared_ptr<write_behind_t>          _write_behind;
+  size_t                                   _io_batch_blocks; // Blocks read ahead, prefetch_blocks or a window
+  bool                                     _io_in_flight;
+  bool                                     _io_parked; // Until the worker calls handle_io_complete()
+  uint64_t                                 _io_parked_us;
+  disk_stats_t                             _disk_stats;
+  datagram_cache                          *_datagrams;
+  datagram_cache::key_t                    _datagram_key;
+  std::shared_ptr<datagram_source_t>       _datagram_source;
+  datagram_cache::run_ptr                  _run;
+  size_t                                   _run_index;
+  uint64_t                                 _datagram_block;
+  metadata_cache                          *_metadata;
+  metadata_cache::entry_ptr                _file_entry; // Dropped from the cache by uploads
+  std::string                              _filename;
+  std::shared_ptr<const pack_file>         _pack; // Kept until the session ends, whatever pack is swapped in meanwhile
+  std::optional<std::string_view>          _packed;
 
   void                                process_options(const tftp::rw_packet_t &request);
   void                                retransmit();
-  std::optional<tftp::error_packet_t> is_operation_allowed(const std::string   &file_request,
-                                                           const tftp::packet_t type) const;
+  bool                                read_block_into_window();
+  bool                                take_read_ahead_block(tftp::data_packet_buffer &packet);
+  bool                                take_cached_datagram(window_slot_t &slot);
+  void                                submit_read_ahead();
+  void                                submit_ring_read(const size_t index);
+  bool                                write_block(const std::string_view data, const bool last);
+  void                                submit_write_behind();
+  bool                                submit_io(std::function<void()> job);
+  void                                park_for_io();
+  void                                add_disk_wait(const uint64_t start_us);
+  void                                send_window();
+  void                                window_sent(const size_t count, const bool zerocopy);
+  void                                arm_retransmit_timer();
+  void                                sample_rtt(const uint64_t sent_us);
+  void                                recv_zerocopy_completions();
+  std::string_view                    receive();
+  std::optional<tftp::error_packet_t> is_operation_allowed(const metadata_cache::entry_t &entry,
+                                                           const tftp::packet_t          type) const;
 };
\ No newline at end of file
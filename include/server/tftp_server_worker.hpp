@@ -0,0 +1,100 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "common/disk_io_pool.hpp"
+#include "common/event_poller.hpp"
+#include "common/slab.hpp"
+#include "common/timer_wheel.hpp"
+#include "server/multicast_address_pool.hpp"
+#include "server/server_options.hpp"
+#include "server/tftp_connection_handler.hpp"
+#include "server/tftp_multicast_group.hpp"
+#include "server/tftp_server_connection.hpp"
+
+/**
+ * @brief A single event loop (reactor) of the server
+ *
+ * Each worker owns its own listening socket, event poller and set of client connections, nothing is shared between
+ * workers. When several workers are started, their listening sockets are bound with SO_REUSEPORT so the kernel
+ * spreads new requests between them. Retransmit timers of all connections of a worker run on its timer wheel, which
+ * also sets the poller timeout.
+ *
+ * Connections live in a slab sized to the client limit, poller events and timers refer to them by slab handle so a
+ * session can be reclaimed as soon as it finishes, without leaving dangling references behind.
+ *
+ * Sessions are started with the worker's server_options and the server wide state of tftp_server_connection::shared_t,
+ * see tftp_server_connection for what each of them does. Reads go through the file_cache and datagram_cache, requests
+ * are checked against the metadata_cache, descriptors are shared through the open_file_table and the pack_store's
+ * current pack is served first, each only if it is given. The copy counts of finished sessions, zero_copy reads
+ * included, are summed up and logged when the worker stops, as are the duplicate ACKs they received.
+ *
+ * With a disk_io_pool, sessions do their file I/O on the pool. Completions come back through the worker's own
+ * disk_io_channel, whose eventfd is polled alongside the sockets, and parked sessions are resumed from there. The time
+ * sessions spent waiting for the disk, on the pool or not, is summed up and logged with the copy counts. Without one,
+ * a poller that does the sessions' socket I/O reads their files as well, its read completions are tagged with
+ * READ_HANDLE_BIT.
+ *
+ * With a multicast_address_pool, reads asking for the multicast option (RFC 2090) join the worker's
+ * tftp_multicast_group for the file, or start one, instead of getting a session of their own. Groups live in a slab of
+ * their own, their poller handles are tagged with GROUP_HANDLE_BIT. Groups are per worker, clients whose requests land
+ * on different workers read through different groups. Requests a group can not serve fall back to a session.
+ */
+class tftp_server_worker
+{
+public:
+  tftp_server_worker(const server_options &options, const size_t max_clients, const bool reuse_port,
+                     const std::atomic_bool &exit_requested, const tftp_server_connection::shared_t &shared = {},
+                     disk_io_pool *io_pool = nullptr, multicast_address_pool *multicast = nullptr);
+  ~tftp_server_worker() = default;
+  tftp_server_worker(const tftp_server_worker &) = delete;
+  tftp_server_worker(tftp_server_worker &&)      = delete;
+  tftp_server_worker &operator=(const tftp_server_worker &) = delete;
+  tftp_server_worker &operator=(tftp_server_worker &&) = delete;
+
+  void run();
+
+  static constexpr uint64_t GROUP_HANDLE_BIT = uint64_t(1) << 63;
+  static constexpr uint64_t READ_HANDLE_BIT  = uint64_t(1) << 62;
+  static_assert((GROUP_HANDLE_BIT & slab<tftp_multicast_group>::TAG_BITS) == GROUP_HANDLE_BIT,
+                "Group handles are tagged with a bit the slab never sets");
+  static_assert((READ_HANDLE_BIT & slab<tftp_server_connection>::TAG_BITS) == READ_HANDLE_BIT,
+                "Session read completions are tagged with a bit the slab never sets");
+
+private:
+  using handle_t = slab<tftp_server_connection>::handle_t;
+
+  const std::atomic_bool                   &_exit_requested;
+  timer_wheel                               _timer_wheel;
+  tftp_connection_handler                   _conn_handler;
+  slab<tftp_server_connection>              _client_connections;
+  std::unordered_map<handle_t, std::string> _session_keys; // Key of the request each session was started for
+  std::vector<handle_t>                     _timed_out;
+  std::unique_ptr<event_poller>             _poller;
+  const server_options                      _options;
+  tftp_server_connection::shared_t          _shared; // Handed to every session, with the worker's disk I/O channel
+  tftp_server_connection::copy_stats_t      _copy_stats;
+  tftp_server_connection::disk_stats_t      _disk_stats;
+  std::unique_ptr<disk_io_channel>          _io;
+  multicast_address_pool                   *_multicast;
+  tftp_server_connection::ack_stats_t       _ack_stats;
+  slab<tftp_multicast_group>                _groups;
+  std::unordered_map<std::string, handle_t> _group_index;
+  std::vector<handle_t>                     _timed_out_groups;
+  size_t                                    _groups_served;
+  tftp_multicast_group::stats_t             _multicast_stats;
+
+  void accept_pending_requests();
+  void service_connection(const handle_t handle, const uint32_t events, const std::string_view datagram = {});
+  void complete_io(const handle_t handle);
+  void complete_read(const handle_t handle, const int32_t result);
+  void close_connection(const handle_t handle);
+  bool join_multicast_group(const tftp_connection_handler::request_t &request);
+  void service_group(const handle_t handle, const uint32_t events);
+  void close_group(const handle_t handle);
+};
@@ -0,0 +1,244 @@
+#pragma once
+
+#include <poll.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common/udp_connection.hpp"
+
+namespace test_utils
+{
+  /**
+   * @brief UDP relay between one tftp client and a server that drops a fraction of the datagrams it forwards
+   *
+   * The client sends its request to port() instead of the server. Replies come back from the relay's own port, so the
+   * client talks to the relay for the whole session while the relay follows the server's transfer id. A request from a
+   * new client address starts a new session, late packets from the transfer ids of earlier sessions are discarded.
+   * Drops are drawn from a seeded generator so runs are repeatable.
+   *
+   * With max_delay_ms set every datagram forwarded is held back for a random time up to that long, as a queue along the
+   * path would, so the delay varies from one datagram to the next but each direction keeps its order. The bytes the
+   * server sends are counted, dropped ones included.
+   *
+   * With duplicate_rate set, that fraction of the datagrams from the client is forwarded a second time, the copy held
+   * back for up to another max_delay_ms out of order, so the server sees ACKs repeated after newer ones.
+   */
+  class lossy_relay
+  {
+  public:
+    lossy_relay(const std::string &server_address, const uint16_t server_port, const double loss_rate,
+                const uint32_t seed = 1, const uint32_t max_delay_ms = 0, const double duplicate_rate = 0.0) :
+        _server_address(server_address),
+        _server_port(server_port),
+        _front(),
+        _back(),
+        _client_address(),
+        _client_port(0),
+        _server_tid(0),
+        _old_tids{},
+        _rng(seed),
+        _loss(loss_rate),
+        _duplicate(duplicate_rate),
+        _delay(0, max_delay_ms * 1000),
+        _delayed{},
+        _last_due_us{0, 0},
+        _forwarded(0),
+        _dropped(0),
+        _duplicated(0),
+        _server_bytes(0),
+        _stop(false),
+        _thread()
+    {
+      _front.bind("127.0.0.1", 0);
+      _back.bind("127.0.0.1", 0);
+      _thread = std::thread([this]() { run(); });
+    }
+
+    lossy_relay(const lossy_relay &) = delete;
+    lossy_relay &operator=(const lossy_relay &) = delete;
+
+    ~lossy_relay()
+    {
+      _stop = true;
+      _thread.join();
+    }
+
+    uint16_t port() const
+    {
+      struct sockaddr_in sa;
+      socklen_t          len = sizeof(sa);
+      getsockname(_front.sd(), (struct sockaddr *)&sa, &len);
+      return ntohs(sa.sin_port);
+    }
+
+    size_t forwarded() const
+    {
+      return _forwarded;
+    }
+
+    size_t dropped() const
+    {
+      return _dropped;
+    }
+
+    size_t duplicated() const
+    {
+      return _duplicated;
+    }
+
+    size_t server_bytes() const
+    {
+      return _server_bytes;
+    }
+
+  private:
+    static const size_t MAX_DATAGRAM = 65536;
+
+    struct delayed_t
+    {
+      bool              to_client;
+      std::vector<char> data;
+    };
+
+    std::string                             _server_address;
+    uint16_t                                _server_port;
+    udp_connection                          _front;
+    udp_connection                          _back;
+    std::string                             _client_address;
+    uint16_t                                _client_port;
+    uint16_t                                _server_tid;
+    std::set<uint16_t>                      _old_tids;
+    std::mt19937                            _rng;
+    std::bernoulli_distribution             _loss;
+    std::bernoulli_distribution             _duplicate;
+    std::uniform_int_distribution<uint32_t> _delay;
+    std::multimap<uint64_t, delayed_t>      _delayed; // Held back datagrams by the time they are due
+    uint64_t                                _last_due_us[2]; // Per direction, later datagrams are not sent before
+    std::atomic<size_t>                     _forwarded;
+    std::atomic<size_t>                     _dropped;
+    std::atomic<size_t>                     _duplicated;
+    std::atomic<size_t>                     _server_bytes;
+    std::atomic_bool                        _stop;
+    std::thread                             _thread;
+
+    bool drop()
+    {
+      if (_loss(_rng))
+      {
+        ++_dropped;
+        return true;
+      }
+      ++_forwarded;
+      return false;
+    }
+
+    static uint64_t now_us()
+    {
+      return std::chrono::duration_cast<std::chrono::microseconds>(
+                 std::chrono::steady_clock::now().time_since_epoch())
+          .count();
+    }
+
+    void send(const bool to_client, const std::vector<char> &data)
+    {
+      if (to_client)
+      {
+        _front.send_to(_client_address, _client_port, data);
+      }
+      else
+      {
+        _back.send_to(_server_address, (_server_tid == 0) ? _server_port : _server_tid, data);
+      }
+    }
+
+    void forward(const bool to_client, std::vector<char> data)
+    {
+      if (_delay.max() == 0)
+      {
+        send(to_client, data);
+        return;
+      }
+      uint64_t &last_due = _last_due_us[to_client ? 1 : 0];
+      last_due           = std::max(last_due, now_us() + _delay(_rng));
+      if (!to_client && _duplicate(_rng))
+      {
+        // The copy does not hold back the datagrams after it
+        ++_duplicated;
+        _delayed.emplace(last_due + _delay(_rng), delayed_t{to_client, data});
+      }
+      _delayed.emplace(last_due, delayed_t{to_client, std::move(data)});
+    }
+
+    void send_due()
+    {
+      const uint64_t now = now_us();
+      while (!_delayed.empty() && (_delayed.begin()->first <= now))
+      {
+        send(_delayed.begin()->second.to_client, _delayed.begin()->second.data);
+        _delayed.erase(_delayed.begin());
+      }
+    }
+
+    void run()
+    {
+      pollfd fds[2] = {{_front.sd(), POLLIN, 0}, {_back.sd(), POLLIN, 0}};
+      while (!_stop)
+      {
+        send_due();
+        int timeout_ms = 20;
+        if (!_delayed.empty())
+        {
+          const uint64_t now = now_us();
+          const uint64_t due = _delayed.begin()->first;
+          timeout_ms         = (due > now) ? static_cast<int>((due - now + 999) / 1000) : 0;
+        }
+        if (poll(fds, 2, timeout_ms) <= 0)
+        {
+          continue;
+        }
+
+        std::string address;
+        uint16_t    port = 0;
+        if (fds[0].revents & POLLIN)
+        {
+          const auto data = _front.recv_from(address, port, MAX_DATAGRAM);
+          if ((address != _client_address) || (port != _client_port))
+          {
+            _client_address = address;
+            _client_port    = port;
+            _old_tids.insert(_server_tid);
+            _server_tid = 0;
+          }
+          if (!drop())
+          {
+            forward(false, data);
+          }
+        }
+        if (fds[1].revents & POLLIN)
+        {
+          const auto data = _back.recv_from(address, port, MAX_DATAGRAM);
+          if ((_server_tid == 0) && (_old_tids.count(port) == 0))
+          {
+            _server_tid = port;
+          }
+          if (port == _server_tid)
+          {
+            _server_bytes += data.size();
+            if (!drop())
+            {
+              forward(true, data);
+            }
+          }
+        }
+      }
+    }
+  };
+} // namespace test_utils
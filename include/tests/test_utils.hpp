@@ -1,7 +1,25 @@
+#pragma once
 
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <random>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
+#include <spdlog/sinks/stdout_color_sinks.h>
+#include <spdlog/spdlog.h>
+
+#include "server/tftp_server.hpp"
+
 namespace test_utils
 {
 
@@ -16,10 +34,137 @@ namespace test_utils
     return ret;
   }
 
+  /**
+   * @brief Registers the "console" logger used by the dbg_* macros, code under test may log
+   */
+  inline void ensure_console_logger()
+  {
+    if (!spdlog::get("console"))
+    {
+      spdlog::stderr_color_mt("console")->set_level(spdlog::level::critical);
+    }
+  }
+
   inline std::vector<char> string_to_vector_null(const std::string &str)
   {
     std::vector<char> ret(str.begin(), str.end());
     ret.push_back(0);
     return ret;
   }
+
+  inline std::filesystem::path make_temp_dir(const std::string &prefix)
+  {
+    std::string tmpl = (std::filesystem::temp_directory_path() / (prefix + "XXXXXX")).string();
+    if (mkdtemp(tmpl.data()) == nullptr)
+    {
+      throw std::runtime_error("Failed to create temporary directory");
+    }
+    return std::filesystem::path(tmpl);
+  }
+
+  inline void write_random_file(const std::filesystem::path &path, const size_t size)
+  {
+    std::mt19937      rng(static_cast<uint32_t>(size));
+    std::vector<char> data(size);
+    for (auto &c : data)
+    {
+      c = static_cast<char>(rng());
+    }
+    std::ofstream out(path, std::ios_base::binary);
+    out.write(data.data(), data.size());
+  }
+
+  inline std::vector<char> read_file(const std::filesystem::path &path)
+  {
+    std::ifstream in(path, std::ios_base::binary);
+    return std::vector<char>(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+  }
+
+  /**
+   * @brief Options of a server for root on the loopback interface, one worker serving up to 16 clients
+   */
+  inline server_options local_server_options(const std::filesystem::path &root, const uint16_t port)
+  {
+    server_options options;
+    options.server_root = root;
+    options.interface   = "127.0.0.1";
+    options.port        = port;
+    options.max_clients = 16;
+    return options;
+  }
+
+  /**
+   * @brief Runs a tftp_server in a child process for the lifetime of this object
+   *
+   * The server is created in the child so that its chdir() to the server root does not affect the test process.
+   * The constructor returns once the server's sockets are bound.
+   */
+  class forked_server
+  {
+  public:
+    explicit forked_server(const std::function<std::unique_ptr<tftp_server>()> &factory) :
+        _pid(-1)
+    {
+      int ready_pipe[2];
+      if (pipe(ready_pipe) < 0)
+      {
+        throw std::runtime_error("Failed to create pipe");
+      }
+
+      _pid = fork();
+      if (_pid < 0)
+      {
+        throw std::runtime_error("Failed to fork");
+      }
+      if (_pid == 0)
+      {
+        close(ready_pipe[0]);
+        try
+        {
+          auto       server = factory();
+          const char ready  = 1;
+          if (write(ready_pipe[1], &ready, 1) != 1)
+          {
+            _exit(1);
+          }
+          server->start();
+        }
+        catch (...)
+        {
+          _exit(1);
+        }
+        _exit(0);
+      }
+
+      close(ready_pipe[1]);
+      char       ready = 0;
+      const auto ret   = read(ready_pipe[0], &ready, 1);
+      close(ready_pipe[0]);
+      if (ret != 1)
+      {
+        waitpid(_pid, nullptr, 0);
+        throw std::runtime_error("Server failed to start");
+      }
+    }
+
+    forked_server(const forked_server &) = delete;
+    forked_server &operator=(const forked_server &) = delete;
+
+    ~forked_server()
+    {
+      if (_pid > 0)
+      {
+        kill(_pid, SIGKILL);
+        waitpid(_pid, nullptr, 0);
+      }
+    }
+
+    pid_t pid() const
+    {
+      return _pid;
+    }
+
+  private:
+    pid_t _pid;
+  };
 } // namespace test_utils
\ No newline at end of file
@@ -0,0 +1,19 @@
+#include <benchmark/benchmark.h>
+
+#include "common/debug_macros.hpp"
+
+//==========================================================
+int main(int argc, char **argv)
+{
+  auto logger = spdlog::stderr_color_mt("console");
+  spdlog::set_level(spdlog::level::warn);
+
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv))
+  {
+    return 1;
+  }
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
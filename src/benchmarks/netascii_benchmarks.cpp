@@ -0,0 +1,99 @@
+#include <benchmark/benchmark.h>
+
+#include <random>
+#include <vector>
+
+#include "common/netascii.hpp"
+
+namespace
+{
+  const size_t INPUT_SIZE = 1024 * 1024;
+
+  enum class input_t
+  {
+    TEXT,
+    BINARY
+  };
+
+  /**
+   * @brief Text has a newline every 60 characters on average, binary data has CR / LF at their random frequency
+   */
+  std::vector<char> make_input(const input_t input)
+  {
+    std::mt19937      rng(42);
+    std::vector<char> data(INPUT_SIZE);
+    for (auto &c : data)
+    {
+      if (input == input_t::TEXT)
+      {
+        c = (rng() % 60 == 0) ? '\n' : static_cast<char>(' ' + rng() % 95);
+      }
+      else
+      {
+        c = static_cast<char>(rng());
+      }
+    }
+    return data;
+  }
+
+  bool skip_unsupported(benchmark::State &state, const netascii::isa_t isa, const input_t input)
+  {
+    state.SetLabel(netascii::isa_to_string(isa) + (input == input_t::TEXT ? "/text" : "/binary"));
+    if (!netascii::isa_supported(isa))
+    {
+      state.SkipWithError("Instruction set not supported");
+      return true;
+    }
+    return false;
+  }
+} // namespace
+
+//==========================================================
+static void BM_netascii_encode(benchmark::State &state)
+{
+  const auto isa   = static_cast<netascii::isa_t>(state.range(0));
+  const auto input = static_cast<input_t>(state.range(1));
+  if (skip_unsupported(state, isa, input))
+  {
+    return;
+  }
+  const auto        data = make_input(input);
+  std::vector<char> out(netascii::max_encoded_size(data.size()));
+  for (auto _ : state)
+  {
+    benchmark::DoNotOptimize(netascii::encode(isa, data.data(), data.size(), out.data()));
+    benchmark::ClobberMemory();
+  }
+  state.SetBytesProcessed(state.iterations() * data.size());
+}
+BENCHMARK(BM_netascii_encode)
+    ->ArgNames({"isa", "input"})
+    ->ArgsProduct({{static_cast<int64_t>(netascii::isa_t::SCALAR), static_cast<int64_t>(netascii::isa_t::SSE2),
+                    static_cast<int64_t>(netascii::isa_t::AVX2)},
+                   {static_cast<int64_t>(input_t::TEXT), static_cast<int64_t>(input_t::BINARY)}});
+
+//==========================================================
+static void BM_netascii_decode(benchmark::State &state)
+{
+  const auto isa   = static_cast<netascii::isa_t>(state.range(0));
+  const auto input = static_cast<input_t>(state.range(1));
+  if (skip_unsupported(state, isa, input))
+  {
+    return;
+  }
+  const auto        native = make_input(input);
+  std::vector<char> data(netascii::max_encoded_size(native.size()));
+  data.resize(netascii::encode(native.data(), native.size(), data.data()));
+  std::vector<char> out(data.size());
+  for (auto _ : state)
+  {
+    benchmark::DoNotOptimize(netascii::decode(isa, data.data(), data.size(), out.data()));
+    benchmark::ClobberMemory();
+  }
+  state.SetBytesProcessed(state.iterations() * data.size());
+}
+BENCHMARK(BM_netascii_decode)
+    ->ArgNames({"isa", "input"})
+    ->ArgsProduct({{static_cast<int64_t>(netascii::isa_t::SCALAR), static_cast<int64_t>(netascii::isa_t::SSE2),
+                    static_cast<int64_t>(netascii::isa_t::AVX2)},
+                   {static_cast<int64_t>(input_t::TEXT), static_cast<int64_t>(input_t::BINARY)}});
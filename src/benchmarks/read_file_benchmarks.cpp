@@ -0,0 +1,77 @@
+#include <benchmark/benchmark.h>
+
+#include "benchmarks/bench_utils.hpp"
+#include "common/tftp_read_file.hpp"
+
+using namespace bench_utils;
+
+namespace
+{
+  const size_t BLOCK_SIZE = 1428;
+
+  enum class backend_t
+  {
+    PREAD,
+    MMAP
+  };
+} // namespace
+
+//==========================================================
+/**
+ * @brief Reads a whole file block by block, with pread() or out of a mapping, including opening and closing it
+ *
+ * The file is in the page cache, so this measures what each backend costs per transfer and per block rather than the
+ * disk. Small files show the fixed cost of setting up and tearing down a mapping.
+ */
+static void BM_read_file(benchmark::State &state)
+{
+  const auto   backend   = static_cast<backend_t>(state.range(0));
+  const size_t file_size = state.range(1);
+  state.SetLabel(backend == backend_t::MMAP ? "mmap" : "pread");
+  const auto dir  = make_temp_dir("tftp_bench_read_");
+  const auto path = (dir / "file").string();
+  write_random_file(path, file_size);
+
+  tftp::data_packet_buffer packet;
+  for (auto _ : state)
+  {
+    tftp_read_file reader(path, tftp::mode_t::OCTET, nullptr, nullptr, (backend == backend_t::MMAP) ? 1 : 0);
+    do
+    {
+      reader.read_in_to(packet, BLOCK_SIZE);
+      benchmark::DoNotOptimize(packet.payload());
+    } while (packet.payload_size() == BLOCK_SIZE);
+  }
+  state.SetBytesProcessed(state.iterations() * file_size);
+  std::filesystem::remove_all(dir);
+}
+BENCHMARK(BM_read_file)
+    ->ArgNames({"backend", "bytes"})
+    ->ArgsProduct({{static_cast<int64_t>(backend_t::PREAD), static_cast<int64_t>(backend_t::MMAP)},
+                   {4 * 1024, 64 * 1024, 1024 * 1024, 16 * 1024 * 1024}});
+
+//==========================================================
+/**
+ * @brief Walks a mapped file block by block the way octet sessions do, taking a pointer to each block
+ */
+static void BM_read_file_mapped_blocks(benchmark::State &state)
+{
+  const size_t file_size = state.range(0);
+  const auto   dir       = make_temp_dir("tftp_bench_read_");
+  const auto   path      = (dir / "file").string();
+  write_random_file(path, file_size);
+
+  for (auto _ : state)
+  {
+    tftp_read_file reader(path, tftp::mode_t::OCTET, nullptr, nullptr, 1);
+    const auto     mapping = *reader.mapping();
+    for (size_t offset = 0; offset < mapping.size(); offset += BLOCK_SIZE)
+    {
+      // Touch each block as the kernel would when sending it
+      benchmark::DoNotOptimize(mapping[offset]);
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * file_size);
+  std::filesystem::remove_all(dir);
+}
+BENCHMARK(BM_read_file_mapped_blocks)->ArgName("bytes")->Arg(64 * 1024)->Arg(1024 * 1024)->Arg(16 * 1024 * 1024);
@@ -0,0 +1,271 @@
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <thread>
+
+#include "benchmarks/bench_utils.hpp"
+#include "client/tftp_client.hpp"
+#include "tests/lossy_relay.hpp"
+
+using namespace bench_utils;
+
+namespace
+{
+  const uint16_t BENCH_PORT  = 16969;
+  const size_t   NUM_CLIENTS = 16;
+  const size_t   FILE_SIZE   = 1024 * 1024;
+} // namespace
+
+//==========================================================
+/**
+ * @brief Aggregate read throughput of NUM_CLIENTS concurrent clients against a server running N workers on the given
+ * event backend
+ */
+static void BM_server_read_throughput(benchmark::State &state)
+{
+  const size_t num_workers = state.range(0);
+  const auto   backend     = static_cast<event_poller::backend_t>(state.range(1));
+  state.SetLabel(event_poller::backend_to_string(backend));
+  const auto   root        = make_temp_dir("tftp_bench_root_");
+  const auto   out_dir     = make_temp_dir("tftp_bench_out_");
+  for (size_t i = 0; i < NUM_CLIENTS; ++i)
+  {
+    write_random_file(root / ("file_" + std::to_string(i)), FILE_SIZE);
+  }
+  const auto old_cwd = std::filesystem::current_path();
+  std::filesystem::current_path(out_dir);
+
+  {
+    forked_server server([&]() {
+      auto options        = local_server_options(root, BENCH_PORT);
+      options.max_clients = NUM_CLIENTS;
+      options.workers     = num_workers;
+      options.backend     = backend;
+      return std::make_unique<tftp_server>(options);
+    });
+
+    size_t failures = 0;
+    for (auto _ : state)
+    {
+      std::vector<std::thread> clients;
+      std::vector<char>        ok(NUM_CLIENTS, 0);
+      for (size_t i = 0; i < NUM_CLIENTS; ++i)
+      {
+        clients.emplace_back([&, i]() {
+          try
+          {
+            ok[i] = tftp_client::get_file("file_" + std::to_string(i), "127.0.0.1", tftp::mode_t::OCTET, "",
+                                          BENCH_PORT);
+          }
+          catch (const std::exception &)
+          {
+            ok[i] = false;
+          }
+        });
+      }
+      for (auto &client : clients)
+      {
+        client.join();
+      }
+      failures += std::count(ok.begin(), ok.end(), 0);
+    }
+    state.SetBytesProcessed(state.iterations() * NUM_CLIENTS * FILE_SIZE);
+    state.counters["failures"] = failures;
+  }
+
+  std::filesystem::current_path(old_cwd);
+  std::filesystem::remove_all(root);
+  std::filesystem::remove_all(out_dir);
+}
+BENCHMARK(BM_server_read_throughput)
+    ->ArgNames({"workers", "backend"})
+    ->ArgsProduct({{1, 2, 4, 8},
+                   {static_cast<int64_t>(event_poller::backend_t::EPOLL),
+                    static_cast<int64_t>(event_poller::backend_t::IO_URING)}})
+    ->UseRealTime()
+    ->Unit(benchmark::kMillisecond);
+
+//==========================================================
+/**
+ * @brief Read throughput of a single client through a lossy relay for a given windowsize and loss rate (per mille)
+ */
+static void BM_windowsize_read_throughput(benchmark::State &state)
+{
+  const uint16_t window_size = state.range(0);
+  const double   loss_rate   = state.range(1) / 1000.0;
+  const auto     root        = make_temp_dir("tftp_bench_root_");
+  const auto     out_dir     = make_temp_dir("tftp_bench_out_");
+  write_random_file(root / "file", FILE_SIZE);
+  const auto old_cwd = std::filesystem::current_path();
+  std::filesystem::current_path(out_dir);
+
+  {
+    forked_server server([&]() {
+      auto options        = local_server_options(root, BENCH_PORT);
+      options.max_clients = 1;
+      return std::make_unique<tftp_server>(options);
+    });
+    test_utils::lossy_relay relay("127.0.0.1", BENCH_PORT, loss_rate);
+
+    size_t failures = 0;
+    for (auto _ : state)
+    {
+      if (!tftp_client::get_file("file", "127.0.0.1", tftp::mode_t::OCTET, "127.0.0.1", relay.port(), window_size))
+      {
+        ++failures;
+      }
+    }
+    state.SetBytesProcessed(state.iterations() * FILE_SIZE);
+    state.counters["failures"] = failures;
+    state.counters["dropped"]  = relay.dropped();
+  }
+
+  std::filesystem::current_path(old_cwd);
+  std::filesystem::remove_all(root);
+  std::filesystem::remove_all(out_dir);
+}
+BENCHMARK(BM_windowsize_read_throughput)
+    ->ArgNames({"windowsize", "loss_permille"})
+    ->ArgsProduct({{1, 4, 16, 64}, {0, 1}})
+    ->UseRealTime()
+    ->Unit(benchmark::kMillisecond);
+
+//==========================================================
+/**
+ * @brief Read throughput of NUM_CLIENTS concurrent clients with and without zero copy sends
+ */
+static void BM_zero_copy_read_throughput(benchmark::State &state)
+{
+  const bool zero_copy = state.range(0);
+  const auto root      = make_temp_dir("tftp_bench_root_");
+  const auto out_dir   = make_temp_dir("tftp_bench_out_");
+  for (size_t i = 0; i < NUM_CLIENTS; ++i)
+  {
+    write_random_file(root / ("file_" + std::to_string(i)), FILE_SIZE);
+  }
+  const auto old_cwd = std::filesystem::current_path();
+  std::filesystem::current_path(out_dir);
+
+  {
+    forked_server server([&]() {
+      auto options        = local_server_options(root, BENCH_PORT);
+      options.max_clients = NUM_CLIENTS;
+      options.zero_copy   = zero_copy;
+      return std::make_unique<tftp_server>(options);
+    });
+
+    size_t failures = 0;
+    for (auto _ : state)
+    {
+      std::vector<std::thread> clients;
+      std::vector<char>        ok(NUM_CLIENTS, 0);
+      for (size_t i = 0; i < NUM_CLIENTS; ++i)
+      {
+        clients.emplace_back([&, i]() {
+          try
+          {
+            ok[i] = tftp_client::get_file("file_" + std::to_string(i), "127.0.0.1", tftp::mode_t::OCTET, "",
+                                          BENCH_PORT, 16);
+          }
+          catch (const std::exception &)
+          {
+            ok[i] = false;
+          }
+        });
+      }
+      for (auto &client : clients)
+      {
+        client.join();
+      }
+      failures += std::count(ok.begin(), ok.end(), 0);
+    }
+    state.SetBytesProcessed(state.iterations() * NUM_CLIENTS * FILE_SIZE);
+    state.counters["failures"] = failures;
+  }
+
+  std::filesystem::current_path(old_cwd);
+  std::filesystem::remove_all(root);
+  std::filesystem::remove_all(out_dir);
+}
+BENCHMARK(BM_zero_copy_read_throughput)
+    ->ArgNames({"zero_copy"})
+    ->Arg(0)
+    ->Arg(1)
+    ->UseRealTime()
+    ->Unit(benchmark::kMillisecond);
+
+//==========================================================
+/**
+ * @brief System calls the server makes per DATA block sent to NUM_CLIENTS concurrent clients, for a given windowsize
+ * and event backend
+ *
+ * The server is traced with ptrace() to count its system calls, which slows it down, only the counter is of interest.
+ */
+static void BM_server_syscalls_per_block(benchmark::State &state)
+{
+  const uint16_t window_size = state.range(0);
+  const auto     backend     = static_cast<event_poller::backend_t>(state.range(1));
+  state.SetLabel(event_poller::backend_to_string(backend));
+  const auto root    = make_temp_dir("tftp_bench_root_");
+  const auto out_dir = make_temp_dir("tftp_bench_out_");
+  for (size_t i = 0; i < NUM_CLIENTS; ++i)
+  {
+    write_random_file(root / ("file_" + std::to_string(i)), FILE_SIZE);
+  }
+  const auto old_cwd = std::filesystem::current_path();
+  std::filesystem::current_path(out_dir);
+
+  {
+    forked_server server([&]() {
+      auto options        = local_server_options(root, BENCH_PORT);
+      options.max_clients = NUM_CLIENTS;
+      options.backend     = backend;
+      return std::make_unique<tftp_server>(options);
+    });
+    syscall_counter syscalls(server);
+
+    size_t   failures = 0;
+    uint64_t counted  = 0;
+    for (auto _ : state)
+    {
+      const uint64_t           before = syscalls.count();
+      std::vector<std::thread> clients;
+      std::vector<char>        ok(NUM_CLIENTS, 0);
+      for (size_t i = 0; i < NUM_CLIENTS; ++i)
+      {
+        clients.emplace_back([&, i]() {
+          try
+          {
+            ok[i] = tftp_client::get_file("file_" + std::to_string(i), "127.0.0.1", tftp::mode_t::OCTET, "",
+                                          BENCH_PORT, window_size);
+          }
+          catch (const std::exception &)
+          {
+            ok[i] = false;
+          }
+        });
+      }
+      for (auto &client : clients)
+      {
+        client.join();
+      }
+      failures += std::count(ok.begin(), ok.end(), 0);
+      counted += syscalls.count() - before;
+    }
+    const size_t blocks                  = (FILE_SIZE / tftp::DATA_PKT_DATA_MAX_SIZE) + 1;
+    state.counters["syscalls_per_block"] = static_cast<double>(counted) / (state.iterations() * NUM_CLIENTS * blocks);
+    state.counters["failures"]           = failures;
+  }
+
+  std::filesystem::current_path(old_cwd);
+  std::filesystem::remove_all(root);
+  std::filesystem::remove_all(out_dir);
+}
+BENCHMARK(BM_server_syscalls_per_block)
+    ->ArgNames({"windowsize", "backend"})
+    ->ArgsProduct({{1, 16},
+                   {static_cast<int64_t>(event_poller::backend_t::EPOLL),
+                    static_cast<int64_t>(event_poller::backend_t::IO_URING)}})
+    ->Iterations(2)
+    ->UseRealTime()
+    ->Unit(benchmark::kMillisecond);
@@ -0,0 +1,166 @@
+#include <benchmark/benchmark.h>
+
+#include <arpa/inet.h>
+
+#include "common/tftp.hpp"
+#include "common/udp_connection.hpp"
+
+namespace
+{
+  const size_t MAX_REQUEST_BYTES = 2048;
+  const size_t BATCH_SIZE        = 32;
+
+  /**
+   * @brief Listener socket with a client that queues num_requests read requests on it
+   */
+  struct request_storm
+  {
+    request_storm() :
+        listener(), client(), port(0), request()
+    {
+      listener.bind("127.0.0.1", 0);
+      listener.set_non_blocking(true);
+      struct sockaddr_in sa;
+      socklen_t          len = sizeof(sa);
+      getsockname(listener.sd(), (struct sockaddr *)&sa, &len);
+      port = ntohs(sa.sin_port);
+
+      client.bind("127.0.0.1", 0);
+      request = tftp::serialise_rw_packet(tftp::rw_packet_t("pxelinux.0", tftp::packet_t::READ, tftp::mode_t::OCTET));
+    }
+
+    void send(const size_t num_requests)
+    {
+      for (size_t i = 0; i < num_requests; ++i)
+      {
+        client.send_to("127.0.0.1", port, request);
+      }
+    }
+
+    udp_connection    listener;
+    udp_connection    client;
+    uint16_t          port;
+    std::vector<char> request;
+  };
+} // namespace
+
+//==========================================================
+/**
+ * @brief The listener drained one recvfrom() at a time, as tftp_connection_handler used to
+ */
+static void BM_listener_recv_from(benchmark::State &state)
+{
+  const size_t  num_requests = state.range(0);
+  request_storm storm;
+  size_t        syscalls = 0;
+  size_t        received = 0;
+
+  for (auto _ : state)
+  {
+    state.PauseTiming();
+    storm.send(num_requests);
+    state.ResumeTiming();
+
+    std::string addr;
+    uint16_t    port = 0;
+    while (true)
+    {
+      ++syscalls;
+      const auto data = storm.listener.recv_from(addr, port, MAX_REQUEST_BYTES);
+      if (data.empty())
+      {
+        break;
+      }
+      ++received;
+      benchmark::DoNotOptimize(tftp::deserialise_rw_packet(data));
+    }
+  }
+  state.SetItemsProcessed(received);
+  state.counters["syscalls_per_request"] = static_cast<double>(syscalls) / received;
+}
+BENCHMARK(BM_listener_recv_from)->ArgName("requests")->Arg(1)->Arg(32)->Arg(256);
+
+//==========================================================
+/**
+ * @brief The listener drained with recvmmsg() in to a reused datagram_batch, as tftp_connection_handler does now
+ */
+static void BM_listener_recv_batch(benchmark::State &state)
+{
+  const size_t   num_requests = state.range(0);
+  request_storm  storm;
+  datagram_batch batch(BATCH_SIZE, MAX_REQUEST_BYTES);
+  size_t         syscalls = 0;
+  size_t         received = 0;
+
+  for (auto _ : state)
+  {
+    state.PauseTiming();
+    storm.send(num_requests);
+    state.ResumeTiming();
+
+    size_t count = batch.capacity();
+    while (count == batch.capacity())
+    {
+      ++syscalls;
+      count = storm.listener.recv_batch(batch);
+      for (size_t i = 0; i < count; ++i)
+      {
+        ++received;
+        benchmark::DoNotOptimize(tftp::deserialise_rw_packet(batch.data(i)));
+      }
+    }
+  }
+  state.SetItemsProcessed(received);
+  state.counters["syscalls_per_request"] = static_cast<double>(syscalls) / received;
+}
+BENCHMARK(BM_listener_recv_batch)->ArgName("requests")->Arg(1)->Arg(32)->Arg(256);
+
+//==========================================================
+/**
+ * @brief Flushing a run of DATA packets on a connected session socket, one send() per packet vs one sendmmsg()
+ */
+static void BM_session_flush(benchmark::State &state)
+{
+  const bool     batched     = state.range(0);
+  const size_t   num_packets = state.range(1);
+  udp_connection sink;
+  udp_connection session;
+  sink.bind("127.0.0.1", 0);
+  struct sockaddr_in sa;
+  socklen_t          len = sizeof(sa);
+  getsockname(sink.sd(), (struct sockaddr *)&sa, &len);
+  session.connect(sa);
+
+  tftp::data_packet_t data;
+  data.data.resize(tftp::DATA_PKT_DATA_MAX_SIZE);
+  const std::vector<char>      packet = tftp::serialise_data_packet(data);
+  std::vector<datagram_view_t> views(num_packets, {packet.data(), packet.size(), nullptr, 0});
+  datagram_batch               drain(BATCH_SIZE, tftp::DATA_PKT_MAX_SIZE);
+  size_t                       syscalls = 0;
+
+  for (auto _ : state)
+  {
+    if (batched)
+    {
+      ++syscalls;
+      session.send_batch(views.data(), views.size());
+    }
+    else
+    {
+      for (size_t i = 0; i < num_packets; ++i)
+      {
+        ++syscalls;
+        session.send(packet);
+      }
+    }
+
+    state.PauseTiming();
+    while (sink.recv_batch(drain) > 0)
+    {
+    }
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * num_packets);
+  state.counters["syscalls_per_packet"] = static_cast<double>(syscalls) / (state.iterations() * num_packets);
+}
+BENCHMARK(BM_session_flush)->ArgNames({"batched", "packets"})->ArgsProduct({{0, 1}, {4, 16, 64}});
@@ -22,6 +22,10 @@ void print_help(char *argv0)
   -h --host       : IP address of the TFTP server
   -i --interface  : IP address of the local interface to send requests from (optional)
   -p --put        : Put files (default is get)
+  -w --windowsize : Number of blocks the server may send before waiting for an ack, gets only (default 1)
+  -m --multicast  : Get files by multicast (RFC 2090), sharing the transfer with other clients, octet only
+  -r --rollover   : Block number to roll over to after 65535, 0 or 1, gets only (not requested by default, wraps to 0)
+  -b --blksize    : Block size to ask for, 8 to 65464, gets only (default 512)
   -v --verbose    : Enable verbose logging
 )";
   fmt::print(help_msg, argv0);
@@ -38,30 +42,38 @@ int main(int argc, char **argv)
   spdlog::set_level(spdlog::level::info);
   dbg_trace("Initialised log");
 
-  int verbose_flag = 0;
-  int help_flag    = 0;
-  int write_flag   = 0;
+  int verbose_flag   = 0;
+  int help_flag      = 0;
+  int write_flag     = 0;
+  int multicast_flag = 0;
 
   static struct option long_options[] = {/* These options set a flag. */
                                          {"verbose", no_argument, &verbose_flag, 1},
                                          {"help", no_argument, &help_flag, 1},
                                          {"put", no_argument, &write_flag, 1},
+                                         {"multicast", no_argument, &multicast_flag, 1},
                                          /* These options don’t set a flag.
                                             We distinguish them by their indices. */
                                          {"host", required_argument, 0, 'h'},
                                          {"interface", required_argument, 0, 'i'},
                                          {"type", required_argument, 0, 't'},
+                                         {"windowsize", required_argument, 0, 'w'},
+                                         {"rollover", required_argument, 0, 'r'},
+                                         {"blksize", required_argument, 0, 'b'},
                                          {0, 0, 0, 0}};
 
   std::string tftp_host{};
   std::string local_interface{};
   std::string transfer_mode{};
+  std::string window_size_str{};
+  std::string rollover_str{};
+  std::string block_size_str{};
 
   while (true)
   {
     int option_index = 0;
 
-    int c = getopt_long(argc, argv, "vph:i:t:", long_options, &option_index);
+    int c = getopt_long(argc, argv, "vpmh:i:t:w:r:b:", long_options, &option_index);
 
     if (c == -1)
       break;
@@ -72,6 +84,10 @@ int main(int argc, char **argv)
       write_flag = 1;
       break;
     }
+    case 'm': {
+      multicast_flag = 1;
+      break;
+    }
     case 'h': {
       tftp_host = optarg;
       break;
@@ -84,6 +100,18 @@ int main(int argc, char **argv)
       transfer_mode = optarg;
       break;
     }
+    case 'w': {
+      window_size_str = optarg;
+      break;
+    }
+    case 'r': {
+      rollover_str = optarg;
+      break;
+    }
+    case 'b': {
+      block_size_str = optarg;
+      break;
+    }
     case 'v': {
       verbose_flag = 1;
       break;
@@ -118,6 +146,54 @@ int main(int argc, char **argv)
     mode = parsed_mode.value();
   }
 
+  uint16_t window_size = 1;
+  if (!window_size_str.empty())
+  {
+    try
+    {
+      const unsigned long parsed_window_size = std::stoul(window_size_str);
+      if ((parsed_window_size < 1) || (parsed_window_size > UINT16_MAX))
+      {
+        throw std::out_of_range("window size must be between 1 and 65535");
+      }
+      window_size = static_cast<uint16_t>(parsed_window_size);
+    }
+    catch (const std::exception &err)
+    {
+      dbg_err("Invalid window size '{}' : {}", window_size_str, err.what());
+      return 1;
+    }
+  }
+
+  size_t block_size = tftp::DATA_PKT_DATA_MAX_SIZE;
+  if (!block_size_str.empty())
+  {
+    try
+    {
+      block_size = std::stoul(block_size_str);
+      if ((block_size < tftp::MIN_BLOCK_SIZE) || (block_size > tftp::MAX_BLOCK_SIZE))
+      {
+        throw std::out_of_range("block size must be between 8 and 65464");
+      }
+    }
+    catch (const std::exception &err)
+    {
+      dbg_err("Invalid block size '{}' : {}", block_size_str, err.what());
+      return 1;
+    }
+  }
+
+  std::optional<uint16_t> rollover;
+  if (!rollover_str.empty())
+  {
+    if ((rollover_str != "0") && (rollover_str != "1"))
+    {
+      dbg_err("Invalid rollover '{}' : must be 0 or 1", rollover_str);
+      return 1;
+    }
+    rollover = static_cast<uint16_t>(rollover_str[0] - '0');
+  }
+
   try
   {
     for (const auto &file : files)
@@ -127,9 +203,14 @@ int main(int argc, char **argv)
         tftp_client::send_file(file, tftp_host, mode, local_interface);
         dbg_info("Successfully sent file '{}'", file);
       }
+      else if (multicast_flag)
+      {
+        tftp_client::get_file_multicast(file, tftp_host, local_interface);
+        dbg_info("Successfully received file '{}'", file);
+      }
       else
       {
-        tftp_client::get_file(file, tftp_host, mode, local_interface);
+        tftp_client::get_file(file, tftp_host, mode, local_interface, 69, window_size, rollover, block_size);
         dbg_info("Successfully received file '{}'", file);
       }
     }
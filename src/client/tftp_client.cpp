@@ -1,67 +1,175 @@
 
 #include "client/tftp_client.hpp"
 
+#include <arpa/inet.h>
+#include <array>
 #include <filesystem>
 #include <fstream>
 #include <poll.h>
+#include <strings.h>
 
 #include "common/debug_macros.hpp"
+#include "common/netascii.hpp"
 #include "common/tftp.hpp"
-#include "common/utils.hpp"
+
+namespace
+{
+  const int     REPLY_TIMEOUT_MS = 1000;
+  const uint8_t MAX_RETRIES      = 5;
+  const char    WINDOWSIZE_OPT[] = "windowsize";
+  const char    MULTICAST_OPT[]  = "multicast";
+  const char    TSIZE_OPT[]      = "tsize";
+  const char    ROLLOVER_OPT[]   = "rollover";
+  const char    BLKSIZE_OPT[]    = "blksize";
+
+  struct multicast_option_t
+  {
+    std::string address;
+    uint16_t    port   = 0;
+    bool        master = false;
+  };
+
+  /**
+   * @brief Parses the server's value of the multicast option, "address,port,mc"
+   */
+  bool parse_multicast_option(const std::string &value, multicast_option_t &option)
+  {
+    const auto first  = value.find(',');
+    const auto second = value.find(',', first + 1);
+    if ((first == std::string::npos) || (second == std::string::npos))
+    {
+      return false;
+    }
+    try
+    {
+      option.address = value.substr(0, first);
+      option.port    = static_cast<uint16_t>(std::stoul(value.substr(first + 1, second - first - 1)));
+      option.master  = std::stoul(value.substr(second + 1)) == 1;
+    }
+    catch (const std::exception &)
+    {
+      return false;
+    }
+    return !option.address.empty() && (option.port != 0);
+  }
+}; // namespace
 
 //========================================================
+/**
+ * @brief Reads a file from a server
+ *
+ * If window_size is greater than 1 the windowsize option (RFC 7440) is requested. Blocks are acknowledged once per
+ * window; a missing block is acknowledged straight away with the last block received in order, so the server resends
+ * from there without waiting for its timeout. On timeout the request or the last ack is resent.
+ *
+ * Block numbers roll over to 0 after 65535, or to rollover if it is given and the server accepts the rollover option.
+ *
+ * If block_size is not 512 the blksize option (RFC 2348) is requested, the server may answer with a smaller one.
+ */
 bool tftp_client::get_file(const std::string &filename, const std::string &tftp_server, const tftp::mode_t mode,
-                           const std::string &local_interface)
+                           const std::string &local_interface, const uint16_t port, const uint16_t window_size,
+                           const std::optional<uint16_t> rollover, const size_t block_size)
 {
   udp_connection udp;
   udp.bind(local_interface, 0);
 
-  const tftp::rw_packet_t request(filename, tftp::packet_t::READ, mode);
-  const auto              request_data = tftp::serialise_rw_packet(request);
-
-  udp.send_to(tftp_server, 69, request_data);
-  dbg_dbg("Sent request to {}:{} to read file '{}'", tftp_server, 69, filename);
+  tftp::rw_packet_t request(filename, tftp::packet_t::READ, mode);
+  if (window_size > 1)
+  {
+    request.options.push_back(std::make_pair(WINDOWSIZE_OPT, std::to_string(window_size)));
+  }
+  if (rollover)
+  {
+    request.options.push_back(std::make_pair(ROLLOVER_OPT, std::to_string(*rollover)));
+  }
+  if (block_size != tftp::DATA_PKT_DATA_MAX_SIZE)
+  {
+    request.options.push_back(std::make_pair(BLKSIZE_OPT, std::to_string(block_size)));
+  }
+  const auto request_data = tftp::serialise_rw_packet(request);
 
   pollfd pfd = {
       .fd      = udp.sd(),
-      .events  = POLLOUT,
+      .events  = POLLIN,
       .revents = 0,
   };
 
-  if ((poll(&pfd, 1, 3000) <= 0) || !(pfd.revents & POLLOUT))
+  std::string       addr;
+  uint16_t          server_tid = 0;
+  std::vector<char> recv_data;
+  for (uint8_t attempt = 0; recv_data.empty(); ++attempt)
   {
-    dbg_warn("Did not receive reply to read request");
-    return false;
+    if (attempt == MAX_RETRIES)
+    {
+      dbg_warn("Did not receive reply to read request");
+      return false;
+    }
+    udp.send_to(tftp_server, port, request_data);
+    dbg_dbg("Sent request to {}:{} to read file '{}'", tftp_server, port, filename);
+    if ((poll(&pfd, 1, REPLY_TIMEOUT_MS) > 0) && (pfd.revents & POLLIN))
+    {
+      recv_data = udp.recv_from(addr, server_tid, tftp::DATA_PKT_HEADER_SIZE + block_size);
+    }
   }
-
-  std::string addr;
-  uint16_t    server_tid        = 0;
-  uint16_t    block_number      = 1;
-  const auto  first_packet_data = udp.recv_from(addr, server_tid, tftp::DATA_PKT_MAX_SIZE);
-  auto        data_packet       = tftp::deserialise_data_packet(first_packet_data);
   dbg_dbg("Server tid is {}", server_tid);
 
-  if (!data_packet)
+  uint16_t negotiated_window   = 1;
+  uint16_t negotiated_rollover = 0;
+  size_t   negotiated_block    = tftp::DATA_PKT_DATA_MAX_SIZE;
+  if (!tftp::decode_data_packet(std::string_view(recv_data.data(), recv_data.size())))
   {
-    const auto error_packet = tftp::deserialise_error_packet(first_packet_data);
-    if (error_packet)
+    const auto oack_packet = tftp::deserialise_oack_packet(recv_data);
+    if (oack_packet)
     {
-      dbg_err("Server replied with error : {}", error_packet->error_msg);
+      for (const auto &opt : oack_packet->options)
+      {
+        if (strcasecmp(opt.first.c_str(), WINDOWSIZE_OPT) == 0)
+        {
+          negotiated_window = static_cast<uint16_t>(std::stoul(opt.second));
+        }
+        else if (strcasecmp(opt.first.c_str(), ROLLOVER_OPT) == 0)
+        {
+          negotiated_rollover = static_cast<uint16_t>(std::stoul(opt.second));
+        }
+        else if (strcasecmp(opt.first.c_str(), BLKSIZE_OPT) == 0)
+        {
+          negotiated_block = std::stoul(opt.second);
+        }
+      }
+      if ((negotiated_window < 1) || (negotiated_window > window_size))
+      {
+        dbg_err("Server replied with invalid window size {}", negotiated_window);
+        return false;
+      }
+      // The server may decline the rollover asked for, leaving the default of 0, but not pick another
+      if ((negotiated_rollover != 0) && (!rollover || (negotiated_rollover != *rollover)))
+      {
+        dbg_err("Server replied with invalid rollover {}", negotiated_rollover);
+        return false;
+      }
+      if ((negotiated_block < tftp::MIN_BLOCK_SIZE) ||
+          ((negotiated_block != tftp::DATA_PKT_DATA_MAX_SIZE) && (negotiated_block > block_size)))
+      {
+        dbg_err("Server replied with invalid block size {}", negotiated_block);
+        return false;
+      }
+      dbg_dbg("Window size is {}, block size is {}", negotiated_window, negotiated_block);
     }
     else
     {
-      dbg_err("Unknown error : Failed to parse packet");
+      const auto error_packet = tftp::deserialise_error_packet(recv_data);
+      if (error_packet)
+      {
+        dbg_err("Server replied with error : {}", error_packet->error_msg);
+      }
+      else
+      {
+        dbg_err("Unknown error : Failed to parse packet");
+      }
+      return false;
     }
-    return false;
   }
 
-  if (data_packet->block_number != block_number)
-  {
-    dbg_err("Received unexpected block number from 1st data package ({})", data_packet->block_number);
-    return false;
-  }
-  dbg_trace("Received block {} of {} bytes", data_packet->block_number, data_packet->data.size());
-
   const std::filesystem::path out_filename(filename);
   std::ofstream               out_file(out_filename.filename(), std::ios_base::binary);
   if (!out_file)
@@ -70,60 +178,341 @@ bool tftp_client::get_file(const std::string &filename, const std::string &tftp_
     return false;
   }
 
-  dbg_trace("Server tid is {}", server_tid);
   udp.connect(tftp_server, server_tid);
+  // A whole window of large blocks arrives back to back, the default buffer drops the end of it
+  udp.set_receive_buffer(2 * negotiated_window * (tftp::DATA_PKT_HEADER_SIZE + negotiated_block));
+
+  // Received blocks are decoded as views into recv_buffer and written straight out, nothing is allocated per block
+  std::vector<char>                        recv_buffer(tftp::DATA_PKT_HEADER_SIZE + negotiated_block);
+  std::vector<char>                        native_buffer(negotiated_block);
+  std::array<char, tftp::ACK_PKT_MAX_SIZE> ack_buffer;
+  std::optional<tftp::data_packet_view_t>  data_packet = tftp::decode_data_packet(
+      std::string_view(recv_data.data(), recv_data.size()));
+
+  uint16_t   last_block = 0; // Last block received in order
+  uint16_t   last_acked = 0;
+  uint8_t    retries    = 0;
+  const auto send_ack   = [&](const uint16_t block_number) {
+    dbg_trace("Sending ack to block {}", block_number);
+    udp.send(ack_buffer.data(), tftp::encode_ack_packet(block_number, ack_buffer.data(), ack_buffer.size()));
+    last_acked = block_number;
+  };
 
-  tftp::ack_packet_t ack(block_number);
+  if (!data_packet)
+  {
+    // Acknowledge the OACK
+    send_ack(0);
+  }
 
   while (true)
   {
-    dbg_trace("Sending ack to block {}", block_number);
-    udp.send(tftp::serialise_ack_packet(ack));
-    ack.block_number = ++block_number;
+    if (data_packet)
+    {
+      const uint16_t block_number = data_packet->block_number;
+      if (block_number == tftp::next_block_number(last_block, negotiated_rollover))
+      {
+        dbg_trace("Received block {} of {} bytes", block_number, data_packet->data.size());
+        retries    = 0;
+        last_block = block_number;
+        if (request.mode == tftp::mode_t::NETASCII)
+        {
+          const size_t native_size =
+              netascii::decode(data_packet->data.data(), data_packet->data.size(), native_buffer.data());
+          out_file.write(native_buffer.data(), native_size);
+        }
+        else
+        {
+          out_file.write(data_packet->data.data(), data_packet->data.size());
+        }
+
+        if (data_packet->data.size() < negotiated_block)
+        {
+          dbg_trace("Final block is {} ({} bytes)", block_number, data_packet->data.size());
+          send_ack(block_number);
+          break;
+        }
+        if (tftp::block_distance(last_acked, block_number, negotiated_rollover) >= negotiated_window)
+        {
+          send_ack(block_number);
+        }
+      }
+      else if (block_number == last_block)
+      {
+        dbg_trace("Received block {} again, ack was lost", block_number);
+        send_ack(last_block);
+      }
+      else if ((tftp::block_distance(last_block, block_number, negotiated_rollover) < (UINT16_MAX / 2)) &&
+               (last_acked != last_block))
+      {
+        dbg_trace("Received block {}, expected {}, acking last block received in order", block_number,
+                  tftp::next_block_number(last_block, negotiated_rollover));
+        send_ack(last_block);
+      }
+    }
 
-    if (request.mode == tftp::mode_t::NETASCII)
+    if ((poll(&pfd, 1, REPLY_TIMEOUT_MS) <= 0) || !(pfd.revents & POLLIN))
     {
-      const auto native_data = utils::netascii_to_native(data_packet->data);
-      out_file.write(native_data.data(), native_data.size());
+      if (++retries > MAX_RETRIES)
+      {
+        dbg_warn("Timed out waiting for reply, expected block number {}",
+                 tftp::next_block_number(last_block, negotiated_rollover));
+        return false;
+      }
+      dbg_trace("Timed out waiting for block {}, resending ack",
+                tftp::next_block_number(last_block, negotiated_rollover));
+      send_ack(last_block);
+      data_packet.reset();
+      continue;
     }
-    else
+
+    const std::string_view packet(recv_buffer.data(), udp.recv(recv_buffer.data(), recv_buffer.size()));
+    data_packet = tftp::decode_data_packet(packet);
+    if (!data_packet)
     {
-      out_file.write(data_packet->data.data(), data_packet->data.size());
+      const auto error_packet = tftp::decode_error_packet(packet);
+      if (error_packet)
+      {
+        dbg_err("Server replied with error : {}", error_packet->error_msg);
+      }
+      else
+      {
+        dbg_err("Failed to parse data packet at block number {}",
+                tftp::next_block_number(last_block, negotiated_rollover));
+      }
+      return false;
     }
+  }
+  return true;
+}
+
+//========================================================
+/**
+ * @brief Reads a file from a server by multicast (RFC 2090), sharing the transfer with other clients reading it
+ *
+ * The server's OACK gives the group's address and port and whether this client is the master. Blocks sent to the
+ * group are written at their offsets whatever order they arrive in. As master the client acknowledges the block
+ * before the first one it is missing, a client that joined late so has the blocks it missed sent again. The server
+ * promotes a listener to master with a new OACK. Once every block has been received the last block is acknowledged,
+ * which takes the client out of the group. On timeout the master resends its ack, a listener its request.
+ *
+ * The file is written to local_filename, or the requested file's name in the working directory if that is empty.
+ */
+bool tftp_client::get_file_multicast(const std::string &filename, const std::string &tftp_server,
+                                     const std::string &local_interface, const uint16_t port,
+                                     const std::string &local_filename)
+{
+  udp_connection udp;
+  udp.bind(local_interface, 0);
+
+  tftp::rw_packet_t request(filename, tftp::packet_t::READ, tftp::mode_t::OCTET);
+  request.options.push_back(std::make_pair(MULTICAST_OPT, ""));
+  request.options.push_back(std::make_pair(TSIZE_OPT, "0"));
+  const auto request_data = tftp::serialise_rw_packet(request);
+
+  pollfd pfd = {
+      .fd      = udp.sd(),
+      .events  = POLLIN,
+      .revents = 0,
+  };
 
-    if (data_packet->data.size() < tftp::DATA_PKT_DATA_MAX_SIZE)
+  std::string       addr;
+  uint16_t          server_tid = 0;
+  std::vector<char> recv_data;
+  for (uint8_t attempt = 0; recv_data.empty(); ++attempt)
+  {
+    if (attempt == MAX_RETRIES)
     {
-      dbg_trace("Final block is {} ({} bytes)", block_number - 1, data_packet->data.size());
-      break;
+      dbg_warn("Did not receive reply to read request");
+      return false;
     }
+    udp.send_to(tftp_server, port, request_data);
+    dbg_dbg("Sent request to {}:{} to read file '{}' by multicast", tftp_server, port, filename);
+    if ((poll(&pfd, 1, REPLY_TIMEOUT_MS) > 0) && (pfd.revents & POLLIN))
+    {
+      recv_data = udp.recv_from(addr, server_tid, tftp::DATA_PKT_MAX_SIZE);
+    }
+  }
+  dbg_dbg("Server tid is {}", server_tid);
 
-    if (!poll(&pfd, 1, 3000) || !(pfd.revents & POLLOUT))
+  const auto oack_packet = tftp::deserialise_oack_packet(recv_data);
+  if (!oack_packet)
+  {
+    const auto error_packet = tftp::deserialise_error_packet(recv_data);
+    if (error_packet)
     {
-      dbg_warn("Timed out waiting for reply, expected block number {}", block_number);
+      dbg_err("Server replied with error : {}", error_packet->error_msg);
+    }
+    else
+    {
+      dbg_err("Server did not accept the multicast option");
+    }
+    return false;
+  }
+  multicast_option_t      group;
+  std::optional<uint64_t> transfer_size;
+  for (const auto &opt : oack_packet->options)
+  {
+    if ((strcasecmp(opt.first.c_str(), MULTICAST_OPT) == 0) && !parse_multicast_option(opt.second, group))
+    {
+      dbg_err("Server replied with invalid multicast option '{}'", opt.second);
       return false;
     }
+    if (strcasecmp(opt.first.c_str(), TSIZE_OPT) == 0)
+    {
+      transfer_size = std::stoull(opt.second);
+    }
+  }
+  if (group.address.empty() || !transfer_size)
+  {
+    dbg_err("Server did not accept the multicast option");
+    return false;
+  }
+  const uint64_t total_blocks = (*transfer_size / tftp::DATA_PKT_DATA_MAX_SIZE) + 1;
+  if (total_blocks > UINT16_MAX)
+  {
+    dbg_err("File of {} bytes too large for multicast", *transfer_size);
+    return false;
+  }
+  dbg_dbg("Multicast group is {}:{}, {}", group.address, group.port, group.master ? "master" : "listener");
 
-    data_packet = tftp::deserialise_data_packet(udp.recv(tftp::DATA_PKT_MAX_SIZE));
+  const std::filesystem::path out_filename =
+      local_filename.empty() ? std::filesystem::path(filename).filename() : std::filesystem::path(local_filename);
+  std::ofstream out_file(out_filename, std::ios_base::binary);
+  if (!out_file)
+  {
+    dbg_err("Failed to open file for writing '{}'", out_filename.c_str());
+    return false;
+  }
 
-    if (!data_packet)
+  udp.connect(tftp_server, server_tid);
+
+  // Every client on this host reading the group binds the same port
+  udp_connection group_udp;
+  struct in_addr group_addr;
+  inet_pton(AF_INET, group.address.c_str(), &group_addr);
+  group_udp.set_reuse_address(true);
+  group_udp.bind(group.address, group.port);
+  group_udp.join_multicast_group(group_addr, local_interface);
+
+  std::array<pollfd, 2> pfds = {
+      pollfd{.fd = udp.sd(), .events = POLLIN, .revents = 0},
+      pollfd{.fd = group_udp.sd(), .events = POLLIN, .revents = 0},
+  };
+
+  std::vector<char>                        recv_buffer(tftp::DATA_PKT_MAX_SIZE);
+  std::array<char, tftp::ACK_PKT_MAX_SIZE> ack_buffer;
+  std::vector<bool>                        received(total_blocks + 1, false);
+  uint64_t                                 missing       = total_blocks;
+  uint16_t                                 first_missing = 1;
+  uint16_t                                 last_acked    = 0;
+  uint8_t                                  retries       = 0;
+  const auto                               send_ack      = [&](const uint16_t block_number) {
+    dbg_trace("Sending ack to block {}", block_number);
+    udp.send(ack_buffer.data(), tftp::encode_ack_packet(block_number, ack_buffer.data(), ack_buffer.size()));
+    last_acked = block_number;
+  };
+  // The master asks for the first block it is missing, all clients acknowledge the last block once they have them all
+  const auto ack_progress = [&]() {
+    send_ack((missing == 0) ? static_cast<uint16_t>(total_blocks) : static_cast<uint16_t>(first_missing - 1));
+  };
+
+  if (group.master)
+  {
+    ack_progress();
+  }
+
+  while (missing > 0)
+  {
+    if ((poll(pfds.data(), pfds.size(), REPLY_TIMEOUT_MS) <= 0))
     {
-      dbg_err("Failed to parse data packet at block number {}", block_number);
-      return false;
+      if (++retries > MAX_RETRIES)
+      {
+        dbg_warn("Timed out waiting for block {} by multicast", first_missing);
+        return false;
+      }
+      if (group.master)
+      {
+        dbg_trace("Timed out waiting for block {}, resending ack", first_missing);
+        ack_progress();
+      }
+      else
+      {
+        dbg_trace("Timed out waiting for block {}, resending request", first_missing);
+        udp.send_to(tftp_server, port, request_data);
+      }
+      continue;
     }
 
-    if (data_packet->block_number != block_number)
+    if (pfds[1].revents & POLLIN)
     {
-      dbg_err("Received unexpected block number ({}) expected {}", data_packet->block_number, block_number);
-      return false;
+      struct sockaddr_in     from;
+      const std::string_view packet(recv_buffer.data(),
+                                    group_udp.recv_from(recv_buffer.data(), recv_buffer.size(), from));
+      const auto             data_packet = tftp::decode_data_packet(packet);
+      const uint16_t         block       = data_packet ? data_packet->block_number : 0;
+      if (data_packet && (ntohs(from.sin_port) == server_tid) && (block >= 1) && (block <= total_blocks))
+      {
+        retries = 0;
+        if (!received[block])
+        {
+          dbg_trace("Received block {} of {} bytes", block, data_packet->data.size());
+          out_file.seekp(static_cast<std::streamoff>(block - 1) * tftp::DATA_PKT_DATA_MAX_SIZE);
+          out_file.write(data_packet->data.data(), data_packet->data.size());
+          received[block] = true;
+          --missing;
+          while ((first_missing <= total_blocks) && received[first_missing])
+          {
+            ++first_missing;
+          }
+        }
+        if ((missing == 0) || (group.master && (block == static_cast<uint16_t>(last_acked + 1))))
+        {
+          ack_progress();
+        }
+      }
+    }
+
+    if (pfds[0].revents & POLLIN)
+    {
+      const std::string_view packet(recv_buffer.data(), udp.recv(recv_buffer.data(), recv_buffer.size()));
+      const auto             error_packet = tftp::decode_error_packet(packet);
+      if (error_packet)
+      {
+        dbg_err("Server replied with error : {}", error_packet->error_msg);
+        return false;
+      }
+      const auto oack = tftp::deserialise_oack_packet(std::vector<char>(packet.begin(), packet.end()));
+      if (!oack)
+      {
+        continue;
+      }
+      for (const auto &opt : oack->options)
+      {
+        multicast_option_t option;
+        if ((strcasecmp(opt.first.c_str(), MULTICAST_OPT) != 0) || !parse_multicast_option(opt.second, option))
+        {
+          continue;
+        }
+        // A repeated OACK answers a repeated request, with mc=1 it promotes this client to master
+        retries = 0;
+        if (option.master && !group.master)
+        {
+          dbg_dbg("Promoted to master, missing block {}", first_missing);
+        }
+        group.master = option.master;
+        if (group.master)
+        {
+          ack_progress();
+        }
+      }
     }
-    dbg_trace("Received block {} of {} bytes", data_packet->block_number, data_packet->data.size());
   }
   return true;
 }
 
 //========================================================
 bool tftp_client::send_file(const std::string &filename, const std::string &tftp_server, const tftp::mode_t mode,
-                            const std::string &local_interface)
+                            const std::string &local_interface, const uint16_t port)
 {
   udp_connection udp;
   udp.bind(local_interface, 0);
@@ -131,8 +520,8 @@ bool tftp_client::send_file(const std::string &filename, const std::string &tftp
   const tftp::rw_packet_t request(filename, tftp::packet_t::WRITE, mode);
   const auto              request_data = tftp::serialise_rw_packet(request);
 
-  udp.send_to(tftp_server, 69, request_data);
-  dbg_dbg("Sent request to {}:{} to write file '{}'", tftp_server, 63, filename);
+  udp.send_to(tftp_server, port, request_data);
+  dbg_dbg("Sent request to {}:{} to write file '{}'", tftp_server, port, filename);
 
   pollfd pfd = {
       .fd      = udp.sd(),
@@ -175,10 +564,6 @@ bool tftp_client::send_file(const std::string &filename, const std::string &tftp
   dbg_trace("Server tid is {}", server_tid);
   udp.connect(tftp_server, server_tid);
 
-  tftp::data_packet_t data_packet;
-  data_packet.block_number = block_number;
-  data_packet.data.resize(512);
-
   std::ifstream in_file(filename, std::ios_base::binary);
   if (!in_file)
   {
@@ -186,27 +571,41 @@ bool tftp_client::send_file(const std::string &filename, const std::string &tftp
     return false;
   }
 
+  // Octet blocks are read straight behind the DATA header, netascii blocks are encoded there
+  tftp::data_packet_buffer                 packet;
+  std::vector<char>                        native_buffer(tftp::DATA_PKT_DATA_MAX_SIZE);
+  std::array<char, tftp::ACK_PKT_MAX_SIZE> ack_buffer;
+  const auto                               read_block = [&]() {
+    packet.resize_payload(netascii::max_encoded_size(tftp::DATA_PKT_DATA_MAX_SIZE));
+    char *const dest = (request.mode == tftp::mode_t::NETASCII) ? native_buffer.data() : packet.payload();
+    in_file.read(dest, tftp::DATA_PKT_DATA_MAX_SIZE);
+    if (!in_file && !in_file.eof())
+    {
+      dbg_err("Read error occured on file '{}'", filename);
+      return false;
+    }
+    size_t size = static_cast<size_t>(in_file.gcount());
+    if (request.mode == tftp::mode_t::NETASCII)
+    {
+      size = netascii::encode(native_buffer.data(), size, packet.payload());
+    }
+    packet.resize_payload(size);
+    return true;
+  };
+
   // Pre read in first block
-  in_file.read(data_packet.data.data(), 512);
-  if (!in_file)
+  if (!read_block())
   {
-    dbg_err("Read error occured on file '{}'", filename);
     return false;
   }
-  data_packet.data.resize(in_file.gcount());
-
-  if (request.mode == tftp::mode_t::NETASCII)
-  {
-    data_packet.data = utils::native_to_netascii(data_packet.data);
-  }
 
   // Transfer loop
   bool finished = false;
   while (!finished)
   {
-    if (data_packet.data.size() < tftp::DATA_PKT_DATA_MAX_SIZE)
+    if (packet.payload_size() < tftp::DATA_PKT_DATA_MAX_SIZE)
     {
-      dbg_trace("Sending final block {} ({} bytes)", block_number, data_packet.data.size());
+      dbg_trace("Sending final block {} ({} bytes)", block_number, packet.payload_size());
       finished = true;
     }
     else
@@ -214,22 +613,14 @@ bool tftp_client::send_file(const std::string &filename, const std::string &tftp
       dbg_trace("Sending data packet, block {}", block_number);
     }
 
-    udp.send(tftp::serialise_data_packet(data_packet));
-    data_packet.block_number = ++block_number;
+    packet.set_block_number(block_number);
+    udp.send(packet.data(), packet.size());
 
     // Read in block before we wait for ACK
-    in_file.read(data_packet.data.data(), 512);
-    if (!in_file && !in_file.eof())
+    if (!finished && !read_block())
     {
-      dbg_err("Read error occured on file '{}'", filename);
       return false;
     }
-    data_packet.data.resize(in_file.gcount());
-
-    if (request.mode == tftp::mode_t::NETASCII)
-    {
-      data_packet.data = utils::native_to_netascii(data_packet.data);
-    }
 
     // Wait for ACK
     if (!poll(&pfd, 1, 3000) || !(pfd.revents & POLLOUT))
@@ -238,18 +629,20 @@ bool tftp_client::send_file(const std::string &filename, const std::string &tftp
       return false;
     }
 
-    ack_packet = tftp::deserialise_ack_packet(udp.recv(tftp::ACK_PKT_MAX_SIZE));
+    const size_t received = udp.recv(ack_buffer.data(), ack_buffer.size());
+    ack_packet            = tftp::decode_ack_packet(std::string_view(ack_buffer.data(), received));
     if (!ack_packet)
     {
       dbg_err("Failed to parse ack packet at block number {}", block_number);
       return false;
     }
 
-    if (data_packet.block_number != block_number)
+    if (ack_packet->block_number != block_number)
     {
-      dbg_err("Received unexpected block number ({}) expected {}", data_packet.block_number, block_number);
+      dbg_err("Received unexpected block number ({}) expected {}", ack_packet->block_number, block_number);
       return false;
     }
+    ++block_number;
   }
   return true;
 }
\ No newline at end of file
@@ -0,0 +1,252 @@
+#include "common/datagram_cache.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+
+namespace
+{
+  size_t hash_combine(const size_t hash, const size_t value)
+  {
+    return hash ^ (value + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2));
+  }
+} // namespace
+
+//========================================================
+bool datagram_cache::key_t::operator==(const key_t &other) const
+{
+  return (block_size == other.block_size) && (mode == other.mode) && (rollover == other.rollover) &&
+         (file == other.file);
+}
+
+//========================================================
+bool datagram_cache::run_key_t::operator==(const run_key_t &other) const
+{
+  return (index == other.index) && (key == other.key);
+}
+
+//========================================================
+size_t datagram_cache::run_key_hash::operator()(const run_key_t &key) const
+{
+  size_t hash = std::hash<uint64_t>()(key.key.file.ino);
+  hash        = hash_combine(hash, std::hash<uint64_t>()(key.key.file.dev));
+  hash        = hash_combine(hash, std::hash<int64_t>()(key.key.file.mtime_ns));
+  hash        = hash_combine(hash, std::hash<size_t>()(key.key.block_size));
+  hash        = hash_combine(hash, std::hash<int>()(static_cast<int>(key.key.mode)));
+  hash        = hash_combine(hash, std::hash<uint16_t>()(key.key.rollover));
+  return hash_combine(hash, std::hash<size_t>()(key.index));
+}
+
+//========================================================
+bool datagram_cache::file_id_t::operator==(const file_id_t &other) const
+{
+  return (dev == other.dev) && (ino == other.ino);
+}
+
+//========================================================
+size_t datagram_cache::file_id_hash::operator()(const file_id_t &id) const
+{
+  return hash_combine(std::hash<uint64_t>()(id.ino), std::hash<uint64_t>()(id.dev));
+}
+
+//========================================================
+/**
+ * @brief Datagram index of the run, which must be less than count
+ */
+std::string_view datagram_cache::run_t::datagram(const size_t index) const
+{
+  const size_t offset = index * packet_size;
+  return std::string_view(datagrams.data() + offset, std::min(packet_size, datagrams.size() - offset));
+}
+
+//========================================================
+datagram_cache::datagram_cache(const size_t capacity_bytes) :
+    _capacity(capacity_bytes), _mutex(), _lru(), _index(), _files(), _stats{0, 0, 0, 0, 0}
+{
+}
+
+//========================================================
+/**
+ * @brief Number of blocks in every run of a transfer with block_size, about RUN_BYTES of datagrams
+ */
+size_t datagram_cache::blocks_per_run(const size_t block_size)
+{
+  return std::max<size_t>(1, RUN_BYTES / (tftp::DATA_PKT_HEADER_SIZE + block_size));
+}
+
+//========================================================
+/**
+ * @brief Reads run run_index of a transfer from file, which must be positioned at the start of the run
+ *
+ * Block numbers are those of the run's place in the transfer, rolling over to rollover after 65535.
+ */
+datagram_cache::run_t datagram_cache::read_run(tftp_read_file &file, const size_t block_size, const size_t run_index,
+                                               const uint16_t rollover)
+{
+  const size_t   blocks = blocks_per_run(block_size);
+  const uint64_t first  = static_cast<uint64_t>(run_index) * blocks;
+  run_t          run{};
+  run.packet_size = tftp::DATA_PKT_HEADER_SIZE + block_size;
+  run.datagrams.resize(blocks * run.packet_size);
+  size_t used = 0;
+  while ((run.count < blocks) && !run.last)
+  {
+    char      *datagram = run.datagrams.data() + used;
+    const auto header   = tftp::serialise_data_header(tftp::block_number_at(first + run.count, rollover));
+    std::memcpy(datagram, header.data(), header.size());
+    const size_t payload = file.read_in_to(datagram + header.size(), block_size);
+    if (file.error())
+    {
+      run.error = true;
+      break;
+    }
+    used += header.size() + payload;
+    run.last = payload < block_size;
+    ++run.count;
+  }
+  run.datagrams.resize(used);
+  if (run.last)
+  {
+    run.datagrams.shrink_to_fit();
+  }
+  run.end = file.position();
+  return run;
+}
+
+//========================================================
+/**
+ * @brief Looks up run run_index of a transfer, marking it most recently used
+ *
+ * @return The run or nullptr on a miss
+ */
+datagram_cache::run_ptr datagram_cache::find(const key_t &key, const size_t run_index)
+{
+  std::lock_guard<std::mutex> lock(_mutex);
+  const auto                  iter = _index.find(run_key_t{key, run_index});
+  if (iter == _index.end())
+  {
+    ++_stats.misses;
+    return nullptr;
+  }
+  ++_stats.hits;
+  _lru.splice(_lru.begin(), _lru, iter->second);
+  return iter->second->second;
+}
+
+//========================================================
+/**
+ * @brief Adds a run read after a miss and evicts least recently used runs to stay under the capacity
+ *
+ * Runs of older versions of the file are dropped. Runs that failed to read, or of a version older than the one
+ * cached, are handed back uncached.
+ *
+ * @return The cached run, which is the one another session inserted first if there was one
+ */
+datagram_cache::run_ptr datagram_cache::insert(const key_t &key, const size_t run_index, run_t run)
+{
+  const size_t bytes = run_bytes(run);
+  auto         ptr   = std::make_shared<const run_t>(std::move(run));
+  if (ptr->error)
+  {
+    return ptr;
+  }
+
+  std::lock_guard<std::mutex> lock(_mutex);
+  const file_id_t             id{key.file.dev, key.file.ino};
+  const auto                  file = _files.find(id);
+  if ((file != _files.end()) && !(file->second.version == key.file))
+  {
+    if (key.file.mtime_ns < file->second.version.mtime_ns)
+    {
+      return ptr;
+    }
+    invalidate(id);
+  }
+
+  const run_key_t run_key{key, run_index};
+  const auto      iter = _index.find(run_key);
+  if (iter != _index.end())
+  {
+    _lru.splice(_lru.begin(), _lru, iter->second);
+    return iter->second->second;
+  }
+  if (bytes > _capacity)
+  {
+    return ptr;
+  }
+
+  _lru.emplace_front(run_key, ptr);
+  _index.emplace(run_key, _lru.begin());
+  auto &entry   = _files[id];
+  entry.version = key.file;
+  ++entry.runs;
+  _stats.cached_bytes += bytes;
+  evict();
+  return ptr;
+}
+
+//========================================================
+size_t datagram_cache::capacity() const
+{
+  return _capacity;
+}
+
+//========================================================
+datagram_cache::stats_t datagram_cache::stats() const
+{
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _stats;
+}
+
+//========================================================
+size_t datagram_cache::run_bytes(const run_t &run)
+{
+  return run.datagrams.size() + run.end.overflow.size();
+}
+
+//========================================================
+/**
+ * @brief Removes a cached run, called with the lock held
+ */
+void datagram_cache::erase(const lru_list_t::iterator iter)
+{
+  const file_id_t id{iter->first.key.file.dev, iter->first.key.file.ino};
+  const auto      file = _files.find(id);
+  if ((file != _files.end()) && (--file->second.runs == 0))
+  {
+    _files.erase(file);
+  }
+  _stats.cached_bytes -= run_bytes(*iter->second);
+  _index.erase(iter->first);
+  _lru.erase(iter);
+}
+
+//========================================================
+/**
+ * @brief Drops every run of a file, called with the lock held when a newer version of it is inserted
+ */
+void datagram_cache::invalidate(const file_id_t &id)
+{
+  for (auto iter = _lru.begin(); iter != _lru.end();)
+  {
+    const auto current = iter++;
+    if ((current->first.key.file.dev == id.dev) && (current->first.key.file.ino == id.ino))
+    {
+      ++_stats.invalidations;
+      erase(current);
+    }
+  }
+}
+
+//========================================================
+/**
+ * @brief Drops least recently used runs until the cache is within its capacity, called with the lock held
+ */
+void datagram_cache::evict()
+{
+  while ((_stats.cached_bytes > _capacity) && !_lru.empty())
+  {
+    ++_stats.evictions;
+    erase(std::prev(_lru.end()));
+  }
+}
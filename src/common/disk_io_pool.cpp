@@ -0,0 +1,177 @@
+#include "common/disk_io_pool.hpp"
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <stdexcept>
+
+#include "common/debug_macros.hpp"
+#include "common/utils.hpp"
+
+//========================================================
+disk_io_pool::disk_io_pool(const size_t num_threads, const size_t max_queued) :
+    _max_queued(max_queued), _mutex(), _cv(), _jobs(), _stopping(false), _threads{}
+{
+  if (num_threads == 0)
+  {
+    throw std::invalid_argument("Number of disk I/O threads must be at least 1");
+  }
+  for (size_t i = 0; i < num_threads; ++i)
+  {
+    _threads.emplace_back(&disk_io_pool::run, this);
+  }
+}
+
+//========================================================
+disk_io_pool::~disk_io_pool()
+{
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stopping = true;
+  }
+  _cv.notify_all();
+  for (auto &thread : _threads)
+  {
+    thread.join();
+  }
+}
+
+//========================================================
+/**
+ * @brief Queues a job for the pool threads
+ *
+ * @return false if the queue is full, the job is not run
+ */
+bool disk_io_pool::try_submit(std::function<void()> job)
+{
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_stopping || (_jobs.size() >= _max_queued))
+    {
+      return false;
+    }
+    _jobs.push_back(std::move(job));
+  }
+  _cv.notify_one();
+  return true;
+}
+
+//========================================================
+size_t disk_io_pool::num_threads() const
+{
+  return _threads.size();
+}
+
+//========================================================
+void disk_io_pool::run()
+{
+  while (true)
+  {
+    std::function<void()> job;
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _cv.wait(lock, [this]() { return _stopping || !_jobs.empty(); });
+      if (_jobs.empty())
+      {
+        return;
+      }
+      job = std::move(_jobs.front());
+      _jobs.pop_front();
+    }
+    try
+    {
+      job();
+    }
+    catch (const std::exception &err)
+    {
+      dbg_err("Disk I/O job failed : {}", err.what());
+    }
+  }
+}
+
+//========================================================
+disk_io_channel::disk_io_channel(disk_io_pool &pool) :
+    _pool(pool), _event_fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)), _mutex(), _completions{}, _running{}
+{
+  if (_event_fd < 0)
+  {
+    throw std::runtime_error(utils::string_error(errno));
+  }
+}
+
+//========================================================
+disk_io_channel::~disk_io_channel()
+{
+  close(_event_fd);
+}
+
+//========================================================
+/**
+ * @brief Runs job on the pool, then queues on_complete to be run by run_completions()
+ *
+ * @return false if the pool's queue is full, neither is run
+ */
+bool disk_io_channel::submit(std::function<void()> job, std::function<void()> on_complete)
+{
+  return _pool.try_submit([this, job = std::move(job), on_complete = std::move(on_complete)]() mutable {
+    try
+    {
+      job();
+    }
+    catch (const std::exception &err)
+    {
+      dbg_err("Disk I/O job failed : {}", err.what());
+    }
+    post(std::move(on_complete));
+  });
+}
+
+//========================================================
+/**
+ * @brief eventfd that is readable while completions are queued
+ */
+int disk_io_channel::fd() const
+{
+  return _event_fd;
+}
+
+//========================================================
+/**
+ * @brief Runs the queued completions on the calling thread
+ *
+ * @return Number of completions run
+ */
+size_t disk_io_channel::run_completions()
+{
+  uint64_t count = 0;
+  if ((read(_event_fd, &count, sizeof(count)) < 0) && (errno != EAGAIN))
+  {
+    dbg_err("Failed to read disk I/O eventfd : {}", utils::string_error(errno));
+  }
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _running.swap(_completions);
+  }
+  for (auto &completion : _running)
+  {
+    completion();
+  }
+  const size_t ran = _running.size();
+  _running.clear();
+  return ran;
+}
+
+//========================================================
+void disk_io_channel::post(std::function<void()> completion)
+{
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _completions.push_back(std::move(completion));
+  }
+  const uint64_t one = 1;
+  if (write(_event_fd, &one, sizeof(one)) < 0)
+  {
+    dbg_err("Failed to signal disk I/O eventfd : {}", utils::string_error(errno));
+  }
+}
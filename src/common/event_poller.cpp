@@ -0,0 +1,189 @@
+#include "common/event_poller.hpp"
+
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "common/debug_macros.hpp"
+#include "common/uring_poller.hpp"
+#include "common/utils.hpp"
+
+namespace
+{
+  const char EPOLL_STR[]    = "EPOLL";
+  const char IO_URING_STR[] = "IO_URING";
+}; // namespace
+
+//========================================================
+/**
+ * @brief Creates a poller of the requested type, falling back to epoll if io_uring is not usable on this kernel
+ */
+std::unique_ptr<event_poller> event_poller::create(const backend_t backend, const size_t max_fds)
+{
+  if (backend == backend_t::IO_URING)
+  {
+    try
+    {
+      return std::make_unique<uring_poller>(max_fds);
+    }
+    catch (const std::exception &err)
+    {
+      dbg_warn("io_uring unavailable, falling back to epoll : {}", err.what());
+    }
+  }
+  return std::make_unique<epoll_poller>();
+}
+
+//========================================================
+/**
+ * @brief Has the poller receive the datagrams arriving on fd itself while fd is polled for EPOLLIN
+ *
+ * @return false if the backend only reports readiness, the caller then receives as usual
+ */
+bool event_poller::receive_datagrams(const int)
+{
+  return false;
+}
+
+//========================================================
+/**
+ * @brief Queues a send of a datagram on the connected socket fd, to go out with the next wait()
+ *
+ * @return false if the backend does not send, the caller then sends itself
+ */
+bool event_poller::queue_send(const int, const char *, const size_t)
+{
+  return false;
+}
+
+//========================================================
+/**
+ * @brief Queues a read of the file fd at offset into count buffers, to be submitted with the next wait()
+ *
+ * The completion is reported as an event carrying data. keep_alive is held until then, it must keep fd, the iovecs and
+ * the buffers they point to valid whatever the caller does in the meantime.
+ *
+ * @return false if the backend does not read files, the caller then reads itself
+ */
+bool event_poller::queue_read(const int, const struct iovec *, const size_t, const uint64_t, const uint64_t,
+                              std::shared_ptr<const void>)
+{
+  return false;
+}
+
+//========================================================
+std::optional<event_poller::backend_t> event_poller::string_to_backend(const std::string &name)
+{
+  std::string upper(name);
+  std::transform(upper.begin(), upper.end(), upper.begin(), ::toupper);
+  if (upper == EPOLL_STR)
+  {
+    return backend_t::EPOLL;
+  }
+  else if ((upper == IO_URING_STR) || (upper == "URING"))
+  {
+    return backend_t::IO_URING;
+  }
+  return {};
+}
+
+//========================================================
+std::string event_poller::backend_to_string(const backend_t backend)
+{
+  switch (backend)
+  {
+  case backend_t::EPOLL: {
+    return std::string(EPOLL_STR);
+  }
+  case backend_t::IO_URING: {
+    return std::string(IO_URING_STR);
+  }
+  default: {
+    return std::string("UNKNOWN");
+  }
+  }
+}
+
+//========================================================
+epoll_poller::epoll_poller() :
+    _epoll_fd(-1), _epoll_events{}
+{
+  _epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (_epoll_fd < 0)
+  {
+    dbg_err("Failed to create epoll : {}", utils::string_error(errno));
+    throw std::runtime_error("Failed to create epoll");
+  }
+}
+
+//========================================================
+epoll_poller::~epoll_poller()
+{
+  if (_epoll_fd > 0)
+  {
+    close(_epoll_fd);
+  }
+}
+
+//========================================================
+event_poller::backend_t epoll_poller::backend() const
+{
+  return backend_t::EPOLL;
+}
+
+//========================================================
+void epoll_poller::add(const int fd, const uint32_t events, const uint64_t data)
+{
+  struct epoll_event e = {0, {0}};
+  e.events             = events;
+  e.data.u64           = data;
+
+  if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, fd, &e) < 0)
+  {
+    dbg_err("epoll add failed : {}", utils::string_error(errno));
+    throw std::runtime_error("epoll add failed");
+  }
+}
+
+//========================================================
+void epoll_poller::modify(const int fd, const uint32_t events, const uint64_t data)
+{
+  struct epoll_event e = {0, {0}};
+  e.events             = events;
+  e.data.u64           = data;
+
+  if (epoll_ctl(_epoll_fd, EPOLL_CTL_MOD, fd, &e) < 0)
+  {
+    dbg_err("epoll mod failed : {}", utils::string_error(errno));
+    throw std::runtime_error("epoll mod failed");
+  }
+}
+
+//========================================================
+void epoll_poller::remove(const int fd)
+{
+  if (epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, fd, NULL) < 0)
+  {
+    dbg_err("epoll del failed : {}", utils::string_error(errno));
+    throw std::runtime_error("epoll del failed");
+  }
+}
+
+//========================================================
+/**
+ * @brief Waits for events, returns the number of events or -1 with errno set
+ */
+int epoll_poller::wait(event_t *events, const int max_events, const int timeout_ms)
+{
+  _epoll_events.resize(max_events);
+  const int num_events = epoll_wait(_epoll_fd, _epoll_events.data(), max_events, timeout_ms);
+  for (int i = 0; i < num_events; ++i)
+  {
+    events[i].events   = _epoll_events[i].events;
+    events[i].data     = _epoll_events[i].data.u64;
+    events[i].datagram = {};
+    events[i].result   = 0;
+  }
+  return num_events;
+}
@@ -0,0 +1,134 @@
+#include "common/file_cache.hpp"
+
+#include <functional>
+#include <stdexcept>
+
+//========================================================
+bool file_cache::key_t::operator==(const key_t &other) const
+{
+  return (dev == other.dev) && (ino == other.ino) && (mtime_ns == other.mtime_ns) && (size == other.size);
+}
+
+//========================================================
+bool file_cache::chunk_key_t::operator==(const chunk_key_t &other) const
+{
+  return (index == other.index) && (file == other.file);
+}
+
+//========================================================
+size_t file_cache::chunk_key_hash::operator()(const chunk_key_t &key) const
+{
+  size_t hash = std::hash<uint64_t>()(key.file.ino);
+  hash ^= std::hash<uint64_t>()(key.file.dev) + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+  hash ^= std::hash<int64_t>()(key.file.mtime_ns) + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+  hash ^= std::hash<size_t>()(key.index) + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+  return hash;
+}
+
+//========================================================
+file_cache::file_cache(const size_t capacity_bytes, const size_t chunk_size) :
+    _capacity(capacity_bytes), _chunk_size(chunk_size), _mutex(), _lru(), _index(), _stats{0, 0, 0, 0, 0}
+{
+  if (chunk_size == 0)
+  {
+    throw std::invalid_argument("Chunk size must be at least 1");
+  }
+}
+
+//========================================================
+/**
+ * @brief Builds the cache key of a file from its stat() result
+ */
+file_cache::key_t file_cache::make_key(const struct stat &st)
+{
+  const int64_t mtime_ns = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+  return key_t{st.st_dev, st.st_ino, mtime_ns, static_cast<uint64_t>(st.st_size)};
+}
+
+//========================================================
+/**
+ * @brief Looks up chunk index (offset index * chunk_size()) of a file, marking it most recently used
+ *
+ * @return The chunk or nullptr on a miss
+ */
+file_cache::chunk_ptr file_cache::find(const key_t &key, const size_t index)
+{
+  std::lock_guard<std::mutex> lock(_mutex);
+  const auto                  iter = _index.find(chunk_key_t{key, index});
+  if (iter == _index.end())
+  {
+    ++_stats.misses;
+    return nullptr;
+  }
+  ++_stats.hits;
+  _lru.splice(_lru.begin(), _lru, iter->second);
+  return iter->second->second;
+}
+
+//========================================================
+/**
+ * @brief Adds a chunk read from disk after a miss and evicts least recently used chunks to stay under the capacity
+ *
+ * @return The cached chunk, which is the one another reader inserted first if there was one
+ */
+file_cache::chunk_ptr file_cache::insert(const key_t &key, const size_t index, std::vector<char> data)
+{
+  const size_t bytes = data.size();
+  auto         chunk = std::make_shared<const std::vector<char>>(std::move(data));
+
+  std::lock_guard<std::mutex> lock(_mutex);
+  _stats.disk_read_bytes += bytes;
+  const chunk_key_t chunk_key{key, index};
+  const auto        iter = _index.find(chunk_key);
+  if (iter != _index.end())
+  {
+    _lru.splice(_lru.begin(), _lru, iter->second);
+    return iter->second->second;
+  }
+  if (bytes > _capacity)
+  {
+    // Never fits, hand it to the reader uncached
+    return chunk;
+  }
+
+  _lru.emplace_front(chunk_key, chunk);
+  _index.emplace(chunk_key, _lru.begin());
+  _stats.cached_bytes += bytes;
+  evict();
+  return chunk;
+}
+
+//========================================================
+/**
+ * @brief Drops least recently used chunks until the cache is within its capacity, called with the lock held
+ */
+void file_cache::evict()
+{
+  while ((_stats.cached_bytes > _capacity) && !_lru.empty())
+  {
+    const auto &oldest = _lru.back();
+    _stats.cached_bytes -= oldest.second->size();
+    ++_stats.evictions;
+    _index.erase(oldest.first);
+    _lru.pop_back();
+  }
+}
+
+//========================================================
+size_t file_cache::chunk_size() const
+{
+  return _chunk_size;
+}
+
+//========================================================
+size_t file_cache::capacity() const
+{
+  return _capacity;
+}
+
+//========================================================
+file_cache::stats_t file_cache::stats() const
+{
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _stats;
+}
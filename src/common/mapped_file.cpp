@@ -0,0 +1,214 @@
+#include "common/mapped_file.hpp"
+
+#include <fcntl.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+
+#include "common/utils.hpp"
+
+namespace
+{
+  // Where a copy out of a mapping on this thread jumps to if it faults, null when no copy is under way. Volatile as
+  // only the signal handler reads it, the stores around the copy must not be optimised away
+  thread_local sigjmp_buf *volatile fault_jump = nullptr;
+  struct sigaction         previous_sigbus;
+
+  void on_sigbus(int signum, siginfo_t *info, void *context)
+  {
+    if (fault_jump != nullptr)
+    {
+      siglongjmp(*fault_jump, 1);
+    }
+    // Not ours, hand the fault on to whoever handled it before, or to the default action
+    if ((previous_sigbus.sa_flags & SA_SIGINFO) != 0)
+    {
+      previous_sigbus.sa_sigaction(signum, info, context);
+      return;
+    }
+    if ((previous_sigbus.sa_handler == SIG_DFL) || (previous_sigbus.sa_handler == SIG_IGN))
+    {
+      // The faulting access runs again on return and is then handled the default way
+      sigaction(SIGBUS, &previous_sigbus, nullptr);
+      return;
+    }
+    previous_sigbus.sa_handler(signum);
+  }
+
+  void install_sigbus_handler()
+  {
+    static std::once_flag installed;
+    std::call_once(installed, []() {
+      struct sigaction action;
+      std::memset(&action, 0, sizeof(action));
+      action.sa_sigaction = on_sigbus;
+      // SA_NODEFER leaves SIGBUS unblocked after jumping out of the handler without saving the signal mask
+      action.sa_flags = SA_SIGINFO | SA_NODEFER;
+      sigemptyset(&action.sa_mask);
+      sigaction(SIGBUS, &action, &previous_sigbus);
+    });
+  }
+
+  /**
+   * @brief memcpy() that returns false rather than dying if the source is a mapping of a file that has shrunk
+   */
+  bool guarded_copy(char *dest, const char *src, const size_t size_bytes)
+  {
+    sigjmp_buf jump;
+    if (sigsetjmp(jump, 0) != 0)
+    {
+      fault_jump = nullptr;
+      return false;
+    }
+    fault_jump = &jump;
+    std::memcpy(dest, src, size_bytes);
+    fault_jump = nullptr;
+    return true;
+  }
+} // namespace
+
+//========================================================
+mapped_file::mapped_file() :
+    _open(false), _data(nullptr), _size(0)
+{
+}
+
+//========================================================
+mapped_file::mapped_file(const std::string &filename) :
+    _open(false), _data(nullptr), _size(0)
+{
+  open(filename);
+}
+
+//========================================================
+mapped_file::~mapped_file()
+{
+  if (_data != nullptr)
+  {
+    munmap(const_cast<char *>(_data), _size);
+  }
+}
+
+//========================================================
+void mapped_file::open(const std::string &filename)
+{
+  if (is_open())
+  {
+    throw std::logic_error("File is already mapped");
+  }
+
+  const int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+  {
+    throw std::runtime_error(utils::string_error(errno));
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) < 0)
+  {
+    const int err = errno;
+    close(fd);
+    throw std::runtime_error(utils::string_error(err));
+  }
+
+  try
+  {
+    open(fd, static_cast<size_t>(st.st_size));
+  }
+  catch (const std::exception &)
+  {
+    close(fd);
+    throw;
+  }
+  // The mapping keeps the file open
+  close(fd);
+}
+
+//========================================================
+/**
+ * @brief Maps the first size_bytes of an open file, the descriptor stays the caller's and may be closed straight away
+ */
+void mapped_file::open(const int fd, const size_t size_bytes)
+{
+  if (is_open())
+  {
+    throw std::logic_error("File is already mapped");
+  }
+
+  _open = true;
+  _size = size_bytes;
+  if (_size == 0)
+  {
+    return;
+  }
+
+  void *addr = mmap(nullptr, _size, PROT_READ, MAP_SHARED, fd, 0);
+  if (addr == MAP_FAILED)
+  {
+    const int err = errno;
+    _open         = false;
+    _size         = 0;
+    throw std::runtime_error(utils::string_error(err));
+  }
+  _data = static_cast<const char *>(addr);
+  // Transfers read the file front to back
+  madvise(addr, _size, MADV_SEQUENTIAL);
+  install_sigbus_handler();
+}
+
+//========================================================
+bool mapped_file::is_open() const
+{
+  return _open;
+}
+
+//========================================================
+const char *mapped_file::data() const
+{
+  return _data;
+}
+
+//========================================================
+size_t mapped_file::size() const
+{
+  return _size;
+}
+
+//========================================================
+/**
+ * @brief Starts the kernel reading size_bytes of the mapping from offset in the background
+ */
+void mapped_file::prefetch(const size_t offset, const size_t size_bytes) const
+{
+  if (offset >= _size)
+  {
+    return;
+  }
+  static const size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  const size_t        start     = offset - (offset % page_size);
+  const size_t        end       = std::min(_size, offset + size_bytes);
+  // Only advice, failing it is harmless
+  (void)madvise(const_cast<char *>(_data) + start, end - start, MADV_WILLNEED);
+}
+
+//========================================================
+/**
+ * @brief Copies size_bytes of the mapping from offset into dest
+ *
+ * @return False if the range is not in the mapping or the file no longer covers it, dest is then partly written
+ */
+bool mapped_file::copy_out(char *dest, const size_t offset, const size_t size_bytes) const
+{
+  if ((offset > _size) || (size_bytes > _size - offset))
+  {
+    return false;
+  }
+  return (size_bytes == 0) || guarded_copy(dest, _data + offset, size_bytes);
+}
@@ -0,0 +1,361 @@
+#include "common/metadata_cache.hpp"
+
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <stdexcept>
+#include <system_error>
+
+#include "common/rtt_estimator.hpp"
+#include "common/utils.hpp"
+
+namespace
+{
+  const uint32_t WATCH_MASK = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_MODIFY | IN_ATTRIB |
+                              IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+
+  /**
+   * @brief The path a request for filename names, before symbolic links are resolved
+   */
+  std::filesystem::path lexical_path(const std::filesystem::path &root, const std::string &filename)
+  {
+    return (root / std::filesystem::path(filename)).lexically_normal();
+  }
+
+  std::shared_ptr<metadata_cache::entry_t> resolve_entry(const std::filesystem::path &root,
+                                                         const std::string &filename, const bool open_file)
+  {
+    auto       entry = std::make_shared<metadata_cache::entry_t>();
+    const auto path  = root / std::filesystem::path(filename);
+    std::error_code error;
+    entry->canonical = std::filesystem::weakly_canonical(path, error);
+    if (error)
+    {
+      entry->canonical = path.lexically_normal();
+    }
+    entry->in_root     = utils::is_subpath(entry->canonical, root);
+    entry->resolved_us = rtt_estimator::steady_clock_us();
+
+    struct stat st;
+    if (stat(entry->canonical.c_str(), &st) < 0)
+    {
+      return entry;
+    }
+    entry->exists  = true;
+    entry->regular = S_ISREG(st.st_mode);
+    if (open_file && entry->in_root && entry->regular)
+    {
+      // Size and key then describe the file the descriptor refers to, even if the path changes meanwhile
+      entry->fd = ::open(entry->canonical.c_str(), O_RDONLY | O_CLOEXEC);
+      if ((entry->fd >= 0) && (fstat(entry->fd, &st) < 0))
+      {
+        ::close(entry->fd);
+        entry->fd = -1;
+      }
+    }
+    entry->size = static_cast<uint64_t>(st.st_size);
+    entry->key  = file_cache::make_key(st);
+    return entry;
+  }
+} // namespace
+
+//========================================================
+metadata_cache::entry_t::entry_t() :
+    canonical(), in_root(false), exists(false), regular(false), size(0), key{}, fd(-1), resolved_us(0), watched(false)
+{
+}
+
+//========================================================
+metadata_cache::entry_t::~entry_t()
+{
+  if (fd >= 0)
+  {
+    ::close(fd);
+  }
+}
+
+//========================================================
+metadata_cache::metadata_cache(const std::filesystem::path &root, const size_t max_entries, const uint32_t ttl_ms,
+                               const bool use_inotify) :
+    _root(std::filesystem::weakly_canonical(std::filesystem::absolute(root))),
+    _max_entries(max_entries),
+    _ttl_us(static_cast<uint64_t>(ttl_ms) * 1000),
+    _inotify_fd(-1),
+    _mutex(),
+    _lru(),
+    _index(),
+    _watches(),
+    _watched_dirs(),
+    _generation(0),
+    _stats{0, 0, 0, 0, 0}
+{
+  if (max_entries == 0)
+  {
+    throw std::invalid_argument("Metadata cache must hold at least 1 entry");
+  }
+  if (use_inotify)
+  {
+    // Without inotify every entry is simply resolved again after ttl_ms
+    _inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  }
+}
+
+//========================================================
+metadata_cache::~metadata_cache()
+{
+  if (_inotify_fd >= 0)
+  {
+    ::close(_inotify_fd);
+  }
+}
+
+//========================================================
+/**
+ * @brief Resolves a requested filename against root without caching it, or opening it
+ */
+metadata_cache::entry_ptr metadata_cache::resolve(const std::filesystem::path &root, const std::string &filename)
+{
+  return resolve_entry(std::filesystem::absolute(root), filename, false);
+}
+
+//========================================================
+/**
+ * @brief Path to open the file an entry describes through its descriptor, or filename if it has none
+ *
+ * Opening it opens the very file that was checked, even if the name has been pointed at another file since.
+ */
+std::string metadata_cache::open_path(const entry_t &entry, const std::string &filename)
+{
+  static const bool proc_fd = access("/proc/self/fd", X_OK) == 0;
+  if ((entry.fd < 0) || !proc_fd)
+  {
+    return filename;
+  }
+  return "/proc/self/fd/" + std::to_string(entry.fd);
+}
+
+//========================================================
+/**
+ * @brief Returns what is known about a requested filename, relative to the root, resolving it on a miss
+ */
+metadata_cache::entry_ptr metadata_cache::lookup(const std::string &filename)
+{
+  const auto lexical    = lexical_path(_root, filename);
+  uint64_t   generation = 0;
+  bool       watched    = false;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    apply_events();
+    const auto iter = _index.find(filename);
+    if (iter != _index.end())
+    {
+      const auto &entry = *iter->second->second;
+      if (entry.watched || ((rtt_estimator::steady_clock_us() - entry.resolved_us) < _ttl_us))
+      {
+        ++_stats.hits;
+        _lru.splice(_lru.begin(), _lru, iter->second);
+        return iter->second->second;
+      }
+      erase(iter->second);
+    }
+    ++_stats.misses;
+    generation = _generation;
+    // Watch before resolving so a change made while resolving is not missed
+    if ((_inotify_fd >= 0) && utils::is_subpath(lexical, _root))
+    {
+      watched = watch(lexical);
+    }
+  }
+
+  auto entry     = resolve_entry(_root, filename, true);
+  entry->watched = watched && (entry->canonical == lexical);
+
+  std::lock_guard<std::mutex> lock(_mutex);
+  apply_events();
+  if (generation != _generation)
+  {
+    // Something changed while the path was resolved, the entry may already be stale
+    return entry;
+  }
+  const auto iter = _index.find(filename);
+  if (iter != _index.end())
+  {
+    _lru.splice(_lru.begin(), _lru, iter->second);
+    return iter->second->second;
+  }
+  _lru.emplace_front(filename, entry);
+  _index.emplace(filename, _lru.begin());
+  evict();
+  return entry;
+}
+
+//========================================================
+/**
+ * @brief Drops the entry of a requested filename, for a file the server itself is creating or changing
+ */
+void metadata_cache::invalidate(const std::string &filename)
+{
+  std::lock_guard<std::mutex> lock(_mutex);
+  ++_generation;
+  const auto iter = _index.find(filename);
+  if (iter != _index.end())
+  {
+    ++_stats.invalidations;
+    erase(iter->second);
+  }
+}
+
+//========================================================
+/**
+ * @brief Drops every entry
+ */
+void metadata_cache::clear()
+{
+  std::lock_guard<std::mutex> lock(_mutex);
+  ++_generation;
+  _stats.invalidations += _lru.size();
+  _lru.clear();
+  _index.clear();
+}
+
+//========================================================
+/**
+ * @brief True if entries are kept up to date with inotify
+ */
+bool metadata_cache::watching() const
+{
+  return _inotify_fd >= 0;
+}
+
+//========================================================
+metadata_cache::stats_t metadata_cache::stats() const
+{
+  std::lock_guard<std::mutex> lock(_mutex);
+  auto                        stats = _stats;
+  stats.entries                     = _lru.size();
+  return stats;
+}
+
+//========================================================
+/**
+ * @brief Watches the existing directories from the root down to the parent of path, called with the lock held
+ *
+ * A directory that does not exist yet is created in a watched one, which is reported as well.
+ *
+ * @return False if a directory could not be watched
+ */
+bool metadata_cache::watch(const std::filesystem::path &path)
+{
+  for (auto dir = path.parent_path(); utils::is_subpath(dir, _root); dir = dir.parent_path())
+  {
+    if (_watched_dirs.find(dir.native()) == _watched_dirs.end())
+    {
+      const int wd = inotify_add_watch(_inotify_fd, dir.c_str(), WATCH_MASK);
+      if (wd >= 0)
+      {
+        _watches[wd] = dir;
+        _watched_dirs.emplace(dir.native(), wd);
+      }
+      else if ((errno != ENOENT) && (errno != ENOTDIR))
+      {
+        return false;
+      }
+    }
+    if ((dir == _root) || (dir == dir.parent_path()))
+    {
+      break;
+    }
+  }
+  return true;
+}
+
+//========================================================
+/**
+ * @brief Drops the entries pending inotify events are about, called with the lock held
+ */
+void metadata_cache::apply_events()
+{
+  if (_inotify_fd < 0)
+  {
+    return;
+  }
+  alignas(struct inotify_event) char buffer[4096];
+  ssize_t                            len;
+  while ((len = read(_inotify_fd, buffer, sizeof(buffer))) > 0)
+  {
+    ++_generation;
+    for (ssize_t offset = 0; offset < len;)
+    {
+      const auto *event = reinterpret_cast<const struct inotify_event *>(buffer + offset);
+      offset += sizeof(struct inotify_event) + event->len;
+      if ((event->mask & IN_Q_OVERFLOW) != 0)
+      {
+        // Events were lost, nothing cached can be trusted
+        _stats.invalidations += _lru.size();
+        _lru.clear();
+        _index.clear();
+        continue;
+      }
+      const auto dir = _watches.find(event->wd);
+      if (dir == _watches.end())
+      {
+        continue;
+      }
+      if ((event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) != 0)
+      {
+        // The watch no longer follows that path, it is watched afresh by the next lookup under it
+        invalidate_under(dir->second);
+        if ((event->mask & IN_IGNORED) == 0)
+        {
+          (void)inotify_rm_watch(_inotify_fd, event->wd);
+        }
+        _watched_dirs.erase(dir->second.native());
+        _watches.erase(dir);
+        continue;
+      }
+      invalidate_under((event->len > 0) ? (dir->second / event->name) : dir->second);
+    }
+  }
+}
+
+//========================================================
+/**
+ * @brief Drops the entries for path and, if it is a directory, for everything in it, called with the lock held
+ */
+void metadata_cache::invalidate_under(const std::filesystem::path &path)
+{
+  for (auto iter = _lru.begin(); iter != _lru.end();)
+  {
+    const auto current = iter++;
+    if (utils::is_subpath(current->second->canonical, path))
+    {
+      ++_stats.invalidations;
+      erase(current);
+    }
+  }
+}
+
+//========================================================
+/**
+ * @brief Removes a cached entry, called with the lock held
+ */
+void metadata_cache::erase(const lru_list_t::iterator iter)
+{
+  _index.erase(iter->first);
+  _lru.erase(iter);
+}
+
+//========================================================
+/**
+ * @brief Drops least recently used entries until there are at most max_entries, called with the lock held
+ */
+void metadata_cache::evict()
+{
+  while (_lru.size() > _max_entries)
+  {
+    ++_stats.evictions;
+    erase(std::prev(_lru.end()));
+  }
+}
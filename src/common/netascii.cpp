@@ -0,0 +1,436 @@
+#include "common/netascii.hpp"
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define NETASCII_X86 1
+#endif
+
+namespace
+{
+  const char CR  = 0x0D;
+  const char LF  = 0x0A;
+  const char NUL = 0x00;
+
+  [[noreturn]] void throw_cr_without_lf()
+  {
+    throw std::runtime_error("Invalid character sequence : CR with no LF or NULL");
+  }
+
+  [[noreturn]] void throw_eol_after_cr()
+  {
+    throw std::runtime_error("Invalid character sequence : EOL after CR");
+  }
+
+  //========================================================
+  size_t encode_scalar(const char *src, const size_t size, char *dest)
+  {
+    char *out = dest;
+    for (size_t i = 0; i < size; ++i)
+    {
+      const char c = src[i];
+      if (c == LF)
+      {
+        *out++ = CR;
+        *out++ = LF;
+      }
+      else if (c == CR)
+      {
+        *out++ = CR;
+        *out++ = NUL;
+      }
+      else
+      {
+        *out++ = c;
+      }
+    }
+    return out - dest;
+  }
+
+  //========================================================
+  size_t decode_scalar(const char *src, const size_t size, char *dest)
+  {
+    char  *out = dest;
+    size_t i   = 0;
+    while (i < size)
+    {
+      const char c = src[i];
+      if (c != CR)
+      {
+        *out++ = c;
+        ++i;
+        continue;
+      }
+      if (i + 1 >= size)
+      {
+        throw_eol_after_cr();
+      }
+      // CR NUL to CR, CR LF to LF
+      const char next = src[i + 1];
+      if ((next != NUL) && (next != LF))
+      {
+        throw_cr_without_lf();
+      }
+      *out++ = (next == NUL) ? CR : LF;
+      i += 2;
+    }
+    return out - dest;
+  }
+
+#ifdef NETASCII_X86
+  //========================================================
+  /**
+   * Blocks are stored whole before looking at where the first CR / LF is, which is safe as long as the output has
+   * room for 16 bytes: encoded output is at most twice the input consumed so far.
+   */
+  size_t encode_sse2(const char *src, const size_t size, char *dest)
+  {
+    const __m128i cr  = _mm_set1_epi8(CR);
+    const __m128i lf  = _mm_set1_epi8(LF);
+    char         *out = dest;
+    size_t        i   = 0;
+    while (i + 16 <= size)
+    {
+      const __m128i v    = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+      const int     mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, lf)));
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(out), v);
+      if (mask == 0)
+      {
+        i += 16;
+        out += 16;
+        continue;
+      }
+      const int run = __builtin_ctz(mask);
+      i += run;
+      out += run;
+      out[0] = CR;
+      out[1] = (src[i] == LF) ? LF : NUL;
+      out += 2;
+      ++i;
+    }
+    return (out - dest) + encode_scalar(src + i, size - i, out);
+  }
+
+  //========================================================
+  size_t decode_sse2(const char *src, const size_t size, char *dest)
+  {
+    const __m128i cr  = _mm_set1_epi8(CR);
+    char         *out = dest;
+    size_t        i   = 0;
+    while (i + 16 <= size)
+    {
+      const __m128i v    = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+      const int     mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, cr));
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(out), v);
+      if (mask == 0)
+      {
+        i += 16;
+        out += 16;
+        continue;
+      }
+      const int run = __builtin_ctz(mask);
+      i += run;
+      out += run;
+      if (i + 1 >= size)
+      {
+        throw_eol_after_cr();
+      }
+      const char next = src[i + 1];
+      if ((next != NUL) && (next != LF))
+      {
+        throw_cr_without_lf();
+      }
+      *out++ = (next == NUL) ? CR : LF;
+      i += 2;
+    }
+    return (out - dest) + decode_scalar(src + i, size - i, out);
+  }
+
+  /**
+   * @brief pshufb controls for 8 byte groups indexed by the bit mask of CR / LF (expand) or of dropped bytes (contract)
+   */
+  struct shuffle_tables_t
+  {
+    // Each flagged byte is duplicated, first_copy marks the first of each pair
+    std::array<std::array<uint8_t, 16>, 256> expand;
+    std::array<std::array<uint8_t, 16>, 256> first_copy;
+    // Flagged bytes are removed, the rest packed to the front
+    std::array<std::array<uint8_t, 16>, 256> contract;
+  };
+
+  const shuffle_tables_t &shuffle_tables()
+  {
+    static const shuffle_tables_t tables = []() {
+      shuffle_tables_t t;
+      for (int mask = 0; mask < 256; ++mask)
+      {
+        t.expand[mask].fill(0x80);
+        t.first_copy[mask].fill(0);
+        t.contract[mask].fill(0x80);
+        size_t expanded   = 0;
+        size_t contracted = 0;
+        for (uint8_t j = 0; j < 8; ++j)
+        {
+          if (mask & (1 << j))
+          {
+            t.first_copy[mask][expanded] = 0xFF;
+            t.expand[mask][expanded++]   = j;
+          }
+          else
+          {
+            t.contract[mask][contracted++] = j;
+          }
+          t.expand[mask][expanded++] = j;
+        }
+      }
+      return t;
+    }();
+    return tables;
+  }
+
+  //========================================================
+  bool cpu_has_avx2()
+  {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+  }
+
+  //========================================================
+  /**
+   * Groups of 8 bytes containing CR / LF are expanded with one shuffle that duplicates those bytes. The first byte of
+   * each pair then becomes CR, the second stays LF or becomes NUL if it was a CR.
+   */
+  __attribute__((target("avx2"))) size_t encode_avx2(const char *src, const size_t size, char *dest)
+  {
+    const shuffle_tables_t &tables = shuffle_tables();
+    const __m256i           cr     = _mm256_set1_epi8(CR);
+    const __m256i           lf     = _mm256_set1_epi8(LF);
+    const __m128i           cr128  = _mm_set1_epi8(CR);
+    char                   *out    = dest;
+    size_t                  i      = 0;
+    while (i + 32 <= size)
+    {
+      const __m256i  v    = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+      const uint32_t mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, cr), _mm256_cmpeq_epi8(v, lf)));
+      if (mask == 0)
+      {
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out), v);
+        i += 32;
+        out += 32;
+        continue;
+      }
+      for (int group = 0; group < 4; ++group)
+      {
+        const uint8_t group_mask = (mask >> (group * 8)) & 0xFF;
+        const __m128i bytes      = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(src + i + group * 8));
+        if (group_mask == 0)
+        {
+          _mm_storel_epi64(reinterpret_cast<__m128i *>(out), bytes);
+          out += 8;
+          continue;
+        }
+        const __m128i control = _mm_loadu_si128(reinterpret_cast<const __m128i *>(tables.expand[group_mask].data()));
+        const __m128i first   = _mm_loadu_si128(reinterpret_cast<const __m128i *>(tables.first_copy[group_mask].data()));
+        const __m128i second  = _mm_slli_si128(first, 1);
+        __m128i       result  = _mm_shuffle_epi8(bytes, control);
+        result                = _mm_or_si128(_mm_andnot_si128(first, result), _mm_and_si128(first, cr128));
+        result                = _mm_andnot_si128(_mm_and_si128(second, _mm_cmpeq_epi8(result, cr128)), result);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out), result);
+        out += 8 + __builtin_popcount(group_mask);
+      }
+      i += 32;
+    }
+    return (out - dest) + encode_sse2(src + i, size - i, out);
+  }
+
+  //========================================================
+  /**
+   * A CR is dropped when followed by LF, a NUL is dropped when preceded by CR. Groups of 8 bytes with dropped bytes
+   * are packed with one shuffle. Blocks are only handled here if the byte after them can be looked at, a CR NUL pair
+   * straddling two blocks skips the NUL at the start of the next block.
+   */
+  __attribute__((target("avx2"))) size_t decode_avx2(const char *src, const size_t size, char *dest)
+  {
+    const shuffle_tables_t &tables = shuffle_tables();
+    const __m256i           cr     = _mm256_set1_epi8(CR);
+    const __m256i           lf     = _mm256_set1_epi8(LF);
+    const __m256i           nul    = _mm256_setzero_si256();
+    char                   *out    = dest;
+    size_t                  i      = 0;
+    while (i + 33 <= size)
+    {
+      const __m256i  v       = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+      const uint32_t cr_mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, cr));
+      if (cr_mask == 0)
+      {
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out), v);
+        i += 32;
+        out += 32;
+        continue;
+      }
+      const __m256i  next     = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i + 1));
+      const uint32_t next_lf  = _mm256_movemask_epi8(_mm256_cmpeq_epi8(next, lf));
+      const uint32_t next_nul = _mm256_movemask_epi8(_mm256_cmpeq_epi8(next, nul));
+      if (cr_mask & ~(next_lf | next_nul))
+      {
+        throw_cr_without_lf();
+      }
+      const uint32_t cr_nul = cr_mask & next_nul;
+      const uint32_t drop   = (cr_mask & next_lf) | (cr_nul << 1);
+      for (int group = 0; group < 4; ++group)
+      {
+        const uint8_t group_drop = (drop >> (group * 8)) & 0xFF;
+        const __m128i bytes      = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(src + i + group * 8));
+        const __m128i control = _mm_loadu_si128(reinterpret_cast<const __m128i *>(tables.contract[group_drop].data()));
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(out), _mm_shuffle_epi8(bytes, control));
+        out += 8 - __builtin_popcount(group_drop);
+      }
+      // The NUL of a CR NUL pair ending the block
+      i += (cr_nul & 0x80000000) ? 33 : 32;
+    }
+    return (out - dest) + decode_sse2(src + i, size - i, out);
+  }
+#endif
+
+  using kernel_fn = size_t (*)(const char *, const size_t, char *);
+
+  kernel_fn encode_kernel(const netascii::isa_t isa)
+  {
+    switch (isa)
+    {
+#ifdef NETASCII_X86
+    case netascii::isa_t::AVX2:
+      return encode_avx2;
+    case netascii::isa_t::SSE2:
+      return encode_sse2;
+#else
+    case netascii::isa_t::AVX2:
+    case netascii::isa_t::SSE2:
+#endif
+    case netascii::isa_t::SCALAR:
+    default:
+      return encode_scalar;
+    }
+  }
+
+  kernel_fn decode_kernel(const netascii::isa_t isa)
+  {
+    switch (isa)
+    {
+#ifdef NETASCII_X86
+    case netascii::isa_t::AVX2:
+      return decode_avx2;
+    case netascii::isa_t::SSE2:
+      return decode_sse2;
+#else
+    case netascii::isa_t::AVX2:
+    case netascii::isa_t::SSE2:
+#endif
+    case netascii::isa_t::SCALAR:
+    default:
+      return decode_scalar;
+    }
+  }
+}; // namespace
+
+//========================================================
+/**
+ * @brief Best implementation supported by this CPU, decided once
+ */
+netascii::isa_t netascii::active_isa()
+{
+  static const isa_t isa = isa_supported(isa_t::AVX2) ? isa_t::AVX2
+                           : isa_supported(isa_t::SSE2) ? isa_t::SSE2
+                                                        : isa_t::SCALAR;
+  return isa;
+}
+
+//========================================================
+bool netascii::isa_supported(const isa_t isa)
+{
+  switch (isa)
+  {
+#ifdef NETASCII_X86
+  case isa_t::AVX2:
+    return cpu_has_avx2();
+  case isa_t::SSE2:
+    return true;
+#else
+  case isa_t::AVX2:
+  case isa_t::SSE2:
+    return false;
+#endif
+  case isa_t::SCALAR:
+  default:
+    return true;
+  }
+}
+
+//========================================================
+std::string netascii::isa_to_string(const isa_t isa)
+{
+  switch (isa)
+  {
+  case isa_t::AVX2:
+    return "avx2";
+  case isa_t::SSE2:
+    return "sse2";
+  case isa_t::SCALAR:
+  default:
+    return "scalar";
+  }
+}
+
+//========================================================
+/**
+ * @brief Encodes native text as netascii, dest must have room for max_encoded_size(size) bytes
+ *
+ * @return The number of bytes written to dest
+ */
+size_t netascii::encode(const char *src, const size_t size, char *dest)
+{
+  static const kernel_fn kernel = encode_kernel(active_isa());
+  return kernel(src, size, dest);
+}
+
+//========================================================
+/**
+ * @brief Decodes netascii to native text, dest must have room for size bytes
+ *
+ * @return The number of bytes written to dest
+ */
+size_t netascii::decode(const char *src, const size_t size, char *dest)
+{
+  static const kernel_fn kernel = decode_kernel(active_isa());
+  return kernel(src, size, dest);
+}
+
+//========================================================
+/**
+ * @brief encode() with a given implementation, which must be supported by the CPU
+ */
+size_t netascii::encode(const isa_t isa, const char *src, const size_t size, char *dest)
+{
+  if (!isa_supported(isa))
+  {
+    throw std::invalid_argument("Unsupported instruction set");
+  }
+  return encode_kernel(isa)(src, size, dest);
+}
+
+//========================================================
+/**
+ * @brief decode() with a given implementation, which must be supported by the CPU
+ */
+size_t netascii::decode(const isa_t isa, const char *src, const size_t size, char *dest)
+{
+  if (!isa_supported(isa))
+  {
+    throw std::invalid_argument("Unsupported instruction set");
+  }
+  return decode_kernel(isa)(src, size, dest);
+}
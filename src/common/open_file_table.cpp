@@ -0,0 +1,134 @@
+#include "common/open_file_table.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <functional>
+#include <stdexcept>
+
+#include "common/utils.hpp"
+
+//========================================================
+open_file_table::open_file_t::open_file_t(const int descriptor, const struct stat &st) :
+    fd(descriptor), dev(st.st_dev), ino(st.st_ino)
+{
+}
+
+//========================================================
+open_file_table::open_file_t::~open_file_t()
+{
+  ::close(fd);
+}
+
+//========================================================
+bool open_file_table::file_id_t::operator==(const file_id_t &other) const
+{
+  return (dev == other.dev) && (ino == other.ino);
+}
+
+//========================================================
+size_t open_file_table::file_id_hash::operator()(const file_id_t &id) const
+{
+  size_t hash = std::hash<uint64_t>()(id.ino);
+  hash ^= std::hash<uint64_t>()(id.dev) + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+  return hash;
+}
+
+//========================================================
+open_file_table::open_file_table() : _state(std::make_shared<state_t>())
+{
+  _state->stats = stats_t{0, 0, 0};
+}
+
+//========================================================
+/**
+ * @brief Opens filename read only for a single reader, filling st with the stat() of what was opened
+ */
+open_file_table::file_ptr open_file_table::open(const std::string &filename, struct stat &st)
+{
+  return std::make_shared<const open_file_t>(open_descriptor(filename, st), st);
+}
+
+//========================================================
+/**
+ * @brief Returns a descriptor for filename, the one already open for its inode if there is one
+ *
+ * st is filled with the stat() of the file the descriptor refers to.
+ */
+open_file_table::file_ptr open_file_table::acquire(const std::string &filename, struct stat &st)
+{
+  if (stat(filename.c_str(), &st) == 0)
+  {
+    std::lock_guard<std::mutex> lock(_state->mutex);
+    const auto                  iter = _state->files.find(file_id_t{st.st_dev, st.st_ino});
+    if (iter != _state->files.end())
+    {
+      auto file = iter->second.lock();
+      if (file)
+      {
+        ++_state->stats.shares;
+        return file;
+      }
+    }
+  }
+
+  // Opened outside the lock, fstat() of the descriptor says which file it really is
+  const int fd = open_descriptor(filename, st);
+  file_ptr  file;
+  {
+    std::lock_guard<std::mutex> lock(_state->mutex);
+    auto                       &slot = _state->files[file_id_t{st.st_dev, st.st_ino}];
+    file                             = slot.lock();
+    if (!file)
+    {
+      const auto state = _state;
+      file             = file_ptr(new open_file_t(fd, st), [state](const open_file_t *released) {
+        {
+          std::lock_guard<std::mutex> released_lock(state->mutex);
+          const auto                  iter = state->files.find(file_id_t{released->dev, released->ino});
+          if ((iter != state->files.end()) && iter->second.expired())
+          {
+            state->files.erase(iter);
+          }
+          --state->stats.open_files;
+        }
+        delete released;
+      });
+      slot = file;
+      ++_state->stats.opens;
+      ++_state->stats.open_files;
+      return file;
+    }
+    ++_state->stats.shares;
+  }
+  // Another reader opened it meanwhile, theirs is shared
+  ::close(fd);
+  return file;
+}
+
+//========================================================
+open_file_table::stats_t open_file_table::stats() const
+{
+  std::lock_guard<std::mutex> lock(_state->mutex);
+  return _state->stats;
+}
+
+//========================================================
+/**
+ * @brief Opens filename read only and fills st with the stat() of the descriptor, throws if either fails
+ */
+int open_file_table::open_descriptor(const std::string &filename, struct stat &st)
+{
+  const int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+  {
+    throw std::runtime_error(utils::string_error(errno));
+  }
+  if (fstat(fd, &st) < 0)
+  {
+    const int error = errno;
+    ::close(fd);
+    throw std::runtime_error(utils::string_error(error));
+  }
+  return fd;
+}
@@ -0,0 +1,378 @@
+#include "common/pack_file.hpp"
+
+#include <endian.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "common/utils.hpp"
+
+namespace
+{
+  const char   MAGIC[8]    = {'T', 'F', 'T', 'P', 'P', 'A', 'C', 'K'};
+  const size_t HEADER_SIZE = 48;
+  const size_t SLOT_SIZE   = 40;
+
+  // Field offsets in the header and in a slot
+  const size_t VERSION_AT      = 8;
+  const size_t ENTRY_COUNT_AT  = 16;
+  const size_t SLOT_COUNT_AT   = 24;
+  const size_t SLOTS_OFFSET_AT = 32;
+  const size_t PACK_SIZE_AT    = 40;
+  const size_t HASH_AT         = 0;
+  const size_t NAME_OFFSET_AT  = 8;
+  const size_t DATA_OFFSET_AT  = 16;
+  const size_t DATA_SIZE_AT    = 24;
+  const size_t NAME_SIZE_AT    = 32;
+
+  uint64_t get_u64(const char *at)
+  {
+    uint64_t value;
+    std::memcpy(&value, at, sizeof(value));
+    return le64toh(value);
+  }
+
+  uint32_t get_u32(const char *at)
+  {
+    uint32_t value;
+    std::memcpy(&value, at, sizeof(value));
+    return le32toh(value);
+  }
+
+  void put_u64(char *at, const uint64_t value)
+  {
+    const uint64_t le = htole64(value);
+    std::memcpy(at, &le, sizeof(le));
+  }
+
+  void put_u32(char *at, const uint32_t value)
+  {
+    const uint32_t le = htole32(value);
+    std::memcpy(at, &le, sizeof(le));
+  }
+
+  /**
+   * @brief Flushes a file or a directory entry to disk, throws if that fails
+   */
+  void sync_to_disk(const std::filesystem::path &path)
+  {
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+      throw std::runtime_error("Failed to open " + path.string() + " : " + utils::string_error(errno));
+    }
+    const int ret   = fsync(fd);
+    const int error = errno;
+    close(fd);
+    if (ret < 0)
+    {
+      throw std::runtime_error("Failed to sync " + path.string() + " : " + utils::string_error(error));
+    }
+  }
+
+  /**
+   * @brief True if [offset, offset + size) lies within a pack of pack_size bytes
+   */
+  bool in_pack(const uint64_t offset, const uint64_t size, const uint64_t pack_size)
+  {
+    return (offset <= pack_size) && (size <= pack_size - offset);
+  }
+} // namespace
+
+//========================================================
+/**
+ * @brief Maps the pack and checks its header, throws if it is not a complete pack of this version
+ */
+pack_file::pack_file(const std::string &filename) :
+    _data(nullptr), _size(0), _entry_count(0), _slot_count(0), _slots_offset(0)
+{
+  const int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+  {
+    throw std::runtime_error(utils::string_error(errno));
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0)
+  {
+    const int err = errno;
+    close(fd);
+    throw std::runtime_error(utils::string_error(err));
+  }
+  if (static_cast<uint64_t>(st.st_size) < HEADER_SIZE)
+  {
+    close(fd);
+    throw std::runtime_error("Not a pack file");
+  }
+  _size         = static_cast<size_t>(st.st_size);
+  void     *addr = mmap(nullptr, _size, PROT_READ, MAP_SHARED, fd, 0);
+  const int err  = errno;
+  // The mapping keeps the file open
+  close(fd);
+  if (addr == MAP_FAILED)
+  {
+    throw std::runtime_error(utils::string_error(err));
+  }
+  _data = static_cast<const char *>(addr);
+
+  _entry_count  = get_u64(_data + ENTRY_COUNT_AT);
+  _slot_count   = get_u64(_data + SLOT_COUNT_AT);
+  _slots_offset = get_u64(_data + SLOTS_OFFSET_AT);
+  const char *error = nullptr;
+  if (std::memcmp(_data, MAGIC, sizeof(MAGIC)) != 0)
+  {
+    error = "Not a pack file";
+  }
+  else if (get_u32(_data + VERSION_AT) != VERSION)
+  {
+    error = "Unsupported pack version";
+  }
+  else if (get_u64(_data + PACK_SIZE_AT) != _size)
+  {
+    error = "Pack file is truncated";
+  }
+  else if ((_slot_count == 0) || ((_slot_count & (_slot_count - 1)) != 0) || (_slot_count <= _entry_count) ||
+           (_slot_count > _size / SLOT_SIZE) || !in_pack(_slots_offset, _slot_count * SLOT_SIZE, _size))
+  {
+    error = "Pack file index is corrupt";
+  }
+  if (error != nullptr)
+  {
+    munmap(addr, _size);
+    throw std::runtime_error(error);
+  }
+  // Requests land anywhere in the pack, only the header and index are read ahead
+  madvise(addr, _size, MADV_RANDOM);
+  madvise(addr, _slots_offset + _slot_count * SLOT_SIZE, MADV_WILLNEED);
+}
+
+//========================================================
+pack_file::~pack_file()
+{
+  munmap(const_cast<char *>(_data), _size);
+}
+
+//========================================================
+/**
+ * @brief Looks up the contents of a file by its requested path
+ *
+ * @return A view into the mapping, valid while the pack is, or nullopt if the pack has no such file
+ */
+std::optional<std::string_view> pack_file::find(const std::string &filename) const
+{
+  const auto name = normalise(filename);
+  if (name.empty())
+  {
+    return std::nullopt;
+  }
+  const uint64_t name_hash = hash(name);
+  const uint64_t mask      = _slot_count - 1;
+  uint64_t       index     = name_hash & mask;
+  for (uint64_t probe = 0; probe < _slot_count; ++probe, index = (index + 1) & mask)
+  {
+    const char    *slot      = _data + _slots_offset + index * SLOT_SIZE;
+    const uint64_t slot_hash = get_u64(slot + HASH_AT);
+    if (slot_hash == 0)
+    {
+      break;
+    }
+    const uint64_t name_offset = get_u64(slot + NAME_OFFSET_AT);
+    const uint32_t name_size   = get_u32(slot + NAME_SIZE_AT);
+    if ((slot_hash != name_hash) || (name_size != name.size()) || !in_pack(name_offset, name_size, _size) ||
+        (std::memcmp(_data + name_offset, name.data(), name_size) != 0))
+    {
+      continue;
+    }
+    const uint64_t data_offset = get_u64(slot + DATA_OFFSET_AT);
+    const uint64_t data_size   = get_u64(slot + DATA_SIZE_AT);
+    if (!in_pack(data_offset, data_size, _size))
+    {
+      return std::nullopt;
+    }
+    return std::string_view(_data + data_offset, data_size);
+  }
+  return std::nullopt;
+}
+
+//========================================================
+/**
+ * @brief Size of the whole pack in bytes
+ */
+size_t pack_file::size() const
+{
+  return _size;
+}
+
+//========================================================
+uint64_t pack_file::entry_count() const
+{
+  return _entry_count;
+}
+
+//========================================================
+/**
+ * @brief The form paths are stored and looked up in, empty for a path that cannot name a packed file
+ */
+std::string pack_file::normalise(const std::string &filename)
+{
+  const auto path = std::filesystem::path(filename).lexically_normal();
+  if (path.empty() || path.is_absolute())
+  {
+    return std::string();
+  }
+  auto name = path.generic_string();
+  if ((name == ".") || (name == "..") || (name.rfind("../", 0) == 0) || (name.back() == '/'))
+  {
+    return std::string();
+  }
+  return name;
+}
+
+//========================================================
+/**
+ * @brief FNV-1a 64 hash of a path as stored in the index, never 0 which marks an empty slot
+ */
+uint64_t pack_file::hash(const std::string_view name)
+{
+  uint64_t value = 0xcbf29ce484222325ULL;
+  for (const char c : name)
+  {
+    value ^= static_cast<uint8_t>(c);
+    value *= 0x100000001b3ULL;
+  }
+  return (value == 0) ? 1 : value;
+}
+
+//========================================================
+/**
+ * @brief Packs the regular files under dir into pack
+ *
+ * Symbolic links are skipped, they could point outside dir. The pack is written next to its final name and renamed
+ * over it, so a server serving pack swaps from the whole old pack to the whole new one. The new pack and the directory
+ * holding it are synced to disk before the rename, and the directory again after it, so a crash leaves either the old
+ * pack or the whole new one under the pack's name.
+ */
+pack_file::stats_t pack_file::build(const std::filesystem::path &dir, const std::filesystem::path &pack)
+{
+  const auto tmp = std::filesystem::path(pack.string() + ".tmp");
+  std::vector<std::pair<std::string, std::filesystem::path>> files;
+  for (const auto &entry :
+       std::filesystem::recursive_directory_iterator(dir, std::filesystem::directory_options::skip_permission_denied))
+  {
+    if (entry.is_symlink() || !entry.is_regular_file())
+    {
+      continue;
+    }
+    std::error_code error;
+    if (std::filesystem::equivalent(entry.path(), pack, error) || std::filesystem::equivalent(entry.path(), tmp, error))
+    {
+      continue;
+    }
+    const auto name = normalise(entry.path().lexically_relative(dir).generic_string());
+    if (!name.empty())
+    {
+      files.emplace_back(name, entry.path());
+    }
+  }
+  std::sort(files.begin(), files.end());
+
+  uint64_t slot_count = 2;
+  while (slot_count < 2 * files.size())
+  {
+    slot_count *= 2;
+  }
+  std::vector<char> index(HEADER_SIZE + slot_count * SLOT_SIZE, 0);
+  uint64_t          offset = index.size();
+  std::ofstream     out(tmp, std::ios::binary | std::ios::trunc);
+
+  const auto abandon = [&out, &tmp](const std::string &error) {
+    out.close();
+    std::filesystem::remove(tmp);
+    throw std::runtime_error(error);
+  };
+  out.write(index.data(), static_cast<std::streamsize>(index.size()));
+
+  std::vector<uint64_t> name_offsets;
+  for (const auto &file : files)
+  {
+    name_offsets.push_back(offset);
+    out.write(file.first.data(), static_cast<std::streamsize>(file.first.size()));
+    offset += file.first.size();
+  }
+
+  const uint64_t    mask = slot_count - 1;
+  std::vector<char> buffer(64 * 1024);
+  stats_t           stats{0, 0};
+  for (size_t i = 0; i < files.size(); ++i)
+  {
+    std::ifstream in(files[i].second, std::ios::binary);
+    if (!in)
+    {
+      abandon("Failed to read " + files[i].second.string());
+    }
+    const uint64_t data_offset = offset;
+    while (in)
+    {
+      in.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+      out.write(buffer.data(), in.gcount());
+      offset += static_cast<uint64_t>(in.gcount());
+    }
+    // Checked per file, a full disk would otherwise leave the index pointing past the data written
+    if (in.bad())
+    {
+      abandon("Failed to read " + files[i].second.string());
+    }
+    if (!out)
+    {
+      abandon("Failed to write " + tmp.string());
+    }
+
+    const uint64_t name_hash = hash(files[i].first);
+    uint64_t       slot      = name_hash & mask;
+    while (get_u64(index.data() + HEADER_SIZE + slot * SLOT_SIZE + HASH_AT) != 0)
+    {
+      slot = (slot + 1) & mask;
+    }
+    char *at = index.data() + HEADER_SIZE + slot * SLOT_SIZE;
+    put_u64(at + HASH_AT, name_hash);
+    put_u64(at + NAME_OFFSET_AT, name_offsets[i]);
+    put_u64(at + DATA_OFFSET_AT, data_offset);
+    put_u64(at + DATA_SIZE_AT, offset - data_offset);
+    put_u32(at + NAME_SIZE_AT, static_cast<uint32_t>(files[i].first.size()));
+    ++stats.files;
+    stats.bytes += offset - data_offset;
+  }
+
+  std::memcpy(index.data(), MAGIC, sizeof(MAGIC));
+  put_u32(index.data() + VERSION_AT, VERSION);
+  put_u64(index.data() + ENTRY_COUNT_AT, files.size());
+  put_u64(index.data() + SLOT_COUNT_AT, slot_count);
+  put_u64(index.data() + SLOTS_OFFSET_AT, HEADER_SIZE);
+  put_u64(index.data() + PACK_SIZE_AT, offset);
+  out.seekp(0);
+  out.write(index.data(), static_cast<std::streamsize>(index.size()));
+  out.close();
+  if (!out)
+  {
+    abandon("Failed to write " + tmp.string());
+  }
+  try
+  {
+    sync_to_disk(tmp);
+    sync_to_disk(tmp.parent_path().empty() ? std::filesystem::path(".") : tmp.parent_path());
+  }
+  catch (const std::exception &err)
+  {
+    abandon(err.what());
+  }
+  std::filesystem::rename(tmp, pack);
+  sync_to_disk(pack.parent_path().empty() ? std::filesystem::path(".") : pack.parent_path());
+  return stats;
+}
@@ -0,0 +1,110 @@
+#include "common/pack_store.hpp"
+
+#include <sys/stat.h>
+
+#include <stdexcept>
+
+#include "common/debug_macros.hpp"
+#include "common/rtt_estimator.hpp"
+#include "common/utils.hpp"
+
+//========================================================
+bool pack_store::identity_t::operator==(const identity_t &other) const
+{
+  return (dev == other.dev) && (ino == other.ino) && (mtime_ns == other.mtime_ns) && (size == other.size);
+}
+
+//========================================================
+/**
+ * @brief Opens the pack at path, throws if it cannot be opened
+ */
+pack_store::pack_store(const std::string &path) :
+    _path(path), _mutex(), _pack(), _identity{}, _checked_us(rtt_estimator::steady_clock_us()), _swaps(0)
+{
+  std::lock_guard<std::mutex> lock(_mutex);
+  load(true);
+}
+
+//========================================================
+/**
+ * @brief The pack to serve a request from, swapped for a new one first if the path has been replaced
+ */
+std::shared_ptr<const pack_file> pack_store::current()
+{
+  std::lock_guard<std::mutex> lock(_mutex);
+  const uint64_t              now_us = rtt_estimator::steady_clock_us();
+  if ((now_us - _checked_us) >= static_cast<uint64_t>(RECHECK_MS) * 1000)
+  {
+    _checked_us = now_us;
+    load(false);
+  }
+  return _pack;
+}
+
+//========================================================
+/**
+ * @brief Checks the path straight away rather than on the next periodic check
+ *
+ * @return True if a new pack was swapped in
+ */
+bool pack_store::reload()
+{
+  std::lock_guard<std::mutex> lock(_mutex);
+  _checked_us = rtt_estimator::steady_clock_us();
+  return load(false);
+}
+
+//========================================================
+/**
+ * @brief Number of times a new pack was swapped in
+ */
+size_t pack_store::swaps() const
+{
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _swaps;
+}
+
+//========================================================
+/**
+ * @brief Opens the pack at the path if it is not the one loaded, called with the lock held
+ */
+bool pack_store::load(const bool initial)
+{
+  struct stat st;
+  if (stat(_path.c_str(), &st) < 0)
+  {
+    if (initial)
+    {
+      throw std::runtime_error(utils::string_error(errno));
+    }
+    return false;
+  }
+  const identity_t identity{st.st_dev, st.st_ino,
+                            static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec, st.st_size};
+  if (!initial && (identity == _identity))
+  {
+    return false;
+  }
+  try
+  {
+    _pack     = std::make_shared<const pack_file>(_path);
+    _identity = identity;
+  }
+  catch (const std::exception &err)
+  {
+    if (initial)
+    {
+      throw;
+    }
+    dbg_warn("Failed to open new pack '{}', still serving the old one : {}", _path, err.what());
+    // Not retried until the path changes again
+    _identity = identity;
+    return false;
+  }
+  if (!initial)
+  {
+    ++_swaps;
+    dbg_info("Swapped in pack '{}' with {} files", _path, _pack->entry_count());
+  }
+  return true;
+}
@@ -0,0 +1,109 @@
+#include "common/rtt_estimator.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+namespace
+{
+  const uint64_t CLOCK_GRANULARITY_US = 1000; // Timer wheel resolution
+  const uint8_t  MAX_BACKOFF_SHIFT    = 16;
+}; // namespace
+
+//========================================================
+rtt_estimator::rtt_estimator(const uint32_t initial_rto_ms, const uint32_t min_rto_ms, const uint32_t max_rto_ms,
+                             const uint32_t seed) :
+    _min_rto_ms(min_rto_ms),
+    _max_rto_ms(std::max(min_rto_ms, max_rto_ms)),
+    _base_rto_ms(std::clamp(initial_rto_ms, _min_rto_ms, _max_rto_ms)),
+    _backoff_shift(0),
+    _has_samples(false),
+    _srtt_us(0),
+    _rttvar_us(0),
+    _rng(seed)
+{
+}
+
+//========================================================
+uint64_t rtt_estimator::steady_clock_us()
+{
+  const auto now = std::chrono::steady_clock::now().time_since_epoch();
+  return std::chrono::duration_cast<std::chrono::microseconds>(now).count();
+}
+
+//========================================================
+/**
+ * @brief Adds a round trip time sample and recalculates the timeout, clearing any backoff
+ */
+void rtt_estimator::add_sample(const uint64_t rtt_us)
+{
+  if (!_has_samples)
+  {
+    _srtt_us     = rtt_us;
+    _rttvar_us   = rtt_us / 2;
+    _has_samples = true;
+  }
+  else
+  {
+    const uint64_t delta = (_srtt_us > rtt_us) ? (_srtt_us - rtt_us) : (rtt_us - _srtt_us);
+    _rttvar_us           = (3 * _rttvar_us + delta) / 4;
+    _srtt_us             = (7 * _srtt_us + rtt_us) / 8;
+  }
+
+  const uint64_t rto_us = _srtt_us + std::max(CLOCK_GRANULARITY_US, 4 * _rttvar_us);
+  // Round up to whole milliseconds
+  const uint64_t rto_ms = (rto_us + 999) / 1000;
+  _base_rto_ms   = static_cast<uint32_t>(std::clamp<uint64_t>(rto_ms, _min_rto_ms, _max_rto_ms));
+  _backoff_shift = 0;
+}
+
+//========================================================
+/**
+ * @brief Doubles the timeout after a retransmission, up to the maximum
+ */
+void rtt_estimator::backoff()
+{
+  if ((_backoff_shift < MAX_BACKOFF_SHIFT) && (rto_ms() < _max_rto_ms))
+  {
+    ++_backoff_shift;
+  }
+}
+
+//========================================================
+uint32_t rtt_estimator::rto_ms() const
+{
+  const uint64_t rto = static_cast<uint64_t>(_base_rto_ms) << _backoff_shift;
+  return static_cast<uint32_t>(std::min<uint64_t>(rto, _max_rto_ms));
+}
+
+//========================================================
+/**
+ * @brief Returns the timeout to arm the retransmit timer with, the current timeout plus jitter
+ */
+uint32_t rtt_estimator::next_timeout_ms()
+{
+  const uint32_t rto    = rto_ms();
+  const uint32_t jitter = rto / 8;
+  if (jitter == 0)
+  {
+    return rto;
+  }
+  return rto + static_cast<uint32_t>(_rng() % (jitter + 1));
+}
+
+//========================================================
+bool rtt_estimator::has_samples() const
+{
+  return _has_samples;
+}
+
+//========================================================
+uint64_t rtt_estimator::srtt_us() const
+{
+  return _srtt_us;
+}
+
+//========================================================
+uint64_t rtt_estimator::rttvar_us() const
+{
+  return _rttvar_us;
+}
@@ -10,14 +10,26 @@ namespace
 {
   const char OCTET_MODE_STR[]    = "OCTET";
   const char NETASCII_MODE_STR[] = "NETASCII";
+
+  uint16_t read_uint16(const std::string_view packet, const size_t offset)
+  {
+    return static_cast<uint16_t>((static_cast<uint16_t>(static_cast<unsigned char>(packet[offset])) << 8) |
+                                 static_cast<unsigned char>(packet[offset + 1]));
+  }
 }; // namespace
 
 //========================================================
 std::vector<char> tftp::serialise_rw_packet(const rw_packet_t &packet)
 {
   const auto   mode_str = tftp::mode_t_to_string(packet.mode);
-  const size_t packet_size =
-      2 + packet.filename.size() + 1 + mode_str.size() + 1; // opcode + filename + null byte + mode + null_byte
+  const size_t packet_size = [&]() {
+    size_t size = 2 + packet.filename.size() + 1 + mode_str.size() + 1; // opcode + filename + null byte + mode + null
+    for (const auto &param : packet.options)
+    {
+      size += param.first.size() + 1 + param.second.size() + 1;
+    }
+    return size;
+  }();
   std::vector<char> ret;
   ret.reserve(packet_size);
   ret.push_back(0);
@@ -26,6 +38,13 @@ std::vector<char> tftp::serialise_rw_packet(const rw_packet_t &packet)
   ret.push_back(0);
   ret.insert(ret.end(), mode_str.begin(), mode_str.end());
   ret.push_back(0);
+  for (const auto &param : packet.options)
+  {
+    ret.insert(ret.end(), param.first.begin(), param.first.end());
+    ret.push_back(0);
+    ret.insert(ret.end(), param.second.begin(), param.second.end());
+    ret.push_back(0);
+  }
   return ret;
 }
 
@@ -83,18 +102,86 @@ std::vector<char> tftp::serialise_data_packet(const data_packet_t &packet)
   ret.insert(ret.end(), packet.data.begin(), packet.data.end());
   return ret;
 }
+
+//========================================================
+/**
+ * @brief Serialises only the opcode and block number of a data packet, for sending with a separate payload buffer
+ */
+std::array<char, tftp::DATA_PKT_HEADER_SIZE> tftp::serialise_data_header(const uint16_t block_number)
+{
+  return {0, static_cast<char>(packet_t::DATA), static_cast<char>(block_number >> 8),
+          static_cast<char>(block_number & 0xFF)};
+}
+
+//========================================================
+tftp::data_packet_buffer::data_packet_buffer() :
+    _buffer{0, static_cast<char>(packet_t::DATA), 0, 0}
+{
+}
+
+//========================================================
+char *tftp::data_packet_buffer::payload()
+{
+  return _buffer.data() + DATA_PKT_HEADER_SIZE;
+}
+
+//========================================================
+const char *tftp::data_packet_buffer::payload() const
+{
+  return _buffer.data() + DATA_PKT_HEADER_SIZE;
+}
+
+//========================================================
+size_t tftp::data_packet_buffer::payload_size() const
+{
+  return _buffer.size() - DATA_PKT_HEADER_SIZE;
+}
+
+//========================================================
+/**
+ * @brief Resizes the payload, the header and as much of the payload as fits are kept
+ */
+void tftp::data_packet_buffer::resize_payload(const size_t size)
+{
+  _buffer.resize(DATA_PKT_HEADER_SIZE + size);
+}
+
+//========================================================
+void tftp::data_packet_buffer::set_block_number(const uint16_t block_number)
+{
+  _buffer[2] = static_cast<char>(block_number >> 8);
+  _buffer[3] = static_cast<char>(block_number & 0xFF);
+}
+
+//========================================================
+uint16_t tftp::data_packet_buffer::block_number() const
+{
+  return read_uint16(std::string_view(_buffer.data(), _buffer.size()), 2);
+}
+
+//========================================================
+const char *tftp::data_packet_buffer::data() const
+{
+  return _buffer.data();
+}
+
+//========================================================
+size_t tftp::data_packet_buffer::size() const
+{
+  return _buffer.size();
+}
+
 //========================================================
 std::optional<tftp::data_packet_t> tftp::deserialise_data_packet(const std::vector<char> &data)
 {
-  data_packet_t packet;
-  if ((data.size() < 4) || (static_cast<packet_t>(data.at(1)) != packet_t::DATA))
+  const auto view = decode_data_packet(std::string_view(data.data(), data.size()));
+  if (!view)
   {
     return {};
   }
-
-  packet.block_number =
-      (static_cast<uint16_t>((unsigned char)data.at(2)) << 8) | static_cast<uint16_t>((unsigned char)data.at(3));
-  packet.data.assign(data.begin() + 4, data.end());
+  data_packet_t packet;
+  packet.block_number = view->block_number;
+  packet.data.assign(view->data.begin(), view->data.end());
   return packet;
 }
 
@@ -114,13 +201,7 @@ std::vector<char> tftp::serialise_ack_packet(const ack_packet_t &packet)
 //========================================================
 std::optional<tftp::ack_packet_t> tftp::deserialise_ack_packet(const std::vector<char> &data)
 {
-  if ((data.size() < 4) || (static_cast<packet_t>(data.at(1)) != packet_t::ACK))
-  {
-    return {};
-  }
-  const uint16_t block_num =
-      (static_cast<uint16_t>((unsigned char)data.at(2)) << 8) | static_cast<uint16_t>((unsigned char)data.at(3));
-  return ack_packet_t(block_num);
+  return decode_ack_packet(std::string_view(data.data(), data.size()));
 }
 
 //========================================================
@@ -141,20 +222,14 @@ std::vector<char> tftp::serialise_error_packet(const error_packet_t &packet)
 //========================================================
 std::optional<tftp::error_packet_t> tftp::deserialise_error_packet(const std::vector<char> &data)
 {
-  error_packet_t packet;
-  if ((data.size() < 5) || (static_cast<packet_t>(data.at(1)) != packet_t::ERROR))
-  {
-    return {};
-  }
-
-  packet.error_code = (static_cast<uint16_t>(data.at(2)) << 8) | static_cast<uint16_t>(data.at(3));
-
-  const auto null = std::find(data.begin() + 4, data.end(), 0);
-  if (null == data.end())
+  const auto view = decode_error_packet(std::string_view(data.data(), data.size()));
+  if (!view)
   {
     return {};
   }
-  packet.error_msg = std::string(data.begin() + 4, null);
+  error_packet_t packet;
+  packet.error_code = view->error_code;
+  packet.error_msg  = std::string(view->error_msg);
   return packet;
 }
 
@@ -209,6 +284,88 @@ std::optional<tftp::oack_packet_t> tftp::deserialise_oack_packet(const std::vect
   return packet;
 }
 
+//========================================================
+size_t tftp::encode_data_packet(const uint16_t block_number, const std::string_view payload, char *buffer,
+                                const size_t buffer_size)
+{
+  const size_t packet_size = DATA_PKT_HEADER_SIZE + payload.size();
+  if (buffer_size < packet_size)
+  {
+    return 0;
+  }
+  const auto header = serialise_data_header(block_number);
+  std::memcpy(buffer, header.data(), header.size());
+  std::memcpy(buffer + header.size(), payload.data(), payload.size());
+  return packet_size;
+}
+
+//========================================================
+size_t tftp::encode_ack_packet(const uint16_t block_number, char *buffer, const size_t buffer_size)
+{
+  if (buffer_size < ACK_PKT_MAX_SIZE)
+  {
+    return 0;
+  }
+  buffer[0] = 0;
+  buffer[1] = static_cast<char>(packet_t::ACK);
+  buffer[2] = static_cast<char>(block_number >> 8);
+  buffer[3] = static_cast<char>(block_number & 0xFF);
+  return ACK_PKT_MAX_SIZE;
+}
+
+//========================================================
+size_t tftp::encode_error_packet(const uint16_t error_code, const std::string_view error_msg, char *buffer,
+                                 const size_t buffer_size)
+{
+  const size_t packet_size = 2 + 2 + error_msg.size() + 1; // opcode + error_num + error_msg + null byte
+  if (buffer_size < packet_size)
+  {
+    return 0;
+  }
+  buffer[0] = 0;
+  buffer[1] = static_cast<char>(packet_t::ERROR);
+  buffer[2] = static_cast<char>(error_code >> 8);
+  buffer[3] = static_cast<char>(error_code & 0xFF);
+  std::memcpy(buffer + 4, error_msg.data(), error_msg.size());
+  buffer[packet_size - 1] = 0;
+  return packet_size;
+}
+
+//========================================================
+std::optional<tftp::data_packet_view_t> tftp::decode_data_packet(const std::string_view packet)
+{
+  if ((packet.size() < 4) || (static_cast<packet_t>(packet[1]) != packet_t::DATA))
+  {
+    return {};
+  }
+  return data_packet_view_t{packet.substr(4), read_uint16(packet, 2)};
+}
+
+//========================================================
+std::optional<tftp::ack_packet_t> tftp::decode_ack_packet(const std::string_view packet)
+{
+  if ((packet.size() < 4) || (static_cast<packet_t>(packet[1]) != packet_t::ACK))
+  {
+    return {};
+  }
+  return ack_packet_t(read_uint16(packet, 2));
+}
+
+//========================================================
+std::optional<tftp::error_packet_view_t> tftp::decode_error_packet(const std::string_view packet)
+{
+  if ((packet.size() < 5) || (static_cast<packet_t>(packet[1]) != packet_t::ERROR))
+  {
+    return {};
+  }
+  const size_t null = packet.find('\0', 4);
+  if (null == std::string_view::npos)
+  {
+    return {};
+  }
+  return error_packet_view_t{packet.substr(4, null - 4), read_uint16(packet, 2)};
+}
+
 //========================================================
 std::optional<tftp::mode_t> tftp::string_to_mode_t(std::string mode_str)
 {
@@ -276,3 +433,67 @@ std::string tftp::error_code_to_string(const tftp::error_t err)
   }
   return std::string("");
 }
+
+//========================================================
+/**
+ * @brief Block number following block_number, after 65535 block numbers roll over to rollover, 0 or 1
+ */
+uint16_t tftp::next_block_number(const uint16_t block_number, const uint16_t rollover)
+{
+  return (block_number == MAX_BLOCK_NUMBER) ? rollover : static_cast<uint16_t>(block_number + 1);
+}
+
+//========================================================
+/**
+ * @brief Block number before block_number, the inverse of next_block_number()
+ */
+uint16_t tftp::previous_block_number(const uint16_t block_number, const uint16_t rollover)
+{
+  return (block_number == rollover) ? MAX_BLOCK_NUMBER : static_cast<uint16_t>(block_number - 1);
+}
+
+//========================================================
+/**
+ * @brief Number of blocks from block number from up to block number to, counted the way the numbers roll over
+ *
+ * Rolling over to 1 the numbers cycle through 65535 values, block 0 (the ACK of an OACK) then stands just before
+ * block 1 like block 65535 does.
+ */
+uint16_t tftp::block_distance(const uint16_t from, const uint16_t to, const uint16_t rollover)
+{
+  if (rollover == 0)
+  {
+    return static_cast<uint16_t>(to - from);
+  }
+  const uint32_t cycle      = MAX_BLOCK_NUMBER;
+  const uint32_t from_index = (static_cast<uint32_t>(from) + cycle - 1) % cycle;
+  const uint32_t to_index   = (static_cast<uint32_t>(to) + cycle - 1) % cycle;
+  return static_cast<uint16_t>((to_index + cycle - from_index) % cycle);
+}
+
+//========================================================
+/**
+ * @brief Block number of the block at index (0 for the first block) of a transfer
+ */
+uint16_t tftp::block_number_at(const uint64_t index, const uint16_t rollover)
+{
+  if (rollover == 0)
+  {
+    return static_cast<uint16_t>(index + 1);
+  }
+  return static_cast<uint16_t>((index % MAX_BLOCK_NUMBER) + 1);
+}
+
+//========================================================
+/**
+ * @brief Largest block size whose DATA packets fit in an IPv4 packet of mtu bytes, within the range of RFC 2348
+ */
+size_t tftp::block_size_for_mtu(const int mtu)
+{
+  const size_t overhead = IPV4_UDP_HEADER_SIZE + DATA_PKT_HEADER_SIZE;
+  if (mtu < static_cast<int>(overhead + MIN_BLOCK_SIZE))
+  {
+    return MIN_BLOCK_SIZE;
+  }
+  return std::min(static_cast<size_t>(mtu) - overhead, MAX_BLOCK_SIZE);
+}
@@ -1,94 +1,440 @@
 #include "common/tftp_read_file.hpp"
 
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
 #include <cassert>
+#include <cstring>
 
+#include "common/netascii.hpp"
 #include "common/utils.hpp"
 
+namespace
+{
+  /**
+   * @brief Tells the kernel the whole file will be read front to back, it then reads ahead further
+   */
+  void advise_sequential(const int fd)
+  {
+    // Only advice, failing it is harmless
+    (void)posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  }
+} // namespace
+
 //========================================================
 tftp_read_file::tftp_read_file() :
-    _fd(NULL), _mode(tftp::mode_t::OCTET), _overflow_buffer{}
+    _file(),
+    _map(),
+    _mode(tftp::mode_t::OCTET),
+    _overflow_buffer{},
+    _filename(),
+    _cache(nullptr),
+    _files(nullptr),
+    _memory(),
+    _memory_size(0),
+    _key{},
+    _chunk(),
+    _chunk_index(0),
+    _position(0),
+    _advised_to(0),
+    _eof(false),
+    _error(false)
 {
 }
 
 //========================================================
-tftp_read_file::tftp_read_file(const std::string &filename, const tftp::mode_t mode) :
-    _fd(NULL), _mode(mode), _overflow_buffer{}
+tftp_read_file::tftp_read_file(const std::string &filename, const tftp::mode_t mode, file_cache *cache,
+                               open_file_table *files, const uint64_t mmap_min_bytes) :
+    _file(),
+    _map(),
+    _mode(mode),
+    _overflow_buffer{},
+    _filename(),
+    _cache(nullptr),
+    _files(nullptr),
+    _memory(),
+    _memory_size(0),
+    _key{},
+    _chunk(),
+    _chunk_index(0),
+    _position(0),
+    _advised_to(0),
+    _eof(false),
+    _error(false)
 {
-  open(filename, mode);
+  open(filename, mode, cache, files, mmap_min_bytes);
 }
 
 //========================================================
 tftp_read_file::~tftp_read_file()
 {
-  if (_fd != NULL)
-  {
-    fclose(_fd);
-  }
   assert(_overflow_buffer.empty());
 }
 
 //========================================================
-void tftp_read_file::open(const std::string &filename, const tftp::mode_t mode)
+/**
+ * @brief Opens the file, or with a cache only stats it, the file is then opened on the first cache miss
+ *
+ * Either way the file's identity is taken for key(). With an open_file_table the descriptor is shared with the other
+ * readers of the file. Without a cache, a file of at least mmap_min_bytes is mapped, 0 never maps.
+ */
+void tftp_read_file::open(const std::string &filename, const tftp::mode_t mode, file_cache *cache,
+                          open_file_table *files, const uint64_t mmap_min_bytes)
 {
-  _mode = mode;
-  _fd   = fopen(filename.c_str(), "r");
-  if (_fd == NULL)
+  _mode  = mode;
+  _cache = cache;
+  _files = files;
+  if (_cache != nullptr)
   {
-    throw std::runtime_error(utils::string_error(errno));
+    struct stat st;
+    if (stat(filename.c_str(), &st) < 0)
+    {
+      throw std::runtime_error(utils::string_error(errno));
+    }
+    if (!S_ISREG(st.st_mode))
+    {
+      throw std::runtime_error("Not a regular file");
+    }
+    _filename = filename;
+    _key      = file_cache::make_key(st);
+    return;
   }
+
+  struct stat st;
+  _file = (_files != nullptr) ? _files->acquire(filename, st) : open_file_table::open(filename, st);
+  _key  = file_cache::make_key(st);
+  if ((mmap_min_bytes > 0) && (_key.size >= mmap_min_bytes))
+  {
+    // Mapped as it is now, a file growing later is sent as it was
+    _map.open(_file->fd, _key.size);
+    return;
+  }
+  advise_sequential(_file->fd);
+}
+
+//========================================================
+/**
+ * @brief Opens a reader on size_bytes at data, which the reader keeps alive
+ *
+ * With an aliasing shared_ptr, data points into whatever holds the bytes, a pack_file for example.
+ */
+void tftp_read_file::open(std::shared_ptr<const char> data, const size_t size_bytes, const tftp::mode_t mode)
+{
+  _mode        = mode;
+  _memory      = std::move(data);
+  _memory_size = size_bytes;
 }
 
 //========================================================
 bool tftp_read_file::eof() const
 {
-  return _overflow_buffer.empty() && feof(_fd);
+  if (_memory)
+  {
+    return _overflow_buffer.empty() && (_position >= _memory_size);
+  }
+  if (_cache != nullptr)
+  {
+    return _overflow_buffer.empty() && (_position >= _key.size);
+  }
+  return _overflow_buffer.empty() && _eof;
 }
 
 //========================================================
 bool tftp_read_file::error() const
 {
-  return ferror(_fd);
+  return _error;
+}
+
+//========================================================
+/**
+ * @brief Identity of the file as (device, inode, mtime, size) when it was opened
+ */
+const file_cache::key_t &tftp_read_file::key() const
+{
+  return _key;
+}
+
+//========================================================
+/**
+ * @brief The whole file when it is mapped, nullopt when it is read with pread()
+ */
+std::optional<std::string_view> tftp_read_file::mapping() const
+{
+  if (!_map.is_open())
+  {
+    return std::nullopt;
+  }
+  return std::string_view(_map.data(), _map.size());
+}
+
+//========================================================
+/**
+ * @brief The open file when blocks are its bytes read with pread() at position(), nullptr otherwise
+ *
+ * A caller may then read the blocks some other way, through an event_poller for example, and seek() past them.
+ */
+open_file_table::file_ptr tftp_read_file::descriptor() const
+{
+  if ((_mode != tftp::mode_t::OCTET) || _memory || (_cache != nullptr) || _map.is_open())
+  {
+    return nullptr;
+  }
+  return _file;
+}
+
+//========================================================
+tftp_read_file::position_t tftp_read_file::position() const
+{
+  return position_t{_position, std::string(_overflow_buffer.begin(), _overflow_buffer.end())};
+}
+
+//========================================================
+/**
+ * @brief Carries on reading from position, as returned by position() of this or another reader of the same file
+ */
+void tftp_read_file::seek(const position_t &position)
+{
+  _position = position.offset;
+  _eof      = false;
+  _overflow_buffer.assign(position.overflow.begin(), position.overflow.end());
 }
 
 //========================================================
 void tftp_read_file::read_in_to(std::vector<char> &ret, const size_t size_bytes)
 {
-  size_t read_bytes = 0;
   ret.resize(size_bytes);
+  ret.resize(read_block(ret.data(), size_bytes));
+}
+
+//========================================================
+/**
+ * @brief Reads the next block straight into the payload of a DATA packet, the header is left to the caller
+ */
+void tftp_read_file::read_in_to(tftp::data_packet_buffer &packet, const size_t size_bytes)
+{
+  packet.resize_payload(size_bytes);
+  packet.resize_payload(read_block(packet.payload(), size_bytes));
+}
+
+//========================================================
+/**
+ * @brief Reads the next block into dest
+ *
+ * @return Size of the block, smaller than size_bytes only for the last block
+ */
+size_t tftp_read_file::read_in_to(char *dest, const size_t size_bytes)
+{
+  return read_block(dest, size_bytes);
+}
+
+//========================================================
+/**
+ * @brief Starts the kernel reading the next size_bytes of the file in the background
+ *
+ * Called before every block, so it advises in batches: nothing is asked for while at least half of size_bytes is
+ * still advised ahead of the position, then everything up to size_bytes ahead that is not advised yet. Does nothing
+ * before a cached file has been opened, its data then comes from the cache.
+ */
+void tftp_read_file::prefetch(const size_t size_bytes)
+{
+  const uint64_t ahead = (_advised_to > _position) ? (_advised_to - _position) : 0;
+  if (!_file || ((ahead * 2) >= size_bytes))
+  {
+    return;
+  }
+  const uint64_t start = std::max(_position, _advised_to);
+  const uint64_t end   = _position + size_bytes;
+  _advised_to          = end;
+  if (_map.is_open())
+  {
+    _map.prefetch(start, end - start);
+    return;
+  }
+  (void)posix_fadvise(_file->fd, static_cast<off_t>(start), static_cast<off_t>(end - start), POSIX_FADV_WILLNEED);
+}
+
+//========================================================
+/**
+ * @brief Reads the next block of up to size_bytes into dest, encoded for the transfer mode
+ *
+ * @return Size of the block, smaller than size_bytes only for the last block
+ */
+size_t tftp_read_file::read_block(char *dest, const size_t size_bytes)
+{
+  if (_mode == tftp::mode_t::OCTET)
+  {
+    return read_from_file(dest, size_bytes);
+  }
+
+  // Encoded data carries on from what overflowed the previous block
+  const size_t overflow        = _overflow_buffer.size();
+  const size_t bytes_from_file = size_bytes - overflow;
+  const size_t read_bytes      = read_from_file(dest, bytes_from_file);
+  _netascii_buffer.resize(overflow + netascii::max_encoded_size(read_bytes));
+  std::copy(_overflow_buffer.begin(), _overflow_buffer.end(), _netascii_buffer.begin());
+  const size_t encoded = overflow + netascii::encode(dest, read_bytes, _netascii_buffer.data() + overflow);
+
+  const size_t block_bytes = std::min(encoded, size_bytes);
+  std::memcpy(dest, _netascii_buffer.data(), block_bytes);
+  _overflow_buffer.assign(_netascii_buffer.begin() + block_bytes, _netascii_buffer.begin() + encoded);
+  return block_bytes;
+}
+
+//========================================================
+/**
+ * @brief Reads up to size_bytes raw bytes of the file, fewer only at the end of the file or on error
+ *
+ * Reads at the reader's own position with pread(), the descriptor may be shared with other readers.
+ */
+size_t tftp_read_file::read_from_file(char *dest, const size_t size_bytes)
+{
+  if (_memory)
+  {
+    return read_from_memory(dest, size_bytes);
+  }
+  if (_cache != nullptr)
+  {
+    return read_from_cache(dest, size_bytes);
+  }
+  if (_map.is_open())
+  {
+    return read_from_map(dest, size_bytes);
+  }
 
-  if (_mode != tftp::mode_t::OCTET)
+  const size_t read_bytes = pread_fully(dest, size_bytes, _position);
+  _position += read_bytes;
+  _eof = _eof || (!_error && (read_bytes < size_bytes));
+  return read_bytes;
+}
+
+//========================================================
+/**
+ * @brief Reads size_bytes at offset, fewer only at the end of the file or on error, which sets error()
+ */
+size_t tftp_read_file::pread_fully(char *dest, const size_t size_bytes, const uint64_t offset)
+{
+  size_t read_bytes = 0;
+  while (read_bytes < size_bytes)
   {
-    const size_t bytes_from_file = size_bytes - _overflow_buffer.size();
-    while (!ferror(_fd) && !feof(_fd) && (read_bytes < bytes_from_file))
+    const ssize_t ret =
+        pread(_file->fd, dest + read_bytes, size_bytes - read_bytes, static_cast<off_t>(offset + read_bytes));
+    if ((ret < 0) && (errno == EINTR))
     {
-      read_bytes += fread(ret.data() + read_bytes, 1, bytes_from_file, _fd);
+      continue;
     }
-    ret.resize(read_bytes);
-
-    std::vector<char> netascii_data = utils::native_to_netascii(ret);
-    ret.clear();
-    if (!_overflow_buffer.empty())
+    if (ret < 0)
     {
-      ret.insert(ret.begin(), _overflow_buffer.begin(), _overflow_buffer.end());
-      _overflow_buffer.clear();
+      _error = true;
+      break;
     }
-    if (!netascii_data.empty())
+    if (ret == 0)
     {
-      ret.insert(ret.end(), netascii_data.begin(), netascii_data.end());
+      break;
     }
+    read_bytes += static_cast<size_t>(ret);
+  }
+  return read_bytes;
+}
 
-    if (ret.size() > size_bytes)
+//========================================================
+size_t tftp_read_file::read_from_memory(char *dest, const size_t size_bytes)
+{
+  const size_t count = std::min<uint64_t>(size_bytes, _memory_size - std::min<uint64_t>(_position, _memory_size));
+  std::memcpy(dest, _memory.get() + _position, count);
+  _position += count;
+  return count;
+}
+
+//========================================================
+/**
+ * @brief Copies the next bytes out of the mapping, the mapped size stands in for the end of the file
+ */
+size_t tftp_read_file::read_from_map(char *dest, const size_t size_bytes)
+{
+  const size_t count = std::min<uint64_t>(size_bytes, _map.size() - std::min<uint64_t>(_position, _map.size()));
+  if (!_map.copy_out(dest, _position, count))
+  {
+    // Truncated under us
+    _error = true;
+    return 0;
+  }
+  _position += count;
+  _eof = _eof || (count < size_bytes);
+  return count;
+}
+
+//========================================================
+size_t tftp_read_file::read_from_cache(char *dest, const size_t size_bytes)
+{
+  const size_t chunk_size = _cache->chunk_size();
+  size_t       read_bytes = 0;
+  while (!_error && (read_bytes < size_bytes) && (_position < _key.size))
+  {
+    const size_t index = _position / chunk_size;
+    if ((!_chunk || (_chunk_index != index)) && !load_chunk(index))
+    {
+      break;
+    }
+    const size_t offset = _position - (index * chunk_size);
+    if (offset >= _chunk->size())
     {
-      _overflow_buffer.insert(_overflow_buffer.begin(), ret.begin() + size_bytes, ret.end());
-      ret.resize(size_bytes);
+      // The file was truncated under us
+      _error = true;
+      break;
     }
+    const size_t count = std::min(size_bytes - read_bytes, _chunk->size() - offset);
+    std::memcpy(dest + read_bytes, _chunk->data() + offset, count);
+    read_bytes += count;
+    _position += count;
   }
-  else
+  return read_bytes;
+}
+
+//========================================================
+/**
+ * @brief Makes chunk index the current chunk, reading it from the file and adding it to the cache on a miss
+ */
+bool tftp_read_file::load_chunk(const size_t index)
+{
+  _chunk       = _cache->find(_key, index);
+  _chunk_index = index;
+  if (_chunk)
+  {
+    return true;
+  }
+
+  if (!_file)
   {
-    while (!ferror(_fd) && !feof(_fd) && (read_bytes < size_bytes))
+    struct stat st;
+    try
     {
-      read_bytes += fread(ret.data() + read_bytes, 1, size_bytes - read_bytes, _fd);
+      _file = (_files != nullptr) ? _files->acquire(_filename, st) : open_file_table::open(_filename, st);
     }
-    ret.resize(read_bytes);
+    catch (const std::exception &)
+    {
+      _error = true;
+      return false;
+    }
+    if (!(file_cache::make_key(st) == _key))
+    {
+      // Replaced since it was opened, chunks of the new file must not be mixed with the old
+      _error = true;
+      return false;
+    }
+    advise_sequential(_file->fd);
+  }
+
+  const size_t      chunk_size = _cache->chunk_size();
+  const uint64_t    start      = static_cast<uint64_t>(index) * chunk_size;
+  std::vector<char> data(std::min<uint64_t>(chunk_size, _key.size - start));
+  if (pread_fully(data.data(), data.size(), start) < data.size())
+  {
+    // Truncated under us
+    _error = true;
+    return false;
   }
+  _chunk = _cache->insert(_key, index, std::move(data));
+  return true;
 }
@@ -1,71 +1,268 @@
 #include "common/tftp_write_file.hpp"
 
-#include <cassert>
+#include <fcntl.h>
+#include <unistd.h>
 
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include "common/netascii.hpp"
 #include "common/utils.hpp"
 
+namespace
+{
+  const char     NONE_STR[]     = "NONE";
+  const char     ON_CLOSE_STR[] = "CLOSE";
+  const uint64_t MIB            = 1024 * 1024;
+} // namespace
+
 //========================================================
 tftp_write_file::tftp_write_file() :
-    _fd(NULL), _mode(tftp::mode_t::OCTET)
+    _fd(-1),
+    _mode(tftp::mode_t::OCTET),
+    _sync_policy{},
+    _native_buffer{},
+    _batch{},
+    _batch_size(0),
+    _offset(0),
+    _unsynced(0),
+    _allocated(0),
+    _errno(0)
 {
 }
 
 //========================================================
-tftp_write_file::tftp_write_file(const std::string &filename, const tftp::mode_t mode) :
-    _fd(NULL), _mode(mode)
+tftp_write_file::tftp_write_file(const std::string &filename, const tftp::mode_t mode,
+                                 const sync_policy_t &sync_policy) :
+    _fd(-1),
+    _mode(mode),
+    _sync_policy(sync_policy),
+    _native_buffer{},
+    _batch{},
+    _batch_size(0),
+    _offset(0),
+    _unsynced(0),
+    _allocated(0),
+    _errno(0)
 {
-  open(filename, mode);
+  open(filename, mode, sync_policy);
 }
 
 //========================================================
 tftp_write_file::~tftp_write_file()
 {
-  if (_fd != NULL)
+  close();
+}
+
+//========================================================
+void tftp_write_file::open(const std::string &filename, const tftp::mode_t mode, const sync_policy_t &sync_policy)
+{
+  _mode        = mode;
+  _sync_policy = sync_policy;
+  _fd          = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+  if (_fd < 0)
   {
-    fclose(_fd);
+    throw std::runtime_error(utils::string_error(errno));
   }
+  _batch.resize(WRITE_BATCH_BYTES);
 }
 
 //========================================================
-void tftp_write_file::open(const std::string &filename, const tftp::mode_t mode)
+/**
+ * @brief Allocates disk space for size_bytes up front
+ *
+ * Filesystems without fallocate() are left to allocate as the file is written.
+ *
+ * @return false if the space could not be allocated, disk_full() then tells if it was for lack of space
+ */
+bool tftp_write_file::preallocate(const uint64_t size_bytes)
 {
-  _mode = mode;
-  _fd   = fopen(filename.c_str(), "w");
-  if (_fd == NULL)
+  if (size_bytes == 0)
   {
-    throw std::runtime_error(utils::string_error(errno));
+    return true;
+  }
+  if (fallocate(_fd, 0, 0, static_cast<off_t>(size_bytes)) < 0)
+  {
+    if ((errno == EOPNOTSUPP) || (errno == ENOSYS))
+    {
+      return true;
+    }
+    _errno = errno;
+    return false;
   }
+  _allocated = size_bytes;
+  return true;
+}
+
+//========================================================
+void tftp_write_file::write(const std::vector<char> &data)
+{
+  write(data.data(), data.size());
 }
 
 //========================================================
-bool tftp_write_file::eof() const
+void tftp_write_file::write(const char *data, const size_t size)
 {
-  return feof(_fd);
+  if (_mode != tftp::mode_t::OCTET)
+  {
+    _native_buffer.resize(size);
+    append(_native_buffer.data(), netascii::decode(data, size, _native_buffer.data()));
+  }
+  else
+  {
+    append(data, size);
+  }
+}
+
+//========================================================
+/**
+ * @brief Writes out the partly filled batch
+ */
+void tftp_write_file::flush()
+{
+  size_t written = 0;
+  while ((_errno == 0) && (written < _batch_size))
+  {
+    const ssize_t ret = pwrite(_fd, _batch.data() + written, _batch_size - written, static_cast<off_t>(_offset));
+    if (ret < 0)
+    {
+      if (errno != EINTR)
+      {
+        _errno = errno;
+      }
+      continue;
+    }
+    written += static_cast<size_t>(ret);
+    _offset += static_cast<uint64_t>(ret);
+    _unsynced += static_cast<uint64_t>(ret);
+  }
+  _batch_size = 0;
+  if ((_sync_policy.sync == sync_t::INTERVAL) && (_unsynced >= _sync_policy.interval_bytes))
+  {
+    sync();
+  }
+}
+
+//========================================================
+/**
+ * @brief Writes everything out, syncs it if the policy asks to and closes the file
+ *
+ * Space preallocated past the end of what was written is given back.
+ */
+void tftp_write_file::close()
+{
+  if (_fd < 0)
+  {
+    return;
+  }
+  flush();
+  if ((_sync_policy.sync != sync_t::NONE) && (_unsynced > 0))
+  {
+    sync();
+  }
+  if ((_allocated > _offset) && (ftruncate(_fd, static_cast<off_t>(_offset)) < 0) && (_errno == 0))
+  {
+    _errno = errno;
+  }
+  if ((::close(_fd) < 0) && (_errno == 0))
+  {
+    _errno = errno;
+  }
+  _fd = -1;
 }
 
 //========================================================
 bool tftp_write_file::error() const
 {
-  return ferror(_fd);
+  return _errno != 0;
 }
 
 //========================================================
-void tftp_write_file::write(const std::vector<char> &data)
+/**
+ * @brief True if a write or the preallocation failed for lack of space or quota
+ */
+bool tftp_write_file::disk_full() const
 {
-  size_t bytes_written = 0;
-  if (_mode != tftp::mode_t::OCTET)
+  return (_errno == ENOSPC) || (_errno == EDQUOT);
+}
+
+//========================================================
+/**
+ * @brief Parses "none", "close" or a number of MiB to sync after
+ */
+std::optional<tftp_write_file::sync_policy_t> tftp_write_file::string_to_sync_policy(const std::string &name)
+{
+  std::string upper(name);
+  std::transform(upper.begin(), upper.end(), upper.begin(), ::toupper);
+  if (upper == NONE_STR)
+  {
+    return sync_policy_t{sync_t::NONE, 0};
+  }
+  else if (upper == ON_CLOSE_STR)
   {
-    const auto native_data = utils::netascii_to_native(data);
-    while (!ferror(_fd) && !feof(_fd) && (bytes_written < native_data.size()))
+    return sync_policy_t{sync_t::ON_CLOSE, 0};
+  }
+  try
+  {
+    size_t         parsed = 0;
+    const uint64_t mib    = std::stoull(name, &parsed);
+    if ((parsed == name.size()) && (mib > 0))
     {
-      bytes_written += fwrite(native_data.data(), 1, native_data.size() - bytes_written, _fd);
+      return sync_policy_t{sync_t::INTERVAL, mib * MIB};
     }
   }
-  else
+  catch (const std::exception &)
   {
-    while (!feof(_fd) && (bytes_written < data.size()))
+  }
+  return {};
+}
+
+//========================================================
+std::string tftp_write_file::sync_policy_to_string(const sync_policy_t &policy)
+{
+  switch (policy.sync)
+  {
+  case sync_t::NONE: {
+    return "none";
+  }
+  case sync_t::ON_CLOSE: {
+    return "close";
+  }
+  case sync_t::INTERVAL:
+  default: {
+    return "every " + std::to_string(policy.interval_bytes / MIB) + " MiB";
+  }
+  }
+}
+
+//========================================================
+/**
+ * @brief Adds data to the batch, writing the batch out each time it fills
+ */
+void tftp_write_file::append(const char *data, const size_t size)
+{
+  size_t appended = 0;
+  while ((_errno == 0) && (appended < size))
+  {
+    const size_t count = std::min(size - appended, _batch.size() - _batch_size);
+    std::memcpy(_batch.data() + _batch_size, data + appended, count);
+    _batch_size += count;
+    appended += count;
+    if (_batch_size == _batch.size())
     {
-      bytes_written += fwrite(data.data(), 1, data.size() - bytes_written, _fd);
+      flush();
     }
   }
 }
+
+//========================================================
+void tftp_write_file::sync()
+{
+  if ((fdatasync(_fd) < 0) && (_errno == 0))
+  {
+    _errno = errno;
+  }
+  _unsynced = 0;
+}
@@ -1,71 +1,57 @@
-
 #include "common/timer.hpp"
 
-#include <stdint.h>
-#include <sys/timerfd.h>
-#include <unistd.h>
-
-#include "common/debug_macros.hpp"
-#include "common/utils.hpp"
-
 //========================================================
-timer::timer() :
-    _fd(-1)
+timer::timer(timer_wheel &wheel) :
+    _node{&_node, &_node, this},
+    _wheel(wheel),
+    _on_expiry(),
+    _expiry_ms(0),
+    _armed(false),
+    _expired(false)
 {
-  _fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
-  if (_fd < 0)
-  {
-    throw std::runtime_error(utils::string_error(errno));
-  }
 }
 
 //========================================================
 timer::~timer()
 {
-  if (_fd > 0)
-  {
-    close(_fd);
-  }
+  disarm_timer();
 }
 
 //========================================================
-int timer::fd() const
+void timer::set_callback(std::function<void()> on_expiry)
 {
-  return _fd;
+  _on_expiry = std::move(on_expiry);
 }
 
 //========================================================
-void timer::arm_timer(const time_t seconds)
+/**
+ * @brief (Re)arms the timer to expire timeout_ms milliseconds from now
+ */
+void timer::arm_timer(const uint64_t timeout_ms)
 {
-  struct itimerspec new_value;
-  new_value.it_value.tv_sec     = seconds;
-  new_value.it_value.tv_nsec    = 0;
-  new_value.it_interval.tv_sec  = 0;
-  new_value.it_interval.tv_nsec = 0;
-  if (timerfd_settime(_fd, 0, &new_value, NULL) == -1)
-  {
-    dbg_warn("Failed to arm timer : {}", utils::string_error(errno));
-  }
+  _wheel.schedule(*this, _wheel.now_ms() + timeout_ms);
 }
 
 //========================================================
 void timer::disarm_timer()
 {
-  struct itimerspec new_value;
-  new_value.it_value.tv_sec     = 0;
-  new_value.it_value.tv_nsec    = 0;
-  new_value.it_interval.tv_sec  = 0;
-  new_value.it_interval.tv_nsec = 0;
-  if (timerfd_settime(_fd, 0, &new_value, NULL) == -1)
-  {
-    dbg_warn("Failed to disarm timer : {}", utils::string_error(errno));
-  }
+  _wheel.cancel(*this);
+  _expired = false;
 }
 
 //========================================================
+/**
+ * @brief Returns true once after the timer expires
+ */
 bool timer::has_expired()
 {
-  uint64_t      exp = 0;
-  const ssize_t ret = read(_fd, &exp, sizeof(uint64_t));
-  return (ret > 0) && (exp > 0);
-}
\ No newline at end of file
+  const bool expired = _expired;
+  _expired           = false;
+  return expired;
+}
+
+//========================================================
+bool timer::is_armed() const
+{
+  return _armed;
+}
@@ -0,0 +1,273 @@
+#include "common/timer_wheel.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+#include "common/timer.hpp"
+
+//========================================================
+timer_wheel::timer_wheel(clock_fn clock) :
+    _clock(std::move(clock)), _current_ms(0), _size(0), _level0{}, _levels{}
+{
+  _current_ms = _clock();
+  for (auto &slot : _level0)
+  {
+    list_init(slot);
+  }
+  for (auto &level : _levels)
+  {
+    for (auto &slot : level)
+    {
+      list_init(slot);
+    }
+  }
+}
+
+//========================================================
+timer_wheel::~timer_wheel()
+{
+  // Any timer still armed now refers to a dead wheel, detach them so their destructors don't touch it
+  auto detach = [](node_t &slot) {
+    while (!list_empty(slot))
+    {
+      node_t *node        = slot.next;
+      node->owner->_armed = false;
+      list_unlink(*node);
+    }
+  };
+  std::for_each(_level0.begin(), _level0.end(), detach);
+  for (auto &level : _levels)
+  {
+    std::for_each(level.begin(), level.end(), detach);
+  }
+}
+
+//========================================================
+uint64_t timer_wheel::steady_clock_ms()
+{
+  const auto now = std::chrono::steady_clock::now().time_since_epoch();
+  return std::chrono::duration_cast<std::chrono::milliseconds>(now).count();
+}
+
+//========================================================
+uint64_t timer_wheel::now_ms() const
+{
+  return _clock();
+}
+
+//========================================================
+size_t timer_wheel::size() const
+{
+  return _size;
+}
+
+//========================================================
+/**
+ * @brief Returns how long the event loop may sleep before the next timer is due, capped at max_timeout_ms
+ *
+ * Searches the first level, and wakes early at the next cascade if that would bring down a timer.
+ */
+int timer_wheel::next_timeout_ms(const int max_timeout_ms) const
+{
+  if (_size == 0)
+  {
+    return max_timeout_ms;
+  }
+
+  const uint64_t cascade_ms = ((_current_ms >> LEVEL0_BITS) + 1) << LEVEL0_BITS;
+  const size_t   cascade_ix = (cascade_ms >> LEVEL0_BITS) & LEVELN_MASK;
+  uint64_t       next_ms    = _current_ms + LEVEL0_SIZE;
+  if ((cascade_ix == 0) || !list_empty(_levels[0][cascade_ix]))
+  {
+    next_ms = cascade_ms;
+  }
+  for (uint64_t tick = _current_ms + 1; tick < next_ms; ++tick)
+  {
+    if (!list_empty(_level0[tick & LEVEL0_MASK]))
+    {
+      next_ms = tick;
+      break;
+    }
+  }
+
+  const uint64_t now = _clock();
+  if (next_ms <= now)
+  {
+    return 0;
+  }
+  return static_cast<int>(std::min<uint64_t>(next_ms - now, max_timeout_ms));
+}
+
+//========================================================
+/**
+ * @brief Turns the wheel up to the current time, calling the expiry callback of every timer that became due
+ */
+void timer_wheel::advance()
+{
+  const uint64_t now = _clock();
+  if (_size == 0)
+  {
+    _current_ms = std::max(_current_ms, now);
+    return;
+  }
+
+  while (_current_ms < now)
+  {
+    ++_current_ms;
+    const size_t index = _current_ms & LEVEL0_MASK;
+    if (index == 0)
+    {
+      // Level 0 wrapped, pull the next slot of each upper level down as far as the wrap goes
+      for (size_t level = 0; level < NUM_LEVELN; ++level)
+      {
+        const size_t level_index = (_current_ms >> (LEVEL0_BITS + level * LEVELN_BITS)) & LEVELN_MASK;
+        cascade(level, level_index);
+        if (level_index != 0)
+        {
+          break;
+        }
+      }
+    }
+    expire(_level0[index]);
+    if (_size == 0)
+    {
+      _current_ms = now;
+    }
+  }
+}
+
+//========================================================
+void timer_wheel::schedule(timer &t, const uint64_t expiry_ms)
+{
+  if (t._armed)
+  {
+    cancel(t);
+  }
+  t._expiry_ms = expiry_ms;
+  t._armed     = true;
+  t._expired   = false;
+  ++_size;
+  insert(t);
+}
+
+//========================================================
+void timer_wheel::cancel(timer &t)
+{
+  if (t._armed)
+  {
+    list_unlink(t._node);
+    t._armed = false;
+    --_size;
+  }
+}
+
+//========================================================
+/**
+ * @brief Places an armed timer in the slot matching its distance from the current time
+ */
+void timer_wheel::insert(timer &t)
+{
+  const uint64_t expiry = std::max(t._expiry_ms, _current_ms + 1);
+  const uint64_t delta  = std::min(expiry - _current_ms, MAX_DELTA_MS);
+  const uint64_t due    = _current_ms + delta;
+
+  if (delta < LEVEL0_SIZE)
+  {
+    list_push_back(_level0[due & LEVEL0_MASK], t._node);
+    return;
+  }
+
+  for (size_t level = 0; level < NUM_LEVELN; ++level)
+  {
+    const size_t shift = LEVEL0_BITS + level * LEVELN_BITS;
+    if ((delta < (uint64_t(1) << (shift + LEVELN_BITS))) || (level == NUM_LEVELN - 1))
+    {
+      list_push_back(_levels[level][(due >> shift) & LEVELN_MASK], t._node);
+      return;
+    }
+  }
+}
+
+//========================================================
+void timer_wheel::cascade(const size_t level, const size_t index)
+{
+  node_t pending;
+  list_init(pending);
+  list_splice(_levels[level][index], pending);
+  while (!list_empty(pending))
+  {
+    timer &t = *pending.next->owner;
+    list_unlink(t._node);
+    insert(t);
+  }
+}
+
+//========================================================
+void timer_wheel::expire(node_t &slot)
+{
+  // Callbacks may arm or cancel any timer, including the ones still pending here, so work from a private list
+  node_t pending;
+  list_init(pending);
+  list_splice(slot, pending);
+  while (!list_empty(pending))
+  {
+    timer &t = *pending.next->owner;
+    list_unlink(t._node);
+    t._armed   = false;
+    t._expired = true;
+    --_size;
+    if (t._on_expiry)
+    {
+      t._on_expiry();
+    }
+  }
+}
+
+//========================================================
+void timer_wheel::list_init(node_t &head)
+{
+  head.prev  = &head;
+  head.next  = &head;
+  head.owner = nullptr;
+}
+
+//========================================================
+bool timer_wheel::list_empty(const node_t &head)
+{
+  return head.next == &head;
+}
+
+//========================================================
+void timer_wheel::list_push_back(node_t &head, node_t &node)
+{
+  node.prev       = head.prev;
+  node.next       = &head;
+  head.prev->next = &node;
+  head.prev       = &node;
+}
+
+//========================================================
+void timer_wheel::list_unlink(node_t &node)
+{
+  node.prev->next = node.next;
+  node.next->prev = node.prev;
+  node.prev       = &node;
+  node.next       = &node;
+}
+
+//========================================================
+void timer_wheel::list_splice(node_t &from, node_t &to)
+{
+  if (list_empty(from))
+  {
+    return;
+  }
+  node_t *first = from.next;
+  node_t *last  = from.prev;
+
+  first->prev   = to.prev;
+  to.prev->next = first;
+  last->next    = &to;
+  to.prev       = last;
+  list_init(from);
+}
@@ -3,18 +3,60 @@
 
 #include <arpa/inet.h>
 #include <fcntl.h>
+#include <linux/errqueue.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <climits>
 #include <cstring>
 #include <stdexcept>
 
 #include "common/debug_macros.hpp"
 #include "common/utils.hpp"
 
+//========================================================
+datagram_batch::datagram_batch(const size_t capacity, const size_t max_datagram_size) :
+    _size(0),
+    _max_datagram_size(max_datagram_size),
+    _buffers(capacity),
+    _iovecs(capacity),
+    _addresses(capacity),
+    _headers(capacity)
+{
+  for (auto &buffer : _buffers)
+  {
+    buffer.reserve(max_datagram_size);
+  }
+}
+
+//========================================================
+size_t datagram_batch::size() const
+{
+  return _size;
+}
+
+//========================================================
+size_t datagram_batch::capacity() const
+{
+  return _buffers.size();
+}
+
+//========================================================
+const std::vector<char> &datagram_batch::data(const size_t index) const
+{
+  return _buffers.at(index);
+}
+
+//========================================================
+const struct sockaddr_in &datagram_batch::address(const size_t index) const
+{
+  return _addresses.at(index);
+}
+
 //========================================================
 udp_connection::udp_connection() :
-    _sd(-1)
+    _sd(-1), _send_iovecs{}, _send_headers{}, _zerocopy_pending{}
 {
   _sd = socket(AF_INET, SOCK_DGRAM, 0);
 
@@ -62,6 +104,88 @@ void udp_connection::set_non_blocking(const bool enable)
   }
 }
 
+//========================================================
+/**
+ * @brief Allow several sockets to bind the same address & port, the kernel then spreads incoming datagrams
+ * between them. Must be called before bind()
+ */
+void udp_connection::set_reuse_port(const bool enable)
+{
+  const int value = enable ? 1 : 0;
+  if (setsockopt(_sd, SOL_SOCKET, SO_REUSEPORT, &value, sizeof(int)) < 0)
+  {
+    throw std::runtime_error(utils::string_error(errno));
+  }
+}
+
+//========================================================
+/**
+ * @brief Allow several sockets to bind the same address & port, such as clients of the same multicast group on one
+ * host, each then gets its own copy of every multicast datagram. Must be called before bind()
+ */
+void udp_connection::set_reuse_address(const bool enable)
+{
+  const int value = enable ? 1 : 0;
+  if (setsockopt(_sd, SOL_SOCKET, SO_REUSEADDR, &value, sizeof(int)) < 0)
+  {
+    throw std::runtime_error(utils::string_error(errno));
+  }
+}
+
+//========================================================
+/**
+ * @brief Asks for a receive buffer of at least bytes, the kernel caps it at net.core.rmem_max
+ */
+void udp_connection::set_receive_buffer(const size_t bytes)
+{
+  const int value = static_cast<int>(std::min<size_t>(bytes, INT_MAX));
+  if (setsockopt(_sd, SOL_SOCKET, SO_RCVBUF, &value, sizeof(int)) < 0)
+  {
+    throw std::runtime_error(utils::string_error(errno));
+  }
+}
+
+//========================================================
+/**
+ * @brief Sends multicast datagrams out of the interface with the given address, all interfaces' default if empty
+ *
+ * Multicast sent is looped back to members on this host too.
+ */
+void udp_connection::set_multicast_interface(const std::string &ip_address)
+{
+  struct in_addr addr;
+  addr.s_addr = INADDR_ANY;
+  if (!ip_address.empty() && !inet_pton(AF_INET, ip_address.c_str(), &addr))
+  {
+    throw std::runtime_error("Invalid address");
+  }
+  const unsigned char loop = 1;
+  if ((setsockopt(_sd, IPPROTO_IP, IP_MULTICAST_IF, &addr, sizeof(addr)) < 0) ||
+      (setsockopt(_sd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop)) < 0))
+  {
+    throw std::runtime_error(utils::string_error(errno));
+  }
+}
+
+//========================================================
+/**
+ * @brief Receives datagrams sent to a multicast group on the interface with the given address, any if empty
+ */
+void udp_connection::join_multicast_group(const struct in_addr group, const std::string &ip_address)
+{
+  struct ip_mreq mreq;
+  mreq.imr_multiaddr        = group;
+  mreq.imr_interface.s_addr = INADDR_ANY;
+  if (!ip_address.empty() && !inet_pton(AF_INET, ip_address.c_str(), &mreq.imr_interface))
+  {
+    throw std::runtime_error("Invalid address");
+  }
+  if (setsockopt(_sd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0)
+  {
+    throw std::runtime_error(utils::string_error(errno));
+  }
+}
+
 //========================================================
 void udp_connection::bind(const std::string &ip_address, const uint16_t port_num)
 {
@@ -117,7 +241,13 @@ void udp_connection::connect(const struct sockaddr_in sa)
 //========================================================
 ssize_t udp_connection::send(const std::vector<char> &data)
 {
-  return ::send(_sd, data.data(), data.size(), 0);
+  return send(data.data(), data.size());
+}
+
+//========================================================
+ssize_t udp_connection::send(const char *data, const size_t size)
+{
+  return ::send(_sd, data, size, 0);
 }
 
 //========================================================
@@ -135,6 +265,12 @@ ssize_t udp_connection::send_to(const std::string &ip_address, const uint16_t po
   return ::sendto(_sd, data.data(), data.size(), 0, (const struct sockaddr *)&sa, sizeof(struct sockaddr_in));
 }
 
+//========================================================
+ssize_t udp_connection::send_to(const struct sockaddr_in &sa, const char *data, const size_t size)
+{
+  return ::sendto(_sd, data, size, 0, (const struct sockaddr *)&sa, sizeof(struct sockaddr_in));
+}
+
 //========================================================
 std::vector<char> udp_connection::recv(const size_t size)
 {
@@ -156,6 +292,228 @@ std::vector<char> udp_connection::recv(const size_t size)
   return buffer;
 }
 
+//========================================================
+/**
+ * @brief Receives a datagram into a caller provided buffer, truncated to size bytes
+ *
+ * @return Number of bytes received, 0 if nothing was queued on a non-blocking socket
+ */
+size_t udp_connection::recv(char *buffer, const size_t size)
+{
+  const ssize_t received = ::recv(_sd, buffer, size, 0);
+  if ((received <= 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+  {
+    return 0;
+  }
+  else if (received < 0)
+  {
+    throw std::runtime_error(utils::string_error(errno));
+  }
+  return static_cast<size_t>(received);
+}
+
+//========================================================
+/**
+ * @brief Receives as many queued datagrams as fit in the batch with a single recvmmsg() call
+ *
+ * Never blocks, returns the number of datagrams received, 0 if none were waiting.
+ */
+size_t udp_connection::recv_batch(datagram_batch &batch)
+{
+  for (size_t i = 0; i < batch.capacity(); ++i)
+  {
+    batch._buffers[i].resize(batch._max_datagram_size);
+    batch._iovecs[i].iov_base = batch._buffers[i].data();
+    batch._iovecs[i].iov_len  = batch._max_datagram_size;
+
+    std::memset(&batch._headers[i], 0, sizeof(struct mmsghdr));
+    batch._headers[i].msg_hdr.msg_name    = &batch._addresses[i];
+    batch._headers[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+    batch._headers[i].msg_hdr.msg_iov     = &batch._iovecs[i];
+    batch._headers[i].msg_hdr.msg_iovlen  = 1;
+  }
+
+  batch._size        = 0;
+  const int received = ::recvmmsg(_sd, batch._headers.data(), batch.capacity(), MSG_DONTWAIT, nullptr);
+  if ((received < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+  {
+    return 0;
+  }
+  else if (received < 0)
+  {
+    throw std::runtime_error(utils::string_error(errno));
+  }
+
+  batch._size = static_cast<size_t>(received);
+  for (size_t i = 0; i < batch._size; ++i)
+  {
+    batch._buffers[i].resize(batch._headers[i].msg_len);
+  }
+  return batch._size;
+}
+
+//========================================================
+/**
+ * @brief Sends several datagrams on a connected socket with a single sendmmsg() call
+ *
+ * Each datagram is gathered from its header and payload buffers, nothing is copied in userspace and the iovecs and
+ * headers are reused from call to call. With zerocopy set every datagram is sent with MSG_ZEROCOPY, as send_gather()
+ * does.
+ *
+ * Returns the number of datagrams sent, which may be fewer than requested if the socket buffer fills, or -1 on error.
+ */
+int udp_connection::send_batch(const datagram_view_t *datagrams, const size_t count, const bool zerocopy)
+{
+  _send_iovecs.resize(count * 2);
+  _send_headers.resize(count);
+  for (size_t i = 0; i < count; ++i)
+  {
+    struct iovec *iov = &_send_iovecs[i * 2];
+    iov[0].iov_base   = const_cast<char *>(datagrams[i].header);
+    iov[0].iov_len    = datagrams[i].header_len;
+    iov[1].iov_base   = const_cast<char *>(datagrams[i].payload);
+    iov[1].iov_len    = datagrams[i].payload_len;
+
+    std::memset(&_send_headers[i], 0, sizeof(struct mmsghdr));
+    _send_headers[i].msg_hdr.msg_iov    = iov;
+    _send_headers[i].msg_hdr.msg_iovlen = (datagrams[i].payload_len > 0) ? 2 : 1;
+  }
+
+  const int sent = ::sendmmsg(_sd, _send_headers.data(), count, zerocopy ? MSG_ZEROCOPY : 0);
+  if (zerocopy)
+  {
+    // Each datagram is its own send and takes the next completion id
+    for (int i = 0; i < sent; ++i)
+    {
+      _zerocopy_pending.push_back(datagrams[i].payload_len);
+    }
+  }
+  return sent;
+}
+
+//========================================================
+/**
+ * @brief Sends a header and a payload from separate buffers as a single datagram with sendmsg()
+ *
+ * With zerocopy set the payload is sent with MSG_ZEROCOPY: the kernel references the payload pages instead of copying
+ * them, so they must stay unchanged until recv_zerocopy_completions() reports the send complete. enable_zerocopy()
+ * must have succeeded first.
+ */
+ssize_t udp_connection::send_gather(const char *header, const size_t header_len, const char *payload,
+                                    const size_t payload_len, const bool zerocopy)
+{
+  struct iovec iov[2];
+  iov[0].iov_base = const_cast<char *>(header);
+  iov[0].iov_len  = header_len;
+  iov[1].iov_base = const_cast<char *>(payload);
+  iov[1].iov_len  = payload_len;
+
+  struct msghdr msg;
+  std::memset(&msg, 0, sizeof(struct msghdr));
+  msg.msg_iov    = iov;
+  msg.msg_iovlen = (payload_len > 0) ? 2 : 1;
+
+  const ssize_t ret = ::sendmsg(_sd, &msg, zerocopy ? MSG_ZEROCOPY : 0);
+  if (zerocopy && (ret >= 0))
+  {
+    // Every successful MSG_ZEROCOPY send takes the next completion id, starting from 0
+    _zerocopy_pending.push_back(payload_len);
+  }
+  return ret;
+}
+
+//========================================================
+/**
+ * @brief Reads zero copy completion notifications from the socket error queue, never blocks
+ *
+ * Pending errors on the socket raise EPOLLERR while notifications are queued.
+ */
+zerocopy_completions_t udp_connection::recv_zerocopy_completions()
+{
+  zerocopy_completions_t ret{0, 0, 0};
+  while (true)
+  {
+    char          control[128];
+    struct msghdr msg;
+    std::memset(&msg, 0, sizeof(struct msghdr));
+    msg.msg_control    = control;
+    msg.msg_controllen = sizeof(control);
+
+    if (::recvmsg(_sd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+    {
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+      {
+        break;
+      }
+      throw std::runtime_error(utils::string_error(errno));
+    }
+
+    for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm != nullptr; cm = CMSG_NXTHDR(&msg, cm))
+    {
+      if ((cm->cmsg_level != SOL_IP) || (cm->cmsg_type != IP_RECVERR))
+      {
+        continue;
+      }
+      struct sock_extended_err serr;
+      std::memcpy(&serr, CMSG_DATA(cm), sizeof(struct sock_extended_err));
+      if ((serr.ee_errno != 0) || (serr.ee_origin != SO_EE_ORIGIN_ZEROCOPY))
+      {
+        continue;
+      }
+
+      // Notifications cover an inclusive range of ids and arrive in order
+      const bool copied = serr.ee_code & SO_EE_CODE_ZEROCOPY_COPIED;
+      uint32_t   count  = serr.ee_data - serr.ee_info + 1;
+      while ((count > 0) && !_zerocopy_pending.empty())
+      {
+        ret.sends += 1;
+        ret.bytes += _zerocopy_pending.front();
+        if (copied)
+        {
+          ret.copied_bytes += _zerocopy_pending.front();
+        }
+        _zerocopy_pending.pop_front();
+        --count;
+      }
+    }
+  }
+  return ret;
+}
+
+//========================================================
+/**
+ * @brief Number of zero copy sends the kernel has not released yet
+ */
+size_t udp_connection::zerocopy_pending() const
+{
+  return _zerocopy_pending.size();
+}
+
+//========================================================
+/**
+ * @brief Sets SO_ZEROCOPY so send_gather() can use MSG_ZEROCOPY, returns false if the kernel does not support it
+ */
+bool udp_connection::enable_zerocopy()
+{
+  const int enable = 1;
+  return setsockopt(_sd, SOL_SOCKET, SO_ZEROCOPY, &enable, sizeof(int)) == 0;
+}
+
+//========================================================
+/**
+ * @brief Returns and clears the pending socket error (SO_ERROR), 0 if there is none
+ */
+int udp_connection::socket_error()
+{
+  int       err = 0;
+  socklen_t len = sizeof(int);
+  if (getsockopt(_sd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+  {
+    return errno;
+  }
+  return err;
+}
+
 //========================================================
 std::vector<char> udp_connection::recv_from(std::string &ip_address, uint16_t &port_num, const size_t size)
 {
@@ -188,4 +546,24 @@ std::vector<char> udp_connection::recv_from(std::string &ip_address, uint16_t &p
   ip_address = std::string(addr_buf);
   port_num   = ntohs(sa.sin_port);
   return buffer;
-}
\ No newline at end of file
+}
+
+//========================================================
+/**
+ * @brief Receives a datagram into buffer and its source address into sa, returns 0 if none was waiting
+ */
+size_t udp_connection::recv_from(char *buffer, const size_t size, struct sockaddr_in &sa)
+{
+  socklen_t sa_len = sizeof(sa);
+  std::memset(&sa, 0, sizeof(struct sockaddr_in));
+  const ssize_t received = ::recvfrom(_sd, buffer, size, 0, (struct sockaddr *)&sa, &sa_len);
+  if ((received <= 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+  {
+    return 0;
+  }
+  else if (received < 0)
+  {
+    throw std::runtime_error(utils::string_error(errno));
+  }
+  return static_cast<size_t>(received);
+}
@@ -0,0 +1,581 @@
+#include "common/uring_poller.hpp"
+
+#include <endian.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "common/debug_macros.hpp"
+#include "common/utils.hpp"
+
+namespace
+{
+  const uint64_t REMOVE_TAG      = ~uint64_t(0);
+  const uint64_t SEND_TAG        = ~uint64_t(1);
+  const uint64_t RECV_BIT        = uint64_t(1) << 63;
+  const uint64_t READ_BIT        = uint64_t(1) << 62;
+  const unsigned MIN_RING_SIZE   = 64;
+  const unsigned MAX_RING_SIZE   = 4096;
+  const uint32_t FD_MASK         = 0xFFFFFFFF;
+  const unsigned GENERATION_BITS = 32;
+  const uint32_t GENERATION_MASK = 0x3FFFFFFF; // Clear of RECV_BIT and READ_BIT
+
+  uint64_t make_user_data(const int fd, const uint32_t generation)
+  {
+    return (static_cast<uint64_t>(generation & GENERATION_MASK) << GENERATION_BITS) | static_cast<uint32_t>(fd);
+  }
+
+  uint32_t user_data_generation(const uint64_t user_data)
+  {
+    return static_cast<uint32_t>(user_data >> GENERATION_BITS) & GENERATION_MASK;
+  }
+
+  uint32_t to_poll32_events(const uint32_t events)
+  {
+#if __BYTE_ORDER == __BIG_ENDIAN
+    return (events << 16) | (events >> 16);
+#else
+    return events;
+#endif
+  }
+}; // namespace
+
+//========================================================
+uring_poller::uring_poller(const size_t max_fds) :
+    _ring_fd(-1),
+    _ring_ptr(MAP_FAILED),
+    _ring_size(0),
+    _sqes(nullptr),
+    _sqes_size(0),
+    _sq_head(nullptr),
+    _sq_tail(nullptr),
+    _sq_mask(nullptr),
+    _sq_array(nullptr),
+    _cq_head(nullptr),
+    _cq_tail(nullptr),
+    _cq_mask(nullptr),
+    _cqes(nullptr),
+    _sq_entries(0),
+    _to_submit(0),
+    _registrations{},
+    _pending_arms{},
+    _held{},
+    _reads{},
+    _free_reads{}
+{
+  // Room for a remove and an add of both the poll and the recv of each fd, and a read, in one loop iteration, sends
+  // beyond that flush the queue early
+  unsigned entries = MIN_RING_SIZE;
+  while ((entries < (5 * max_fds + 8)) && (entries < MAX_RING_SIZE))
+  {
+    entries <<= 1;
+  }
+
+  struct io_uring_params params;
+  std::memset(&params, 0, sizeof(params));
+  _ring_fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+  if (_ring_fd < 0)
+  {
+    throw std::runtime_error("io_uring_setup failed : " + utils::string_error(errno));
+  }
+
+  const unsigned required = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_EXT_ARG;
+  if ((params.features & required) != required)
+  {
+    close(_ring_fd);
+    throw std::runtime_error("io_uring lacks required features");
+  }
+
+  const size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  const size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  _ring_size           = std::max(sq_size, cq_size);
+  _ring_ptr = mmap(nullptr, _ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring_fd, IORING_OFF_SQ_RING);
+  if (_ring_ptr == MAP_FAILED)
+  {
+    close(_ring_fd);
+    throw std::runtime_error("io_uring ring mmap failed : " + utils::string_error(errno));
+  }
+
+  _sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  void *sqes = mmap(nullptr, _sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring_fd, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED)
+  {
+    munmap(_ring_ptr, _ring_size);
+    close(_ring_fd);
+    throw std::runtime_error("io_uring sqe mmap failed : " + utils::string_error(errno));
+  }
+  _sqes = static_cast<struct io_uring_sqe *>(sqes);
+
+  char *ring  = static_cast<char *>(_ring_ptr);
+  _sq_head    = reinterpret_cast<unsigned *>(ring + params.sq_off.head);
+  _sq_tail    = reinterpret_cast<unsigned *>(ring + params.sq_off.tail);
+  _sq_mask    = reinterpret_cast<unsigned *>(ring + params.sq_off.ring_mask);
+  _sq_array   = reinterpret_cast<unsigned *>(ring + params.sq_off.array);
+  _cq_head    = reinterpret_cast<unsigned *>(ring + params.cq_off.head);
+  _cq_tail    = reinterpret_cast<unsigned *>(ring + params.cq_off.tail);
+  _cq_mask    = reinterpret_cast<unsigned *>(ring + params.cq_off.ring_mask);
+  _cqes       = reinterpret_cast<struct io_uring_cqe *>(ring + params.cq_off.cqes);
+  _sq_entries = params.sq_entries;
+}
+
+//========================================================
+uring_poller::~uring_poller()
+{
+  // Buffers of reads in flight are only kept alive until their completion is reaped
+  size_t in_flight = _reads.size() - _free_reads.size();
+  while (in_flight > 0)
+  {
+    if ((enter(_to_submit, 1, IORING_ENTER_GETEVENTS, -1) < 0) && (errno != EINTR))
+    {
+      break;
+    }
+    unsigned       head = *_cq_head;
+    const unsigned tail = __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head)
+    {
+      const uint64_t user_data = _cqes[head & *_cq_mask].user_data;
+      if ((user_data != REMOVE_TAG) && (user_data != SEND_TAG) && (user_data & READ_BIT))
+      {
+        --in_flight;
+      }
+    }
+    __atomic_store_n(_cq_head, head, __ATOMIC_RELEASE);
+  }
+  munmap(_sqes, _sqes_size);
+  munmap(_ring_ptr, _ring_size);
+  close(_ring_fd);
+}
+
+//========================================================
+event_poller::backend_t uring_poller::backend() const
+{
+  return backend_t::IO_URING;
+}
+
+//========================================================
+uring_poller::registration_t &uring_poller::registration(const int fd)
+{
+  if (fd < 0)
+  {
+    throw std::invalid_argument("Invalid fd");
+  }
+  if (static_cast<size_t>(fd) >= _registrations.size())
+  {
+    _registrations.resize(fd + 1, registration_t{});
+  }
+  return _registrations[fd];
+}
+
+//========================================================
+void uring_poller::add(const int fd, const uint32_t events, const uint64_t data)
+{
+  registration_t &reg = registration(fd);
+  if (reg.active)
+  {
+    throw std::runtime_error("uring add failed : fd already registered");
+  }
+  reg.data   = data;
+  reg.events = events;
+  reg.active = true;
+  queue_arm(fd);
+}
+
+//========================================================
+/**
+ * @brief Changes the interest of a registered fd, an outstanding poll for different events is cancelled
+ */
+void uring_poller::modify(const int fd, const uint32_t events, const uint64_t data)
+{
+  registration_t &reg = registration(fd);
+  if (!reg.active)
+  {
+    throw std::runtime_error("uring mod failed : fd not registered");
+  }
+  reg.data = data;
+  if (reg.in_flight && (poll_mask(reg, reg.events) != poll_mask(reg, events)))
+  {
+    queue_poll_remove(fd, reg);
+  }
+  reg.events = events;
+  queue_arm(fd);
+}
+
+//========================================================
+/**
+ * @brief Removes a registered fd, cancelling its poll and recv
+ *
+ * Sends queued on the fd are submitted straight away, the buffers they point to may go away with the fd.
+ */
+void uring_poller::remove(const int fd)
+{
+  registration_t &reg = registration(fd);
+  if (!reg.active)
+  {
+    throw std::runtime_error("uring del failed : fd not registered");
+  }
+  if (reg.in_flight)
+  {
+    queue_poll_remove(fd, reg);
+  }
+  if (reg.recv_in_flight)
+  {
+    queue_recv_cancel(fd, reg);
+  }
+  reg.active    = false;
+  reg.receiving = false;
+  reg.held      = false;
+  if (reg.sends_queued)
+  {
+    reg.sends_queued = false;
+    if ((_to_submit > 0) && (enter(_to_submit, 0, 0, 0) < 0))
+    {
+      throw std::runtime_error("io_uring submit failed : " + utils::string_error(errno));
+    }
+  }
+}
+
+//========================================================
+/**
+ * @brief Receives the datagrams arriving on a registered fd with IORING_OP_RECV instead of polling it for input
+ */
+bool uring_poller::receive_datagrams(const int fd)
+{
+  registration_t &reg = registration(fd);
+  if (!reg.active)
+  {
+    throw std::runtime_error("uring receive failed : fd not registered");
+  }
+  if (reg.receiving)
+  {
+    return true;
+  }
+  if (reg.in_flight)
+  {
+    // Polled for input, it is re-armed without it
+    queue_poll_remove(fd, reg);
+  }
+  if (reg.buffer.empty())
+  {
+    reg.buffer.resize(MAX_DATAGRAM_SIZE);
+  }
+  reg.receiving = true;
+  queue_arm(fd);
+  return true;
+}
+
+//========================================================
+/**
+ * @brief Queues an IORING_OP_SEND of data on fd, its completion is not reported
+ */
+bool uring_poller::queue_send(const int fd, const char *data, const size_t size)
+{
+  registration_t &reg = registration(fd);
+  io_uring_sqe   *sqe = next_sqe();
+  sqe->opcode         = IORING_OP_SEND;
+  sqe->fd             = fd;
+  sqe->addr           = reinterpret_cast<uint64_t>(data);
+  sqe->len            = static_cast<uint32_t>(size);
+  sqe->msg_flags      = MSG_DONTWAIT;
+  sqe->user_data      = SEND_TAG;
+  reg.sends_queued    = true;
+  return true;
+}
+
+//========================================================
+/**
+ * @brief Queues an IORING_OP_READV of the file fd at offset, its completion is reported as an event carrying data
+ */
+bool uring_poller::queue_read(const int fd, const struct iovec *iov, const size_t count, const uint64_t offset,
+                              const uint64_t data, std::shared_ptr<const void> keep_alive)
+{
+  io_uring_sqe *sqe   = next_sqe();
+  uint32_t      index = static_cast<uint32_t>(_reads.size());
+  if (_free_reads.empty())
+  {
+    _reads.emplace_back();
+  }
+  else
+  {
+    index = _free_reads.back();
+    _free_reads.pop_back();
+  }
+  _reads[index]  = read_t{data, std::move(keep_alive)};
+  sqe->opcode    = IORING_OP_READV;
+  sqe->fd        = fd;
+  sqe->addr      = reinterpret_cast<uint64_t>(iov);
+  sqe->len       = static_cast<uint32_t>(count);
+  sqe->off       = offset;
+  sqe->user_data = READ_BIT | index;
+  return true;
+}
+
+//========================================================
+/**
+ * @brief Submits queued interest changes and waits for events in one io_uring_enter()
+ *
+ * Returns the number of events or -1 with errno set, like epoll_wait().
+ */
+int uring_poller::wait(event_t *events, const int max_events, const int timeout_ms)
+{
+  for (const int fd : _pending_arms)
+  {
+    registration_t &reg = _registrations[fd];
+    reg.pending_arm     = false;
+    if (!reg.active)
+    {
+      continue;
+    }
+    if (!reg.in_flight && (!reg.receiving || (poll_mask(reg, reg.events) != 0)))
+    {
+      queue_poll_add(fd, reg);
+    }
+    if (reg.receiving && !reg.recv_in_flight && !reg.held)
+    {
+      queue_recv(fd, reg);
+    }
+  }
+  _pending_arms.clear();
+
+  // Datagrams held while their fd was not polled for input are reported without waiting
+  const bool held_ready =
+      std::any_of(_held.begin(), _held.end(), [this](const int fd) { return report_ready(_registrations[fd]); });
+  const bool completions_ready = __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE) != *_cq_head;
+  if (completions_ready || held_ready || (timeout_ms == 0))
+  {
+    if ((_to_submit > 0) && (enter(_to_submit, 0, 0, 0) < 0) && (errno != EINTR))
+    {
+      return -1;
+    }
+  }
+  else if (enter(_to_submit, 1, IORING_ENTER_GETEVENTS, timeout_ms) < 0)
+  {
+    if (errno == ETIME)
+    {
+      return 0;
+    }
+    return -1;
+  }
+
+  int      num_events = 0;
+  unsigned head       = *_cq_head;
+  unsigned tail       = __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE);
+  while ((head != tail) && (num_events < max_events))
+  {
+    const struct io_uring_cqe &cqe = _cqes[head & *_cq_mask];
+    ++head;
+
+    if ((cqe.user_data == REMOVE_TAG) || (cqe.user_data == SEND_TAG))
+    {
+      continue;
+    }
+    if (cqe.user_data & READ_BIT)
+    {
+      const uint32_t index        = static_cast<uint32_t>(cqe.user_data & FD_MASK);
+      events[num_events].events   = 0;
+      events[num_events].data     = _reads[index].data;
+      events[num_events].datagram = {};
+      events[num_events].result   = cqe.res;
+      ++num_events;
+      _reads[index].keep_alive.reset();
+      _free_reads.push_back(index);
+      continue;
+    }
+    const int       fd         = static_cast<int>(cqe.user_data & FD_MASK);
+    const uint32_t  generation = user_data_generation(cqe.user_data);
+    registration_t &reg        = _registrations[fd];
+    if (cqe.user_data & RECV_BIT)
+    {
+      if (!reg.active || !reg.recv_in_flight || ((reg.recv_generation & GENERATION_MASK) != generation))
+      {
+        // Completion of a recv that has since been cancelled
+        continue;
+      }
+      reg.recv_in_flight = false;
+      if (cqe.res == -ECANCELED)
+      {
+        queue_arm(fd);
+        continue;
+      }
+      reg.recv_result = cqe.res;
+      reg.held        = true;
+      _held.push_back(fd);
+      continue;
+    }
+    if (!reg.active || !reg.in_flight || ((reg.generation & GENERATION_MASK) != generation))
+    {
+      // Completion of a poll that has since been removed or replaced
+      continue;
+    }
+    reg.in_flight               = false;
+    events[num_events].events   = (cqe.res < 0) ? static_cast<uint32_t>(EPOLLERR) : static_cast<uint32_t>(cqe.res);
+    events[num_events].data     = reg.data;
+    events[num_events].datagram = {};
+    events[num_events].result   = 0;
+    ++num_events;
+    queue_arm(fd);
+  }
+  __atomic_store_n(_cq_head, head, __ATOMIC_RELEASE);
+
+  // The datagram stays in the buffer until the recv is re-armed on the next wait()
+  size_t kept = 0;
+  for (const int fd : _held)
+  {
+    registration_t &reg = _registrations[fd];
+    if (!reg.held)
+    {
+      continue;
+    }
+    if (!report_ready(reg) || (num_events >= max_events))
+    {
+      _held[kept++] = fd;
+      continue;
+    }
+    reg.held = false;
+    if (reg.recv_result < 0)
+    {
+      events[num_events].events   = EPOLLERR;
+      events[num_events].datagram = {};
+    }
+    else
+    {
+      events[num_events].events   = EPOLLIN;
+      events[num_events].datagram = std::string_view(reg.buffer.data(), static_cast<size_t>(reg.recv_result));
+    }
+    events[num_events].data   = reg.data;
+    events[num_events].result = 0;
+    ++num_events;
+    queue_arm(fd);
+  }
+  _held.resize(kept);
+  return num_events;
+}
+
+//========================================================
+/**
+ * @brief Events to poll for, input is left out for an fd whose datagrams the poller receives
+ */
+uint32_t uring_poller::poll_mask(const registration_t &reg, const uint32_t events) const
+{
+  return reg.receiving ? (events & ~static_cast<uint32_t>(EPOLLIN)) : events;
+}
+
+//========================================================
+bool uring_poller::report_ready(const registration_t &reg) const
+{
+  return reg.active && reg.held && (reg.events & EPOLLIN);
+}
+
+//========================================================
+void uring_poller::queue_arm(const int fd)
+{
+  registration_t &reg = _registrations[fd];
+  if (!reg.pending_arm)
+  {
+    reg.pending_arm = true;
+    _pending_arms.push_back(fd);
+  }
+}
+
+//========================================================
+void uring_poller::queue_poll_add(const int fd, registration_t &reg)
+{
+  io_uring_sqe *sqe  = next_sqe();
+  sqe->opcode        = IORING_OP_POLL_ADD;
+  sqe->fd            = fd;
+  sqe->poll32_events = to_poll32_events(poll_mask(reg, reg.events));
+  sqe->user_data     = make_user_data(fd, reg.generation);
+  reg.in_flight      = true;
+}
+
+//========================================================
+void uring_poller::queue_poll_remove(const int fd, registration_t &reg)
+{
+  io_uring_sqe *sqe = next_sqe();
+  sqe->opcode       = IORING_OP_POLL_REMOVE;
+  sqe->fd           = -1;
+  sqe->addr         = make_user_data(fd, reg.generation);
+  sqe->user_data    = REMOVE_TAG;
+  reg.in_flight     = false;
+  reg.generation += 1;
+}
+
+//========================================================
+void uring_poller::queue_recv(const int fd, registration_t &reg)
+{
+  io_uring_sqe *sqe  = next_sqe();
+  sqe->opcode        = IORING_OP_RECV;
+  sqe->fd            = fd;
+  sqe->addr          = reinterpret_cast<uint64_t>(reg.buffer.data());
+  sqe->len           = static_cast<uint32_t>(reg.buffer.size());
+  sqe->user_data     = make_user_data(fd, reg.recv_generation) | RECV_BIT;
+  reg.recv_in_flight = true;
+}
+
+//========================================================
+void uring_poller::queue_recv_cancel(const int fd, registration_t &reg)
+{
+  io_uring_sqe *sqe  = next_sqe();
+  sqe->opcode        = IORING_OP_ASYNC_CANCEL;
+  sqe->fd            = -1;
+  sqe->addr          = make_user_data(fd, reg.recv_generation) | RECV_BIT;
+  sqe->user_data     = REMOVE_TAG;
+  reg.recv_in_flight = false;
+  reg.recv_generation += 1;
+}
+
+//========================================================
+/**
+ * @brief Returns a zeroed submission entry, flushing the queue to the kernel first if it is full
+ */
+io_uring_sqe *uring_poller::next_sqe()
+{
+  if (_to_submit == _sq_entries)
+  {
+    if (enter(_to_submit, 0, 0, 0) < 0)
+    {
+      throw std::runtime_error("io_uring submit failed : " + utils::string_error(errno));
+    }
+  }
+
+  const unsigned tail  = *_sq_tail;
+  const unsigned index = tail & *_sq_mask;
+  io_uring_sqe  *sqe   = &_sqes[index];
+  std::memset(sqe, 0, sizeof(io_uring_sqe));
+  _sq_array[index] = index;
+  __atomic_store_n(_sq_tail, tail + 1, __ATOMIC_RELEASE);
+  ++_to_submit;
+  return sqe;
+}
+
+//========================================================
+int uring_poller::enter(const unsigned to_submit, const unsigned min_complete, const unsigned flags,
+                        const int timeout_ms)
+{
+  struct __kernel_timespec       ts;
+  struct io_uring_getevents_arg  arg;
+  std::memset(&arg, 0, sizeof(arg));
+  arg.sigmask_sz = _NSIG / 8;
+
+  unsigned enter_flags = flags;
+  if ((flags & IORING_ENTER_GETEVENTS) && (timeout_ms >= 0))
+  {
+    ts.tv_sec   = timeout_ms / 1000;
+    ts.tv_nsec  = (timeout_ms % 1000) * 1000000LL;
+    arg.ts      = reinterpret_cast<uint64_t>(&ts);
+    enter_flags |= IORING_ENTER_EXT_ARG;
+  }
+
+  const int ret = static_cast<int>(syscall(__NR_io_uring_enter, _ring_fd, to_submit, min_complete, enter_flags,
+                                           (enter_flags & IORING_ENTER_EXT_ARG) ? &arg : nullptr,
+                                           (enter_flags & IORING_ENTER_EXT_ARG) ? sizeof(arg) : 0));
+
+  // Whatever the outcome, the kernel has consumed the entries up to its head
+  _to_submit = *_sq_tail - __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE);
+  return ret;
+}
@@ -2,87 +2,26 @@
 #include "common/utils.hpp"
 
 #include <algorithm>
-#include <net/if.h>
-#include <sys/ioctl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/statvfs.h>
+
+#include "common/netascii.hpp"
 
 //========================================================
 std::vector<char> utils::native_to_netascii(const std::vector<char> &data)
 {
-  const char CR = (char)0x0D;
-  const char LF = (char)0x0A;
-
-  std::vector<char> ret;
-  ret.reserve(data.size() * 2); // Worst case where every char is a \n
-
-  // TODO: make this more efficient
-  for (const auto &c : data)
-  {
-    if (c == LF)
-    {
-      ret.push_back(CR);
-      ret.push_back(LF);
-    }
-    else if (c == CR)
-    {
-      ret.push_back(CR);
-      ret.push_back(0);
-    }
-    else
-    {
-      ret.push_back(c);
-    }
-  }
-
+  std::vector<char> ret(netascii::max_encoded_size(data.size()));
+  ret.resize(netascii::encode(data.data(), data.size(), ret.data()));
   return ret;
 }
 
 //========================================================
 std::vector<char> utils::netascii_to_native(const std::vector<char> &data)
 {
-  const char CR = (char)0x0D;
-  const char LF = (char)0x0A;
-
-  std::vector<char> ret;
-  ret.reserve(data.size());
-
-  // TODO: make this more efficient
-  auto iter = data.cbegin();
-  while (iter != data.cend())
-  {
-    if (*iter == CR)
-    {
-      if (std::next(iter) != data.cend())
-      {
-        const auto next = *std::next(iter);
-        if (next == '\0') // CR NULL to CR
-        {
-          ret.push_back(*iter);
-          iter = std::next(iter);
-        }
-        else if (next == LF)
-        {
-          // CR LF to LF
-          // Skip the CR
-        }
-        else
-        {
-          throw std::runtime_error("Invalid character sequence : CR with no LF or NULL");
-        }
-      }
-      else
-      {
-        throw std::runtime_error("Invalid character sequence : EOL after CR");
-      }
-    }
-    else
-    {
-      ret.push_back(*iter);
-    }
-
-    ++iter;
-  }
-
+  std::vector<char> ret(data.size());
+  ret.resize(netascii::decode(data.data(), data.size(), ret.data()));
   return ret;
 }
 
@@ -142,16 +81,21 @@ std::vector<std::string> utils::extract_c_strings_from_buffer(const std::vector<
 }
 
 //========================================================
+/**
+ * @brief Path MTU of the route a connected socket sends on, as the kernel knows it, or -1 if the socket is not
+ * connected
+ */
 int utils::get_mtu(const int sd)
 {
-  struct ifreq res;
+  int       mtu = 0;
+  socklen_t len = sizeof(mtu);
 
-  if (ioctl(sd, SIOCGIFMTU, &res) < 0)
+  if (getsockopt(sd, IPPROTO_IP, IP_MTU, &mtu, &len) < 0)
   {
     return -1;
   }
 
-  return res.ifr_mtu;
+  return mtu;
 }
 
 //========================================================
@@ -164,3 +108,17 @@ size_t utils::get_file_size(const char *fname)
   }
   return 0;
 }
+
+//========================================================
+/**
+ * @brief Returns the bytes free for unprivileged users on the filesystem holding path
+ */
+std::optional<uint64_t> utils::get_free_space(const char *path)
+{
+  struct statvfs s;
+  if ((path == nullptr) || (statvfs(path, &s) < 0))
+  {
+    return {};
+  }
+  return static_cast<uint64_t>(s.f_bavail) * s.f_frsize;
+}
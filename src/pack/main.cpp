@@ -0,0 +1,39 @@
+
+#include <fmt/core.h>
+
+#include <exception>
+#include <string>
+
+#include "common/pack_file.hpp"
+
+//==========================================================
+void print_help(char *argv0)
+{
+  fmt::print(stderr, "Usage: {} [SOURCE_DIR] [PACK_FILE]\n", argv0);
+  fmt::print(stderr, "\tSOURCE_DIR: Directory tree to pack, symbolic links in it are skipped\n");
+  fmt::print(stderr, "\tPACK_FILE:  Pack to write, replaced atomically if it exists so a running server swaps to it\n");
+}
+
+//==========================================================
+int main(int argc, char **argv)
+{
+  if (argc < 3)
+  {
+    print_help(argv[0]);
+    return 1;
+  }
+
+  const std::string source_dir(argv[1]);
+  const std::string pack_path(argv[2]);
+  try
+  {
+    const auto stats = pack_file::build(source_dir, pack_path);
+    fmt::print("Packed {} files, {} bytes, into {}\n", stats.files, stats.bytes, pack_path);
+  }
+  catch (const std::exception &e)
+  {
+    fmt::print(stderr, "Failed to pack {}: {}\n", source_dir, e.what());
+    return 1;
+  }
+  return 0;
+}
@@ -1,6 +1,11 @@
-
+#include <getopt.h>
 #include <signal.h>
 
+#include <cctype>
+#include <iterator>
+#include <limits>
+#include <string>
+
 #include "common/debug_macros.hpp"
 #include "server/tftp_server.hpp"
 
@@ -11,41 +16,259 @@ void setup_signal_handlers();
 void print_usage(char *argv0);
 int  initialise_logger(const bool trace);
 
-//==========================================================
-int main(int argc, char **argv)
+namespace
 {
+  // Options without a short form
+  enum long_option_t : int
+  {
+    HELP = 256,
+    MAX_CLIENTS,
+    ZEROCOPY,
+    CACHE_MB,
+    IO_THREADS,
+    PREFETCH,
+    SYNC,
+    DGRAM_CACHE_MB,
+    META_CACHE,
+    PACK,
+    MMAP_MIN_KB,
+    MULTICAST,
+    FRAGMENT,
+    DUP_ACKS
+  };
 
-  if (argc < 3)
+  /**
+   * @brief Parses the unsigned number given to an option into value, scaled by unit, printing why if it is not one
+   */
+  template <typename T>
+  bool parse_number(const char *name, const std::string &text, T &value, const uint64_t unit = 1)
   {
-    print_usage(argv[0]);
-    return 1;
+    // std::stoull() takes a sign and ignores trailing characters, neither belongs in a count or a size
+    size_t   end    = 0;
+    uint64_t parsed = 0;
+    try
+    {
+      parsed = std::stoull(text, &end);
+    }
+    catch (const std::out_of_range &)
+    {
+      parsed = std::numeric_limits<uint64_t>::max();
+      end    = text.size();
+    }
+    catch (const std::invalid_argument &)
+    {
+    }
+    if ((end == 0) || (end != text.size()) || !std::isdigit(static_cast<unsigned char>(text[0])))
+    {
+      fmt::print(stderr, "Invalid --{} '{}' : not a number\n", name, text);
+      return false;
+    }
+    const uint64_t max = std::numeric_limits<T>::max() / unit;
+    if (parsed > max)
+    {
+      fmt::print(stderr, "Invalid --{} '{}' : at most {}\n", name, text, max);
+      return false;
+    }
+    value = static_cast<T>(parsed * unit);
+    return true;
   }
 
-  bool log_trace = false;
-  if (argc > 3)
+  /**
+   * @brief Sets a switch, given as an option it is on, given as a positional argument it is on for a non zero number
+   */
+  bool parse_switch(const char *name, const char *text, bool &value)
   {
-    try
+    uint64_t number = 1;
+    if ((text != nullptr) && !parse_number(name, text, number))
+    {
+      return false;
+    }
+    value = (number != 0);
+    return true;
+  }
+
+  /**
+   * @brief Applies the value of one option to options, returns false after printing why if it is not valid
+   */
+  bool apply_option(const int option, const char *value, server_options &options, bool &verbose)
+  {
+    bool valid = true;
+    switch (option)
     {
-      log_trace = std::stoul(argv[3]);
+    case 'v':
+      valid = parse_switch("verbose", value, verbose);
+      break;
+    case 'i':
+      options.interface = value;
+      break;
+    case 'p':
+      valid = parse_number("port", value, options.port);
+      break;
+    case 'w':
+      valid = parse_number("workers", value, options.workers);
+      break;
+    case 'b': {
+      const auto backend = event_poller::string_to_backend(value);
+      if (!backend)
+      {
+        fmt::print(stderr, "Unknown --backend '{}'\n", value);
+        return false;
+      }
+      options.backend = *backend;
+      break;
     }
-    catch (const std::exception &err)
+    case MAX_CLIENTS:
+      valid = parse_number("max-clients", value, options.max_clients);
+      break;
+    case ZEROCOPY:
+      valid = parse_switch("zerocopy", value, options.zero_copy);
+      break;
+    case CACHE_MB:
+      valid = parse_number("cache-mb", value, options.cache_bytes, 1024 * 1024);
+      break;
+    case IO_THREADS:
+      valid = parse_number("io-threads", value, options.io_threads);
+      break;
+    case PREFETCH:
+      valid = parse_number("prefetch", value, options.prefetch_blocks);
+      break;
+    case SYNC: {
+      const auto sync_policy = tftp_write_file::string_to_sync_policy(value);
+      if (!sync_policy)
+      {
+        fmt::print(stderr, "Unknown --sync '{}'\n", value);
+        return false;
+      }
+      options.sync_policy = *sync_policy;
+      break;
+    }
+    case DGRAM_CACHE_MB:
+      valid = parse_number("dgram-cache-mb", value, options.datagram_cache_bytes, 1024 * 1024);
+      break;
+    case META_CACHE:
+      valid = parse_number("meta-cache", value, options.metadata_cache_entries);
+      break;
+    case PACK:
+      options.pack_path = value;
+      break;
+    case MMAP_MIN_KB:
+      valid = parse_number("mmap-min-kb", value, options.mmap_min_bytes, 1024);
+      break;
+    case MULTICAST:
+      options.multicast_group = value;
+      break;
+    case FRAGMENT:
+      valid = parse_switch("fragment", value, options.allow_fragmentation);
+      break;
+    case DUP_ACKS:
+      valid = parse_number("dup-acks", value, options.dup_ack_threshold);
+      break;
+    default:
+      break;
+    }
+    return valid;
+  }
+
+  /**
+   * @brief Parses the command line into options, returns false after printing why if it is not valid
+   */
+  bool parse_options(int argc, char **argv, server_options &options, bool &verbose, bool &help)
+  {
+    static const struct option long_options[] = {{"help", no_argument, 0, HELP},
+                                                 {"verbose", no_argument, 0, 'v'},
+                                                 {"interface", required_argument, 0, 'i'},
+                                                 {"port", required_argument, 0, 'p'},
+                                                 {"workers", required_argument, 0, 'w'},
+                                                 {"backend", required_argument, 0, 'b'},
+                                                 {"max-clients", required_argument, 0, MAX_CLIENTS},
+                                                 {"zerocopy", no_argument, 0, ZEROCOPY},
+                                                 {"cache-mb", required_argument, 0, CACHE_MB},
+                                                 {"io-threads", required_argument, 0, IO_THREADS},
+                                                 {"prefetch", required_argument, 0, PREFETCH},
+                                                 {"sync", required_argument, 0, SYNC},
+                                                 {"dgram-cache-mb", required_argument, 0, DGRAM_CACHE_MB},
+                                                 {"meta-cache", required_argument, 0, META_CACHE},
+                                                 {"pack", required_argument, 0, PACK},
+                                                 {"mmap-min-kb", required_argument, 0, MMAP_MIN_KB},
+                                                 {"multicast", required_argument, 0, MULTICAST},
+                                                 {"fragment", no_argument, 0, FRAGMENT},
+                                                 {"dup-acks", required_argument, 0, DUP_ACKS},
+                                                 {0, 0, 0, 0}};
+
+    while (true)
+    {
+      int       option_index = 0;
+      const int c            = getopt_long(argc, argv, "vi:p:w:b:", long_options, &option_index);
+      if (c == -1)
+      {
+        break;
+      }
+
+      switch (c)
+      {
+      case HELP:
+        help = true;
+        return true;
+      case '?':
+        // getopt_long() has printed what is wrong
+        return false;
+      default:
+        if (!apply_option(c, optarg, options, verbose))
+        {
+          return false;
+        }
+      }
+    }
+
+    // SERVER_ROOT INTERFACE [DEBUG] [WORKERS] ... as earlier releases took them, each setting in a fixed position
+    static const int positional[] = {'i', 'v', 'w', 'b', ZEROCOPY, CACHE_MB, IO_THREADS, PREFETCH, SYNC, DGRAM_CACHE_MB,
+                                     META_CACHE, PACK, MMAP_MIN_KB, MULTICAST, FRAGMENT, DUP_ACKS};
+
+    const int count = argc - optind;
+    if ((count < 1) || (count > 1 + static_cast<int>(std::size(positional))))
+    {
+      fmt::print(stderr, "Expected the server root, and at most {} positional settings after it\n",
+                 std::size(positional));
+      return false;
+    }
+    options.server_root = argv[optind];
+    for (int i = 1; i < count; ++i)
     {
-      fmt::print(stderr, "Failed to parse DEBUG argument : {}\n", err.what());
-      return 1;
+      if (!apply_option(positional[i - 1], argv[optind + i], options, verbose))
+      {
+        return false;
+      }
     }
+    return true;
+  }
+} // namespace
+
+//==========================================================
+int main(int argc, char **argv)
+{
+  server_options options;
+  bool           verbose = false;
+  bool           help    = false;
+  if (!parse_options(argc, argv, options, verbose, help))
+  {
+    fmt::print(stderr, "Try '{} --help' for the options\n", argv[0]);
+    return 1;
+  }
+  if (help)
+  {
+    print_usage(argv[0]);
+    return 0;
   }
-  const std::string server_root(argv[1]);
-  const std::string interface(argv[2]);
 
   setup_signal_handlers();
-  if (initialise_logger(log_trace))
+  if (initialise_logger(verbose))
   {
     return 1;
   }
 
   try
   {
-    tftp_server server(server_root, interface, 69, 100);
+    tftp_server server(options);
     _pserver = &server;
 
     dbg_trace("Starting server");
@@ -88,10 +311,39 @@ void setup_signal_handlers()
 //==========================================================
 void print_usage(char *argv0)
 {
-  fmt::print(stderr, "Usage: {} [SERVER_ROOT] [INTERFACE] [DEBUG]\n", argv0);
-  fmt::print(stderr, "\tSERVER_ROOT: (Required) Path to a directory from which to serve / receive files\n");
-  fmt::print(stderr, "\tINTERFACE:   (Required) Local ip address to bind to (0.0.0.0 for all)\n");
-  fmt::print(stderr, "\tDEBUG:       (Optional) 1 to turn on debug and trace prints\n");
+  const char usage_msg[] = R"({}: [OPTIONS] SERVER_ROOT
+  SERVER_ROOT      : Directory from which to serve / receive files
+  -i --interface   : Local ip address to bind to (default all)
+  -p --port        : Port to listen on (default 69)
+  -w --workers     : Number of worker threads, each with its own event loop (default 1)
+  -b --backend     : Event backend, epoll or io_uring (default epoll, io_uring falls back to epoll if unavailable)
+  --max-clients    : Sessions served at once, shared out between the workers (default 100)
+  --zerocopy       : Send octet reads from a file mapping with MSG_ZEROCOPY
+  --cache-mb       : Size in MiB of the file contents cache shared by all sessions (default 0, off)
+  --io-threads     : Number of threads doing file I/O for the workers (default 0, file I/O is done by the workers)
+  --prefetch       : Number of blocks each read session keeps read ahead of the client (default {}, at least the
+                     windowsize)
+  --sync           : When uploads are synced to disk, none, close or a number of MiB to sync after (default none)
+  --dgram-cache-mb : Size in MiB of the cache of ready to send DATA datagrams shared by all sessions (default 0, off)
+  --meta-cache     : Number of requested paths whose checks and size are cached (default 0, off)
+  --pack           : Pack file built with tftp_pack to serve reads from before the root, swapped for a new one
+                     renamed over it
+  --mmap-min-kb    : Files of at least this many KiB are read through a memory mapping instead of pread() (default
+                     0, never)
+  --multicast      : address:port reads asking for the multicast option (RFC 2090) are sent to, each file on its own
+                     port from port up (default off)
+  --fragment       : Accept block sizes up to 65464 whatever the path MTU, leaving large DATA packets to IP
+                     fragmentation
+  --dup-acks       : Duplicate ACKs in a row that resend the window before the timeout (default 0, only the timeout
+                     resends)
+  -v --verbose     : Turn on debug and trace prints
+  --help           : Print this help
+
+The positional form of earlier releases is still accepted, each setting given a value in this order:
+  {} SERVER_ROOT INTERFACE [DEBUG] [WORKERS] [BACKEND] [ZEROCOPY] [CACHE_MB] [IO_THREADS] [PREFETCH] [SYNC]
+     [DGRAM_CACHE_MB] [META_CACHE] [PACK] [MMAP_MIN_KB] [MULTICAST] [FRAGMENT] [DUP_ACKS]
+)";
+  fmt::print(stderr, usage_msg, argv0, server_options::PREFETCH_BLOCKS, argv0);
 }
 
 //==========================================================
@@ -100,7 +352,7 @@ int initialise_logger(const bool trace)
   try
   {
     spdlog::set_pattern(LOGGER_PATTERN);
-    auto err_logger = spdlog::stderr_color_st("console");
+    auto err_logger = spdlog::stderr_color_mt("console");
     if (trace)
     {
       spdlog::set_level(spdlog::level::trace);
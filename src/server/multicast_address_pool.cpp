@@ -0,0 +1,97 @@
+#include "server/multicast_address_pool.hpp"
+
+#include <arpa/inet.h>
+
+#include <cstring>
+#include <stdexcept>
+
+//========================================================
+/**
+ * @brief Pool of count ports on the group given as "address:port", the address must be an IPv4 multicast address
+ */
+multicast_address_pool::multicast_address_pool(const std::string &group, const uint16_t count) :
+    _mutex(), _group{}, _first_port(0), _free_ports{}
+{
+  const auto colon = group.rfind(':');
+  if (colon == std::string::npos)
+  {
+    throw std::invalid_argument("Multicast group must be given as address:port");
+  }
+  if (inet_pton(AF_INET, group.substr(0, colon).c_str(), &_group) != 1)
+  {
+    throw std::invalid_argument("Invalid multicast address '" + group.substr(0, colon) + "'");
+  }
+  if (!IN_MULTICAST(ntohl(_group.s_addr)))
+  {
+    throw std::invalid_argument("Not a multicast address '" + group.substr(0, colon) + "'");
+  }
+  unsigned long port = 0;
+  try
+  {
+    port = std::stoul(group.substr(colon + 1));
+  }
+  catch (const std::exception &)
+  {
+    throw std::invalid_argument("Invalid multicast port '" + group.substr(colon + 1) + "'");
+  }
+  if ((port == 0) || (count == 0) || ((port + count - 1) > UINT16_MAX))
+  {
+    throw std::invalid_argument("Multicast ports out of range");
+  }
+  _first_port = static_cast<uint16_t>(port);
+
+  // Handed out lowest first
+  _free_ports.reserve(count);
+  for (uint16_t i = count; i > 0; --i)
+  {
+    _free_ports.push_back(static_cast<uint16_t>(_first_port + i - 1));
+  }
+}
+
+//========================================================
+/**
+ * @brief Takes an address for a new transfer, nullopt when every port is in use
+ */
+std::optional<struct sockaddr_in> multicast_address_pool::acquire()
+{
+  std::lock_guard<std::mutex> lock(_mutex);
+  if (_free_ports.empty())
+  {
+    return std::nullopt;
+  }
+  struct sockaddr_in address;
+  std::memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr   = _group;
+  address.sin_port   = htons(_free_ports.back());
+  _free_ports.pop_back();
+  return address;
+}
+
+//========================================================
+void multicast_address_pool::release(const struct sockaddr_in &address)
+{
+  std::lock_guard<std::mutex> lock(_mutex);
+  _free_ports.push_back(ntohs(address.sin_port));
+}
+
+//========================================================
+size_t multicast_address_pool::available() const
+{
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _free_ports.size();
+}
+
+//========================================================
+/**
+ * @brief The group address with the first port, datagrams to any of the pool's addresses take the same route
+ */
+struct sockaddr_in multicast_address_pool::first_address() const
+{
+  struct sockaddr_in address;
+  std::memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr   = _group;
+  address.sin_port   = htons(_first_port);
+  return address;
+}
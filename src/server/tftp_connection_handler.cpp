@@ -2,11 +2,26 @@
 
 #include "common/debug_macros.hpp"
 #include "common/utils.hpp"
+#include "server/tftp_multicast_group.hpp"
+
+namespace
+{
+  const size_t BATCH_SIZE        = 32;
+  const size_t MAX_REQUEST_BYTES = 2048;
+}; // namespace
 
 //========================================================
-tftp_connection_handler::tftp_connection_handler(const std::string &addr, const uint16_t port) :
-    _udp(), _request_queue{}
+tftp_connection_handler::tftp_connection_handler(const std::string &addr, const uint16_t port, const bool reuse_port) :
+    _udp(),
+    _batch(BATCH_SIZE, MAX_REQUEST_BYTES),
+    _request_queue{},
+    _sessions{},
+    _duplicates(0)
 {
+  if (reuse_port)
+  {
+    _udp.set_reuse_port(true);
+  }
   _udp.bind(addr, port);
   _udp.set_non_blocking(true);
 }
@@ -18,33 +33,37 @@ int tftp_connection_handler::sd() const
 }
 
 //========================================================
+/**
+ * @brief Drains the listening socket with batched receives, queueing every valid request that is not a duplicate
+ */
 void tftp_connection_handler::handle_read()
 {
-  std::string ip_address = "";
-  uint16_t    port_num   = 0;
-  auto        data       = _udp.recv_from(ip_address, port_num, 2048);
-
-  while (!data.empty())
+  // A short batch means the socket is drained, epoll is level triggered so anything arriving later wakes us again
+  size_t received = _batch.capacity();
+  while (received == _batch.capacity())
   {
-    auto       request = tftp::deserialise_rw_packet(data);
-    const auto client  = utils::to_sockaddr_in(ip_address, port_num);
-    if (!client || !request)
+    received = _udp.recv_batch(_batch);
+    for (size_t i = 0; i < received; ++i)
     {
-      if (client)
+      const auto &client  = _batch.address(i);
+      auto        request = tftp::deserialise_rw_packet(_batch.data(i));
+      if (!request)
       {
-        dbg_err("Failed to parse request from {}", client.value());
+        dbg_err("Failed to parse request from {}", client);
+        continue;
+      }
+      auto key = request_key(*request, client);
+      if (!key.empty() && !_sessions.insert(key).second)
+      {
+        ++_duplicates;
+        dbg_dbg("Dropped repeated request from {} for '{}'", client, request->filename);
       }
       else
       {
-        dbg_err("Failed to parse request");
+        dbg_trace("Enqueued request from {}", client);
+        _request_queue.emplace(std::move(request.value()), client, std::move(key));
       }
     }
-    else
-    {
-      dbg_trace("Enqueued request from {}:{}", ip_address, port_num);
-      _request_queue.emplace(request.value(), client.value());
-    }
-    data = _udp.recv_from(ip_address, port_num, 2048);
   }
 }
 
@@ -64,4 +83,59 @@ tftp_connection_handler::request_t tftp_connection_handler::get_request()
   auto ret = _request_queue.front();
   _request_queue.pop();
   return ret;
-}
\ No newline at end of file
+}
+
+//========================================================
+/**
+ * @brief Number of repeated requests dropped
+ */
+size_t tftp_connection_handler::duplicates() const
+{
+  return _duplicates;
+}
+
+//========================================================
+/**
+ * @brief Forgets the request a closed session was started for, so the same request from the same client is accepted
+ * again
+ */
+void tftp_connection_handler::session_ended(const std::string &key)
+{
+  _sessions.erase(key);
+}
+
+//========================================================
+/**
+ * @brief Answers a request no session could be started for with an error from the listening socket, and forgets it
+ * like a session that ended
+ */
+void tftp_connection_handler::refuse(const request_t &request, const tftp::error_packet_t &error)
+{
+  const auto data = tftp::serialise_error_packet(error);
+  if (_udp.send_to(request.client, data.data(), data.size()) < 0)
+  {
+    dbg_err("Failed to send error to {} : {}", request.client, utils::string_error(errno));
+  }
+  if (!request.key.empty())
+  {
+    session_ended(request.key);
+  }
+}
+
+//========================================================
+/**
+ * @brief Identifies a request by client address and port, operation and file, empty for requests that may repeat
+ */
+std::string tftp_connection_handler::request_key(const tftp::rw_packet_t &request, const sockaddr_in &client)
+{
+  if (tftp_multicast_group::is_multicast_request(request))
+  {
+    return {};
+  }
+
+  std::string key(reinterpret_cast<const char *>(&client.sin_addr), sizeof(client.sin_addr));
+  key.append(reinterpret_cast<const char *>(&client.sin_port), sizeof(client.sin_port));
+  key.push_back(static_cast<char>(request.type));
+  key.append(request.filename);
+  return key;
+}
@@ -0,0 +1,565 @@
+#include "server/tftp_multicast_group.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+
+#include "common/debug_macros.hpp"
+#include "common/utils.hpp"
+
+namespace
+{
+  const char     BLKSIZE_OPT[]      = "BLKSIZE";
+  const char     TSIZE_OPT[]        = "TSIZE";
+  const char     MULTICAST_OPT[]    = "MULTICAST";
+  const size_t   DEFAULT_BLKSIZE    = 512;
+  const uint32_t DEFAULT_TIMEOUT_MS = 2000;
+  const uint32_t INITIAL_RTO_MS     = 1000;
+  const uint32_t MIN_RTO_MS         = 5;
+
+  bool has_option(const tftp::rw_packet_t &request, const char *name)
+  {
+    return std::any_of(request.options.begin(), request.options.end(),
+                       [name](const auto &opt) { return std::strcmp(opt.first.c_str(), name) == 0; });
+  }
+
+  /**
+   * @brief Block size asked for with the blksize option, the default if it is missing or out of range
+   */
+  size_t requested_block_size(const tftp::rw_packet_t &request)
+  {
+    for (const auto &opt : request.options)
+    {
+      if (std::strcmp(opt.first.c_str(), BLKSIZE_OPT) != 0)
+      {
+        continue;
+      }
+      try
+      {
+        const size_t val = std::stoul(opt.second);
+        if ((val >= tftp::MIN_BLOCK_SIZE) && (val <= tftp::MAX_BLOCK_SIZE))
+        {
+          return val;
+        }
+      }
+      catch (const std::exception &)
+      {
+      }
+    }
+    return DEFAULT_BLKSIZE;
+  }
+
+  /**
+   * @brief MTU of the route datagrams to address take when sent from local_interface, -1 if it can not be queried
+   *
+   * Only a connected socket knows its route, and the group's own socket takes the ACKs of every member.
+   */
+  int route_mtu(const struct sockaddr_in &address, const std::string &local_interface)
+  {
+    try
+    {
+      udp_connection probe;
+      probe.set_multicast_interface(local_interface);
+      probe.connect(address);
+      return utils::get_mtu(probe.sd());
+    }
+    catch (const std::exception &)
+    {
+      return -1;
+    }
+  }
+
+  bool would_block(const ssize_t sent)
+  {
+    return (sent < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK));
+  }
+} // namespace
+
+//========================================================
+/**
+ * @brief Opens the requested file and takes a multicast address for it, the first member joins with join()
+ *
+ * Throws if the request is not for a multicast octet read of a regular file in the root that fits in 65535 blocks, or
+ * if the pool has no address free. The client is then served by an ordinary session, which also sends it any error.
+ *
+ * Unless allow_fragmentation is set, the block size is held to the MTU of the route to the multicast address.
+ */
+tftp_multicast_group::tftp_multicast_group(const tftp::rw_packet_t &request, multicast_address_pool &pool,
+                                           const std::string &local_interface, timer_wheel &wheel,
+                                           metadata_cache *metadata, open_file_table *files,
+                                           const uint64_t mmap_min_bytes, const bool allow_fragmentation) :
+    _logger(spdlog::get("console")),
+    _pool(pool),
+    _udp(),
+    _address{},
+    _address_str(),
+    _option_prefix(),
+    _key(group_key(request)),
+    _filename(request.filename),
+    _file_reader(),
+    _file_size(0),
+    _block_size(requested_block_size(request)),
+    _total_blocks(0),
+    _members{},
+    _master_acked(false),
+    _last_reply_us(rtt_estimator::steady_clock_us()),
+    _packet(),
+    _packet_loaded(false),
+    _data_pending(false),
+    _sent_us(0),
+    _transmissions(0),
+    _recv_buffer(tftp::DATA_PKT_MAX_SIZE),
+    _error_pkt(),
+    _error_pending(false),
+    _finished(false),
+    _rtt(INITIAL_RTO_MS, MIN_RTO_MS, DEFAULT_TIMEOUT_MS),
+    _timer(wheel),
+    _stats{0, 0}
+{
+  if (!is_multicast_request(request))
+  {
+    throw std::invalid_argument("Not a multicast octet read");
+  }
+  const auto entry = (metadata != nullptr) ? metadata->lookup(request.filename)
+                                           : metadata_cache::resolve(std::filesystem::current_path(), request.filename);
+  if (!entry->in_root || !entry->exists || !entry->regular)
+  {
+    throw std::runtime_error("File can not be read");
+  }
+  _file_reader.open(metadata_cache::open_path(*entry, request.filename), tftp::mode_t::OCTET, nullptr, files,
+                    mmap_min_bytes);
+  if (!allow_fragmentation)
+  {
+    const int MTU = route_mtu(pool.first_address(), local_interface);
+    if (MTU < 0)
+    {
+      log_warn(_logger, "Failed to query the MTU of multicast group routes : {}", utils::string_error(errno));
+    }
+    else if (tftp::block_size_for_mtu(MTU) < _block_size)
+    {
+      log_info(_logger, "Requested blksize {} does not fit the multicast route MTU of {}, replying with {}",
+               _block_size, MTU, tftp::block_size_for_mtu(MTU));
+      _block_size = tftp::block_size_for_mtu(MTU);
+    }
+  }
+  _file_size                = _file_reader.key().size;
+  const uint64_t num_blocks = (_file_size / _block_size) + 1;
+  if (num_blocks > UINT16_MAX)
+  {
+    throw std::runtime_error("File too large to send by multicast");
+  }
+  _total_blocks = static_cast<uint16_t>(num_blocks);
+
+  _udp.bind(local_interface, 0);
+  _udp.set_multicast_interface(local_interface);
+  _udp.set_non_blocking(true);
+
+  // Taken last, the destructor hands it back
+  const auto address = _pool.acquire();
+  if (!address)
+  {
+    throw std::runtime_error("No multicast address free");
+  }
+  _address     = *address;
+  _address_str = utils::sockaddr_to_str(_address);
+  char addr_buf[INET_ADDRSTRLEN] = {0};
+  inet_ntop(AF_INET, &_address.sin_addr, addr_buf, INET_ADDRSTRLEN);
+  _option_prefix = fmt::format("{},{},", addr_buf, ntohs(_address.sin_port));
+  log_debug(_logger, "Multicast group {} created for '{}', {} blocks of {} bytes", _address_str, _filename,
+            _total_blocks, _block_size);
+}
+
+//========================================================
+tftp_multicast_group::~tftp_multicast_group()
+{
+  _pool.release(_address);
+}
+
+//========================================================
+int tftp_multicast_group::sd() const
+{
+  return _udp.sd();
+}
+
+//========================================================
+/**
+ * @brief Requests with the same key are served by the same group, see group_key()
+ */
+const std::string &tftp_multicast_group::key() const
+{
+  return _key;
+}
+
+//========================================================
+const struct sockaddr_in &tftp_multicast_group::address() const
+{
+  return _address;
+}
+
+//========================================================
+void tftp_multicast_group::set_timeout_callback(std::function<void()> on_timeout)
+{
+  _timer.set_callback(std::move(on_timeout));
+}
+
+//========================================================
+/**
+ * @brief Adds the client of a request to the group, the first one to join is the master
+ *
+ * A request from a client already in the group is a retransmitted RRQ, its OACK is sent again.
+ */
+void tftp_multicast_group::join(const tftp::rw_packet_t &request, const struct sockaddr_in &client)
+{
+  const size_t index = find_member(client);
+  if (index < _members.size())
+  {
+    log_trace(_logger, "Repeated request from a member of group {}, resending OACK [{}]", _address_str,
+              _members[index].client_str);
+    _members[index].oack_pending = true;
+    return;
+  }
+
+  _members.push_back(member_t{client, utils::sockaddr_to_str(client), has_option(request, BLKSIZE_OPT),
+                              has_option(request, TSIZE_OPT), true});
+  ++_stats.clients;
+  if (_members.size() == 1)
+  {
+    _master_acked  = false;
+    _last_reply_us = rtt_estimator::steady_clock_us();
+  }
+  log_debug(_logger, "Client joined multicast group {} for '{}' as {}, {} member(s) [{}]", _address_str, _filename,
+            (_members.size() == 1) ? "master" : "listener", _members.size(), _members.back().client_str);
+}
+
+//========================================================
+/**
+ * @brief Handles the members' ACKs and ERRORs, or a retransmit timeout
+ */
+void tftp_multicast_group::handle_read()
+{
+  if (_timer.has_expired())
+  {
+    handle_timeout();
+    return;
+  }
+
+  struct sockaddr_in from;
+  while (!_finished)
+  {
+    size_t received = 0;
+    try
+    {
+      received = _udp.recv_from(_recv_buffer.data(), _recv_buffer.size(), from);
+    }
+    catch (const std::exception &err)
+    {
+      log_warn(_logger, "Failed to receive on multicast group {} : {}", _address_str, err.what());
+      break;
+    }
+    if (received == 0)
+    {
+      break;
+    }
+    handle_packet(from, std::string_view(_recv_buffer.data(), received));
+  }
+}
+
+//========================================================
+/**
+ * @brief Sends pending OACKs to members, then the pending block to the group
+ *
+ * Stops at the first send that would block, the rest is sent on the next call.
+ */
+void tftp_multicast_group::handle_write()
+{
+  if (_error_pending)
+  {
+    // Every member is told, listeners as well as the master
+    std::array<char, tftp::DATA_PKT_MAX_SIZE> buffer;
+    const size_t size =
+        tftp::encode_error_packet(_error_pkt.error_code, _error_pkt.error_msg, buffer.data(), buffer.size());
+    for (const auto &member : _members)
+    {
+      (void)_udp.send_to(member.client, buffer.data(), size);
+    }
+    _members.clear();
+    _error_pending = false;
+    _finished      = true;
+    _timer.disarm_timer();
+    return;
+  }
+
+  for (size_t i = 0; i < _members.size(); ++i)
+  {
+    if (!_members[i].oack_pending)
+    {
+      continue;
+    }
+    if (!send_oack(_members[i], i == 0))
+    {
+      return;
+    }
+    if (i == 0)
+    {
+      _timer.arm_timer(_rtt.next_timeout_ms());
+    }
+  }
+
+  if (_data_pending)
+  {
+    const ssize_t sent = _udp.send_to(_address, _packet.data(), _packet.size());
+    if (would_block(sent))
+    {
+      return;
+    }
+    if (sent < 0)
+    {
+      // Handled like a lost datagram
+      log_warn(_logger, "Failed to send block {} to multicast group {} : {}", _packet.block_number(), _address_str,
+               utils::string_error(errno));
+    }
+    _data_pending = false;
+    _sent_us      = rtt_estimator::steady_clock_us();
+    ++_transmissions;
+    ++_stats.blocks_sent;
+    _timer.arm_timer(_rtt.next_timeout_ms());
+  }
+}
+
+//========================================================
+bool tftp_multicast_group::is_finished() const
+{
+  return _finished;
+}
+
+//========================================================
+bool tftp_multicast_group::wait_for_write() const
+{
+  return _error_pending || _data_pending ||
+         std::any_of(_members.begin(), _members.end(), [](const member_t &member) { return member.oack_pending; });
+}
+
+//========================================================
+size_t tftp_multicast_group::members() const
+{
+  return _members.size();
+}
+
+//========================================================
+const tftp_multicast_group::stats_t &tftp_multicast_group::stats() const
+{
+  return _stats;
+}
+
+//========================================================
+/**
+ * @brief Whether a request asks for a transfer a multicast group can serve, an octet read with the multicast option
+ */
+bool tftp_multicast_group::is_multicast_request(const tftp::rw_packet_t &request)
+{
+  return (request.type == tftp::packet_t::READ) && (request.mode == tftp::mode_t::OCTET) &&
+         has_option(request, MULTICAST_OPT);
+}
+
+//========================================================
+/**
+ * @brief Requests for the same file with the same block size share a group
+ */
+std::string tftp_multicast_group::group_key(const tftp::rw_packet_t &request)
+{
+  return request.filename + '\0' + std::to_string(requested_block_size(request));
+}
+
+//========================================================
+void tftp_multicast_group::handle_packet(const struct sockaddr_in &from, const std::string_view packet)
+{
+  const size_t index = find_member(from);
+  if (index == _members.size())
+  {
+    log_trace(_logger, "Ignoring packet from {}, not a member of multicast group {}", from, _address_str);
+    return;
+  }
+
+  const auto ack_packet = tftp::decode_ack_packet(packet);
+  if (ack_packet)
+  {
+    handle_ack(index, ack_packet->block_number);
+    return;
+  }
+  const auto error_packet = tftp::decode_error_packet(packet);
+  if (error_packet)
+  {
+    log_debug(_logger, "Member of multicast group {} sent error {} : {} [{}]", _address_str, error_packet->error_code,
+              error_packet->error_msg, _members[index].client_str);
+    leave(index);
+    return;
+  }
+  log_warn(_logger, "Unexpected packet on multicast group {} [{}]", _address_str, _members[index].client_str);
+}
+
+//========================================================
+/**
+ * @brief An ACK of the last block from any member, or of any block from the master
+ *
+ * The master acknowledges the block before the first one it is missing, which is sent next. An ACK of the block just
+ * sent, sent only once, gives a round trip time sample.
+ */
+void tftp_multicast_group::handle_ack(const size_t index, const uint16_t block_number)
+{
+  if (block_number == _total_blocks)
+  {
+    log_debug(_logger, "Member has the whole file, leaving multicast group {} [{}]", _address_str,
+              _members[index].client_str);
+    leave(index);
+    return;
+  }
+  if ((index != 0) || (block_number > _total_blocks))
+  {
+    // Only the master's ACKs move the transfer on
+    return;
+  }
+
+  _last_reply_us                = rtt_estimator::steady_clock_us();
+  _master_acked                 = true;
+  _members.front().oack_pending = false;
+  if (_packet_loaded && (_packet.block_number() == block_number) && (_transmissions == 1))
+  {
+    _rtt.add_sample(_last_reply_us - _sent_us);
+  }
+  _timer.disarm_timer();
+  if (load_block(static_cast<uint16_t>(block_number + 1)))
+  {
+    _data_pending = true;
+  }
+}
+
+//========================================================
+void tftp_multicast_group::leave(const size_t index)
+{
+  _members.erase(_members.begin() + static_cast<std::ptrdiff_t>(index));
+  if (index == 0)
+  {
+    promote();
+  }
+}
+
+//========================================================
+/**
+ * @brief Makes the longest standing member the master, the group is finished if there is none left
+ */
+void tftp_multicast_group::promote()
+{
+  _master_acked  = false;
+  _data_pending  = false;
+  _last_reply_us = rtt_estimator::steady_clock_us();
+  _timer.disarm_timer();
+  if (_members.empty())
+  {
+    log_debug(_logger, "Multicast group {} for '{}' finished, {} client(s) served with {} blocks sent", _address_str,
+              _filename, _stats.clients, _stats.blocks_sent);
+    _finished = true;
+    return;
+  }
+  log_debug(_logger, "Promoting next master of multicast group {} [{}]", _address_str, _members.front().client_str);
+  _members.front().oack_pending = true;
+}
+
+//========================================================
+/**
+ * @brief Resends what the master has not answered, or drops a master that has been silent for too long
+ */
+void tftp_multicast_group::handle_timeout()
+{
+  if (_members.empty())
+  {
+    return;
+  }
+  const uint64_t silent_ms = (rtt_estimator::steady_clock_us() - _last_reply_us) / 1000;
+  if (silent_ms >= static_cast<uint64_t>(MAX_TIMEOUTS) * DEFAULT_TIMEOUT_MS)
+  {
+    log_warn(_logger, "No reply from master for {}ms, dropping it from multicast group {} [{}]", silent_ms,
+             _address_str, _members.front().client_str);
+    leave(0);
+    return;
+  }
+  _rtt.backoff();
+  if (_master_acked)
+  {
+    _data_pending = true;
+  }
+  else
+  {
+    _members.front().oack_pending = true;
+  }
+}
+
+//========================================================
+/**
+ * @brief Reads block block_number of the file into the packet, unless it is already there
+ */
+bool tftp_multicast_group::load_block(const uint16_t block_number)
+{
+  if (_packet_loaded && (_packet.block_number() == block_number))
+  {
+    return true;
+  }
+  const uint64_t offset = static_cast<uint64_t>(block_number - 1) * _block_size;
+  _file_reader.seek({offset, ""});
+  _file_reader.read_in_to(_packet, _block_size);
+  const uint64_t expected = std::min<uint64_t>(_block_size, _file_size - std::min(offset, _file_size));
+  if (_file_reader.error() || (_packet.payload_size() < expected))
+  {
+    log_error(_logger, "Failed to read block {} of '{}' for multicast group {}", block_number, _filename,
+              _address_str);
+    _packet_loaded = false;
+    _error_pkt     = tftp::error_packet_t(tftp::error_t::NOT_DEFINED, "Failed to read file");
+    _error_pending = true;
+    return false;
+  }
+  _packet.set_block_number(block_number);
+  _packet_loaded = true;
+  _transmissions = 0;
+  return true;
+}
+
+//========================================================
+/**
+ * @brief Sends the member its OACK, telling it whether it is the master
+ *
+ * @return false if the send would block, the OACK is then still pending
+ */
+bool tftp_multicast_group::send_oack(member_t &member, const bool master)
+{
+  tftp::oack_packet_t oack;
+  if (member.blksize)
+  {
+    oack.options.emplace_back(BLKSIZE_OPT, std::to_string(_block_size));
+  }
+  if (member.tsize)
+  {
+    oack.options.emplace_back(TSIZE_OPT, std::to_string(_file_size));
+  }
+  oack.options.emplace_back(MULTICAST_OPT, _option_prefix + (master ? "1" : "0"));
+  const auto    data = tftp::serialise_oack_packet(oack);
+  const ssize_t sent = _udp.send_to(member.client, data.data(), data.size());
+  if (would_block(sent))
+  {
+    return false;
+  }
+  if (sent < 0)
+  {
+    log_warn(_logger, "Failed to send OACK for multicast group {} : {} [{}]", _address_str,
+             utils::string_error(errno), member.client_str);
+  }
+  member.oack_pending = false;
+  return true;
+}
+
+//========================================================
+size_t tftp_multicast_group::find_member(const struct sockaddr_in &client) const
+{
+  const auto iter = std::find_if(_members.begin(), _members.end(), [&client](const member_t &member) {
+    return (member.client.sin_addr.s_addr == client.sin_addr.s_addr) && (member.client.sin_port == client.sin_port);
+  });
+  return static_cast<size_t>(iter - _members.begin());
+}
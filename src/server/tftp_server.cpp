@@ -1,31 +1,72 @@
 #include "server/tftp_server.hpp"
 
-#include <sys/epoll.h>
+#include <exception>
+#include <filesystem>
+#include <mutex>
+#include <thread>
 #include <unistd.h>
 
 #include "common/debug_macros.hpp"
 #include "common/utils.hpp"
 
 //========================================================
-tftp_server::tftp_server(const std::string &server_root, const std::string &local_interface, const int port_num, const size_t max_clients) :
-    _server_root(server_root),
-    _epoll_fd(-1),
-    _max_clients(max_clients),
+tftp_server::tftp_server(const server_options &options) :
+    _server_root(options.server_root),
     _exit_requested(false),
-    _conn_handler((local_interface.empty() ? "0.0.0.0" : local_interface), port_num),
-    _client_connections{}
+    _cache(options.cache_bytes > 0 ? std::make_unique<file_cache>(options.cache_bytes) : nullptr),
+    _datagrams(options.datagram_cache_bytes > 0 ? std::make_unique<datagram_cache>(options.datagram_cache_bytes)
+                                                : nullptr),
+    _metadata(),
+    _files(),
+    // Opened before changing to the root, a relative path is relative to where the server was started
+    _packs(options.pack_path.empty() ? nullptr
+                                     : std::make_unique<pack_store>(std::filesystem::absolute(options.pack_path))),
+    _multicast(options.multicast_group.empty() ? nullptr
+                                               : std::make_unique<multicast_address_pool>(options.multicast_group)),
+    _workers{},
+    _io_pool(options.io_threads > 0 ? std::make_unique<disk_io_pool>(options.io_threads, options.max_clients)
+                                    : nullptr)
 {
-  if (chdir(server_root.c_str()) < 0)
+  if (chdir(options.server_root.c_str()) < 0)
   {
-    dbg_err("Failed to chdir to server root '{}' : {}", server_root, utils::string_error(errno));
+    dbg_err("Failed to chdir to server root '{}' : {}", options.server_root, utils::string_error(errno));
     throw std::runtime_error("Failed to chdir");
   }
 
-  _epoll_fd = epoll_create1(EPOLL_CLOEXEC);
-  if (_epoll_fd < 0)
+  if (options.metadata_cache_entries > 0)
   {
-    dbg_err("Failed to create epoll : {}", utils::string_error(errno));
-    throw std::runtime_error("Failed to create epoll");
+    // Paths are resolved relative to the working directory, the root, from now on
+    _metadata = std::make_unique<metadata_cache>(std::filesystem::current_path(), options.metadata_cache_entries);
+    if (!_metadata->watching())
+    {
+      dbg_warn("inotify not available, cached metadata is refreshed every {}ms", metadata_cache::DEFAULT_TTL_MS);
+    }
+  }
+
+  if (options.workers == 0)
+  {
+    throw std::invalid_argument("Number of workers must be at least 1");
+  }
+
+  // The client limit is shared out between the workers
+  const size_t   clients_per_worker = (options.max_clients + options.workers - 1) / options.workers;
+  const bool     reuse_port         = options.workers > 1;
+  server_options worker_options     = options;
+  if (worker_options.interface.empty())
+  {
+    worker_options.interface = "0.0.0.0";
+  }
+  tftp_server_connection::shared_t shared{};
+  shared.cache     = _cache.get();
+  shared.datagrams = _datagrams.get();
+  shared.metadata  = _metadata.get();
+  shared.files     = &_files;
+  shared.packs     = _packs.get();
+  for (size_t i = 0; i < options.workers; ++i)
+  {
+    _workers.push_back(std::make_unique<tftp_server_worker>(worker_options, clients_per_worker, reuse_port,
+                                                            _exit_requested, shared, _io_pool.get(),
+                                                            _multicast.get()));
   }
 }
 
@@ -37,126 +78,126 @@ void tftp_server::stop()
 }
 
 //========================================================
-tftp_server::~tftp_server()
+tftp_server::~tftp_server() = default;
+
+//========================================================
+/**
+ * @brief Returns the file cache shared by all workers, nullptr if caching is disabled
+ */
+const file_cache *tftp_server::cache() const
 {
-  if (_epoll_fd > 0)
-  {
-    close(_epoll_fd);
-  }
+  return _cache.get();
 }
 
 //========================================================
-void tftp_server::start()
+/**
+ * @brief Returns the datagram cache shared by all workers, nullptr if it is disabled
+ */
+const datagram_cache *tftp_server::datagrams() const
+{
+  return _datagrams.get();
+}
+
+//========================================================
+/**
+ * @brief Returns the metadata cache shared by all workers, nullptr if it is disabled
+ */
+const metadata_cache *tftp_server::metadata() const
 {
-  epoll_ctl_add(_conn_handler.sd(), EPOLLIN, &_conn_handler);
+  return _metadata.get();
+}
 
-  const int   TIMEOUT_MS = 1000;
-  const int   MAX_EVENTS = _max_clients + 1;
-  epoll_event events[MAX_EVENTS];
+//========================================================
+/**
+ * @brief Returns the table of files open for reading shared by all workers
+ */
+const open_file_table *tftp_server::files() const
+{
+  return &_files;
+}
 
-  while (!_exit_requested)
-  {
-    const int num_events = epoll_wait(_epoll_fd, events, MAX_EVENTS, TIMEOUT_MS);
-    if (num_events < 0)
-    {
-      if (errno == EINTR)
-      {
-        continue;
-      }
-      dbg_err("epoll error : {}", utils::string_error(errno));
-      throw std::runtime_error("epoll error");
-    }
+//========================================================
+/**
+ * @brief Returns the pack store reads are served from first, nullptr if there is no pack
+ */
+pack_store *tftp_server::packs()
+{
+  return _packs.get();
+}
+
+//========================================================
+/**
+ * @brief Runs the workers until stop() is called
+ *
+ * The first worker runs on the calling thread, the rest each get their own thread. If any worker fails the others are
+ * stopped and the error is rethrown from here.
+ */
+void tftp_server::start()
+{
+  std::mutex               error_mutex;
+  std::exception_ptr       error;
+  std::vector<std::thread> threads;
 
-    for (int i = 0; i < num_events; ++i)
+  auto run_worker = [&](tftp_server_worker &worker) {
+    try
     {
-      /* Handle new requests */
-      if (events[i].data.ptr == &_conn_handler)
-      {
-        _conn_handler.handle_read();
-
-        while (_conn_handler.requests_pending() && (_client_connections.size() < _max_clients))
-        {
-          auto new_request = _conn_handler.get_request();
-          dbg_dbg("Accepting new connection from client {}", new_request.client);
-          _client_connections.emplace_back(new_request.request, new_request.client);
-          const uint32_t epoll_events = _client_connections.back().wait_for_read() ? EPOLLIN : EPOLLOUT;
-          epoll_ctl_add(_client_connections.back().sd(), epoll_events, &_client_connections.back());
-          epoll_ctl_add(_client_connections.back().timer_fd(), EPOLLIN, &_client_connections.back());
-        }
-      }
-      else
-      {
-        /* Service connected clients */
-        tftp_server_connection *conn = reinterpret_cast<tftp_server_connection *>(events[i].data.ptr);
-        if (events[i].events & EPOLLIN)
-        {
-          conn->handle_read();
-        }
-        else if (events[i].events & EPOLLOUT)
-        {
-          conn->handle_write();
-        }
-        else if (events[i].events & (EPOLLERR | EPOLLHUP))
-        {
-          dbg_warn("Socket error on connection to {}, closing connection", conn->client());
-          conn->set_finished(true);
-        }
-        else
-        {
-          const int unknown_event = events[i].events;
-          dbg_warn("Unknown event : {}", unknown_event);
-        }
-
-        events[i].events = conn->wait_for_read() ? EPOLLIN : EPOLLOUT;
-        epoll_ctl_mod(conn->sd(), &events[i]);
-      }
+      worker.run();
     }
-
-    // Clean up -- TODO: integrate this in to the above epoll event handling
-    for (auto iter = _client_connections.begin(); iter != _client_connections.end(); ++iter)
+    catch (const std::exception &err)
     {
-      if (iter->is_finished())
+      dbg_err("Worker failed : {}", err.what());
+      std::lock_guard<std::mutex> lock(error_mutex);
+      if (!error)
       {
-        dbg_dbg("Closing connection {}", iter->client());
-        epoll_ctl_del(iter->sd());
-        epoll_ctl_del(iter->timer_fd());
-        iter = _client_connections.erase(iter);
+        error = std::current_exception();
       }
+      stop();
     }
-  }
-  dbg_dbg("Server stopped");
-}
-
-//========================================================
-void tftp_server::epoll_ctl_add(const int fd, const uint32_t events, void *data)
-{
-  struct epoll_event e = {0, {0}};
-  e.events             = events;
-  e.data.ptr           = data;
+  };
 
-  if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, fd, &e) < 0)
+  dbg_dbg("Starting {} worker(s)", _workers.size());
+  for (size_t i = 1; i < _workers.size(); ++i)
   {
-    dbg_err("epoll add failed : {}", utils::string_error(errno));
-    throw std::runtime_error("epoll add failed");
+    threads.emplace_back(run_worker, std::ref(*_workers[i]));
   }
-}
+  run_worker(*_workers.front());
 
-//========================================================
-void tftp_server::epoll_ctl_mod(const int fd, struct epoll_event *ev)
-{
-  if (epoll_ctl(_epoll_fd, EPOLL_CTL_MOD, fd, ev) < 0)
+  for (auto &thread : threads)
   {
-    dbg_err("epoll mod failed : {}", utils::string_error(errno));
-    throw std::runtime_error("epoll mod failed");
+    thread.join();
   }
-}
 
-//========================================================
-void tftp_server::epoll_ctl_del(const int fd)
-{
-  if (epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, fd, NULL) < 0)
+  dbg_dbg("Server stopped");
+  if (_cache)
+  {
+    const auto stats = _cache->stats();
+    dbg_info("File cache: {} hits, {} misses, {} evictions, {} bytes cached, {} bytes read from disk", stats.hits,
+             stats.misses, stats.evictions, stats.cached_bytes, stats.disk_read_bytes);
+  }
+  if (_datagrams)
+  {
+    const auto stats = _datagrams->stats();
+    dbg_info("Datagram cache: {} hits, {} misses, {} evictions, {} invalidations, {} bytes cached", stats.hits,
+             stats.misses, stats.evictions, stats.invalidations, stats.cached_bytes);
+  }
+  const auto file_stats = _files.stats();
+  if (file_stats.opens > 0)
+  {
+    dbg_info("Open files: {} opened, {} shared, {} still open", file_stats.opens, file_stats.shares,
+             file_stats.open_files);
+  }
+  if (_packs)
+  {
+    dbg_info("Pack: {} swaps", _packs->swaps());
+  }
+  if (_metadata)
+  {
+    const auto stats = _metadata->stats();
+    dbg_info("Metadata cache: {} hits, {} misses, {} evictions, {} invalidations, {} entries", stats.hits,
+             stats.misses, stats.evictions, stats.invalidations, stats.entries);
+  }
+  if (error)
   {
-    dbg_err("epoll del failed : {}", utils::string_error(errno));
-    throw std::runtime_error("epoll del failed");
+    std::rethrow_exception(error);
   }
-}
\ No newline at end of file
+}
@@ -1,47 +1,184 @@
 #include "server/tftp_server_connection.hpp"
 
+#include <algorithm>
 #include <filesystem>
 #include <netinet/in.h>
+#include <sys/uio.h>
 
 #include "common/debug_macros.hpp"
 #include "common/utils.hpp"
 
 namespace
 {
-  const char    BLKSIZE_OPT[] = "BLKSIZE";
-  const char    TSIZE_OPT[]   = "TSIZE";
-  const char    TIMEOUT_OPT[] = "TIMEOUT";
-  const uint8_t MAX_TIMEOUTS  = 3;
+  const char     BLKSIZE_OPT[]      = "BLKSIZE";
+  const char     TSIZE_OPT[]        = "TSIZE";
+  const char     TIMEOUT_OPT[]      = "TIMEOUT";
+  const char     WINDOWSIZE_OPT[]   = "WINDOWSIZE";
+  const char     UTIMEOUT_OPT[]     = "UTIMEOUT";
+  const char     ROLLOVER_OPT[]     = "ROLLOVER";
+  const uint8_t  MAX_TIMEOUTS       = 3;
+  const uint16_t MAX_WINDOW_SIZE    = 64;
+  const uint32_t DEFAULT_TIMEOUT_MS = 2000;
+  const uint32_t INITIAL_RTO_MS     = 1000;
+  const uint32_t MIN_RTO_MS         = 5;
+  const uint32_t MAX_UTIMEOUT_MS    = 255000;
+
+  /**
+   * @brief Error sent to the client when storing its upload fails
+   */
+  tftp::error_packet_t write_error_packet(const bool disk_full)
+  {
+    if (disk_full)
+    {
+      return tftp::error_packet_t(tftp::error_t::DISK_FULL, "Not enough disk space for the file");
+    }
+    return tftp::error_packet_t(tftp::error_t::NOT_DEFINED, "Internal server error");
+  }
 }; // namespace
 
 //========================================================
-tftp_server_connection::tftp_server_connection(const tftp::rw_packet_t &request, struct sockaddr_in &client_address) :
+/**
+ * @brief Read side state shared with disk I/O jobs, a job only touches the file and the batch it fills
+ *
+ * With ring_file set the batches are read by the poller instead, straight from the session reader's descriptor. The
+ * poller then holds on to the state, ring_file included, until the read completes.
+ */
+struct tftp_server_connection::read_ahead_t
+{
+  struct batch_t
+  {
+    std::vector<tftp::data_packet_buffer> blocks;
+    size_t                                count = 0; // Blocks read into the batch
+    size_t                                next  = 0; // Next block to hand to the window
+    bool                                  last  = false;
+    bool                                  error = false;
+  };
+
+  tftp_read_file            file;
+  open_file_table::file_ptr ring_file;
+  std::vector<struct iovec> iovecs;     // The block payloads of the batch the poller reads into
+  uint64_t                  offset = 0; // Of the next batch the poller reads
+  std::array<batch_t, 2>    batches;
+  size_t                    head  = 0; // Batch blocks are taken from
+  size_t                    ready = 0; // Batches read and not yet fully taken
+  bool                      done  = false;
+};
+
+//========================================================
+/**
+ * @brief Write side state shared with disk I/O jobs, a job only touches the file and the batch it writes
+ */
+struct tftp_server_connection::write_behind_t
+{
+  tftp_write_file                  file;
+  std::array<std::vector<char>, 2> batches;
+  size_t                           fill        = 0; // Batch received blocks are appended to
+  size_t                           fill_blocks = 0;
+  bool                             fill_last   = false; // The batch being filled holds the last block
+  bool                             error       = false;
+  bool                             disk_full   = false;
+};
+
+//========================================================
+/**
+ * @brief Reader of a transfer going through the datagram cache, shared with the disk I/O job reading a missing run
+ */
+struct tftp_server_connection::datagram_source_t
+{
+  tftp_read_file          file;
+  size_t                  next_run    = 0; // Run the file is positioned at
+  size_t                  built_index = 0;
+  datagram_cache::run_ptr built; // Run last read by a job
+};
+
+//========================================================
+tftp_server_connection::tftp_server_connection(const tftp::rw_packet_t &request, struct sockaddr_in &client_address,
+                                               timer_wheel &wheel, const server_options &options,
+                                               const shared_t &shared) :
     _logger(spdlog::get("console")),
     _udp(),
     _type(request.type),
     _file_reader(),
+    _file_map(),
+    _mapped(),
+    _send_mapped(false),
+    _file_offset(0),
     _file_writer(),
+    _transfer_size(),
     _client(client_address),
     _client_str(utils::sockaddr_to_str(_client)),
-    _data_pkt(),
+    _window{},
+    _send_views{},
+    _recv_buffer{},
+    _ack_buffer{},
+    _poller_io(nullptr),
+    _poller_read_data(0),
     _error_pkt(),
     _finished(false),
     _final_ack(false),
-    _pkt_ready(false),
     _state(state_t::ERROR),
-    _timeout_s(2),
-    _timeout_count(0),
+    _timeout_ms(DEFAULT_TIMEOUT_MS),
+    _last_reply_us(rtt_estimator::steady_clock_us()),
+    _ack_sent_us(0),
+    _ack_transmissions(0),
+    _retransmits(0),
+    _dup_ack_threshold(options.dup_ack_threshold),
+    _dup_acks(0),
+    _ack_stats{0, 0},
+    _rtt(INITIAL_RTO_MS, MIN_RTO_MS, DEFAULT_TIMEOUT_MS),
     _block_number(0),
+    _last_acked(0),
+    _rollover(0),
+    _window_size(1),
+    _window_head(0),
+    _window_count(0),
+    _window_sent(0),
     _block_size(512),
+    _allow_fragmentation(options.allow_fragmentation),
     _oack_packet{},
-    _timer()
-
+    _timer(wheel),
+    _zero_copy(options.zero_copy),
+    _msg_zerocopy(false),
+    _copy_stats{0, 0},
+    _io(shared.io),
+    _on_io_complete(),
+    _read_ahead(),
+    _write_behind(),
+    _io_batch_blocks(options.prefetch_blocks),
+    _io_in_flight(false),
+    _io_parked(false),
+    _io_parked_us(0),
+    _disk_stats{0, 0},
+    _datagrams(shared.datagrams),
+    _datagram_key{},
+    _datagram_source(),
+    _run(),
+    _run_index(0),
+    _datagram_block(0),
+    _metadata(shared.metadata),
+    _file_entry(),
+    _filename(request.filename),
+    _pack(),
+    _packed()
 {
   _udp.bind("", 0);
   _udp.connect(client_address);
   _udp.set_non_blocking(true);
 
-  const auto error = is_operation_allowed(request.filename, request.type);
+  if ((request.type == tftp::packet_t::READ) && (shared.packs != nullptr))
+  {
+    // A packed file needs no path checks, only files under the packed directory are in the pack
+    _pack   = shared.packs->current();
+    _packed = _pack->find(request.filename);
+  }
+  std::optional<tftp::error_packet_t> error;
+  if (!_packed)
+  {
+    _file_entry = (_metadata != nullptr)
+                      ? _metadata->lookup(request.filename)
+                      : metadata_cache::resolve(std::filesystem::current_path(), request.filename);
+    error       = is_operation_allowed(*_file_entry, request.type);
+  }
   if (error)
   {
     _error_pkt = error.value();
@@ -49,17 +186,92 @@ tftp_server_connection::tftp_server_connection(const tftp::rw_packet_t &request,
   }
   else
   {
-    _data_pkt.data.resize(_block_size);
-
     process_options(request);
+    _window.resize(_window_size);
+    _send_views.reserve(_window_size);
+    _recv_buffer.resize(std::max(tftp::DATA_PKT_MAX_SIZE, tftp::DATA_PKT_HEADER_SIZE + _block_size));
+    // Read ahead at least a whole window so sending a window does not wait for the disk twice
+    _io_batch_blocks = std::max<size_t>(std::max<size_t>(options.prefetch_blocks, 1), _window_size);
+    // Start from the client's timeout if it asked for one, it also caps the backed off timeout
+    const uint32_t initial_rto_ms = (_timeout_ms == DEFAULT_TIMEOUT_MS) ? INITIAL_RTO_MS : _timeout_ms;
+    _rtt = rtt_estimator(initial_rto_ms, MIN_RTO_MS, _timeout_ms,
+                         static_cast<uint32_t>(_last_reply_us) ^ ntohs(_client.sin_port));
 
     switch (request.type)
     {
     case tftp::packet_t::READ: {
       log_debug(_logger, "Connection created for request to READ '{}' by client [{}]", request.filename, _client_str);
+      _block_number = 1;
+      if (_oack_packet.options.empty())
+      {
+        _state = state_t::SEND_DATA;
+      }
+      else
+      {
+        _state = state_t::SEND_OACK;
+      }
       try
       {
-        _file_reader.open(request.filename, request.mode);
+        if (_packed)
+        {
+          log_debug(_logger, "Serving '{}' from the pack [{}]", request.filename, _client_str);
+          if (request.mode == tftp::mode_t::OCTET)
+          {
+            // Sent straight from the pack's mapping, like a zero copy read
+            _mapped       = *_packed;
+            _send_mapped  = true;
+            _msg_zerocopy = _zero_copy && _udp.enable_zerocopy();
+          }
+          else
+          {
+            _file_reader.open(std::shared_ptr<const char>(_pack, _packed->data()), _packed->size(), request.mode);
+          }
+          break;
+        }
+        const auto path = metadata_cache::open_path(*_file_entry, request.filename);
+        if (_zero_copy && (request.mode == tftp::mode_t::OCTET))
+        {
+          _file_map.open(path);
+          _mapped       = std::string_view(_file_map.data(), _file_map.size());
+          _send_mapped  = true;
+          _msg_zerocopy = _udp.enable_zerocopy();
+          if (!_msg_zerocopy)
+          {
+            log_debug(_logger, "SO_ZEROCOPY not supported, sending from the file mapping without it [{}]",
+                      _client_str);
+          }
+        }
+        else if (_datagrams != nullptr)
+        {
+          _datagram_source = std::make_shared<datagram_source_t>();
+          _datagram_source->file.open(path, request.mode, shared.cache, shared.files, options.mmap_min_bytes);
+          _datagram_key =
+              datagram_cache::key_t{_datagram_source->file.key(), _block_size, request.mode, _rollover};
+        }
+        else if (_io != nullptr)
+        {
+          _read_ahead = std::make_shared<read_ahead_t>();
+          _read_ahead->file.open(path, request.mode, shared.cache, shared.files, options.mmap_min_bytes);
+          for (auto &batch : _read_ahead->batches)
+          {
+            batch.blocks.resize(_io_batch_blocks);
+          }
+        }
+        else
+        {
+          _file_reader.open(path, request.mode, shared.cache, shared.files, options.mmap_min_bytes);
+          const auto mapping = _file_reader.mapping();
+          if (mapping && (request.mode == tftp::mode_t::OCTET))
+          {
+            // Blocks are pointers into the mapping, sent from there without copying them out first
+            _mapped      = *mapping;
+            _send_mapped = true;
+          }
+          else
+          {
+            _file_reader.prefetch(_io_batch_blocks * _block_size);
+          }
+        }
       }
       catch (const std::exception &err)
       {
@@ -68,17 +280,6 @@ tftp_server_connection::tftp_server_connection(const tftp::rw_packet_t &request,
         _state     = state_t::ERROR;
       }
 
-      if (_oack_packet.options.empty())
-      {
-        _state        = state_t::SEND_DATA;
-        _block_number = 1;
-      }
-      else
-      {
-        _block_number = 0;
-        _state        = state_t::SEND_OACK;
-      }
-
       break;
     }
     case tftp::packet_t::WRITE: {
@@ -92,9 +293,44 @@ tftp_server_connection::tftp_server_connection(const tftp::rw_packet_t &request,
         _state = state_t::SEND_OACK;
       }
       _block_number = 0;
+      if (_transfer_size)
+      {
+        // Refuse now rather than after sending most of the file
+        const auto parent     = std::filesystem::path(request.filename).parent_path();
+        const auto free_space = utils::get_free_space(parent.empty() ? "." : parent.c_str());
+        if (free_space && (*free_space < *_transfer_size))
+        {
+          log_warn(_logger, "Refusing upload of {} bytes with {} bytes free [{}]", *_transfer_size, *free_space,
+                   _client_str);
+          _error_pkt = write_error_packet(true);
+          _state     = state_t::ERROR;
+          break;
+        }
+      }
       try
       {
-        _file_writer.open(request.filename, request.mode);
+        tftp_write_file *file = &_file_writer;
+        if (_io != nullptr)
+        {
+          _write_behind = std::make_shared<write_behind_t>();
+          file          = &_write_behind->file;
+          for (auto &batch : _write_behind->batches)
+          {
+            batch.reserve(_io_batch_blocks * _block_size);
+          }
+        }
+        file->open(request.filename, request.mode, options.sync_policy);
+        if (_metadata != nullptr)
+        {
+          _metadata->invalidate(request.filename);
+        }
+        if (_transfer_size && !file->preallocate(*_transfer_size))
+        {
+          log_warn(_logger, "Failed to allocate {} bytes for '{}' [{}]", *_transfer_size, request.filename,
+                   _client_str);
+          _error_pkt = write_error_packet(file->disk_full());
+          _state     = state_t::ERROR;
+        }
       }
       catch (const std::exception &err)
       {
@@ -118,13 +354,43 @@ tftp_server_connection::tftp_server_connection(const tftp::rw_packet_t &request,
 }
 
 //========================================================
-tftp_server_connection::~tftp_server_connection() = default;
+tftp_server_connection::~tftp_server_connection()
+{
+  if (_udp.zerocopy_pending() > 0)
+  {
+    recv_zerocopy_completions();
+  }
+  if ((_type == tftp::packet_t::WRITE) && (_metadata != nullptr))
+  {
+    // The upload changed the file's size since it was created
+    _metadata->invalidate(_filename);
+  }
+  log_debug(_logger, "Connection closed after {} retransmits, {} duplicate acks, {} resends held back, srtt {}us [{}]",
+            _retransmits, _ack_stats.duplicate_acks, _ack_stats.suppressed_retransmits, _rtt.srtt_us(),
+            _client_str);
+  if (_disk_stats.waits > 0)
+  {
+    log_debug(_logger, "Waited for the disk {} times, {}us in total [{}]", _disk_stats.waits, _disk_stats.wait_us,
+              _client_str);
+  }
+  if (_copy_stats.payload_bytes > 0)
+  {
+    log_debug(_logger, "Sent {} payload bytes, copied {} ({:.2f} copies per byte) [{}]", _copy_stats.payload_bytes,
+              _copy_stats.copied_bytes,
+              static_cast<double>(_copy_stats.copied_bytes) / static_cast<double>(_copy_stats.payload_bytes),
+              _client_str);
+  }
+}
 
 //========================================================
 /**
  * @brief Parse options contained in a read/write request packet
  *
- * Currently supports block size, transfer size and timeout duration
+ * Currently supports block size, transfer size, timeout duration in seconds (timeout) or milliseconds (utimeout),
+ * window size (read requests only) and the block number blocks roll over to after 65535 (rollover, 0 or 1)
+ *
+ * Block sizes are capped at 65464 and, unless fragmentation is allowed, at the largest whose DATA packets fit in the
+ * path MTU to the client. Block sizes below 8 are ignored.
  */
 void tftp_server_connection::process_options(const tftp::rw_packet_t &request)
 {
@@ -135,27 +401,31 @@ void tftp_server_connection::process_options(const tftp::rw_packet_t &request)
     {
       try
       {
-        uint32_t val  = std::stoul(opt.second);
-        _block_size   = val;
-        const int MTU = utils::get_mtu(_udp.sd());
-        if (MTU < 0)
+        const unsigned long val = std::stoul(opt.second);
+        if (val < tftp::MIN_BLOCK_SIZE)
         {
-          log_warn(_logger, "Failed to query MTU [{}]", _client_str);
-          _oack_packet.options.push_back(std::make_pair(opt.first, opt.second));
-          log_trace(_logger, "Requested blksize is {} [{}]", _block_size, _client_str);
-        }
-        else if (MTU < static_cast<int>(_block_size))
-        {
-          _block_size = MTU;
-          _oack_packet.options.push_back(std::make_pair(opt.first, std::to_string(MTU)));
-          log_info(_logger, "Requested blksize is greater than MTU : {} vs {}. Replying with MTU [{}]", _block_size,
-                   MTU, _client_str);
+          log_warn(_logger, "Ignoring blksize {} below the minimum of {} [{}]", val, tftp::MIN_BLOCK_SIZE,
+                   _client_str);
+          continue;
         }
-        else
+        _block_size = std::min<size_t>(val, tftp::MAX_BLOCK_SIZE);
+        if (!_allow_fragmentation)
         {
-          _oack_packet.options.push_back(std::make_pair(opt.first, opt.second));
-          log_trace(_logger, "Requested blksize is {} [{}]", _block_size, _client_str);
+          // The socket is connected to the client, so this is the MTU of the route to it
+          const int MTU = utils::get_mtu(_udp.sd());
+          if (MTU < 0)
+          {
+            log_warn(_logger, "Failed to query path MTU : {} [{}]", utils::string_error(errno), _client_str);
+          }
+          else if (tftp::block_size_for_mtu(MTU) < _block_size)
+          {
+            _block_size = tftp::block_size_for_mtu(MTU);
+            log_info(_logger, "Requested blksize {} does not fit the path MTU of {}, replying with {} [{}]", val,
+                     MTU, _block_size, _client_str);
+          }
         }
+        _oack_packet.options.push_back(std::make_pair(opt.first, std::to_string(_block_size)));
+        log_trace(_logger, "Block size is {} [{}]", _block_size, _client_str);
       }
       catch (const std::exception &err)
       {
@@ -167,12 +437,21 @@ void tftp_server_connection::process_options(const tftp::rw_packet_t &request)
       switch (request.type)
       {
       case tftp::packet_t::READ: {
-        const size_t FILE_SIZE = utils::get_file_size(request.filename.c_str());
-        _oack_packet.options.push_back(std::make_pair(opt.first, std::to_string(FILE_SIZE)));
+        const uint64_t file_size = _packed ? _packed->size() : _file_entry->size;
+        _oack_packet.options.push_back(std::make_pair(opt.first, std::to_string(file_size)));
         break;
       }
       case tftp::packet_t::WRITE: {
-        log_trace(_logger, "Incoming file '{}' is {} bytes [{}]", request.filename, opt.second, _client_str);
+        try
+        {
+          _transfer_size = std::stoull(opt.second);
+          _oack_packet.options.push_back(std::make_pair(opt.first, opt.second));
+          log_trace(_logger, "Incoming file '{}' is {} bytes [{}]", request.filename, *_transfer_size, _client_str);
+        }
+        catch (const std::exception &err)
+        {
+          log_error(_logger, "Failed to convert tsize value to int '{}' [{}]", opt.second, _client_str);
+        }
         break;
       }
       case tftp::packet_t::DATA:
@@ -195,9 +474,9 @@ void tftp_server_connection::process_options(const tftp::rw_packet_t &request)
         }
         else
         {
-          _timeout_s = static_cast<uint8_t>(req_timeout_s);
-          _oack_packet.options.push_back(std::make_pair(opt.first, std::to_string(_timeout_s)));
-          log_trace(_logger, "Set timeout to {}s [{}]", _timeout_s, _client_str);
+          _timeout_ms = static_cast<uint32_t>(req_timeout_s * 1000);
+          _oack_packet.options.push_back(std::make_pair(opt.first, std::to_string(req_timeout_s)));
+          log_trace(_logger, "Set timeout to {}s [{}]", req_timeout_s, _client_str);
         }
       }
       catch (const std::exception &err)
@@ -205,6 +484,64 @@ void tftp_server_connection::process_options(const tftp::rw_packet_t &request)
         log_error(_logger, "Failed to convert timeout value to int '{}' [{}]", opt.second, _client_str);
       }
     }
+    else if (std::strcmp(opt.first.c_str(), UTIMEOUT_OPT) == 0)
+    {
+      try
+      {
+        const uint64_t req_timeout_ms = std::stoull(opt.second);
+        if ((req_timeout_ms < MIN_RTO_MS) || (req_timeout_ms > MAX_UTIMEOUT_MS))
+        {
+          log_warn(_logger, "Received invalid utimeout value '{}' [{}]", opt.second, _client_str);
+        }
+        else
+        {
+          _timeout_ms = static_cast<uint32_t>(req_timeout_ms);
+          _oack_packet.options.push_back(std::make_pair(opt.first, std::to_string(_timeout_ms)));
+          log_trace(_logger, "Set timeout to {}ms [{}]", _timeout_ms, _client_str);
+        }
+      }
+      catch (const std::exception &err)
+      {
+        log_error(_logger, "Failed to convert utimeout value to int '{}' [{}]", opt.second, _client_str);
+      }
+    }
+    else if (std::strcmp(opt.first.c_str(), WINDOWSIZE_OPT) == 0)
+    {
+      if (request.type != tftp::packet_t::READ)
+      {
+        log_info(_logger, "Window size is only supported for read requests, ignoring [{}]", _client_str);
+        continue;
+      }
+      try
+      {
+        const uint64_t req_window_size = std::stoull(opt.second);
+        if ((req_window_size < 1) || (req_window_size > UINT16_MAX))
+        {
+          log_warn(_logger, "Received invalid window size value '{}' [{}]", opt.second, _client_str);
+        }
+        else
+        {
+          _window_size = static_cast<uint16_t>(std::min<uint64_t>(req_window_size, MAX_WINDOW_SIZE));
+          _oack_packet.options.push_back(std::make_pair(opt.first, std::to_string(_window_size)));
+          log_trace(_logger, "Set window size to {} [{}]", _window_size, _client_str);
+        }
+      }
+      catch (const std::exception &err)
+      {
+        log_error(_logger, "Failed to convert window size value to int '{}' [{}]", opt.second, _client_str);
+      }
+    }
+    else if (std::strcmp(opt.first.c_str(), ROLLOVER_OPT) == 0)
+    {
+      if ((opt.second != "0") && (opt.second != "1"))
+      {
+        log_warn(_logger, "Received invalid rollover value '{}' [{}]", opt.second, _client_str);
+        continue;
+      }
+      _rollover = static_cast<uint16_t>(opt.second[0] - '0');
+      _oack_packet.options.push_back(std::make_pair(opt.first, opt.second));
+      log_trace(_logger, "Block numbers roll over to {} [{}]", _rollover, _client_str);
+    }
     else
     {
       log_info(_logger, "Unsupported option '{}' [{}]", opt.first.c_str(), _client_str);
@@ -222,11 +559,61 @@ int tftp_server_connection::sd() const
 }
 //========================================================
 /**
- * @brief Returns file descriptor of the timer fd
+ * @brief Sets the function called by the timer wheel when the retransmit timer expires
+ *
+ * The owning event loop is expected to call handle_read() from it, which then handles the timeout.
+ */
+void tftp_server_connection::set_timeout_callback(std::function<void()> on_timeout)
+{
+  _timer.set_callback(std::move(on_timeout));
+}
+
+//========================================================
+/**
+ * @brief Sets the function disk I/O completions of this session are posted as, required when created with a
+ * disk_io_channel
+ *
+ * The owning event loop is expected to call handle_io_complete() from it.
+ */
+void tftp_server_connection::set_io_callback(std::function<void()> on_io_complete)
+{
+  _on_io_complete = std::move(on_io_complete);
+}
+
+//========================================================
+/**
+ * @brief Hands the session's DATA / ACK traffic to a poller that does socket I/O itself, see
+ * event_poller::receive_datagrams()
+ *
+ * The owning event loop passes each datagram the poller received to handle_read(), and may call handle_write() as soon
+ * as the session has something to send, DATA and ACK packets are queued on the poller and go out with its next wait.
+ * Other packets are still sent on the socket straight away, as are blocks sent from a file mapping.
+ *
+ * Octet blocks read with pread() are then read a batch ahead by the poller too, see event_poller::queue_read(). Their
+ * completions carry read_data, the event loop passes their results to handle_read_complete(). Call before the first
+ * handle_write().
  */
-int tftp_server_connection::timer_fd() const
+void tftp_server_connection::set_poller_io(event_poller *poller, const uint64_t read_data)
+{
+  _poller_io        = poller;
+  _poller_read_data = read_data;
+  auto file         = _file_reader.descriptor();
+  if ((_poller_io == nullptr) || !file)
+  {
+    return;
+  }
+  _read_ahead            = std::make_shared<read_ahead_t>();
+  _read_ahead->ring_file = std::move(file);
+  for (auto &batch : _read_ahead->batches)
+  {
+    batch.blocks.resize(_io_batch_blocks);
+  }
+}
+
+//========================================================
+bool tftp_server_connection::poller_io() const
 {
-  return _timer.fd();
+  return _poller_io != nullptr;
 }
 
 //========================================================
@@ -250,7 +637,7 @@ void tftp_server_connection::set_finished(const bool finished)
  */
 bool tftp_server_connection::wait_for_read() const
 {
-  return (_state == state_t::WAIT_FOR_ACK || _state == state_t::WAIT_FOR_DATA);
+  return !_io_parked && (_state == state_t::WAIT_FOR_ACK || _state == state_t::WAIT_FOR_DATA);
 }
 //========================================================
 /**
@@ -258,8 +645,17 @@ bool tftp_server_connection::wait_for_read() const
  */
 bool tftp_server_connection::wait_for_write() const
 {
-  return (_state == state_t::SEND_ACK || _state == state_t::SEND_DATA || _state == state_t::SEND_OACK ||
-          _state == state_t::ERROR);
+  return !_io_parked && (_state == state_t::SEND_ACK || _state == state_t::SEND_DATA ||
+                         _state == state_t::SEND_OACK || _state == state_t::ERROR);
+}
+
+//========================================================
+/**
+ * @brief Returns true if this client session is parked until its disk I/O completes
+ */
+bool tftp_server_connection::wait_for_io() const
+{
+  return _io_parked;
 }
 
 //========================================================
@@ -268,21 +664,66 @@ const struct sockaddr_in &tftp_server_connection::client() const
   return _client;
 }
 
+//========================================================
+const tftp_server_connection::copy_stats_t &tftp_server_connection::copy_stats() const
+{
+  return _copy_stats;
+}
+
+//========================================================
+const tftp_server_connection::ack_stats_t &tftp_server_connection::ack_stats() const
+{
+  return _ack_stats;
+}
+
+//========================================================
+/**
+ * @brief Returns how often and for how long the session has waited for the disk
+ */
+const tftp_server_connection::disk_stats_t &tftp_server_connection::disk_stats() const
+{
+  return _disk_stats;
+}
+
+//========================================================
+/**
+ * @brief Handles EPOLLERR on the socket
+ *
+ * Zero copy completions queued on the error queue also raise EPOLLERR, they are consumed here. The session only ends
+ * if the socket has a real error pending.
+ */
+void tftp_server_connection::handle_error()
+{
+  if (_zero_copy)
+  {
+    recv_zerocopy_completions();
+  }
+  const int err = _udp.socket_error();
+  if (err != 0)
+  {
+    log_warn(_logger, "Socket error, ending connection : {} [{}]", utils::string_error(err), _client_str);
+    _finished = true;
+  }
+}
+
 //========================================================
 /**
  * @brief Changes the state machines state to resend the previous packet
  *
+ * For read transfers this rolls back to the last acknowledged block and resends the whole window, or the OACK if the
+ * client has not acknowledged it yet.
  */
 void tftp_server_connection::retransmit()
 {
   if (_state == state_t::WAIT_FOR_ACK)
   {
-    _state = state_t::SEND_DATA;
+    _window_sent = 0;
+    _state       = (_window_count == 0) ? state_t::SEND_OACK : state_t::SEND_DATA;
   }
   else if (_state == state_t::WAIT_FOR_DATA)
   {
-    _state = state_t::SEND_ACK;
-    _block_number -= 1;
+    _state        = state_t::SEND_ACK;
+    _block_number = _last_acked;
   }
   else
   {
@@ -295,20 +736,30 @@ void tftp_server_connection::retransmit()
 /**
  * @brief Handles reading of the next packet and advances the state machine
  *
+ * With set_poller_io() the packet is the datagram the poller received, it is dropped if the retransmit timer expired.
  */
-void tftp_server_connection::handle_read()
+void tftp_server_connection::handle_read(const std::string_view received)
 {
   if (_timer.has_expired())
   {
-    if (_timeout_count >= MAX_TIMEOUTS)
+    if (!wait_for_read())
+    {
+      // Expired just as a reply arrived, the pending send re-arms the timer
+      return;
+    }
+    const uint64_t silent_ms = (rtt_estimator::steady_clock_us() - _last_reply_us) / 1000;
+    if (silent_ms >= static_cast<uint64_t>(MAX_TIMEOUTS) * _timeout_ms)
     {
-      log_error(_logger, "Reached maximum retransmits, ending connection [{}]", _client_str);
+      log_error(_logger, "No reply for {}ms after {} retransmits, ending connection [{}]", silent_ms, _retransmits,
+                _client_str);
       _finished = true;
     }
     else
     {
-      _timeout_count += 1;
-      log_warn(_logger, "Timed out in '{}': retransmitting last packet. [{}]", state_to_string(_state), _client_str);
+      ++_retransmits;
+      _rtt.backoff();
+      log_debug(_logger, "Timed out in '{}': retransmitting last packet, next timeout {}ms [{}]",
+                state_to_string(_state), _rtt.rto_ms(), _client_str);
       retransmit();
     }
     return;
@@ -317,42 +768,81 @@ void tftp_server_connection::handle_read()
   switch (_state)
   {
   case state_t::WAIT_FOR_ACK: {
-    const auto recv_data  = _udp.recv(tftp::ACK_PKT_MAX_SIZE);
-    const auto ack_packet = tftp::deserialise_ack_packet(recv_data);
+    const std::string_view recv_data  = (_poller_io != nullptr) ? received : receive();
+    const auto             ack_packet = tftp::decode_ack_packet(recv_data);
     if (ack_packet)
     {
-      _timeout_count = 0;
-      if (ack_packet->block_number == (_block_number - 1)) // IE the client retransmitted
+      _last_reply_us = rtt_estimator::steady_clock_us();
+      // Number of blocks newly acknowledged by this ack, block numbers roll over
+      const uint16_t acked = tftp::block_distance(_last_acked, ack_packet->block_number, _rollover);
+      if ((acked == 0) && (_window_count == 0))
       {
-        log_trace(
-            _logger,
-            "Received ack to previous packet data packet ({}), assuming packet was lost, retransmitting last [{}]",
-            _block_number - 1, _client_str);
-        _state = state_t::SEND_DATA;
+        log_trace(_logger, "Received ack to OACK [{}]", _client_str);
+        _window_sent = 0;
+        _state       = state_t::SEND_DATA;
+      }
+      else if (acked == 0)
+      {
+        // Most likely a late or repeated ack, the retransmit timer resends if blocks really were lost
+        ++_ack_stats.duplicate_acks;
+        ++_dup_acks;
+        if ((_dup_ack_threshold > 0) && (_dup_acks >= _dup_ack_threshold))
+        {
+          log_trace(_logger, "Received {} duplicate acks to block {}, resending window [{}]", _dup_acks, _last_acked,
+                    _client_str);
+          _dup_acks    = 0;
+          _window_sent = 0;
+          _state       = state_t::SEND_DATA;
+        }
+        else
+        {
+          log_trace(_logger, "Received duplicate ack to block {}, not resending [{}]", _last_acked, _client_str);
+          ++_ack_stats.suppressed_retransmits;
+        }
       }
-      else if (ack_packet->block_number == _block_number)
+      else if (acked <= _window_count)
       {
-        if (_final_ack)
+        // Blocks sent before a timeout rolled the window back may be acknowledged before they are resent
+        log_trace(_logger, "Received ack to block {} [{}]", ack_packet->block_number, _client_str);
+        _dup_acks = 0;
+        const window_slot_t &newest_acked = _window[(_window_head + acked - 1) % _window_size];
+        if (newest_acked.transmissions == 1)
+        {
+          sample_rtt(newest_acked.sent_us);
+        }
+        _window_head = (_window_head + acked) % _window_size;
+        _window_count -= acked;
+        _last_acked = ack_packet->block_number;
+        if (_final_ack && (_window_count == 0))
         {
-          log_trace(_logger, "Received final ack ({}) [{}]", _block_number, _client_str);
+          log_trace(_logger, "Received final ack ({}) [{}]", _last_acked, _client_str);
           _finished = true;
           break;
         }
-        log_trace(_logger, "Received ack to block {} [{}]", _block_number, _client_str);
-        _pkt_ready = false;
-        _state     = state_t::SEND_DATA;
-        ++_block_number;
+        if (acked < _window_sent)
+        {
+          // The client drops blocks arriving out of order, so it acks the last one in order and wants the rest again
+          log_trace(_logger, "Ack is inside the window, resending from block {} [{}]", _last_acked, _client_str);
+        }
+        _window_sent = 0;
+        _state       = state_t::SEND_DATA;
+      }
+      else if (acked > (UINT16_MAX / 2))
+      {
+        log_trace(_logger, "Ignoring stale ack to block {} [{}]", ack_packet->block_number, _client_str);
+        ++_ack_stats.duplicate_acks;
+        ++_ack_stats.suppressed_retransmits;
       }
       else
       {
-        log_error(_logger, "Received incorrect block number in ack {} vs expected {} [{}]", ack_packet->block_number,
-                  _block_number, _client_str);
+        log_error(_logger, "Received incorrect block number in ack {}, {} blocks sent after block {} [{}]",
+                  ack_packet->block_number, _window_sent, _last_acked, _client_str);
         _state = state_t::ERROR;
       }
     }
     else
     {
-      const auto error_packet = tftp::deserialise_error_packet(recv_data);
+      const auto error_packet = tftp::decode_error_packet(recv_data);
       if (error_packet)
       {
         log_warn(_logger, "Received error when waiting for ack to block {} from client [{}] : {} - {}", _block_number,
@@ -363,33 +853,35 @@ void tftp_server_connection::handle_read()
     break;
   }
   case state_t::WAIT_FOR_DATA: {
-    const auto recv_data   = _udp.recv(_block_size);
-    const auto data_packet = tftp::deserialise_data_packet(recv_data);
+    const std::string_view recv_data   = (_poller_io != nullptr) ? received : receive();
+    const auto             data_packet = tftp::decode_data_packet(recv_data);
     if (data_packet)
     {
-      _timeout_count = 0;
-      if (data_packet->block_number == (_block_number - 1))
+      _last_reply_us = rtt_estimator::steady_clock_us();
+      if (data_packet->block_number == _last_acked)
       {
         log_trace(
             _logger,
             "Received data packet to previous ack packet ({}), assuming packet was lost, retransmitting last ack [{}]",
-            _block_number - 1, _client_str);
-        _block_number -= 1;
-        _state = state_t::SEND_ACK;
+            _last_acked, _client_str);
+        _block_number = _last_acked;
+        _state        = state_t::SEND_ACK;
       }
       else if (data_packet->block_number == _block_number)
       {
         log_trace(_logger, "Received data block {} from {}", _block_number, _client_str);
-        _file_writer.write(data_packet->data);
-        if (_file_writer.error())
+        if (_ack_transmissions == 1)
+        {
+          sample_rtt(_ack_sent_us);
+        }
+        _ack_transmissions = 0;
+        const bool last = data_packet->data.size() < _block_size;
+        if (!write_block(data_packet->data, last))
         {
-          log_error(_logger, "Error occued when writing data block {} from {}", _block_number, _client_str);
-          _error_pkt = tftp::error_packet_t(tftp::error_t::NOT_DEFINED, "Internal server error");
-          _state     = state_t::ERROR;
           break;
         }
 
-        if (data_packet->data.size() < _block_size)
+        if (last)
         {
           log_trace(_logger, "Received final data block from client {}", _client_str);
           _final_ack = true;
@@ -405,7 +897,7 @@ void tftp_server_connection::handle_read()
     }
     else
     {
-      const auto error_packet = tftp::deserialise_error_packet(recv_data);
+      const auto error_packet = tftp::decode_error_packet(recv_data);
       if (error_packet)
       {
         log_warn(_logger, "Received error when waiting for data packet block {} from client [{}] : {} - {}",
@@ -435,53 +927,28 @@ void tftp_server_connection::handle_write()
   switch (_state)
   {
   case state_t::SEND_DATA: {
-
-    if (!_pkt_ready)
+    send_window();
+    break;
+  }
+  case state_t::SEND_ACK: {
+    if (_write_behind)
     {
-      _file_reader.read_in_to(_data_pkt.data, _block_size);
-      if (_file_reader.error())
+      // Acks run ahead of the disk by at most a batch, the final ack waits for everything to be written
+      const write_behind_t &wb      = *_write_behind;
+      const bool            flushed = !_io_in_flight && wb.batches[wb.fill].empty();
+      if (_final_ack ? !flushed : (wb.fill_blocks >= _io_batch_blocks))
       {
-        log_error(_logger, "Error occued when reading data block {} from {}", _block_number, _client_str);
-        _error_pkt = tftp::error_packet_t(tftp::error_t::NOT_DEFINED, "Internal server error");
-        _state     = state_t::ERROR;
+        log_trace(_logger, "Waiting for disk writes before acking block {} [{}]", _block_number, _client_str);
+        park_for_io();
         break;
       }
-      else if ((_data_pkt.data.size() < _block_size) || _file_reader.eof())
-      {
-        log_trace(_logger, "Read last data block {} ({} bytes) [{}]", _block_number, _data_pkt.data.size(),
-                  _client_str);
-        if (_data_pkt.data.size() < _block_size)
-        {
-          _final_ack = true;
-        }
-      }
-
-      _data_pkt.block_number = _block_number;
-      _pkt_ready             = true;
-    }
-
-    const ssize_t ret = _udp.send(tftp::serialise_data_packet(_data_pkt));
-    if ((ret <= 0) && ((errno != EAGAIN) && (errno != EWOULDBLOCK)))
-    {
-      log_error(_logger, "Send data packet failed for client {} : {}", _client_str, utils::string_error(errno));
-      _error_pkt = tftp::error_packet_t(tftp::error_t::NOT_DEFINED, "Internal server error");
-      _state     = state_t::ERROR;
-    }
-    else if (ret > 0)
-    {
-      log_trace(_logger, "Sent data packet block {} [{}]", _block_number, _client_str);
-      _state = state_t::WAIT_FOR_ACK;
-      _timer.arm_timer(_timeout_s);
     }
-    else
+    const size_t size = tftp::encode_ack_packet(_block_number, _ack_buffer.data(), _ack_buffer.size());
+    ssize_t      ret  = static_cast<ssize_t>(size);
+    if ((_poller_io == nullptr) || !_poller_io->queue_send(_udp.sd(), _ack_buffer.data(), size))
     {
-      log_trace(_logger, "Send for data packet block {} not ready for client {}", _block_number, _client_str);
+      ret = _udp.send(_ack_buffer.data(), size);
     }
-    break;
-  }
-  case state_t::SEND_ACK: {
-    const auto    data = tftp::serialise_ack_packet(tftp::ack_packet_t(_block_number));
-    const ssize_t ret  = _udp.send(data);
     if ((ret <= 0) && ((errno != EAGAIN) && (errno != EWOULDBLOCK)))
     {
       log_error(_logger, "Send failed : {}", utils::string_error(errno));
@@ -497,9 +964,15 @@ void tftp_server_connection::handle_write()
         break;
       }
       log_trace(_logger, "Sent ack packet block {} [{}]", _block_number, _client_str);
-      ++_block_number;
-      _state = state_t::WAIT_FOR_DATA;
-      _timer.arm_timer(_timeout_s);
+      _ack_sent_us = rtt_estimator::steady_clock_us();
+      if (_ack_transmissions < UINT8_MAX)
+      {
+        ++_ack_transmissions;
+      }
+      _last_acked   = _block_number;
+      _block_number = tftp::next_block_number(_block_number, _rollover);
+      _state        = state_t::WAIT_FOR_DATA;
+      arm_retransmit_timer();
     }
     else
     {
@@ -521,10 +994,19 @@ void tftp_server_connection::handle_write()
       if (_type == tftp::packet_t::READ)
       {
         _state = state_t::WAIT_FOR_ACK;
+        arm_retransmit_timer();
+        if (_read_ahead)
+        {
+          // Read the first blocks while the client acknowledges the options
+          submit_read_ahead();
+        }
       }
       else
       {
-        _state = state_t::WAIT_FOR_DATA;
+        // The OACK stands in for the ACK of block 0
+        _last_acked   = 0;
+        _block_number = tftp::next_block_number(0, _rollover);
+        _state        = state_t::WAIT_FOR_DATA;
       }
     }
     break;
@@ -555,42 +1037,685 @@ void tftp_server_connection::handle_write()
 
 //========================================================
 /**
- * @brief Checks if a read / write operation is allowed
- *
- * Checks if the request filepath is contained within the server root.
- * Checks if a file already exists for write requests.
- * Checks if a file doesn't exist for read requests.
+ * @brief Reads the next block of the file into the free slot after the end of the window
  *
- * @param file_request Request filepath
- * @param type Request type: read or write.
- * @return std::optional<tftp::error_packet_t> Returns nullopt if operation is ok, otherwise, returns the error packet
- * with the error code & msg.
+ * @return false if no block was added, the connection is then in the error state or parked waiting for disk I/O
  */
-std::optional<tftp::error_packet_t> tftp_server_connection::is_operation_allowed(const std::string   &file_request,
-                                                                                 const tftp::packet_t type) const
+bool tftp_server_connection::read_block_into_window()
 {
-  const auto filepath              = std::filesystem::current_path() /= std::filesystem::path(file_request);
-  const auto canonical_filepath    = std::filesystem::weakly_canonical(filepath);
-  const auto canonical_server_root = std::filesystem::absolute(std::filesystem::current_path());
-
-  log_trace(_logger, "Checking if requested file : {} is within server root {}", canonical_filepath.c_str(),
-            canonical_server_root.c_str());
+  window_slot_t &slot = _window[(_window_head + _window_count) % _window_size];
+  slot.transmissions  = 0;
+  if (_send_mapped)
+  {
+    // Zero copy, the block is sent straight from the mapping
+    slot.header      = tftp::serialise_data_header(_block_number);
+    slot.payload     = _mapped.data() + _file_offset;
+    slot.payload_len = std::min(_mapped.size() - _file_offset, _block_size);
+    _file_offset += slot.payload_len;
+    if (slot.payload_len < _block_size)
+    {
+      log_trace(_logger, "Mapped last data block {} ({} bytes) [{}]", _block_number, slot.payload_len, _client_str);
+      _final_ack = true;
+    }
+  }
+  else if (_datagram_source)
+  {
+    if (!take_cached_datagram(slot))
+    {
+      return false;
+    }
+  }
+  else
+  {
+    // Read behind the header, the packet is then sent and resent from this buffer as is
+    tftp::data_packet_buffer &packet = slot.packet;
+    if (_read_ahead)
+    {
+      if (!take_read_ahead_block(packet))
+      {
+        return false;
+      }
+    }
+    else
+    {
+      const uint64_t start_us = rtt_estimator::steady_clock_us();
+      _file_reader.read_in_to(packet, _block_size);
+      add_disk_wait(start_us);
+      _file_reader.prefetch(_io_batch_blocks * _block_size);
+      if (_file_reader.error())
+      {
+        log_error(_logger, "Error occued when reading data block {} from {}", _block_number, _client_str);
+        _error_pkt = tftp::error_packet_t(tftp::error_t::NOT_DEFINED, "Internal server error");
+        _state     = state_t::ERROR;
+        return false;
+      }
+    }
+    if (packet.payload_size() < _block_size)
+    {
+      log_trace(_logger, "Read last data block {} ({} bytes) [{}]", _block_number, packet.payload_size(),
+                _client_str);
+      _final_ack = true;
+    }
+    packet.set_block_number(_block_number);
+    slot.datagram     = packet.data();
+    slot.datagram_len = packet.size();
+    slot.payload      = packet.payload();
+    slot.payload_len  = packet.payload_size();
+    _copy_stats.copied_bytes += packet.payload_size();
+  }
+
+  slot.block_number = _block_number;
+  _block_number     = tftp::next_block_number(_block_number, _rollover);
+  ++_window_count;
+  return true;
+}
+
+//========================================================
+/**
+ * @brief Sends the unsent blocks of the window, reading new blocks from the file as required
+ *
+ * The window is filled first and its unsent blocks go out together with a single sendmmsg(). Waits for an ack once the
+ * window is full or the final block has been sent. Stops early if the socket is not writable, the next call carries on
+ * from the first unsent block.
+ */
+void tftp_server_connection::send_window()
+{
+  bool waiting_for_disk = false;
+  while ((_window_count < _window_size) && !_final_ack)
+  {
+    if (!read_block_into_window())
+    {
+      // Blocks read so far are still sent, unless the read failed
+      if (_state == state_t::ERROR)
+      {
+        return;
+      }
+      waiting_for_disk = true;
+      break;
+    }
+  }
+
+  if ((_poller_io != nullptr) && !_send_mapped)
+  {
+    // Nothing waits for the socket, a send that finds its buffer full is lost like any other datagram
+    for (size_t i = _window_sent; i < _window_count; ++i)
+    {
+      const window_slot_t &slot = _window[(_window_head + i) % _window_size];
+      _poller_io->queue_send(_udp.sd(), slot.datagram, slot.datagram_len);
+    }
+    window_sent(_window_count - _window_sent, false);
+  }
+
+  bool zerocopy = _send_mapped && _msg_zerocopy;
+  while (_window_sent < _window_count)
+  {
+    _send_views.clear();
+    for (size_t i = _window_sent; i < _window_count; ++i)
+    {
+      const window_slot_t &slot = _window[(_window_head + i) % _window_size];
+      if (_send_mapped)
+      {
+        _send_views.push_back({slot.header.data(), slot.header.size(), slot.payload, slot.payload_len});
+      }
+      else
+      {
+        _send_views.push_back({slot.datagram, slot.datagram_len, nullptr, 0});
+      }
+    }
+
+    const int sent = _udp.send_batch(_send_views.data(), _send_views.size(), zerocopy);
+    if ((sent < 0) && (errno == ENOBUFS) && zerocopy)
+    {
+      // Out of optmem for completion notifications, collect them and send these blocks the normal way
+      recv_zerocopy_completions();
+      zerocopy = false;
+      continue;
+    }
+    if ((sent <= 0) && ((errno != EAGAIN) && (errno != EWOULDBLOCK)))
+    {
+      log_error(_logger, "Send data packet failed for client {} : {}", _client_str, utils::string_error(errno));
+      _error_pkt = tftp::error_packet_t(tftp::error_t::NOT_DEFINED, "Internal server error");
+      _state     = state_t::ERROR;
+      return;
+    }
+    else if (sent <= 0)
+    {
+      log_trace(_logger, "Send for data packet block {} not ready for client {}",
+                _window[(_window_head + _window_sent) % _window_size].block_number, _client_str);
+      return;
+    }
+
+    window_sent(static_cast<size_t>(sent), zerocopy);
+    zerocopy = _send_mapped && _msg_zerocopy;
+  }
+
+  if (!waiting_for_disk)
+  {
+    _state = state_t::WAIT_FOR_ACK;
+    arm_retransmit_timer();
+  }
+}
+
+//========================================================
+/**
+ * @brief Accounts for the next count blocks of the window having been sent
+ */
+void tftp_server_connection::window_sent(const size_t count, const bool zerocopy)
+{
+  const uint64_t now_us = rtt_estimator::steady_clock_us();
+  for (size_t i = 0; i < count; ++i)
+  {
+    window_slot_t &slot = _window[(_window_head + _window_sent) % _window_size];
+    log_trace(_logger, "Sent data packet block {} [{}]", slot.block_number, _client_str);
+    _copy_stats.payload_bytes += slot.payload_len;
+    if (!zerocopy)
+    {
+      _copy_stats.copied_bytes += slot.payload_len;
+    }
+    slot.sent_us = now_us;
+    if (slot.transmissions < UINT8_MAX)
+    {
+      ++slot.transmissions;
+    }
+    ++_window_sent;
+  }
+}
+
+//========================================================
+/**
+ * @brief Receives a datagram from the socket into the receive buffer, empty if none was waiting
+ */
+std::string_view tftp_server_connection::receive()
+{
+  return std::string_view(_recv_buffer.data(), _udp.recv(_recv_buffer.data(), _recv_buffer.size()));
+}
+
+//========================================================
+/**
+ * @brief Moves the next prefetched block into packet, the packet's old buffer is reused for a later batch
+ *
+ * @return false if the block is not read yet, the session is then parked, or its read failed
+ */
+bool tftp_server_connection::take_read_ahead_block(tftp::data_packet_buffer &packet)
+{
+  read_ahead_t &ra = *_read_ahead;
+  if (ra.ready == 0)
+  {
+    submit_read_ahead();
+    if (ra.ready == 0)
+    {
+      log_trace(_logger, "Waiting for disk read of block {} [{}]", _block_number, _client_str);
+      park_for_io();
+      return false;
+    }
+  }
+
+  auto &batch = ra.batches[ra.head];
+  if (batch.error)
+  {
+    log_error(_logger, "Error occued when reading data block {} from {}", _block_number, _client_str);
+    _error_pkt = tftp::error_packet_t(tftp::error_t::NOT_DEFINED, "Internal server error");
+    _state     = state_t::ERROR;
+    return false;
+  }
+  std::swap(packet, batch.blocks[batch.next]);
+  if (++batch.next == batch.count)
+  {
+    ra.head = (ra.head + 1) % ra.batches.size();
+    --ra.ready;
+  }
+  submit_read_ahead();
+  return true;
+}
+
+//========================================================
+/**
+ * @brief Points the slot at the next block's datagram in the cache, reading its run first on a miss
+ *
+ * @return false if the run is being read, the session is then parked, or its read failed
+ */
+bool tftp_server_connection::take_cached_datagram(window_slot_t &slot)
+{
+  const size_t per_run   = datagram_cache::blocks_per_run(_block_size);
+  const size_t run_index = static_cast<size_t>(_datagram_block / per_run);
+  if (!_run || (_run_index != run_index))
+  {
+    datagram_source_t &source = *_datagram_source;
+    if (_io_in_flight)
+    {
+      park_for_io();
+      return false;
+    }
+    datagram_cache::run_ptr run;
+    if (source.built && (source.built_index == run_index))
+    {
+      run = std::move(source.built);
+    }
+    else
+    {
+      run = _datagrams->find(_datagram_key, run_index);
+    }
+    if (!run)
+    {
+      if (source.next_run != run_index)
+      {
+        // Carry on from where the cached run before this one ended, runs are taken in order
+        source.file.seek(_run->end);
+        source.next_run = run_index;
+      }
+      auto job = [source = _datagram_source, datagrams = _datagrams, key = _datagram_key, block_size = _block_size,
+                  run_index, logger = _logger]() {
+        try
+        {
+          source->file.prefetch(2 * datagram_cache::RUN_BYTES);
+          source->built = datagrams->insert(
+              key, run_index, datagram_cache::read_run(source->file, block_size, run_index, key.rollover));
+        }
+        catch (const std::exception &err)
+        {
+          log_error(logger, "Failed to read datagram run {} : {}", run_index, err.what());
+          datagram_cache::run_t failed{};
+          failed.error  = true;
+          source->built = std::make_shared<const datagram_cache::run_t>(std::move(failed));
+        }
+        source->built_index = run_index;
+        source->next_run    = run_index + 1;
+      };
+      if (_io != nullptr)
+      {
+        if (submit_io(job))
+        {
+          log_trace(_logger, "Waiting for disk read of block {} [{}]", _block_number, _client_str);
+          park_for_io();
+          return false;
+        }
+      }
+      else
+      {
+        const uint64_t start_us = rtt_estimator::steady_clock_us();
+        job();
+        add_disk_wait(start_us);
+      }
+      run = std::move(source.built);
+    }
+    _run       = std::move(run);
+    _run_index = run_index;
+  }
+
+  const size_t index = static_cast<size_t>(_datagram_block - (static_cast<uint64_t>(run_index) * per_run));
+  if (_run->error || (index >= _run->count))
+  {
+    log_error(_logger, "Error occued when reading data block {} from {}", _block_number, _client_str);
+    _error_pkt = tftp::error_packet_t(tftp::error_t::NOT_DEFINED, "Internal server error");
+    _state     = state_t::ERROR;
+    return false;
+  }
+  const std::string_view datagram = _run->datagram(index);
+  slot.run                        = _run;
+  slot.datagram                   = datagram.data();
+  slot.datagram_len               = datagram.size();
+  slot.payload                    = datagram.data() + tftp::DATA_PKT_HEADER_SIZE;
+  slot.payload_len                = datagram.size() - tftp::DATA_PKT_HEADER_SIZE;
+  if (_run->last && ((index + 1) == _run->count))
+  {
+    log_trace(_logger, "Last data block {} ({} bytes) [{}]", _block_number, slot.payload_len, _client_str);
+    _final_ack = true;
+  }
+  ++_datagram_block;
+  return true;
+}
+
+//========================================================
+/**
+ * @brief Starts reading the next batch of blocks if a batch is free and no other I/O of this session is running
+ */
+void tftp_server_connection::submit_read_ahead()
+{
+  const read_ahead_t &ra = *_read_ahead;
+  if (_io_in_flight || ra.done || (ra.ready == ra.batches.size()))
+  {
+    return;
+  }
+  const size_t index = (ra.head + ra.ready) % ra.batches.size();
+  if (ra.ring_file)
+  {
+    submit_ring_read(index);
+    return;
+  }
+  submit_io([read_ahead = _read_ahead, index, block_size = _block_size, logger = _logger]() {
+    auto &batch = read_ahead->batches[index];
+    batch.count = 0;
+    batch.next  = 0;
+    batch.last  = false;
+    batch.error = false;
+    try
+    {
+      // Have the kernel fetch the batch after this one while this one is read
+      read_ahead->file.prefetch(2 * batch.blocks.size() * block_size);
+      while ((batch.count < batch.blocks.size()) && !batch.last)
+      {
+        auto &packet = batch.blocks[batch.count];
+        read_ahead->file.read_in_to(packet, block_size);
+        if (read_ahead->file.error())
+        {
+          batch.error = true;
+          break;
+        }
+        batch.last = packet.payload_size() < block_size;
+        ++batch.count;
+      }
+    }
+    catch (const std::exception &err)
+    {
+      log_error(logger, "Failed to read ahead : {}", err.what());
+      batch.error = true;
+    }
+  });
+}
+
+//========================================================
+/**
+ * @brief Queues the read of a batch on the poller, one read into the payloads of all of its blocks
+ *
+ * A poller that does not read files has the batch read right here instead.
+ */
+void tftp_server_connection::submit_ring_read(const size_t index)
+{
+  read_ahead_t &ra    = *_read_ahead;
+  auto         &batch = ra.batches[index];
+  batch.count         = 0;
+  batch.next          = 0;
+  batch.last          = false;
+  batch.error         = false;
+  ra.iovecs.resize(batch.blocks.size());
+  for (size_t i = 0; i < batch.blocks.size(); ++i)
+  {
+    batch.blocks[i].resize_payload(_block_size);
+    ra.iovecs[i] = {batch.blocks[i].payload(), _block_size};
+  }
+
+  _io_in_flight = true;
+  if (_poller_io->queue_read(ra.ring_file->fd, ra.iovecs.data(), ra.iovecs.size(), ra.offset, _poller_read_data,
+                             _read_ahead))
+  {
+    return;
+  }
+  const ssize_t ret = preadv(ra.ring_file->fd, ra.iovecs.data(), static_cast<int>(ra.iovecs.size()),
+                             static_cast<off_t>(ra.offset));
+  handle_read_complete((ret < 0) ? -errno : static_cast<int32_t>(ret));
+}
+
+//========================================================
+/**
+ * @brief Hands the session the result of the read the poller did into its batch, see set_poller_io()
+ *
+ * A short read is the end of the file. One that stops before the size the file was opened with keeps only its whole
+ * blocks, the next batch reads on from there, unless not even one block was read.
+ */
+void tftp_server_connection::handle_read_complete(const int32_t result)
+{
+  read_ahead_t &ra    = *_read_ahead;
+  auto         &batch = ra.batches[(ra.head + ra.ready) % ra.batches.size()];
+  if (result < 0)
+  {
+    log_error(_logger, "Failed to read ahead : {} [{}]", utils::string_error(-result), _client_str);
+    batch.error = true;
+  }
+  else
+  {
+    const size_t bytes      = static_cast<size_t>(result);
+    const bool   short_read = bytes < (batch.blocks.size() * _block_size);
+    const bool   at_end     = (bytes < _block_size) || ((ra.offset + bytes) >= _file_reader.key().size);
+    batch.last              = short_read && at_end;
+    const size_t used       = batch.last ? bytes : (bytes - (bytes % _block_size));
+    batch.count             = batch.last ? ((used / _block_size) + 1) : (used / _block_size);
+    for (size_t i = 0; i < batch.count; ++i)
+    {
+      batch.blocks[i].resize_payload(std::min(_block_size, used - (i * _block_size)));
+    }
+    ra.offset += used;
+  }
+  handle_io_complete();
+}
+
+//========================================================
+/**
+ * @brief Writes a received block, or queues it to be written behind when disk I/O runs on the pool
+ *
+ * The file is closed after the last block, so the upload is written, and synced if asked to, before the final ack.
+ *
+ * @return false if the write failed, the connection is then in the error state
+ */
+bool tftp_server_connection::write_block(const std::string_view data, const bool last)
+{
+  if (_write_behind)
+  {
+    auto &batch = _write_behind->batches[_write_behind->fill];
+    batch.insert(batch.end(), data.begin(), data.end());
+    ++_write_behind->fill_blocks;
+    _write_behind->fill_last = last;
+    submit_write_behind();
+    return true;
+  }
+
+  const uint64_t start_us = rtt_estimator::steady_clock_us();
+  bool           failed   = false;
+  try
+  {
+    _file_writer.write(data.data(), data.size());
+    if (last)
+    {
+      _file_writer.close();
+    }
+  }
+  catch (const std::exception &err)
+  {
+    log_error(_logger, "Failed to write data block {} : {} [{}]", _block_number, err.what(), _client_str);
+    failed = true;
+  }
+  add_disk_wait(start_us);
+  if (failed || _file_writer.error())
+  {
+    log_error(_logger, "Error occued when writing data block {} from {}", _block_number, _client_str);
+    _error_pkt = write_error_packet(_file_writer.disk_full());
+    _state     = state_t::ERROR;
+    return false;
+  }
+  return true;
+}
+
+//========================================================
+/**
+ * @brief Starts writing the batch being filled if it is not empty and no other I/O of this session is running
+ */
+void tftp_server_connection::submit_write_behind()
+{
+  write_behind_t &wb = *_write_behind;
+  if (_io_in_flight || wb.batches[wb.fill].empty())
+  {
+    return;
+  }
+  const size_t index = wb.fill;
+  const bool   last  = wb.fill_last;
+  wb.fill            = (wb.fill + 1) % wb.batches.size();
+  wb.fill_blocks     = 0;
+  submit_io([write_behind = _write_behind, index, last, logger = _logger]() {
+    auto &batch = write_behind->batches[index];
+    try
+    {
+      write_behind->file.write(batch.data(), batch.size());
+      if (last)
+      {
+        write_behind->file.close();
+      }
+      write_behind->error     = write_behind->error || write_behind->file.error();
+      write_behind->disk_full = write_behind->file.disk_full();
+    }
+    catch (const std::exception &err)
+    {
+      // Netascii decoding refuses bad line endings, the upload can not be completed either way
+      log_error(logger, "Failed to write behind : {}", err.what());
+      write_behind->error = true;
+    }
+    batch.clear();
+  });
+}
+
+//========================================================
+/**
+ * @brief Runs a job on the disk I/O pool, or right here if the pool's queue is full
+ *
+ * @return true if the job was queued, its completion then comes through handle_io_complete()
+ */
+bool tftp_server_connection::submit_io(std::function<void()> job)
+{
+  _io_in_flight = true;
+  if (_io->submit(job, _on_io_complete))
+  {
+    return true;
+  }
+  log_warn(_logger, "Disk I/O queue full, running I/O on the event loop [{}]", _client_str);
+  job();
+  handle_io_complete();
+  return false;
+}
+
+//========================================================
+/**
+ * @brief Handles completion of the session's disk I/O job and unparks the session
+ *
+ * Starts the next job if there is more to read ahead or write behind. A failed write ends the session with an error.
+ */
+void tftp_server_connection::handle_io_complete()
+{
+  _io_in_flight = false;
+  if (_read_ahead)
+  {
+    read_ahead_t &ra    = *_read_ahead;
+    const auto   &batch = ra.batches[(ra.head + ra.ready) % ra.batches.size()];
+    ra.done             = batch.last || batch.error;
+    ++ra.ready;
+    submit_read_ahead();
+  }
+  else if (_write_behind)
+  {
+    if (_write_behind->error)
+    {
+      log_error(_logger, "Error occued when writing data from {}", _client_str);
+      _error_pkt = write_error_packet(_write_behind->disk_full);
+      _state     = state_t::ERROR;
+    }
+    else
+    {
+      submit_write_behind();
+    }
+  }
+  if (_io_parked)
+  {
+    add_disk_wait(_io_parked_us);
+    _io_parked = false;
+  }
+}
+
+//========================================================
+/**
+ * @brief Stops the session polling its socket until its disk I/O job completes
+ */
+void tftp_server_connection::park_for_io()
+{
+  _io_parked    = true;
+  _io_parked_us = rtt_estimator::steady_clock_us();
+}
+
+//========================================================
+/**
+ * @brief Counts a wait for the disk that started at start_us and ends now
+ */
+void tftp_server_connection::add_disk_wait(const uint64_t start_us)
+{
+  ++_disk_stats.waits;
+  _disk_stats.wait_us += rtt_estimator::steady_clock_us() - start_us;
+}
+
+//========================================================
+/**
+ * @brief Arms the retransmit timer with the current adaptive timeout
+ */
+void tftp_server_connection::arm_retransmit_timer()
+{
+  _timer.arm_timer(_rtt.next_timeout_ms());
+}
+
+//========================================================
+/**
+ * @brief Feeds the round trip time of a packet that was sent once and has now been answered to the estimator
+ */
+void tftp_server_connection::sample_rtt(const uint64_t sent_us)
+{
+  const uint64_t rtt_us = rtt_estimator::steady_clock_us() - sent_us;
+  _rtt.add_sample(rtt_us);
+  log_trace(_logger, "RTT sample {}us, srtt {}us, rttvar {}us, timeout {}ms [{}]", rtt_us, _rtt.srtt_us(),
+            _rtt.rttvar_us(), _rtt.rto_ms(), _client_str);
+}
+
+//========================================================
+/**
+ * @brief Collects zero copy completions from the socket error queue
+ *
+ * Sends the kernel ended up copying are added to the copy count. Once that happens MSG_ZEROCOPY only adds the cost of
+ * the notifications, so the rest of the session sends without it (still without copying the file into userspace).
+ */
+void tftp_server_connection::recv_zerocopy_completions()
+{
+  try
+  {
+    const auto completions = _udp.recv_zerocopy_completions();
+    _copy_stats.copied_bytes += completions.copied_bytes;
+    if ((completions.copied_bytes > 0) && _msg_zerocopy)
+    {
+      log_debug(_logger, "Kernel copied zero copy sends, disabling MSG_ZEROCOPY [{}]", _client_str);
+      _msg_zerocopy = false;
+    }
+  }
+  catch (const std::exception &err)
+  {
+    log_error(_logger, "Failed to read zero copy completions : {} [{}]", err.what(), _client_str);
+  }
+}
+
+//========================================================
+/**
+ * @brief Checks if a read / write operation is allowed
+ *
+ * Checks if the request filepath is contained within the server root.
+ * Checks if a file already exists for write requests.
+ * Checks if a file doesn't exist for read requests.
+ *
+ * @param entry What is known about the requested filepath
+ * @param type Request type: read or write.
+ * @return std::optional<tftp::error_packet_t> Returns nullopt if operation is ok, otherwise, returns the error packet
+ * with the error code & msg.
+ */
+std::optional<tftp::error_packet_t> tftp_server_connection::is_operation_allowed(const metadata_cache::entry_t &entry,
+                                                                                 const tftp::packet_t type) const
+{
+  log_trace(_logger, "Checking if requested file : {} is within server root", entry.canonical.c_str());
 
-  if (!utils::is_subpath(canonical_filepath, canonical_server_root))
+  if (!entry.in_root)
   {
-    log_warn(_logger, "File {} is not in server root [{}]", canonical_filepath.c_str(), _client_str);
+    log_warn(_logger, "File {} is not in server root [{}]", entry.canonical.c_str(), _client_str);
     return tftp::error_packet_t(tftp::error_t::ACCESS_ERROR, "Access denied");
   }
 
-  if ((type == tftp::packet_t::WRITE) && (std::filesystem::exists(canonical_filepath)))
+  if ((type == tftp::packet_t::WRITE) && entry.exists)
   {
-    log_warn(_logger, "File {} already exists [{}]", canonical_filepath.c_str(), _client_str);
+    log_warn(_logger, "File {} already exists [{}]", entry.canonical.c_str(), _client_str);
     return tftp::error_packet_t(tftp::error_t::FILE_EXISTS, "File already exists");
   }
 
-  if ((type == tftp::packet_t::READ) && (!std::filesystem::exists(canonical_filepath)))
+  if ((type == tftp::packet_t::READ) && !entry.exists)
   {
-    log_warn(_logger, "File {} does not exists [{}]", canonical_filepath.c_str(), _client_str);
+    log_warn(_logger, "File {} does not exists [{}]", entry.canonical.c_str(), _client_str);
     return tftp::error_packet_t(tftp::error_t::ACCESS_ERROR, "File not found");
   }
 
@@ -0,0 +1,430 @@
+#include "server/tftp_server_worker.hpp"
+
+#include <sys/epoll.h>
+
+#include "common/debug_macros.hpp"
+#include "common/utils.hpp"
+
+namespace
+{
+  const uint64_t LISTENER_HANDLE = slab<tftp_server_connection>::INVALID_HANDLE;
+  const uint64_t DISK_IO_HANDLE  = slab<tftp_server_connection>::INVALID_HANDLE - 1;
+
+  /**
+   * @brief Events to poll a connection's socket for, none while it is parked on disk I/O
+   */
+  uint32_t poll_events(const tftp_server_connection &conn)
+  {
+    if (conn.wait_for_io())
+    {
+      return 0;
+    }
+    return conn.wait_for_read() ? EPOLLIN : EPOLLOUT;
+  }
+
+  /**
+   * @brief Events to poll a multicast group's socket for, it always listens for its members
+   */
+  uint32_t poll_events(const tftp_multicast_group &group)
+  {
+    return group.wait_for_write() ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+  }
+}; // namespace
+
+//========================================================
+tftp_server_worker::tftp_server_worker(const server_options &options, const size_t max_clients,
+                                       const bool reuse_port, const std::atomic_bool &exit_requested,
+                                       const tftp_server_connection::shared_t &shared, disk_io_pool *io_pool,
+                                       multicast_address_pool *multicast) :
+    _exit_requested(exit_requested),
+    _timer_wheel(),
+    _conn_handler(options.interface, options.port, reuse_port),
+    _client_connections(max_clients),
+    _session_keys{},
+    _timed_out{},
+    _poller(event_poller::create(options.backend, (multicast != nullptr ? 2 * max_clients : max_clients) + 2)),
+    _options(options),
+    _shared(shared),
+    _copy_stats{0, 0},
+    _disk_stats{0, 0},
+    _io(io_pool != nullptr ? std::make_unique<disk_io_channel>(*io_pool) : nullptr),
+    _multicast(multicast),
+    _ack_stats{0, 0},
+    // Every group has at least one client
+    _groups(multicast != nullptr ? max_clients : 0),
+    _group_index{},
+    _timed_out_groups{},
+    _groups_served(0),
+    _multicast_stats{0, 0}
+{
+  _shared.io = _io.get();
+  _timed_out.reserve(max_clients);
+  _session_keys.reserve(max_clients);
+  _timed_out_groups.reserve(_groups.capacity());
+  dbg_info("Worker using {} event backend", event_poller::backend_to_string(_poller->backend()));
+}
+
+//========================================================
+void tftp_server_worker::run()
+{
+  _poller->add(_conn_handler.sd(), EPOLLIN, LISTENER_HANDLE);
+  if (_io)
+  {
+    _poller->add(_io->fd(), EPOLLIN, DISK_IO_HANDLE);
+  }
+
+  const int                          TIMEOUT_MS = 1000;
+  const int                          MAX_EVENTS = _client_connections.capacity() + _groups.capacity() + 2;
+  std::vector<event_poller::event_t> events(MAX_EVENTS);
+
+  while (!_exit_requested)
+  {
+    const int timeout_ms = _timer_wheel.next_timeout_ms(TIMEOUT_MS);
+    const int num_events = _poller->wait(events.data(), MAX_EVENTS, timeout_ms);
+    if (num_events < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      dbg_err("poller error : {}", utils::string_error(errno));
+      throw std::runtime_error("poller error");
+    }
+
+    bool requests_arrived = false;
+    for (int i = 0; i < num_events; ++i)
+    {
+      if (events[i].data == LISTENER_HANDLE)
+      {
+        requests_arrived = true;
+      }
+      else if (events[i].data == DISK_IO_HANDLE)
+      {
+        _io->run_completions();
+      }
+      else if (events[i].data & GROUP_HANDLE_BIT)
+      {
+        service_group(events[i].data & ~GROUP_HANDLE_BIT, events[i].events);
+      }
+      else if (events[i].data & READ_HANDLE_BIT)
+      {
+        complete_read(events[i].data & ~READ_HANDLE_BIT, events[i].result);
+      }
+      else
+      {
+        /* Service connected clients, the handle is stale if the session was closed earlier in this batch */
+        service_connection(events[i].data, events[i].events, events[i].datagram);
+      }
+    }
+
+    /* Handle new requests once the sessions ending in this batch are closed, their clients may be asking again */
+    if (requests_arrived)
+    {
+      _conn_handler.handle_read();
+      accept_pending_requests();
+    }
+
+    /* Retransmit timeouts */
+    _timer_wheel.advance();
+    for (const auto handle : _timed_out)
+    {
+      service_connection(handle, EPOLLIN);
+    }
+    _timed_out.clear();
+    for (const auto handle : _timed_out_groups)
+    {
+      service_group(handle, EPOLLIN);
+    }
+    _timed_out_groups.clear();
+
+    // Requests that arrived while we were at capacity
+    accept_pending_requests();
+  }
+
+  if (_copy_stats.payload_bytes > 0)
+  {
+    dbg_info("Worker sent {} payload bytes, copied {} ({:.2f} copies per byte)", _copy_stats.payload_bytes,
+             _copy_stats.copied_bytes,
+             static_cast<double>(_copy_stats.copied_bytes) / static_cast<double>(_copy_stats.payload_bytes));
+  }
+  if (_disk_stats.waits > 0)
+  {
+    dbg_info("Sessions waited for the disk {} times, {}us in total ({:.1f}us per wait)", _disk_stats.waits,
+             _disk_stats.wait_us, static_cast<double>(_disk_stats.wait_us) / static_cast<double>(_disk_stats.waits));
+  }
+  if (_ack_stats.duplicate_acks > 0)
+  {
+    dbg_info("Sessions received {} duplicate acks, {} resends held back", _ack_stats.duplicate_acks,
+             _ack_stats.suppressed_retransmits);
+  }
+  if (_conn_handler.duplicates() > 0)
+  {
+    dbg_info("Worker dropped {} repeated request(s)", _conn_handler.duplicates());
+  }
+  if (_groups_served > 0)
+  {
+    dbg_info("Worker ran {} multicast group(s) for {} clients, {} blocks sent", _groups_served,
+             _multicast_stats.clients, _multicast_stats.blocks_sent);
+  }
+}
+
+//========================================================
+/**
+ * @brief Creates connections for queued requests until the client limit is reached
+ */
+void tftp_server_worker::accept_pending_requests()
+{
+  while (_conn_handler.requests_pending() && !_client_connections.full())
+  {
+    auto new_request = _conn_handler.get_request();
+    if (join_multicast_group(new_request))
+    {
+      continue;
+    }
+    dbg_dbg("Accepting new connection from client {}", new_request.client);
+    handle_t handle = slab<tftp_server_connection>::INVALID_HANDLE;
+    try
+    {
+      handle = _client_connections.emplace(new_request.request, new_request.client, _timer_wheel, _options, _shared);
+    }
+    catch (const std::exception &err)
+    {
+      // Out of sockets for example, the client may ask again once there are some
+      dbg_err("Failed to start session for client {} : {}", new_request.client, err.what());
+      _conn_handler.refuse(new_request, tftp::error_packet_t(tftp::error_t::NOT_DEFINED, "Internal server error"));
+      continue;
+    }
+    auto &conn = *_client_connections.get(handle);
+    if (!new_request.key.empty())
+    {
+      _session_keys.emplace(handle, std::move(new_request.key));
+    }
+    conn.set_timeout_callback([this, handle]() { _timed_out.push_back(handle); });
+    conn.set_io_callback([this, handle]() { complete_io(handle); });
+    _poller->add(conn.sd(), poll_events(conn), handle);
+    // Zero copy completions come back on the socket's error queue, which only a poll notices
+    if (!_options.zero_copy && _poller->receive_datagrams(conn.sd()))
+    {
+      conn.set_poller_io(_poller.get(), handle | READ_HANDLE_BIT);
+    }
+  }
+}
+
+//========================================================
+/**
+ * @brief Runs a connection's state machine for the given events, then either closes it or updates what the poller
+ * waits on for it
+ */
+void tftp_server_worker::service_connection(const handle_t handle, const uint32_t events,
+                                            const std::string_view datagram)
+{
+  tftp_server_connection *conn = _client_connections.get(handle);
+  if (conn == nullptr)
+  {
+    return;
+  }
+
+  if (events & EPOLLERR)
+  {
+    // Zero copy completions also raise EPOLLERR, the connection only ends on a real socket error
+    conn->handle_error();
+  }
+
+  if (conn->is_finished())
+  {
+    close_connection(handle);
+    return;
+  }
+
+  if (events & EPOLLIN)
+  {
+    conn->handle_read(datagram);
+    if (conn->poller_io() && !conn->is_finished() && conn->wait_for_write())
+    {
+      // Its sends are queued on the poller, they need not wait for the socket to be writable
+      conn->handle_write();
+    }
+  }
+  else if (events & EPOLLOUT)
+  {
+    conn->handle_write();
+  }
+  else if (events & EPOLLHUP)
+  {
+    dbg_warn("Socket hung up on connection to {}, closing connection", conn->client());
+    conn->set_finished(true);
+  }
+  else if (!(events & EPOLLERR))
+  {
+    const int unknown_event = events;
+    dbg_warn("Unknown event : {}", unknown_event);
+  }
+
+  if (conn->is_finished())
+  {
+    close_connection(handle);
+    return;
+  }
+
+  _poller->modify(conn->sd(), poll_events(*conn), handle);
+}
+
+//========================================================
+/**
+ * @brief Hands a disk I/O completion to its connection, the handle is stale if the session has been closed since
+ */
+void tftp_server_worker::complete_io(const handle_t handle)
+{
+  tftp_server_connection *conn = _client_connections.get(handle);
+  if (conn == nullptr)
+  {
+    return;
+  }
+  conn->handle_io_complete();
+  _poller->modify(conn->sd(), poll_events(*conn), handle);
+}
+
+//========================================================
+/**
+ * @brief Hands the result of a file read the poller did to its connection, whose block can then go out straight away
+ */
+void tftp_server_worker::complete_read(const handle_t handle, const int32_t result)
+{
+  tftp_server_connection *conn = _client_connections.get(handle);
+  if (conn == nullptr)
+  {
+    return;
+  }
+  conn->handle_read_complete(result);
+  if (!conn->is_finished() && conn->wait_for_write())
+  {
+    // Its sends are queued on the poller, they need not wait for the socket to be writable
+    conn->handle_write();
+  }
+  if (conn->is_finished())
+  {
+    close_connection(handle);
+    return;
+  }
+  _poller->modify(conn->sd(), poll_events(*conn), handle);
+}
+
+//========================================================
+void tftp_server_worker::close_connection(const handle_t handle)
+{
+  tftp_server_connection *conn = _client_connections.get(handle);
+  if (conn == nullptr)
+  {
+    return;
+  }
+  dbg_dbg("Closing connection {}", conn->client());
+  _copy_stats.payload_bytes += conn->copy_stats().payload_bytes;
+  _copy_stats.copied_bytes += conn->copy_stats().copied_bytes;
+  _disk_stats.waits += conn->disk_stats().waits;
+  _disk_stats.wait_us += conn->disk_stats().wait_us;
+  _ack_stats.duplicate_acks += conn->ack_stats().duplicate_acks;
+  _ack_stats.suppressed_retransmits += conn->ack_stats().suppressed_retransmits;
+  _poller->remove(conn->sd());
+  _client_connections.release(handle);
+
+  // The client may now ask for the same file again from the same port, a PXE client's tsize probe does
+  const auto key = _session_keys.find(handle);
+  if (key != _session_keys.end())
+  {
+    _conn_handler.session_ended(key->second);
+    _session_keys.erase(key);
+  }
+}
+
+//========================================================
+/**
+ * @brief Adds the client of a multicast read to the group for its file, starting the group if there is none
+ *
+ * @return false if the request is to be served by a session instead, it is not a multicast read, there is no room for
+ * another group or the group could not be started
+ */
+bool tftp_server_worker::join_multicast_group(const tftp_connection_handler::request_t &request)
+{
+  if ((_multicast == nullptr) || !tftp_multicast_group::is_multicast_request(request.request))
+  {
+    return false;
+  }
+
+  handle_t   handle = slab<tftp_multicast_group>::INVALID_HANDLE;
+  const auto iter   = _group_index.find(tftp_multicast_group::group_key(request.request));
+  if (iter != _group_index.end())
+  {
+    handle = iter->second;
+  }
+  else
+  {
+    if (_groups.full())
+    {
+      return false;
+    }
+    try
+    {
+      handle = _groups.emplace(request.request, *_multicast, _options.interface, _timer_wheel, _shared.metadata,
+                               _shared.files, _options.mmap_min_bytes, _options.allow_fragmentation);
+    }
+    catch (const std::exception &err)
+    {
+      dbg_dbg("Not serving client {} by multicast : {}", request.client, err.what());
+      return false;
+    }
+    auto &group = *_groups.get(handle);
+    group.set_timeout_callback([this, handle]() { _timed_out_groups.push_back(handle); });
+    _group_index.emplace(group.key(), handle);
+    _poller->add(group.sd(), EPOLLIN, handle | GROUP_HANDLE_BIT);
+    ++_groups_served;
+  }
+
+  auto &group = *_groups.get(handle);
+  group.join(request.request, request.client);
+  _poller->modify(group.sd(), poll_events(group), handle | GROUP_HANDLE_BIT);
+  return true;
+}
+
+//========================================================
+/**
+ * @brief Runs a multicast group for the given events, then either closes it or updates what the poller waits on
+ */
+void tftp_server_worker::service_group(const handle_t handle, const uint32_t events)
+{
+  tftp_multicast_group *group = _groups.get(handle);
+  if (group == nullptr)
+  {
+    return;
+  }
+
+  if (events & (EPOLLIN | EPOLLERR))
+  {
+    group->handle_read();
+  }
+  if (!group->is_finished() && (events & EPOLLOUT))
+  {
+    group->handle_write();
+  }
+
+  if (group->is_finished())
+  {
+    close_group(handle);
+    return;
+  }
+  _poller->modify(group->sd(), poll_events(*group), handle | GROUP_HANDLE_BIT);
+}
+
+//========================================================
+void tftp_server_worker::close_group(const handle_t handle)
+{
+  tftp_multicast_group *group = _groups.get(handle);
+  if (group == nullptr)
+  {
+    return;
+  }
+  _multicast_stats.clients += group->stats().clients;
+  _multicast_stats.blocks_sent += group->stats().blocks_sent;
+  _group_index.erase(group->key());
+  _poller->remove(group->sd());
+  _groups.release(handle);
+}
@@ -0,0 +1,260 @@
+#include <gtest/gtest.h>
+
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <new>
+
+#include "client/tftp_client.hpp"
+#include "common/tftp.hpp"
+#include "server/tftp_server_connection.hpp"
+#include "tests/test_utils.hpp"
+
+using namespace test_utils;
+
+namespace
+{
+  // Counting allocator, replaces the global operator new of the test binary
+  thread_local bool   counting    = false;
+  thread_local size_t allocations = 0;
+
+  /**
+   * @brief Counts the heap allocations made by this thread during its lifetime
+   */
+  class allocation_counter
+  {
+  public:
+    allocation_counter()
+    {
+      allocations = 0;
+      counting    = true;
+    }
+
+    ~allocation_counter()
+    {
+      counting = false;
+    }
+
+    size_t count() const
+    {
+      return allocations;
+    }
+  };
+
+  const uint16_t TEST_PORT  = 16975;
+  const char     FILENAME[] = "file.bin";
+  const size_t   FILE_SIZE  = 64 * 1024 + 100;
+  const size_t   WARM_UP    = 4; // Blocks transferred before counting, the window's buffers are filled by then
+
+  class allocation_test : public ::testing::Test
+  {
+  protected:
+    void SetUp() override
+    {
+      ensure_console_logger();
+      old_cwd = std::filesystem::current_path();
+      dir     = make_temp_dir("tftp_alloc_test_");
+      std::filesystem::current_path(dir);
+    }
+
+    void TearDown() override
+    {
+      std::filesystem::current_path(old_cwd);
+      std::filesystem::remove_all(dir);
+    }
+
+    std::filesystem::path old_cwd;
+    std::filesystem::path dir;
+  };
+
+  /**
+   * @brief Client socket bound to loopback, with its address for constructing a connection
+   */
+  struct test_client
+  {
+    test_client()
+    {
+      udp.bind("127.0.0.1", 0);
+      socklen_t len = sizeof(address);
+      getsockname(udp.sd(), (struct sockaddr *)&address, &len);
+    }
+
+    udp_connection     udp;
+    struct sockaddr_in address;
+  };
+} // namespace
+
+// GCC pairs the inlined new expressions of other code with the free() below
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+void *operator new(std::size_t size)
+{
+  if (counting)
+  {
+    ++allocations;
+  }
+  void *ptr = std::malloc(size == 0 ? 1 : size);
+  if (ptr == nullptr)
+  {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+void operator delete(void *ptr) noexcept
+{
+  std::free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept
+{
+  std::free(ptr);
+}
+#pragma GCC diagnostic pop
+
+TEST(allocation, codec_does_not_allocate)
+{
+  std::array<char, tftp::DATA_PKT_MAX_SIZE> buffer;
+  const std::array<char, 512>               payload{};
+  allocation_counter                        counter;
+
+  const size_t data_size =
+      tftp::encode_data_packet(7, std::string_view(payload.data(), payload.size()), buffer.data(), buffer.size());
+  const auto data = tftp::decode_data_packet(std::string_view(buffer.data(), data_size));
+  ASSERT_TRUE(data.has_value());
+  EXPECT_EQ(data->block_number, 7);
+  EXPECT_EQ(data->data.size(), payload.size());
+
+  const size_t ack_size = tftp::encode_ack_packet(65535, buffer.data(), buffer.size());
+  const auto   ack      = tftp::decode_ack_packet(std::string_view(buffer.data(), ack_size));
+  ASSERT_TRUE(ack.has_value());
+  EXPECT_EQ(ack->block_number, 65535);
+
+  const size_t error_size = tftp::encode_error_packet(3, "Disk full", buffer.data(), buffer.size());
+  const auto   error      = tftp::decode_error_packet(std::string_view(buffer.data(), error_size));
+  ASSERT_TRUE(error.has_value());
+  EXPECT_EQ(error->error_code, 3);
+  EXPECT_EQ(error->error_msg, "Disk full");
+
+  EXPECT_EQ(counter.count(), 0);
+}
+
+TEST_F(allocation_test, read_transfer_loop_does_not_allocate)
+{
+  write_random_file(FILENAME, FILE_SIZE);
+  test_client            client;
+  timer_wheel            wheel;
+  tftp_server_connection conn(tftp::rw_packet_t(FILENAME, tftp::packet_t::READ, tftp::mode_t::OCTET), client.address,
+                              wheel);
+
+  std::array<char, tftp::DATA_PKT_MAX_SIZE> recv_buffer;
+  std::array<char, tftp::ACK_PKT_MAX_SIZE>  ack_buffer;
+  size_t                                    blocks   = 0;
+  size_t                                    received = 0;
+  std::optional<allocation_counter>         counter;
+  while (!conn.is_finished())
+  {
+    if (conn.wait_for_write())
+    {
+      conn.handle_write();
+      continue;
+    }
+    if (blocks == 0)
+    {
+      // The first block tells the client the connection's port
+      std::string address;
+      uint16_t    tid   = 0;
+      const auto  first = client.udp.recv_from(address, tid, recv_buffer.size());
+      std::copy(first.begin(), first.end(), recv_buffer.begin());
+      received = first.size();
+      client.udp.connect("127.0.0.1", tid);
+    }
+    else
+    {
+      received = client.udp.recv(recv_buffer.data(), recv_buffer.size());
+    }
+    const auto packet = tftp::decode_data_packet(std::string_view(recv_buffer.data(), received));
+    ASSERT_TRUE(packet.has_value());
+    client.udp.send(ack_buffer.data(),
+                    tftp::encode_ack_packet(packet->block_number, ack_buffer.data(), ack_buffer.size()));
+    conn.handle_read();
+    if (++blocks == WARM_UP)
+    {
+      counter.emplace();
+    }
+  }
+  ASSERT_TRUE(counter.has_value());
+  EXPECT_EQ(counter->count(), 0);
+  EXPECT_EQ(blocks, (FILE_SIZE / tftp::DATA_PKT_DATA_MAX_SIZE) + 1);
+}
+
+TEST_F(allocation_test, write_transfer_loop_does_not_allocate)
+{
+  write_random_file("source.bin", FILE_SIZE);
+  const auto data = read_file("source.bin");
+  {
+    test_client            client;
+    timer_wheel            wheel;
+    tftp_server_connection conn(tftp::rw_packet_t(FILENAME, tftp::packet_t::WRITE, tftp::mode_t::OCTET),
+                                client.address, wheel);
+
+    // Ack to the request, tells the client the connection's port
+    conn.handle_write();
+    std::string address;
+    uint16_t    tid = 0;
+    const auto  ack = tftp::deserialise_ack_packet(client.udp.recv_from(address, tid, tftp::ACK_PKT_MAX_SIZE));
+    ASSERT_TRUE(ack.has_value());
+    ASSERT_EQ(ack->block_number, 0);
+    client.udp.connect("127.0.0.1", tid);
+
+    std::array<char, tftp::DATA_PKT_MAX_SIZE> packet_buffer;
+    std::array<char, tftp::ACK_PKT_MAX_SIZE>  ack_buffer;
+    std::optional<allocation_counter>         counter;
+    uint16_t                                  block_number = 1;
+    for (size_t offset = 0; !conn.is_finished(); offset += tftp::DATA_PKT_DATA_MAX_SIZE, ++block_number)
+    {
+      const std::string_view payload(data.data() + offset,
+                                     std::min(tftp::DATA_PKT_DATA_MAX_SIZE, data.size() - offset));
+      client.udp.send(packet_buffer.data(),
+                      tftp::encode_data_packet(block_number, payload, packet_buffer.data(), packet_buffer.size()));
+      conn.handle_read();
+      conn.handle_write();
+      const auto data_ack = tftp::decode_ack_packet(
+          std::string_view(ack_buffer.data(), client.udp.recv(ack_buffer.data(), ack_buffer.size())));
+      ASSERT_TRUE(data_ack.has_value());
+      ASSERT_EQ(data_ack->block_number, block_number);
+      if (block_number == WARM_UP)
+      {
+        counter.emplace();
+      }
+    }
+    ASSERT_TRUE(counter.has_value());
+    EXPECT_EQ(counter->count(), 0);
+  }
+  EXPECT_EQ(read_file(FILENAME), data);
+}
+
+TEST_F(allocation_test, client_allocations_do_not_grow_with_file_size)
+{
+  const auto root = make_temp_dir("tftp_alloc_root_");
+  write_random_file(root / "small.bin", 100);
+  write_random_file(root / "large.bin", FILE_SIZE);
+  forked_server server([&root]() { return std::make_unique<tftp_server>(local_server_options(root, TEST_PORT)); });
+
+  const auto count_get_file = [](const std::string &filename) {
+    allocation_counter counter;
+    EXPECT_TRUE(tftp_client::get_file(filename, "127.0.0.1", tftp::mode_t::OCTET, "127.0.0.1", TEST_PORT));
+    return counter.count();
+  };
+  const std::string small("small.bin");
+  const std::string large("large.bin");
+  const size_t      small_allocations = count_get_file(small);
+  const size_t      large_allocations = count_get_file(large);
+  // Setup allocates, so this also shows the counter is live
+  EXPECT_GT(small_allocations, 0);
+  EXPECT_EQ(large_allocations, small_allocations);
+  EXPECT_EQ(read_file(large), read_file(root / large));
+  std::filesystem::remove_all(root);
+}
@@ -0,0 +1,193 @@
+#include <gtest/gtest.h>
+
+#include <fstream>
+
+#include "common/datagram_cache.hpp"
+#include "common/utils.hpp"
+#include "tests/test_utils.hpp"
+
+using namespace test_utils;
+
+namespace
+{
+  const size_t BLOCK_SIZE = 512;
+
+  datagram_cache::key_t make_key(const ino_t ino, const int64_t mtime_ns = 0)
+  {
+    return datagram_cache::key_t{file_cache::key_t{1, ino, mtime_ns, 100}, BLOCK_SIZE, tftp::mode_t::OCTET};
+  }
+
+  datagram_cache::run_t make_run(const size_t bytes)
+  {
+    datagram_cache::run_t run{};
+    run.datagrams.assign(bytes, 'a');
+    run.packet_size = bytes;
+    run.count       = 1;
+    return run;
+  }
+
+  /**
+   * @brief Payloads of the datagrams of a run, checking their block numbers carry on from first_block
+   */
+  std::vector<char> run_payload(const datagram_cache::run_t &run, const uint16_t first_block)
+  {
+    std::vector<char> data;
+    for (size_t i = 0; i < run.count; ++i)
+    {
+      const auto datagram = run.datagram(i);
+      const auto packet   = tftp::decode_data_packet(datagram);
+      EXPECT_TRUE(packet.has_value());
+      if (!packet)
+      {
+        break;
+      }
+      EXPECT_EQ(packet->block_number, static_cast<uint16_t>(first_block + i));
+      data.insert(data.end(), packet->data.begin(), packet->data.end());
+    }
+    return data;
+  }
+
+  class datagram_cache_file_test : public ::testing::Test
+  {
+  protected:
+    void SetUp() override
+    {
+      dir = make_temp_dir("tftp_datagram_test_");
+    }
+
+    void TearDown() override
+    {
+      std::filesystem::remove_all(dir);
+    }
+
+    std::filesystem::path dir;
+  };
+} // namespace
+
+TEST(datagram_cache, miss_then_hit)
+{
+  datagram_cache cache(1024);
+  EXPECT_EQ(cache.find(make_key(1), 0), nullptr);
+  const auto inserted = cache.insert(make_key(1), 0, make_run(100));
+  EXPECT_EQ(cache.find(make_key(1), 0), inserted);
+  EXPECT_EQ(cache.find(make_key(1), 1), nullptr);
+
+  auto other_block_size       = make_key(1);
+  other_block_size.block_size = 1024;
+  EXPECT_EQ(cache.find(other_block_size, 0), nullptr);
+  auto netascii = make_key(1);
+  netascii.mode = tftp::mode_t::NETASCII;
+  EXPECT_EQ(cache.find(netascii, 0), nullptr);
+
+  const auto stats = cache.stats();
+  EXPECT_EQ(stats.hits, 1);
+  EXPECT_EQ(stats.misses, 4);
+  EXPECT_EQ(stats.cached_bytes, 100);
+}
+
+TEST(datagram_cache, evicts_least_recently_used)
+{
+  datagram_cache cache(300);
+  cache.insert(make_key(1), 0, make_run(100));
+  cache.insert(make_key(1), 1, make_run(100));
+  cache.insert(make_key(1), 2, make_run(100));
+  cache.find(make_key(1), 0);
+  cache.insert(make_key(1), 3, make_run(100));
+  EXPECT_NE(cache.find(make_key(1), 0), nullptr);
+  EXPECT_EQ(cache.find(make_key(1), 1), nullptr);
+  EXPECT_EQ(cache.stats().evictions, 1);
+  EXPECT_LE(cache.stats().cached_bytes, cache.capacity());
+}
+
+TEST(datagram_cache, newer_version_invalidates_older)
+{
+  datagram_cache cache(1024);
+  cache.insert(make_key(1, 10), 0, make_run(100));
+  cache.insert(make_key(1, 10), 1, make_run(100));
+  cache.insert(make_key(2, 10), 0, make_run(100));
+
+  // A session still reading the old version does not bring it back
+  cache.insert(make_key(1, 20), 0, make_run(100));
+  EXPECT_EQ(cache.find(make_key(1, 10), 0), nullptr);
+  EXPECT_EQ(cache.find(make_key(1, 10), 1), nullptr);
+  EXPECT_NE(cache.find(make_key(2, 10), 0), nullptr);
+  cache.insert(make_key(1, 10), 1, make_run(100));
+  EXPECT_EQ(cache.find(make_key(1, 10), 1), nullptr);
+  EXPECT_NE(cache.find(make_key(1, 20), 0), nullptr);
+
+  const auto stats = cache.stats();
+  EXPECT_EQ(stats.invalidations, 2);
+  EXPECT_EQ(stats.cached_bytes, 200);
+}
+
+TEST(datagram_cache, failed_run_not_cached)
+{
+  datagram_cache cache(1024);
+  auto           run = make_run(100);
+  run.error          = true;
+  EXPECT_TRUE(cache.insert(make_key(1), 0, std::move(run))->error);
+  EXPECT_EQ(cache.find(make_key(1), 0), nullptr);
+  EXPECT_EQ(cache.stats().cached_bytes, 0);
+}
+
+TEST_F(datagram_cache_file_test, runs_hold_whole_datagrams)
+{
+  const auto   path   = dir / "file.bin";
+  const size_t blocks = datagram_cache::blocks_per_run(BLOCK_SIZE);
+  write_random_file(path, (blocks + 3) * BLOCK_SIZE + 10);
+
+  tftp_read_file file(path, tftp::mode_t::OCTET);
+  const auto     first = datagram_cache::read_run(file, BLOCK_SIZE, 0);
+  EXPECT_FALSE(first.error);
+  EXPECT_FALSE(first.last);
+  EXPECT_EQ(first.count, blocks);
+  EXPECT_EQ(first.datagram(0).size(), tftp::DATA_PKT_HEADER_SIZE + BLOCK_SIZE);
+
+  const auto second = datagram_cache::read_run(file, BLOCK_SIZE, 1);
+  EXPECT_TRUE(second.last);
+  EXPECT_EQ(second.count, 4);
+  EXPECT_EQ(second.datagram(3).size(), tftp::DATA_PKT_HEADER_SIZE + 10);
+
+  auto data         = run_payload(first, 1);
+  const auto second_data = run_payload(second, static_cast<uint16_t>(blocks + 1));
+  data.insert(data.end(), second_data.begin(), second_data.end());
+  EXPECT_EQ(data, read_file(path));
+}
+
+TEST_F(datagram_cache_file_test, netascii_run_continued_by_another_reader)
+{
+  // Every CR and LF encodes to two bytes, so blocks do not line up with the file
+  const auto  path = dir / "file.txt";
+  std::string text;
+  for (size_t i = 0; text.size() < 3 * datagram_cache::RUN_BYTES; ++i)
+  {
+    text += "line " + std::to_string(i) + ((i % 3) == 0 ? "\r\n" : "\n");
+  }
+  std::ofstream(path, std::ios::binary) << text;
+
+  tftp_read_file first_reader(path, tftp::mode_t::NETASCII);
+  const auto     first = datagram_cache::read_run(first_reader, BLOCK_SIZE, 0);
+  while (!first_reader.eof())
+  {
+    // Drain so the reader is destroyed with nothing pending
+    std::vector<char> rest;
+    first_reader.read_in_to(rest, BLOCK_SIZE);
+  }
+
+  tftp_read_file second_reader(path, tftp::mode_t::NETASCII);
+  second_reader.seek(first.end);
+  std::vector<char> encoded = run_payload(first, 1);
+  uint16_t          block   = static_cast<uint16_t>(first.count + 1);
+  for (size_t run_index = 1;; ++run_index)
+  {
+    const auto run     = datagram_cache::read_run(second_reader, BLOCK_SIZE, run_index);
+    const auto payload = run_payload(run, block);
+    encoded.insert(encoded.end(), payload.begin(), payload.end());
+    block = static_cast<uint16_t>(block + run.count);
+    if (run.last)
+    {
+      break;
+    }
+  }
+  EXPECT_EQ(encoded, utils::native_to_netascii(std::vector<char>(text.begin(), text.end())));
+}
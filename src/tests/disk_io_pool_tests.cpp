@@ -0,0 +1,106 @@
+#include <gtest/gtest.h>
+
+#include <poll.h>
+
+#include <atomic>
+#include <future>
+#include <stdexcept>
+#include <thread>
+
+#include "common/disk_io_pool.hpp"
+#include "tests/test_utils.hpp"
+
+namespace
+{
+  bool wait_readable(const int fd, const int timeout_ms = 2000)
+  {
+    pollfd pfd = {fd, POLLIN, 0};
+    return poll(&pfd, 1, timeout_ms) > 0;
+  }
+} // namespace
+
+TEST(disk_io_pool, zero_threads_rejected)
+{
+  EXPECT_THROW(disk_io_pool(0, 4), std::invalid_argument);
+}
+
+TEST(disk_io_pool, runs_jobs_on_pool_threads)
+{
+  disk_io_pool       pool(2, 4);
+  std::promise<void> done;
+  std::thread::id    job_thread;
+  ASSERT_TRUE(pool.try_submit([&]() {
+    job_thread = std::this_thread::get_id();
+    done.set_value();
+  }));
+  done.get_future().wait();
+  EXPECT_NE(job_thread, std::this_thread::get_id());
+  EXPECT_EQ(pool.num_threads(), 2);
+}
+
+TEST(disk_io_pool, full_queue_rejects_jobs)
+{
+  disk_io_pool       pool(1, 1);
+  std::promise<void> release;
+  std::promise<void> started;
+  auto               released = release.get_future().share();
+  ASSERT_TRUE(pool.try_submit([&started, released]() {
+    started.set_value();
+    released.wait();
+  }));
+  // The only thread is busy, one job fits in the queue
+  started.get_future().wait();
+  EXPECT_TRUE(pool.try_submit([]() {}));
+  EXPECT_FALSE(pool.try_submit([]() {}));
+  release.set_value();
+}
+
+TEST(disk_io_pool, destructor_runs_queued_jobs)
+{
+  std::atomic<size_t> ran{0};
+  {
+    disk_io_pool pool(1, 16);
+    for (size_t i = 0; i < 16; ++i)
+    {
+      ASSERT_TRUE(pool.try_submit([&ran]() { ++ran; }));
+    }
+  }
+  EXPECT_EQ(ran, 16);
+}
+
+TEST(disk_io_channel, completions_run_on_calling_thread)
+{
+  disk_io_pool    pool(2, 8);
+  disk_io_channel channel(pool);
+  size_t          completed = 0;
+  std::thread::id completion_thread;
+  for (size_t i = 0; i < 4; ++i)
+  {
+    ASSERT_TRUE(channel.submit([]() {},
+                               [&]() {
+                                 ++completed;
+                                 completion_thread = std::this_thread::get_id();
+                               }));
+  }
+  while (completed < 4)
+  {
+    ASSERT_TRUE(wait_readable(channel.fd()));
+    channel.run_completions();
+  }
+  EXPECT_EQ(completion_thread, std::this_thread::get_id());
+  // Drained, the eventfd is no longer readable
+  EXPECT_FALSE(wait_readable(channel.fd(), 0));
+  EXPECT_EQ(channel.run_completions(), 0);
+}
+
+TEST(disk_io_channel, completion_posted_when_job_throws)
+{
+  test_utils::ensure_console_logger();
+  disk_io_pool    pool(1, 1);
+  disk_io_channel channel(pool);
+  bool            completed = false;
+  ASSERT_TRUE(channel.submit([]() { throw std::runtime_error("read failed"); }, [&completed]() { completed = true; }));
+  ASSERT_TRUE(wait_readable(channel.fd()));
+  EXPECT_EQ(channel.run_completions(), 1);
+  EXPECT_TRUE(completed);
+}
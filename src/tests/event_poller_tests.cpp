@@ -0,0 +1,243 @@
+#include <gtest/gtest.h>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include "common/event_poller.hpp"
+#include "common/udp_connection.hpp"
+#include "tests/test_utils.hpp"
+
+namespace
+{
+  uint16_t local_port(const udp_connection &udp)
+  {
+    struct sockaddr_in sa;
+    socklen_t          len = sizeof(sa);
+    getsockname(udp.sd(), (struct sockaddr *)&sa, &len);
+    return ntohs(sa.sin_port);
+  }
+
+  class event_poller_test : public ::testing::TestWithParam<event_poller::backend_t>
+  {
+  protected:
+    void SetUp() override
+    {
+      test_utils::ensure_console_logger();
+      poller = event_poller::create(GetParam(), 8);
+      receiver.bind("127.0.0.1", 0);
+      sender.bind("127.0.0.1", 0);
+    }
+
+    int wait(const int timeout_ms = 100)
+    {
+      int num_events = -1;
+      do
+      {
+        num_events = poller->wait(events, 8, timeout_ms);
+      } while ((num_events < 0) && (errno == EINTR));
+      return num_events;
+    }
+
+    std::unique_ptr<event_poller> poller;
+    udp_connection                receiver;
+    udp_connection                sender;
+    event_poller::event_t         events[8];
+  };
+} // namespace
+
+TEST_P(event_poller_test, uses_requested_backend)
+{
+  EXPECT_EQ(poller->backend(), GetParam());
+}
+
+TEST_P(event_poller_test, times_out_when_idle)
+{
+  poller->add(receiver.sd(), EPOLLIN, 1);
+  EXPECT_EQ(wait(10), 0);
+  EXPECT_EQ(wait(0), 0);
+}
+
+TEST_P(event_poller_test, reports_readable_with_data)
+{
+  poller->add(receiver.sd(), EPOLLIN, 42);
+  sender.send_to("127.0.0.1", local_port(receiver), {'a'});
+
+  ASSERT_EQ(wait(), 1);
+  EXPECT_TRUE(events[0].events & EPOLLIN);
+  EXPECT_EQ(events[0].data, 42);
+}
+
+TEST_P(event_poller_test, level_triggered_until_drained)
+{
+  poller->add(receiver.sd(), EPOLLIN, 1);
+  sender.send_to("127.0.0.1", local_port(receiver), {'a'});
+
+  ASSERT_EQ(wait(), 1);
+  ASSERT_EQ(wait(), 1);
+  receiver.recv(16);
+  EXPECT_EQ(wait(10), 0);
+}
+
+TEST_P(event_poller_test, modify_changes_events_and_data)
+{
+  poller->add(receiver.sd(), EPOLLIN, 1);
+  EXPECT_EQ(wait(10), 0);
+
+  poller->modify(receiver.sd(), EPOLLOUT, 2);
+  ASSERT_EQ(wait(), 1);
+  EXPECT_TRUE(events[0].events & EPOLLOUT);
+  EXPECT_EQ(events[0].data, 2);
+
+  poller->modify(receiver.sd(), EPOLLIN, 3);
+  EXPECT_EQ(wait(10), 0);
+  sender.send_to("127.0.0.1", local_port(receiver), {'a'});
+  ASSERT_EQ(wait(), 1);
+  EXPECT_TRUE(events[0].events & EPOLLIN);
+  EXPECT_EQ(events[0].data, 3);
+}
+
+TEST_P(event_poller_test, removed_fd_not_reported)
+{
+  poller->add(receiver.sd(), EPOLLIN, 1);
+  poller->add(sender.sd(), EPOLLOUT, 2);
+  ASSERT_EQ(wait(), 1);
+
+  poller->remove(sender.sd());
+  EXPECT_EQ(wait(10), 0);
+}
+
+TEST_P(event_poller_test, reports_several_fds)
+{
+  poller->add(receiver.sd(), EPOLLIN, 1);
+  poller->add(sender.sd(), EPOLLIN, 2);
+  sender.send_to("127.0.0.1", local_port(receiver), {'a'});
+  receiver.send_to("127.0.0.1", local_port(sender), {'b'});
+
+  int num_events = 0;
+  for (int i = 0; (i < 10) && (num_events < 2); ++i)
+  {
+    num_events += wait();
+  }
+  EXPECT_EQ(num_events, 2);
+}
+
+TEST_P(event_poller_test, duplicate_add_throws)
+{
+  poller->add(receiver.sd(), EPOLLIN, 1);
+  EXPECT_THROW(poller->add(receiver.sd(), EPOLLIN, 1), std::runtime_error);
+}
+
+TEST_P(event_poller_test, receives_datagrams_itself)
+{
+  // Session sockets are non-blocking, the recv still waits for a datagram
+  receiver.set_non_blocking(true);
+  poller->add(receiver.sd(), EPOLLIN, 7);
+  if (!poller->receive_datagrams(receiver.sd()))
+  {
+    // Readiness only, the caller receives
+    EXPECT_EQ(poller->backend(), event_poller::backend_t::EPOLL);
+    return;
+  }
+  sender.send_to("127.0.0.1", local_port(receiver), {'a'});
+  sender.send_to("127.0.0.1", local_port(receiver), {'b', 'c'});
+
+  ASSERT_EQ(wait(), 1);
+  EXPECT_EQ(events[0].events, EPOLLIN);
+  EXPECT_EQ(events[0].data, 7);
+  EXPECT_EQ(events[0].datagram, "a");
+  ASSERT_EQ(wait(), 1);
+  EXPECT_EQ(events[0].datagram, "bc");
+  EXPECT_EQ(wait(10), 0);
+}
+
+TEST_P(event_poller_test, received_datagram_held_until_polled_for_input)
+{
+  poller->add(receiver.sd(), EPOLLIN, 1);
+  if (!poller->receive_datagrams(receiver.sd()))
+  {
+    return;
+  }
+  poller->modify(receiver.sd(), 0, 1);
+  EXPECT_EQ(wait(10), 0);
+  sender.send_to("127.0.0.1", local_port(receiver), {'a'});
+  EXPECT_EQ(wait(50), 0);
+
+  poller->modify(receiver.sd(), EPOLLIN, 2);
+  ASSERT_EQ(wait(), 1);
+  EXPECT_EQ(events[0].data, 2);
+  EXPECT_EQ(events[0].datagram, "a");
+}
+
+TEST_P(event_poller_test, queued_send_goes_out_with_next_wait)
+{
+  receiver.set_non_blocking(true);
+  sender.connect("127.0.0.1", local_port(receiver));
+  poller->add(sender.sd(), EPOLLIN, 1);
+  const char data[] = {'x', 'y'};
+  if (!poller->queue_send(sender.sd(), data, sizeof(data)))
+  {
+    EXPECT_EQ(poller->backend(), event_poller::backend_t::EPOLL);
+    return;
+  }
+  EXPECT_TRUE(receiver.recv(16).empty());
+
+  EXPECT_EQ(wait(0), 0);
+  EXPECT_EQ(receiver.recv(16), (std::vector<char>{'x', 'y'}));
+}
+
+TEST_P(event_poller_test, queued_send_goes_out_on_remove)
+{
+  receiver.set_non_blocking(true);
+  sender.connect("127.0.0.1", local_port(receiver));
+  poller->add(sender.sd(), EPOLLIN, 1);
+  const char data[] = {'z'};
+  if (!poller->queue_send(sender.sd(), data, sizeof(data)))
+  {
+    EXPECT_EQ(poller->backend(), event_poller::backend_t::EPOLL);
+    return;
+  }
+  poller->remove(sender.sd());
+  EXPECT_EQ(receiver.recv(16), (std::vector<char>{'z'}));
+}
+
+TEST_P(event_poller_test, queued_read_reported_with_result)
+{
+  const auto dir  = test_utils::make_temp_dir("event_poller_read_");
+  const auto path = dir / "file.bin";
+  test_utils::write_random_file(path, 1000);
+  const int fd = open(path.c_str(), O_RDONLY);
+  ASSERT_GE(fd, 0);
+
+  // Read into two buffers, the second one only partly filled by the end of the file
+  auto         buffers = std::make_shared<std::vector<char>>(2 * 512);
+  struct iovec iov[2]  = {{buffers->data(), 512}, {buffers->data() + 512, 512}};
+  if (poller->queue_read(fd, iov, 2, 100, 9, buffers))
+  {
+    ASSERT_EQ(wait(), 1);
+    EXPECT_EQ(events[0].events, 0);
+    EXPECT_EQ(events[0].data, 9);
+    ASSERT_EQ(events[0].result, 900);
+    const auto contents = test_utils::read_file(path);
+    EXPECT_TRUE(std::equal(contents.begin() + 100, contents.end(), buffers->begin()));
+  }
+  else
+  {
+    EXPECT_EQ(poller->backend(), event_poller::backend_t::EPOLL);
+  }
+  close(fd);
+  std::filesystem::remove_all(dir);
+}
+
+INSTANTIATE_TEST_SUITE_P(backends, event_poller_test,
+                         ::testing::Values(event_poller::backend_t::EPOLL, event_poller::backend_t::IO_URING),
+                         [](const auto &param_info) { return event_poller::backend_to_string(param_info.param); });
+
+TEST(event_poller, backend_strings)
+{
+  EXPECT_EQ(event_poller::string_to_backend("epoll"), event_poller::backend_t::EPOLL);
+  EXPECT_EQ(event_poller::string_to_backend("io_uring"), event_poller::backend_t::IO_URING);
+  EXPECT_FALSE(event_poller::string_to_backend("kqueue").has_value());
+  EXPECT_EQ(event_poller::backend_to_string(event_poller::backend_t::IO_URING), "IO_URING");
+}
@@ -0,0 +1,183 @@
+#include <gtest/gtest.h>
+
+#include <fstream>
+#include <thread>
+
+#include "common/file_cache.hpp"
+#include "common/tftp_read_file.hpp"
+#include "tests/test_utils.hpp"
+
+using namespace test_utils;
+
+namespace
+{
+  file_cache::key_t make_key(const ino_t ino)
+  {
+    return file_cache::key_t{1, ino, 0, 100};
+  }
+
+  std::vector<char> read_whole_file(tftp_read_file &reader, const size_t block_size)
+  {
+    std::vector<char> data;
+    std::vector<char> block;
+    do
+    {
+      reader.read_in_to(block, block_size);
+      data.insert(data.end(), block.begin(), block.end());
+    } while (block.size() == block_size);
+    return data;
+  }
+
+  class file_cache_file_test : public ::testing::Test
+  {
+  protected:
+    void SetUp() override
+    {
+      dir = make_temp_dir("tftp_cache_test_");
+    }
+
+    void TearDown() override
+    {
+      std::filesystem::remove_all(dir);
+    }
+
+    std::filesystem::path dir;
+  };
+} // namespace
+
+TEST(file_cache, miss_then_hit)
+{
+  file_cache cache(1024, 16);
+  EXPECT_EQ(cache.find(make_key(1), 0), nullptr);
+  const auto inserted = cache.insert(make_key(1), 0, std::vector<char>(16, 'a'));
+  const auto found    = cache.find(make_key(1), 0);
+  ASSERT_NE(found, nullptr);
+  EXPECT_EQ(found, inserted);
+  EXPECT_EQ(cache.find(make_key(1), 1), nullptr);
+
+  const auto stats = cache.stats();
+  EXPECT_EQ(stats.hits, 1);
+  EXPECT_EQ(stats.misses, 2);
+  EXPECT_EQ(stats.cached_bytes, 16);
+  EXPECT_EQ(stats.disk_read_bytes, 16);
+}
+
+TEST(file_cache, key_includes_mtime)
+{
+  file_cache cache(1024, 16);
+  cache.insert(make_key(1), 0, std::vector<char>(16, 'a'));
+  auto modified     = make_key(1);
+  modified.mtime_ns = 1;
+  EXPECT_EQ(cache.find(modified, 0), nullptr);
+}
+
+TEST(file_cache, evicts_least_recently_used)
+{
+  file_cache cache(32, 16);
+  cache.insert(make_key(1), 0, std::vector<char>(16, 'a'));
+  cache.insert(make_key(2), 0, std::vector<char>(16, 'b'));
+  // Touch 1 so 2 is the oldest
+  cache.find(make_key(1), 0);
+  cache.insert(make_key(3), 0, std::vector<char>(16, 'c'));
+
+  EXPECT_NE(cache.find(make_key(1), 0), nullptr);
+  EXPECT_EQ(cache.find(make_key(2), 0), nullptr);
+  EXPECT_NE(cache.find(make_key(3), 0), nullptr);
+  EXPECT_EQ(cache.stats().evictions, 1);
+  EXPECT_EQ(cache.stats().cached_bytes, 32);
+}
+
+TEST(file_cache, evicted_chunk_stays_valid_while_referenced)
+{
+  file_cache cache(16, 16);
+  const auto chunk = cache.insert(make_key(1), 0, std::vector<char>(16, 'a'));
+  cache.insert(make_key(2), 0, std::vector<char>(16, 'b'));
+  EXPECT_EQ(cache.find(make_key(1), 0), nullptr);
+  EXPECT_EQ(*chunk, std::vector<char>(16, 'a'));
+}
+
+TEST(file_cache, first_insert_wins)
+{
+  file_cache cache(1024, 16);
+  const auto first  = cache.insert(make_key(1), 0, std::vector<char>(16, 'a'));
+  const auto second = cache.insert(make_key(1), 0, std::vector<char>(16, 'b'));
+  EXPECT_EQ(first, second);
+  EXPECT_EQ(cache.stats().cached_bytes, 16);
+}
+
+TEST(file_cache, concurrent_readers)
+{
+  file_cache               cache(64 * 16, 16);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t)
+  {
+    threads.emplace_back([&cache]() {
+      for (size_t i = 0; i < 1000; ++i)
+      {
+        const size_t index = i % 100;
+        if (!cache.find(make_key(1), index))
+        {
+          cache.insert(make_key(1), index, std::vector<char>(16, static_cast<char>(index)));
+        }
+      }
+    });
+  }
+  for (auto &thread : threads)
+  {
+    thread.join();
+  }
+  EXPECT_LE(cache.stats().cached_bytes, 64 * 16);
+  EXPECT_EQ(cache.stats().hits + cache.stats().misses, 4000);
+}
+
+TEST_F(file_cache_file_test, second_reader_does_no_disk_reads)
+{
+  const auto path = dir / "image.bin";
+  write_random_file(path, 10000);
+  file_cache cache(1024 * 1024, 4096);
+
+  tftp_read_file first(path, tftp::mode_t::OCTET, &cache);
+  EXPECT_EQ(read_whole_file(first, 512), read_file(path));
+  EXPECT_TRUE(first.eof());
+  EXPECT_FALSE(first.error());
+  const auto after_first = cache.stats();
+  EXPECT_EQ(after_first.disk_read_bytes, 10000);
+
+  tftp_read_file second(path, tftp::mode_t::OCTET, &cache);
+  EXPECT_EQ(read_whole_file(second, 1000), read_file(path));
+  const auto after_second = cache.stats();
+  EXPECT_EQ(after_second.disk_read_bytes, 10000);
+  EXPECT_EQ(after_second.misses, after_first.misses);
+  EXPECT_GT(after_second.hits, after_first.hits);
+}
+
+TEST_F(file_cache_file_test, netascii_through_cache)
+{
+  const auto path = dir / "text.txt";
+  {
+    std::ofstream out(path, std::ios_base::binary);
+    for (int i = 0; i < 500; ++i)
+    {
+      out << "line " << i << "\n";
+    }
+  }
+  file_cache     cache(1024 * 1024, 100);
+  tftp_read_file uncached(path, tftp::mode_t::NETASCII);
+  tftp_read_file cached(path, tftp::mode_t::NETASCII, &cache);
+  EXPECT_EQ(read_whole_file(cached, 512), read_whole_file(uncached, 512));
+}
+
+TEST_F(file_cache_file_test, modified_file_is_not_mixed_with_cached_chunks)
+{
+  const auto path = dir / "image.bin";
+  write_random_file(path, 10000);
+  file_cache     cache(1024 * 1024, 4096);
+  tftp_read_file reader(path, tftp::mode_t::OCTET, &cache);
+
+  // Replaced after the key was taken but before the first chunk is read
+  std::filesystem::remove(path);
+  write_random_file(path, 20000);
+  std::vector<char> block;
+  reader.read_in_to(block, 512);
+  EXPECT_TRUE(reader.error());
+}
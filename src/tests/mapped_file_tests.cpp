@@ -0,0 +1,106 @@
+#include <gtest/gtest.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <fstream>
+
+#include "common/mapped_file.hpp"
+#include "common/tftp_read_file.hpp"
+#include "tests/test_utils.hpp"
+
+using namespace test_utils;
+
+namespace
+{
+  std::vector<char> read_whole_file(tftp_read_file &reader, const size_t block_size)
+  {
+    std::vector<char> data;
+    std::vector<char> block;
+    do
+    {
+      reader.read_in_to(block, block_size);
+      data.insert(data.end(), block.begin(), block.end());
+    } while ((block.size() == block_size) && !reader.error());
+    return data;
+  }
+
+  class mapped_file_test : public ::testing::Test
+  {
+  protected:
+    void SetUp() override
+    {
+      dir = make_temp_dir("tftp_mapped_test_");
+    }
+
+    void TearDown() override
+    {
+      std::filesystem::remove_all(dir);
+    }
+
+    std::filesystem::path dir;
+  };
+} // namespace
+
+TEST_F(mapped_file_test, maps_from_a_descriptor)
+{
+  write_random_file(dir / "a.bin", 10000);
+  const int fd = ::open((dir / "a.bin").c_str(), O_RDONLY);
+  ASSERT_GE(fd, 0);
+  mapped_file map;
+  map.open(fd, 10000);
+  // The mapping outlives the descriptor
+  close(fd);
+  ASSERT_TRUE(map.is_open());
+  const auto expected = read_file(dir / "a.bin");
+  EXPECT_EQ(std::vector<char>(map.data(), map.data() + map.size()), expected);
+
+  std::vector<char> out(100);
+  ASSERT_TRUE(map.copy_out(out.data(), 9900, 100));
+  EXPECT_TRUE(std::equal(out.begin(), out.end(), expected.begin() + 9900));
+  EXPECT_FALSE(map.copy_out(out.data(), 9950, 100));
+  EXPECT_THROW(map.open(dir / "a.bin"), std::logic_error);
+}
+
+TEST_F(mapped_file_test, reader_maps_files_from_threshold)
+{
+  write_random_file(dir / "small.bin", 1000);
+  write_random_file(dir / "large.bin", 100000);
+  for (const auto mode : {tftp::mode_t::OCTET, tftp::mode_t::NETASCII})
+  {
+    tftp_read_file small((dir / "small.bin").string(), mode, nullptr, nullptr, 4096);
+    tftp_read_file large((dir / "large.bin").string(), mode, nullptr, nullptr, 4096);
+    tftp_read_file unmapped((dir / "large.bin").string(), mode);
+    EXPECT_FALSE(small.mapping().has_value());
+    ASSERT_TRUE(large.mapping().has_value());
+    EXPECT_EQ(large.mapping()->size(), 100000);
+    EXPECT_FALSE(unmapped.mapping().has_value());
+
+    const auto mapped_data = read_whole_file(large, 512);
+    EXPECT_FALSE(large.error());
+    EXPECT_TRUE(large.eof());
+    EXPECT_EQ(mapped_data, read_whole_file(unmapped, 512));
+  }
+}
+
+TEST_F(mapped_file_test, truncated_file_is_an_error_not_a_crash)
+{
+  write_random_file(dir / "a.bin", 100000);
+  tftp_read_file reader((dir / "a.bin").string(), tftp::mode_t::OCTET, nullptr, nullptr, 1);
+  ASSERT_TRUE(reader.mapping().has_value());
+  std::vector<char> block;
+  reader.read_in_to(block, 512);
+  EXPECT_EQ(block.size(), 512);
+
+  // Pages past the new end of the file now raise SIGBUS when touched
+  std::filesystem::resize_file(dir / "a.bin", 0);
+  tftp_read_file::position_t position{50000, ""};
+  reader.seek(position);
+  reader.read_in_to(block, 512);
+  EXPECT_TRUE(reader.error());
+  EXPECT_TRUE(block.empty());
+
+  // Faults outside a guarded copy are not swallowed
+  const char *data = reader.mapping()->data();
+  EXPECT_DEATH((void)*static_cast<const volatile char *>(data + 50000), "");
+}
@@ -0,0 +1,138 @@
+#include <gtest/gtest.h>
+
+#include <fstream>
+#include <thread>
+#include <unistd.h>
+
+#include "common/metadata_cache.hpp"
+#include "tests/test_utils.hpp"
+
+using namespace test_utils;
+
+namespace
+{
+  class metadata_cache_test : public ::testing::Test
+  {
+  protected:
+    void SetUp() override
+    {
+      dir = std::filesystem::weakly_canonical(make_temp_dir("tftp_metadata_test_"));
+      std::filesystem::create_directory(dir / "sub");
+      write_random_file(dir / "sub" / "file.bin", 1000);
+    }
+
+    void TearDown() override
+    {
+      std::filesystem::remove_all(dir);
+    }
+
+    std::filesystem::path dir;
+  };
+} // namespace
+
+TEST_F(metadata_cache_test, resolves_in_one_lookup)
+{
+  metadata_cache cache(dir, 16);
+  const auto     entry = cache.lookup("sub/../sub/file.bin");
+  EXPECT_EQ(entry->canonical, dir / "sub" / "file.bin");
+  EXPECT_TRUE(entry->in_root);
+  EXPECT_TRUE(entry->exists);
+  EXPECT_TRUE(entry->regular);
+  EXPECT_EQ(entry->size, 1000);
+  ASSERT_GE(entry->fd, 0);
+  char byte;
+  EXPECT_EQ(pread(entry->fd, &byte, 1, 0), 1);
+
+  const auto missing = cache.lookup("sub/missing.bin");
+  EXPECT_TRUE(missing->in_root);
+  EXPECT_FALSE(missing->exists);
+  EXPECT_EQ(missing->fd, -1);
+
+  const auto outside = cache.lookup("../" + dir.filename().string() + "_other/file.bin");
+  EXPECT_FALSE(outside->in_root);
+  EXPECT_FALSE(cache.lookup("/etc/passwd")->in_root);
+  EXPECT_FALSE(cache.lookup("../etc/passwd")->in_root);
+}
+
+TEST_F(metadata_cache_test, hit_and_eviction)
+{
+  metadata_cache cache(dir, 2);
+  const auto     first = cache.lookup("sub/file.bin");
+  EXPECT_EQ(cache.lookup("sub/file.bin"), first);
+  cache.lookup("a");
+  cache.lookup("b");
+  EXPECT_NE(cache.lookup("sub/file.bin"), first);
+
+  const auto stats = cache.stats();
+  EXPECT_EQ(stats.hits, 1);
+  EXPECT_EQ(stats.misses, 4);
+  EXPECT_EQ(stats.evictions, 2);
+  EXPECT_EQ(stats.entries, 2);
+}
+
+TEST_F(metadata_cache_test, inotify_invalidates_on_change)
+{
+  metadata_cache cache(dir, 16);
+  if (!cache.watching())
+  {
+    GTEST_SKIP() << "inotify not available";
+  }
+  EXPECT_FALSE(cache.lookup("sub/new.bin")->exists);
+  EXPECT_EQ(cache.lookup("sub/file.bin")->size, 1000);
+
+  write_random_file(dir / "sub" / "new.bin", 10);
+  EXPECT_TRUE(cache.lookup("sub/new.bin")->exists);
+  write_random_file(dir / "sub" / "file.bin", 2000);
+  EXPECT_EQ(cache.lookup("sub/file.bin")->size, 2000);
+
+  // Renaming a directory on the way to a file is seen too
+  std::filesystem::rename(dir / "sub", dir / "moved");
+  EXPECT_FALSE(cache.lookup("sub/file.bin")->exists);
+  EXPECT_TRUE(cache.lookup("moved/file.bin")->exists);
+  std::filesystem::create_directory(dir / "sub");
+  write_random_file(dir / "sub" / "file.bin", 10);
+  EXPECT_EQ(cache.lookup("sub/file.bin")->size, 10);
+  EXPECT_GE(cache.stats().invalidations, 4);
+}
+
+TEST_F(metadata_cache_test, ttl_without_inotify)
+{
+  metadata_cache cache(dir, 16, 50, false);
+  EXPECT_FALSE(cache.watching());
+  EXPECT_FALSE(cache.lookup("sub/new.bin")->exists);
+  write_random_file(dir / "sub" / "new.bin", 10);
+  EXPECT_FALSE(cache.lookup("sub/new.bin")->exists);
+  std::this_thread::sleep_for(std::chrono::milliseconds(60));
+  EXPECT_TRUE(cache.lookup("sub/new.bin")->exists);
+
+  std::filesystem::remove(dir / "sub" / "new.bin");
+  cache.invalidate("sub/new.bin");
+  EXPECT_FALSE(cache.lookup("sub/new.bin")->exists);
+}
+
+TEST_F(metadata_cache_test, entry_reads_the_checked_file)
+{
+  metadata_cache cache(dir, 16);
+  const auto     entry = cache.lookup("sub/file.bin");
+  const auto     data  = read_file(dir / "sub" / "file.bin");
+  // Replacing the file after the check does not change what is read
+  std::filesystem::rename(dir / "sub" / "file.bin", dir / "sub" / "old.bin");
+  write_random_file(dir / "sub" / "file.bin", 10);
+  cache.clear();
+
+  std::ifstream file(metadata_cache::open_path(*entry, "sub/file.bin"), std::ios::binary);
+  EXPECT_EQ(std::vector<char>(std::istreambuf_iterator<char>(file), {}), data);
+  EXPECT_EQ(metadata_cache::open_path(metadata_cache::entry_t(), "name"), "name");
+}
+
+TEST_F(metadata_cache_test, symbolic_link_resolved)
+{
+  std::filesystem::create_symlink(dir / "sub" / "file.bin", dir / "link.bin");
+  std::filesystem::create_symlink("/etc", dir / "escape");
+  metadata_cache cache(dir, 16);
+  const auto     entry = cache.lookup("link.bin");
+  EXPECT_EQ(entry->canonical, dir / "sub" / "file.bin");
+  EXPECT_TRUE(entry->in_root);
+  EXPECT_FALSE(entry->watched);
+  EXPECT_FALSE(cache.lookup("escape/passwd")->in_root);
+}
@@ -0,0 +1,33 @@
+#include <gtest/gtest.h>
+
+#include "server/multicast_address_pool.hpp"
+
+TEST(multicast_address_pool, ports_handed_out_and_back)
+{
+  multicast_address_pool pool("239.255.69.1:5000", 2);
+  EXPECT_EQ(pool.available(), 2);
+
+  const auto first  = pool.acquire();
+  const auto second = pool.acquire();
+  ASSERT_TRUE(first.has_value());
+  ASSERT_TRUE(second.has_value());
+  EXPECT_EQ(ntohs(first->sin_port), 5000);
+  EXPECT_EQ(ntohs(second->sin_port), 5001);
+  EXPECT_EQ(first->sin_addr.s_addr, htonl(0xEFFF4501));
+  EXPECT_FALSE(pool.acquire().has_value());
+  EXPECT_EQ(ntohs(pool.first_address().sin_port), 5000);
+
+  pool.release(*first);
+  const auto again = pool.acquire();
+  ASSERT_TRUE(again.has_value());
+  EXPECT_EQ(ntohs(again->sin_port), 5000);
+}
+
+TEST(multicast_address_pool, bad_groups_refused)
+{
+  EXPECT_THROW(multicast_address_pool{"239.255.69.1"}, std::invalid_argument);
+  EXPECT_THROW(multicast_address_pool{"10.0.0.1:5000"}, std::invalid_argument);
+  EXPECT_THROW(multicast_address_pool{"239.255.69.1:port"}, std::invalid_argument);
+  EXPECT_THROW(multicast_address_pool("239.255.69.1:65500", 64), std::invalid_argument);
+  EXPECT_THROW(multicast_address_pool{"not an address:5000"}, std::invalid_argument);
+}
@@ -0,0 +1,126 @@
+#include <gtest/gtest.h>
+
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "common/netascii.hpp"
+
+namespace
+{
+  std::vector<char> random_text(const size_t size, const double special_rate, const uint32_t seed)
+  {
+    std::mt19937                rng(seed);
+    std::bernoulli_distribution special(special_rate);
+    std::vector<char>           data(size);
+    for (auto &c : data)
+    {
+      c = special(rng) ? ((rng() & 1) ? '\r' : '\n') : static_cast<char>(rng());
+    }
+    return data;
+  }
+
+  std::vector<char> encode(const netascii::isa_t isa, const std::vector<char> &data)
+  {
+    std::vector<char> ret(netascii::max_encoded_size(data.size()));
+    ret.resize(netascii::encode(isa, data.data(), data.size(), ret.data()));
+    return ret;
+  }
+
+  std::vector<char> decode(const netascii::isa_t isa, const std::vector<char> &data)
+  {
+    std::vector<char> ret(data.size());
+    ret.resize(netascii::decode(isa, data.data(), data.size(), ret.data()));
+    return ret;
+  }
+
+  class netascii_test : public ::testing::TestWithParam<netascii::isa_t>
+  {
+  protected:
+    void SetUp() override
+    {
+      if (!netascii::isa_supported(GetParam()))
+      {
+        GTEST_SKIP() << netascii::isa_to_string(GetParam()) << " not supported";
+      }
+    }
+  };
+} // namespace
+
+TEST_P(netascii_test, encode_matches_scalar)
+{
+  for (const double rate : {0.0, 0.01, 0.1, 0.5, 1.0})
+  {
+    for (size_t size = 0; size < 300; size += 7)
+    {
+      const auto data = random_text(size, rate, static_cast<uint32_t>(size));
+      EXPECT_EQ(encode(GetParam(), data), encode(netascii::isa_t::SCALAR, data)) << "size " << size << " rate " << rate;
+    }
+  }
+}
+
+TEST_P(netascii_test, round_trip)
+{
+  for (const double rate : {0.0, 0.01, 0.1, 0.5, 1.0})
+  {
+    for (size_t size = 0; size < 300; size += 5)
+    {
+      const auto data = random_text(size, rate, static_cast<uint32_t>(size) + 1000);
+      EXPECT_EQ(decode(GetParam(), encode(GetParam(), data)), data) << "size " << size << " rate " << rate;
+    }
+  }
+}
+
+TEST_P(netascii_test, decode_keeps_lone_nul_and_lf)
+{
+  const std::string data     = std::string(40, 'x') + std::string("a\0\nb\r\0\0\r\n\n", 10) + std::string(40, 'y');
+  const std::string expected = std::string(40, 'x') + std::string("a\0\nb\r\0\n\n", 8) + std::string(40, 'y');
+  EXPECT_EQ(decode(GetParam(), std::vector<char>(data.begin(), data.end())),
+            std::vector<char>(expected.begin(), expected.end()));
+}
+
+TEST_P(netascii_test, decode_pairs_across_block_boundaries)
+{
+  for (size_t offset = 0; offset < 70; ++offset)
+  {
+    for (const char second : {'\n', '\0'})
+    {
+      std::vector<char> data(100, 'x');
+      data[offset]     = '\r';
+      data[offset + 1] = second;
+
+      std::vector<char> expected(99, 'x');
+      expected[offset] = (second == '\n') ? '\n' : '\r';
+      EXPECT_EQ(decode(GetParam(), data), expected) << "offset " << offset;
+    }
+  }
+}
+
+TEST_P(netascii_test, decode_throws_on_invalid_sequences)
+{
+  for (size_t offset = 0; offset < 70; ++offset)
+  {
+    std::vector<char> data(100, 'x');
+    data[offset] = '\r';
+    EXPECT_THROW(decode(GetParam(), data), std::runtime_error) << "offset " << offset;
+  }
+  for (size_t size = 1; size < 70; ++size)
+  {
+    std::vector<char> data(size, 'x');
+    data.back() = '\r';
+    EXPECT_THROW(decode(GetParam(), data), std::runtime_error) << "size " << size;
+  }
+}
+
+INSTANTIATE_TEST_SUITE_P(isa, netascii_test,
+                         ::testing::Values(netascii::isa_t::SCALAR, netascii::isa_t::SSE2, netascii::isa_t::AVX2),
+                         [](const ::testing::TestParamInfo<netascii::isa_t> &param_info) {
+                           return netascii::isa_to_string(param_info.param);
+                         });
+
+TEST(netascii, active_isa_is_supported)
+{
+  EXPECT_TRUE(netascii::isa_supported(netascii::active_isa()));
+  EXPECT_TRUE(netascii::isa_supported(netascii::isa_t::SCALAR));
+}
@@ -0,0 +1,148 @@
+#include <gtest/gtest.h>
+
+#include <fcntl.h>
+
+#include "common/open_file_table.hpp"
+#include "common/tftp_read_file.hpp"
+#include "common/utils.hpp"
+#include "tests/test_utils.hpp"
+
+using namespace test_utils;
+
+namespace
+{
+  class open_file_table_test : public ::testing::Test
+  {
+  protected:
+    void SetUp() override
+    {
+      dir = make_temp_dir("tftp_open_file_test_");
+    }
+
+    void TearDown() override
+    {
+      std::filesystem::remove_all(dir);
+    }
+
+    std::filesystem::path dir;
+  };
+
+  bool is_open(const int fd)
+  {
+    return fcntl(fd, F_GETFD) >= 0;
+  }
+} // namespace
+
+TEST_F(open_file_table_test, readers_of_a_file_share_one_descriptor)
+{
+  write_random_file(dir / "a.bin", 100);
+  write_random_file(dir / "b.bin", 100);
+  open_file_table files;
+  struct stat     st;
+  const auto      first  = files.acquire(dir / "a.bin", st);
+  const auto      second = files.acquire((dir / "." / "a.bin").string(), st);
+  const auto      other  = files.acquire(dir / "b.bin", st);
+  EXPECT_EQ(first, second);
+  EXPECT_NE(first->fd, other->fd);
+  EXPECT_EQ(st.st_size, 100);
+
+  const auto stats = files.stats();
+  EXPECT_EQ(stats.opens, 2);
+  EXPECT_EQ(stats.shares, 1);
+  EXPECT_EQ(stats.open_files, 2);
+}
+
+TEST_F(open_file_table_test, closed_after_last_reader)
+{
+  write_random_file(dir / "a.bin", 100);
+  open_file_table files;
+  struct stat     st;
+  auto            first  = files.acquire(dir / "a.bin", st);
+  auto            second = files.acquire(dir / "a.bin", st);
+  const int       fd     = first->fd;
+  first.reset();
+  EXPECT_TRUE(is_open(fd));
+  second.reset();
+  EXPECT_EQ(files.stats().open_files, 0);
+
+  // Opened afresh once nobody holds it
+  const auto again = files.acquire(dir / "a.bin", st);
+  EXPECT_EQ(files.stats().opens, 2);
+}
+
+TEST_F(open_file_table_test, replaced_file_gets_its_own_descriptor)
+{
+  write_random_file(dir / "a.bin", 100);
+  const auto      old_data = read_file(dir / "a.bin");
+  open_file_table files;
+  tftp_read_file  old_reader(dir / "a.bin", tftp::mode_t::OCTET, nullptr, &files);
+
+  write_random_file(dir / "new.bin", 200);
+  std::filesystem::rename(dir / "new.bin", dir / "a.bin");
+  tftp_read_file new_reader(dir / "a.bin", tftp::mode_t::OCTET, nullptr, &files);
+  EXPECT_EQ(files.stats().open_files, 2);
+
+  std::vector<char> block;
+  old_reader.read_in_to(block, 512);
+  EXPECT_EQ(block, old_data);
+  new_reader.read_in_to(block, 512);
+  EXPECT_EQ(block, read_file(dir / "a.bin"));
+}
+
+TEST_F(open_file_table_test, descriptor_outlives_table)
+{
+  write_random_file(dir / "a.bin", 100);
+  open_file_table::file_ptr file;
+  {
+    open_file_table files;
+    struct stat     st;
+    file = files.acquire(dir / "a.bin", st);
+  }
+  EXPECT_TRUE(is_open(file->fd));
+}
+
+TEST_F(open_file_table_test, missing_file_throws)
+{
+  open_file_table files;
+  struct stat     st;
+  EXPECT_THROW(files.acquire(dir / "missing.bin", st), std::runtime_error);
+  EXPECT_EQ(files.stats().open_files, 0);
+}
+
+TEST_F(open_file_table_test, interleaved_readers_keep_their_own_position)
+{
+  const auto path = dir / "a.txt";
+  write_random_file(path, 5000);
+  const auto      data = read_file(path);
+  open_file_table files;
+
+  for (const auto mode : {tftp::mode_t::OCTET, tftp::mode_t::NETASCII})
+  {
+    const auto expected = (mode == tftp::mode_t::OCTET) ? data : utils::native_to_netascii(data);
+    tftp_read_file    first(path, mode, nullptr, &files);
+    tftp_read_file    second(path, mode, nullptr, &files);
+    std::vector<char> first_data;
+    std::vector<char> second_data;
+    std::vector<char> block;
+    // The second reader starts a block behind and reads two blocks for every one of the first
+    second.read_in_to(block, 512);
+    second_data.insert(second_data.end(), block.begin(), block.end());
+    while (!first.eof() || !second.eof())
+    {
+      if (!first.eof())
+      {
+        first.read_in_to(block, 512);
+        first_data.insert(first_data.end(), block.begin(), block.end());
+      }
+      for (int i = 0; (i < 2) && !second.eof(); ++i)
+      {
+        second.read_in_to(block, 512);
+        second_data.insert(second_data.end(), block.begin(), block.end());
+      }
+    }
+    EXPECT_FALSE(first.error());
+    EXPECT_EQ(first_data, expected);
+    EXPECT_EQ(second_data, expected);
+    EXPECT_EQ(files.stats().open_files, 1);
+  }
+}
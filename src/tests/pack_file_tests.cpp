@@ -0,0 +1,194 @@
+#include <gtest/gtest.h>
+
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <fstream>
+
+#include "common/pack_file.hpp"
+#include "common/pack_store.hpp"
+#include "common/tftp_read_file.hpp"
+#include "tests/test_utils.hpp"
+
+using namespace test_utils;
+
+namespace
+{
+  class pack_file_test : public ::testing::Test
+  {
+  protected:
+    void SetUp() override
+    {
+      ensure_console_logger();
+      dir  = make_temp_dir("tftp_pack_test_");
+      src  = dir / "src";
+      pack = dir / "files.pack";
+      std::filesystem::create_directories(src / "boot" / "grub");
+    }
+
+    void TearDown() override
+    {
+      std::filesystem::remove_all(dir);
+    }
+
+    std::string contents(const std::optional<std::string_view> &data)
+    {
+      return data ? std::string(*data) : std::string();
+    }
+
+    std::string file_contents(const std::filesystem::path &path)
+    {
+      const auto data = read_file(path);
+      return std::string(data.begin(), data.end());
+    }
+
+    std::filesystem::path dir;
+    std::filesystem::path src;
+    std::filesystem::path pack;
+  };
+} // namespace
+
+TEST_F(pack_file_test, files_found_by_path)
+{
+  write_random_file(src / "kernel.bin", 5000);
+  write_random_file(src / "boot" / "grub" / "grub.cfg", 300);
+  write_random_file(src / "empty.bin", 0);
+  const auto stats = pack_file::build(src, pack);
+  EXPECT_EQ(stats.files, 3);
+  EXPECT_EQ(stats.bytes, 5300);
+
+  const pack_file packed(pack);
+  EXPECT_EQ(packed.entry_count(), 3);
+  EXPECT_EQ(packed.size(), std::filesystem::file_size(pack));
+  EXPECT_EQ(contents(packed.find("kernel.bin")), file_contents(src / "kernel.bin"));
+  EXPECT_EQ(contents(packed.find("boot/grub/grub.cfg")), file_contents(src / "boot" / "grub" / "grub.cfg"));
+  ASSERT_TRUE(packed.find("empty.bin").has_value());
+  EXPECT_TRUE(packed.find("empty.bin")->empty());
+  EXPECT_FALSE(packed.find("missing.bin").has_value());
+  EXPECT_FALSE(packed.find("boot/grub").has_value());
+}
+
+TEST_F(pack_file_test, requests_normalised_before_lookup)
+{
+  write_random_file(src / "boot" / "grub" / "grub.cfg", 300);
+  pack_file::build(src, pack);
+  const pack_file packed(pack);
+  EXPECT_TRUE(packed.find("./boot//grub/grub.cfg").has_value());
+  EXPECT_TRUE(packed.find("boot/x/../grub/grub.cfg").has_value());
+  EXPECT_FALSE(packed.find("/boot/grub/grub.cfg").has_value());
+  EXPECT_FALSE(packed.find("../src/boot/grub/grub.cfg").has_value());
+
+  EXPECT_EQ(pack_file::normalise("./a//b"), "a/b");
+  EXPECT_EQ(pack_file::normalise("../x"), "");
+  EXPECT_EQ(pack_file::normalise("/etc/passwd"), "");
+  EXPECT_EQ(pack_file::normalise("."), "");
+}
+
+TEST_F(pack_file_test, many_files)
+{
+  const size_t count = 1000;
+  for (size_t i = 0; i < count; ++i)
+  {
+    std::ofstream(src / ("f" + std::to_string(i))) << i;
+  }
+  const auto stats = pack_file::build(src, pack);
+  EXPECT_EQ(stats.files, count);
+  const pack_file packed(pack);
+  for (size_t i = 0; i < count; ++i)
+  {
+    EXPECT_EQ(contents(packed.find("f" + std::to_string(i))), std::to_string(i));
+  }
+  EXPECT_FALSE(packed.find("f" + std::to_string(count)).has_value());
+}
+
+TEST_F(pack_file_test, damaged_pack_refused)
+{
+  write_random_file(src / "kernel.bin", 5000);
+  pack_file::build(src, pack);
+  std::filesystem::resize_file(pack, std::filesystem::file_size(pack) - 1);
+  EXPECT_THROW(pack_file{pack}, std::runtime_error);
+
+  std::ofstream(pack, std::ios::trunc) << "not a pack, but long enough to hold a header......";
+  EXPECT_THROW(pack_file{pack}, std::runtime_error);
+  EXPECT_THROW(pack_file{dir / "missing.pack"}, std::runtime_error);
+}
+
+TEST_F(pack_file_test, failed_build_keeps_old_pack)
+{
+  write_random_file(src / "kernel.bin", 5000);
+  pack_file::build(src, pack);
+  const auto old_pack = file_contents(pack);
+
+  // Built in a child limited to files smaller than the new pack, as if the disk filled up part way through
+  write_random_file(src / "initrd.img", 1024 * 1024);
+  const pid_t pid = fork();
+  ASSERT_GE(pid, 0);
+  if (pid == 0)
+  {
+    signal(SIGXFSZ, SIG_IGN);
+    const struct rlimit limit = {256 * 1024, 256 * 1024};
+    setrlimit(RLIMIT_FSIZE, &limit);
+    try
+    {
+      pack_file::build(src, pack);
+    }
+    catch (const std::runtime_error &)
+    {
+      _exit(0);
+    }
+    _exit(1);
+  }
+  int status = 0;
+  ASSERT_EQ(waitpid(pid, &status, 0), pid);
+  ASSERT_TRUE(WIFEXITED(status));
+  EXPECT_EQ(WEXITSTATUS(status), 0);
+
+  EXPECT_FALSE(std::filesystem::exists(pack.string() + ".tmp"));
+  EXPECT_EQ(file_contents(pack), old_pack);
+  const pack_file packed(pack);
+  EXPECT_FALSE(packed.find("initrd.img").has_value());
+}
+
+TEST_F(pack_file_test, store_swaps_in_replaced_pack)
+{
+  write_random_file(src / "kernel.bin", 5000);
+  pack_file::build(src, pack);
+  pack_store store(pack);
+  const auto first = store.current();
+  EXPECT_FALSE(store.reload());
+
+  write_random_file(src / "kernel.bin", 7000);
+  pack_file::build(src, pack);
+  EXPECT_TRUE(store.reload());
+  EXPECT_EQ(store.swaps(), 1);
+  const auto second = store.current();
+  EXPECT_NE(first, second);
+  EXPECT_EQ(second->find("kernel.bin")->size(), 7000);
+  // A session still holding the old pack keeps reading it
+  EXPECT_EQ(first->find("kernel.bin")->size(), 5000);
+
+  // A bad replacement is ignored
+  std::ofstream(pack.string() + ".bad") << "bad";
+  std::filesystem::rename(pack.string() + ".bad", pack);
+  EXPECT_FALSE(store.reload());
+  EXPECT_EQ(store.current(), second);
+  EXPECT_THROW(pack_store{(dir / "missing.pack").string()}, std::runtime_error);
+}
+
+TEST_F(pack_file_test, packed_file_read_as_netascii)
+{
+  std::ofstream(src / "motd.txt") << "line one\nline two\n";
+  pack_file::build(src, pack);
+  const auto packed = std::make_shared<const pack_file>(pack);
+  const auto data   = packed->find("motd.txt");
+  ASSERT_TRUE(data.has_value());
+
+  tftp_read_file reader;
+  reader.open(std::shared_ptr<const char>(packed, data->data()), data->size(), tftp::mode_t::NETASCII);
+  std::vector<char> block;
+  reader.read_in_to(block, 512);
+  EXPECT_EQ(std::string(block.begin(), block.end()), "line one\r\nline two\r\n");
+  EXPECT_TRUE(reader.eof());
+}
@@ -0,0 +1,88 @@
+#include <gtest/gtest.h>
+
+#include "common/rtt_estimator.hpp"
+
+TEST(rtt_estimator, initial_timeout_before_samples)
+{
+  rtt_estimator rtt(1000, 5, 2000);
+  EXPECT_FALSE(rtt.has_samples());
+  EXPECT_EQ(rtt.rto_ms(), 1000);
+}
+
+TEST(rtt_estimator, initial_timeout_clamped)
+{
+  EXPECT_EQ(rtt_estimator(5000, 5, 2000).rto_ms(), 2000);
+  EXPECT_EQ(rtt_estimator(1, 5, 2000).rto_ms(), 5);
+}
+
+TEST(rtt_estimator, first_sample)
+{
+  rtt_estimator rtt(1000, 5, 2000);
+  rtt.add_sample(10000);
+  EXPECT_TRUE(rtt.has_samples());
+  EXPECT_EQ(rtt.srtt_us(), 10000);
+  EXPECT_EQ(rtt.rttvar_us(), 5000);
+  // srtt + 4 * rttvar
+  EXPECT_EQ(rtt.rto_ms(), 30);
+}
+
+TEST(rtt_estimator, converges_to_steady_rtt)
+{
+  rtt_estimator rtt(1000, 1, 2000);
+  for (int i = 0; i < 100; ++i)
+  {
+    rtt.add_sample(20000);
+  }
+  EXPECT_EQ(rtt.srtt_us(), 20000);
+  EXPECT_LT(rtt.rttvar_us(), 100);
+  // The variance term is at least the clock granularity
+  EXPECT_EQ(rtt.rto_ms(), 21);
+}
+
+TEST(rtt_estimator, sub_millisecond_rtt_uses_minimum)
+{
+  rtt_estimator rtt(1000, 5, 2000);
+  for (int i = 0; i < 20; ++i)
+  {
+    rtt.add_sample(200);
+  }
+  EXPECT_EQ(rtt.rto_ms(), 5);
+}
+
+TEST(rtt_estimator, backoff_doubles_up_to_maximum)
+{
+  rtt_estimator rtt(100, 5, 1000);
+  rtt.backoff();
+  EXPECT_EQ(rtt.rto_ms(), 200);
+  rtt.backoff();
+  EXPECT_EQ(rtt.rto_ms(), 400);
+  rtt.backoff();
+  EXPECT_EQ(rtt.rto_ms(), 800);
+  rtt.backoff();
+  EXPECT_EQ(rtt.rto_ms(), 1000);
+  rtt.backoff();
+  EXPECT_EQ(rtt.rto_ms(), 1000);
+}
+
+TEST(rtt_estimator, sample_clears_backoff)
+{
+  rtt_estimator rtt(100, 5, 1000);
+  rtt.backoff();
+  rtt.backoff();
+  rtt.add_sample(10000);
+  EXPECT_EQ(rtt.rto_ms(), 30);
+}
+
+TEST(rtt_estimator, jitter_within_an_eighth)
+{
+  rtt_estimator rtt(800, 5, 2000, 42);
+  bool          jittered = false;
+  for (int i = 0; i < 100; ++i)
+  {
+    const uint32_t timeout = rtt.next_timeout_ms();
+    EXPECT_GE(timeout, 800);
+    EXPECT_LE(timeout, 900);
+    jittered |= (timeout != 800);
+  }
+  EXPECT_TRUE(jittered);
+}
@@ -0,0 +1,151 @@
+#include <gtest/gtest.h>
+
+#include <set>
+#include <stdexcept>
+
+#include "common/slab.hpp"
+
+namespace
+{
+  struct counted
+  {
+    explicit counted(int &live_count, const int v) :
+        live(live_count), value(v)
+    {
+      ++live;
+    }
+    counted(const counted &) = delete;
+    counted(counted &&)      = delete;
+    ~counted()
+    {
+      --live;
+    }
+    int &live;
+    int  value;
+  };
+
+  struct throws_on_construct
+  {
+    throws_on_construct()
+    {
+      throw std::runtime_error("construct failed");
+    }
+  };
+} // namespace
+
+TEST(slab, emplace_and_get)
+{
+  int           live = 0;
+  slab<counted> s(4);
+
+  const auto handle = s.emplace(live, 42);
+  ASSERT_NE(s.get(handle), nullptr);
+  EXPECT_EQ(s.get(handle)->value, 42);
+  EXPECT_EQ(s.size(), 1);
+  EXPECT_EQ(live, 1);
+}
+
+TEST(slab, release_destroys_and_invalidates_handle)
+{
+  int           live = 0;
+  slab<counted> s(4);
+
+  const auto handle = s.emplace(live, 1);
+  s.release(handle);
+  EXPECT_EQ(live, 0);
+  EXPECT_EQ(s.size(), 0);
+  EXPECT_EQ(s.get(handle), nullptr);
+
+  // Releasing a stale handle is a no-op
+  s.release(handle);
+  EXPECT_EQ(s.size(), 0);
+}
+
+TEST(slab, reused_slot_gets_new_generation)
+{
+  int           live = 0;
+  slab<counted> s(1);
+
+  const auto first = s.emplace(live, 1);
+  s.release(first);
+  const auto second = s.emplace(live, 2);
+
+  EXPECT_NE(first, second);
+  EXPECT_EQ(s.get(first), nullptr);
+  ASSERT_NE(s.get(second), nullptr);
+  EXPECT_EQ(s.get(second)->value, 2);
+}
+
+TEST(slab, full_slab_throws)
+{
+  int           live = 0;
+  slab<counted> s(3);
+  for (int i = 0; i < 3; ++i)
+  {
+    s.emplace(live, i);
+  }
+  EXPECT_TRUE(s.full());
+  EXPECT_THROW(s.emplace(live, 3), std::length_error);
+  EXPECT_EQ(live, 3);
+}
+
+TEST(slab, handles_are_unique_while_live)
+{
+  int                 live = 0;
+  slab<counted>       s(16);
+  std::set<uint64_t>  handles;
+  for (int i = 0; i < 16; ++i)
+  {
+    handles.insert(s.emplace(live, i));
+  }
+  EXPECT_EQ(handles.size(), 16);
+  for (const auto h : handles)
+  {
+    EXPECT_NE(s.get(h), nullptr);
+  }
+}
+
+TEST(slab, invalid_handle_is_never_valid)
+{
+  int           live = 0;
+  slab<counted> s(2);
+  s.emplace(live, 0);
+  s.emplace(live, 1);
+  EXPECT_EQ(s.get(slab<counted>::INVALID_HANDLE), nullptr);
+}
+
+TEST(slab, handles_leave_tag_bits_clear)
+{
+  int           live = 0;
+  slab<counted> s(2);
+  for (int i = 0; i < 100; ++i)
+  {
+    const auto handle = s.emplace(live, i);
+    EXPECT_EQ(handle & slab<counted>::TAG_BITS, 0);
+    s.release(handle);
+  }
+  EXPECT_NE(slab<counted>::TAG_BITS, 0);
+}
+
+TEST(slab, failed_construction_keeps_slot_free)
+{
+  slab<throws_on_construct> s(1);
+  EXPECT_THROW(s.emplace(), std::runtime_error);
+  EXPECT_EQ(s.size(), 0);
+  EXPECT_FALSE(s.full());
+}
+
+TEST(slab, destructor_destroys_live_objects)
+{
+  int live = 0;
+  {
+    slab<counted> s(8);
+    for (int i = 0; i < 5; ++i)
+    {
+      s.emplace(live, i);
+    }
+    s.release(s.emplace(live, 99));
+    EXPECT_EQ(live, 5);
+  }
+  EXPECT_EQ(live, 0);
+}
@@ -0,0 +1,99 @@
+#include <gtest/gtest.h>
+
+#include <arpa/inet.h>
+#include <poll.h>
+
+#include <chrono>
+#include <thread>
+
+#include "server/tftp_connection_handler.hpp"
+#include "tests/test_utils.hpp"
+
+namespace
+{
+  uint16_t local_port(const int sd)
+  {
+    struct sockaddr_in sa;
+    socklen_t          len = sizeof(sa);
+    getsockname(sd, (struct sockaddr *)&sa, &len);
+    return ntohs(sa.sin_port);
+  }
+
+  /**
+   * @brief Sends each request from client, then drains the handler's socket and returns what it queued
+   */
+  std::vector<tftp_connection_handler::request_t> send_requests(tftp_connection_handler              &handler,
+                                                                udp_connection                       &client,
+                                                                const std::vector<tftp::rw_packet_t> &requests)
+  {
+    for (const auto &request : requests)
+    {
+      client.send_to("127.0.0.1", local_port(handler.sd()), tftp::serialise_rw_packet(request));
+    }
+    pollfd pfd = {handler.sd(), POLLIN, 0};
+    poll(&pfd, 1, 1000);
+    // Loopback delivers in order, give the last datagram time to land before draining
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    handler.handle_read();
+
+    std::vector<tftp_connection_handler::request_t> queued;
+    while (handler.requests_pending())
+    {
+      queued.push_back(handler.get_request());
+    }
+    return queued;
+  }
+} // namespace
+
+TEST(tftp_connection_handler, repeated_requests_dropped)
+{
+  test_utils::ensure_console_logger();
+  tftp_connection_handler handler("127.0.0.1", 0);
+  udp_connection          client;
+  client.bind("127.0.0.1", 0);
+
+  const tftp::rw_packet_t read("file.bin", tftp::packet_t::READ, tftp::mode_t::OCTET);
+  const tftp::rw_packet_t write("file.bin", tftp::packet_t::WRITE, tftp::mode_t::OCTET);
+  const tftp::rw_packet_t other("other.bin", tftp::packet_t::READ, tftp::mode_t::OCTET);
+
+  EXPECT_EQ(send_requests(handler, client, {read, read, read}).size(), 1);
+  EXPECT_EQ(handler.duplicates(), 2);
+
+  // A different operation or file is a new request, as is the same request from another port
+  EXPECT_EQ(send_requests(handler, client, {write, other, read}).size(), 2);
+  EXPECT_EQ(handler.duplicates(), 3);
+
+  udp_connection other_client;
+  other_client.bind("127.0.0.1", 0);
+  EXPECT_EQ(send_requests(handler, other_client, {read}).size(), 1);
+  EXPECT_EQ(handler.duplicates(), 3);
+}
+
+TEST(tftp_connection_handler, repeats_accepted_once_session_ended)
+{
+  test_utils::ensure_console_logger();
+  tftp_connection_handler handler("127.0.0.1", 0);
+  udp_connection          client;
+  client.bind("127.0.0.1", 0);
+
+  // However long the session runs, its request is not started again until the session has ended
+  const tftp::rw_packet_t read("file.bin", tftp::packet_t::READ, tftp::mode_t::OCTET);
+  const auto              first = send_requests(handler, client, {read});
+  ASSERT_EQ(first.size(), 1);
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_TRUE(send_requests(handler, client, {read}).empty());
+  EXPECT_EQ(handler.duplicates(), 1);
+
+  // A PXE client probing tsize aborts the transfer and asks again straight away, from the same port
+  handler.session_ended(first.front().key);
+  EXPECT_EQ(send_requests(handler, client, {read, read}).size(), 1);
+  EXPECT_EQ(handler.duplicates(), 2);
+
+  // Members of a multicast group repeat their request to have their OACK resent
+  tftp::rw_packet_t multicast("file.bin", tftp::packet_t::READ, tftp::mode_t::OCTET);
+  multicast.options.push_back(std::make_pair("MULTICAST", ""));
+  const auto repeats = send_requests(handler, client, {multicast, multicast});
+  ASSERT_EQ(repeats.size(), 2);
+  EXPECT_TRUE(repeats.front().key.empty());
+  EXPECT_EQ(handler.duplicates(), 2);
+}
@@ -0,0 +1,939 @@
+#include <gtest/gtest.h>
+
+#include <poll.h>
+#include <sys/resource.h>
+
+#include <chrono>
+#include <thread>
+
+#include "client/tftp_client.hpp"
+#include "common/utils.hpp"
+#include "tests/lossy_relay.hpp"
+#include "tests/test_utils.hpp"
+
+using namespace test_utils;
+
+namespace
+{
+  const uint16_t TEST_PORT = 16970;
+  const char     FILENAME[] = "file.bin";
+  const size_t   FILE_SIZE  = 64 * 1024 + 100;
+
+  /**
+   * @brief Serves a random file from a temporary root for the whole suite, each test reads into its own directory
+   */
+  class tftp_server_test : public ::testing::Test
+  {
+  protected:
+    static void SetUpTestSuite()
+    {
+      ensure_console_logger();
+      root = make_temp_dir("tftp_test_root_");
+      write_random_file(root / FILENAME, FILE_SIZE);
+      server = std::make_unique<forked_server>(
+          []() { return std::make_unique<tftp_server>(local_server_options(root, TEST_PORT)); });
+    }
+
+    static void TearDownTestSuite()
+    {
+      server.reset();
+      std::filesystem::remove_all(root);
+    }
+
+    void SetUp() override
+    {
+      old_cwd = std::filesystem::current_path();
+      out_dir = make_temp_dir("tftp_test_out_");
+      std::filesystem::current_path(out_dir);
+    }
+
+    void TearDown() override
+    {
+      std::filesystem::current_path(old_cwd);
+      std::filesystem::remove_all(out_dir);
+    }
+
+    static std::filesystem::path          root;
+    static std::unique_ptr<forked_server> server;
+    std::filesystem::path                 old_cwd;
+    std::filesystem::path                 out_dir;
+  };
+
+  std::filesystem::path          tftp_server_test::root;
+  std::unique_ptr<forked_server> tftp_server_test::server;
+
+  class tftp_server_windowsize_test : public tftp_server_test, public ::testing::WithParamInterface<uint16_t>
+  {
+  };
+
+  const uint16_t IO_POOL_TEST_PORT = 16971;
+
+  /**
+   * @brief As tftp_server_test, with the server's file I/O on a disk I/O pool
+   *
+   * Prefetches fewer blocks than the larger windows, batches then grow to a window.
+   */
+  class tftp_server_io_pool_test : public ::testing::TestWithParam<uint16_t>
+  {
+  protected:
+    static void SetUpTestSuite()
+    {
+      ensure_console_logger();
+      root = make_temp_dir("tftp_test_io_root_");
+      write_random_file(root / FILENAME, FILE_SIZE);
+      server = std::make_unique<forked_server>([]() {
+        auto options            = local_server_options(root, IO_POOL_TEST_PORT);
+        options.io_threads      = 2;
+        options.prefetch_blocks = 4;
+        return std::make_unique<tftp_server>(options);
+      });
+    }
+
+    static void TearDownTestSuite()
+    {
+      server.reset();
+      std::filesystem::remove_all(root);
+    }
+
+    void SetUp() override
+    {
+      old_cwd = std::filesystem::current_path();
+      out_dir = make_temp_dir("tftp_test_io_out_");
+      std::filesystem::current_path(out_dir);
+    }
+
+    void TearDown() override
+    {
+      std::filesystem::current_path(old_cwd);
+      std::filesystem::remove_all(out_dir);
+    }
+
+    static std::filesystem::path          root;
+    static std::unique_ptr<forked_server> server;
+    std::filesystem::path                 old_cwd;
+    std::filesystem::path                 out_dir;
+  };
+
+  std::filesystem::path          tftp_server_io_pool_test::root;
+  std::unique_ptr<forked_server> tftp_server_io_pool_test::server;
+
+  std::optional<tftp::oack_packet_t> request_oack(const tftp::rw_packet_t &request, const uint16_t port = TEST_PORT)
+  {
+    udp_connection udp;
+    udp.bind("127.0.0.1", 0);
+    udp.send_to("127.0.0.1", port, tftp::serialise_rw_packet(request));
+
+    pollfd pfd = {udp.sd(), POLLIN, 0};
+    if (poll(&pfd, 1, 2000) <= 0)
+    {
+      return {};
+    }
+    std::string address;
+    uint16_t    tid  = 0;
+    const auto  oack = tftp::deserialise_oack_packet(udp.recv_from(address, tid, tftp::DATA_PKT_MAX_SIZE));
+    udp.send_to("127.0.0.1", tid, tftp::serialise_error_packet(tftp::error_packet_t(tftp::error_t::NOT_DEFINED, "")));
+    return oack;
+  }
+
+  /**
+   * @brief Sends request and returns the error packet it is refused with, if it is
+   */
+  std::optional<tftp::error_packet_t> request_error(const tftp::rw_packet_t &request, const uint16_t port = TEST_PORT)
+  {
+    udp_connection udp;
+    udp.bind("127.0.0.1", 0);
+    udp.send_to("127.0.0.1", port, tftp::serialise_rw_packet(request));
+
+    pollfd pfd = {udp.sd(), POLLIN, 0};
+    if (poll(&pfd, 1, 2000) <= 0)
+    {
+      return {};
+    }
+    std::string address;
+    uint16_t    tid   = 0;
+    const auto  reply = udp.recv_from(address, tid, tftp::DATA_PKT_MAX_SIZE);
+    const auto  error = tftp::deserialise_error_packet(reply);
+    if (!error)
+    {
+      udp.send_to("127.0.0.1", tid,
+                  tftp::serialise_error_packet(tftp::error_packet_t(tftp::error_t::NOT_DEFINED, "")));
+    }
+    return error;
+  }
+
+  /**
+   * @brief Uploads data as a netascii file of a single block, returns the error packet the block is answered with, if
+   * it is not acknowledged
+   */
+  std::optional<tftp::error_packet_t> upload_netascii_error(const std::string &filename, const std::string &data,
+                                                            const uint16_t port)
+  {
+    udp_connection udp;
+    udp.bind("127.0.0.1", 0);
+    udp.send_to("127.0.0.1", port,
+                tftp::serialise_rw_packet(tftp::rw_packet_t(filename, tftp::packet_t::WRITE, tftp::mode_t::NETASCII)));
+
+    pollfd pfd = {udp.sd(), POLLIN, 0};
+    if (poll(&pfd, 1, 2000) <= 0)
+    {
+      return {};
+    }
+    std::string address;
+    uint16_t    tid = 0;
+    if (!tftp::deserialise_ack_packet(udp.recv_from(address, tid, tftp::DATA_PKT_MAX_SIZE)))
+    {
+      return {};
+    }
+    tftp::data_packet_t block;
+    block.block_number = 1;
+    block.data.assign(data.begin(), data.end());
+    udp.send_to("127.0.0.1", tid, tftp::serialise_data_packet(block));
+
+    if (poll(&pfd, 1, 2000) <= 0)
+    {
+      return {};
+    }
+    return tftp::deserialise_error_packet(udp.recv_from(address, tid, tftp::DATA_PKT_MAX_SIZE));
+  }
+
+  /**
+   * @brief Runs a lock-step read session in this process, standing in for both the worker and the client
+   *
+   * Returns the copy counts of the session, the received file is appended to data. The session's disk waits are
+   * returned in disk_stats if given.
+   */
+  tftp_server_connection::copy_stats_t run_read_session(const bool zero_copy, std::vector<char> &data,
+                                                        tftp_server_connection::disk_stats_t *disk_stats = nullptr)
+  {
+    udp_connection client;
+    client.bind("127.0.0.1", 0);
+    struct sockaddr_in client_address;
+    socklen_t          len = sizeof(client_address);
+    getsockname(client.sd(), (struct sockaddr *)&client_address, &len);
+
+    timer_wheel            wheel;
+    server_options options;
+    options.zero_copy = zero_copy;
+    tftp_server_connection conn(tftp::rw_packet_t(FILENAME, tftp::packet_t::READ, tftp::mode_t::OCTET),
+                                client_address, wheel, options);
+    while (!conn.is_finished())
+    {
+      if (conn.wait_for_write())
+      {
+        conn.handle_write();
+        continue;
+      }
+      std::string address;
+      uint16_t    tid    = 0;
+      const auto  packet = tftp::deserialise_data_packet(client.recv_from(address, tid, tftp::DATA_PKT_MAX_SIZE));
+      if (!packet)
+      {
+        break;
+      }
+      data.insert(data.end(), packet->data.begin(), packet->data.end());
+      client.send_to("127.0.0.1", tid, tftp::serialise_ack_packet(tftp::ack_packet_t(packet->block_number)));
+      conn.handle_read();
+    }
+    conn.handle_error();
+    if (disk_stats != nullptr)
+    {
+      *disk_stats = conn.disk_stats();
+    }
+    return conn.copy_stats();
+  }
+} // namespace
+
+TEST_P(tftp_server_windowsize_test, read_without_loss)
+{
+  ASSERT_TRUE(tftp_client::get_file(FILENAME, "127.0.0.1", tftp::mode_t::OCTET, "127.0.0.1", TEST_PORT, GetParam()));
+  EXPECT_EQ(read_file(FILENAME), read_file(root / FILENAME));
+}
+
+TEST_P(tftp_server_windowsize_test, read_with_loss)
+{
+  lossy_relay relay("127.0.0.1", TEST_PORT, 0.02, GetParam());
+  ASSERT_TRUE(
+      tftp_client::get_file(FILENAME, "127.0.0.1", tftp::mode_t::OCTET, "127.0.0.1", relay.port(), GetParam()));
+  EXPECT_EQ(read_file(FILENAME), read_file(root / FILENAME));
+  EXPECT_GT(relay.dropped(), 0);
+}
+
+TEST_F(tftp_server_test, loss_recovered_in_milliseconds)
+{
+  // Lock-step transfer, every lost packet has to be recovered by a server timeout
+  lossy_relay relay("127.0.0.1", TEST_PORT, 0.01, 7);
+  const auto  start = std::chrono::steady_clock::now();
+  ASSERT_TRUE(tftp_client::get_file(FILENAME, "127.0.0.1", tftp::mode_t::OCTET, "127.0.0.1", relay.port()));
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+  EXPECT_EQ(read_file(FILENAME), read_file(root / FILENAME));
+  EXPECT_GT(relay.dropped(), 0);
+  EXPECT_LT(elapsed, std::chrono::milliseconds(500));
+}
+
+INSTANTIATE_TEST_SUITE_P(windowsize, tftp_server_windowsize_test, ::testing::Values(1, 4, 16, 64));
+
+TEST_P(tftp_server_io_pool_test, read)
+{
+  ASSERT_TRUE(
+      tftp_client::get_file(FILENAME, "127.0.0.1", tftp::mode_t::OCTET, "127.0.0.1", IO_POOL_TEST_PORT, GetParam()));
+  EXPECT_EQ(read_file(FILENAME), read_file(root / FILENAME));
+}
+
+TEST_P(tftp_server_io_pool_test, read_with_loss)
+{
+  lossy_relay relay("127.0.0.1", IO_POOL_TEST_PORT, 0.02, GetParam());
+  ASSERT_TRUE(
+      tftp_client::get_file(FILENAME, "127.0.0.1", tftp::mode_t::OCTET, "127.0.0.1", relay.port(), GetParam()));
+  EXPECT_EQ(read_file(FILENAME), read_file(root / FILENAME));
+}
+
+TEST_P(tftp_server_io_pool_test, write)
+{
+  // Sized so the final batch is partly filled
+  const std::string filename = "upload_" + std::to_string(GetParam()) + ".bin";
+  write_random_file(filename, FILE_SIZE * GetParam());
+  ASSERT_TRUE(tftp_client::send_file(filename, "127.0.0.1", tftp::mode_t::OCTET, "127.0.0.1", IO_POOL_TEST_PORT));
+  // The final ack is only sent once the upload is on disk
+  EXPECT_EQ(read_file(root / filename), read_file(filename));
+}
+
+TEST_P(tftp_server_io_pool_test, bad_netascii_upload_refused)
+{
+  // A CR followed by neither LF nor NUL can not be decoded, the upload must fail rather than be acknowledged
+  const std::string filename = "bad_" + std::to_string(GetParam()) + ".txt";
+  const auto        error    = upload_netascii_error(filename, "line\rx", IO_POOL_TEST_PORT);
+  ASSERT_TRUE(error.has_value());
+  EXPECT_EQ(error->error_code, static_cast<uint16_t>(tftp::error_t::NOT_DEFINED));
+  std::filesystem::remove(root / filename);
+
+  // The server carries on
+  ASSERT_TRUE(tftp_client::get_file(FILENAME, "127.0.0.1", tftp::mode_t::OCTET, "127.0.0.1", IO_POOL_TEST_PORT));
+  EXPECT_EQ(read_file(FILENAME), read_file(root / FILENAME));
+}
+
+INSTANTIATE_TEST_SUITE_P(windowsize, tftp_server_io_pool_test, ::testing::Values(1, 4, 16));
+
+TEST_F(tftp_server_test, windowsize_echoed_and_capped)
+{
+  tftp::rw_packet_t request(FILENAME, tftp::packet_t::READ, tftp::mode_t::OCTET);
+  request.options.push_back(std::make_pair("windowsize", "1000"));
+  const auto oack = request_oack(request);
+  ASSERT_TRUE(oack.has_value());
+  ASSERT_EQ(oack->options.size(), 1);
+  EXPECT_EQ(oack->options[0].second, "64");
+
+  request.options[0].second = "8";
+  const auto oack_8 = request_oack(request);
+  ASSERT_TRUE(oack_8.has_value());
+  ASSERT_EQ(oack_8->options.size(), 1);
+  EXPECT_EQ(oack_8->options[0].second, "8");
+}
+
+TEST_F(tftp_server_test, utimeout_echoed)
+{
+  tftp::rw_packet_t request(FILENAME, tftp::packet_t::READ, tftp::mode_t::OCTET);
+  request.options.push_back(std::make_pair("utimeout", "150"));
+  const auto oack = request_oack(request);
+  ASSERT_TRUE(oack.has_value());
+  ASSERT_EQ(oack->options.size(), 1);
+  EXPECT_EQ(oack->options[0].first, "UTIMEOUT");
+  EXPECT_EQ(oack->options[0].second, "150");
+
+  request.options[0].second = "0";
+  const auto rejected = request_oack(request);
+  EXPECT_FALSE(rejected.has_value());
+}
+
+TEST_F(tftp_server_test, windowsize_zero_ignored)
+{
+  tftp::rw_packet_t request(FILENAME, tftp::packet_t::READ, tftp::mode_t::OCTET);
+  request.options.push_back(std::make_pair("windowsize", "0"));
+  request.options.push_back(std::make_pair("tsize", "0"));
+  const auto oack = request_oack(request);
+  ASSERT_TRUE(oack.has_value());
+  ASSERT_EQ(oack->options.size(), 1);
+  EXPECT_EQ(oack->options[0].first, "TSIZE");
+}
+
+TEST_F(tftp_server_test, request_repeated_after_tsize_probe_served)
+{
+  // A PXE client asks for tsize, aborts once it has the OACK and asks again straight away from the same port
+  udp_connection udp;
+  udp.bind("127.0.0.1", 0);
+  tftp::rw_packet_t probe(FILENAME, tftp::packet_t::READ, tftp::mode_t::OCTET);
+  probe.options.push_back(std::make_pair("tsize", "0"));
+  udp.send_to("127.0.0.1", TEST_PORT, tftp::serialise_rw_packet(probe));
+
+  pollfd pfd = {udp.sd(), POLLIN, 0};
+  ASSERT_GT(poll(&pfd, 1, 2000), 0);
+  std::string address;
+  uint16_t    tid  = 0;
+  const auto  oack = tftp::deserialise_oack_packet(udp.recv_from(address, tid, tftp::DATA_PKT_MAX_SIZE));
+  ASSERT_TRUE(oack.has_value());
+  udp.send_to("127.0.0.1", tid, tftp::serialise_error_packet(tftp::error_packet_t(tftp::error_t::NOT_DEFINED, "")));
+
+  // The session has ended, so this is a new request rather than a repeat of the probe
+  const tftp::rw_packet_t request(FILENAME, tftp::packet_t::READ, tftp::mode_t::OCTET);
+  udp.send_to("127.0.0.1", TEST_PORT, tftp::serialise_rw_packet(request));
+  ASSERT_GT(poll(&pfd, 1, 1000), 0);
+  const auto data = tftp::deserialise_data_packet(udp.recv_from(address, tid, tftp::DATA_PKT_MAX_SIZE));
+  ASSERT_TRUE(data.has_value());
+  EXPECT_EQ(data->block_number, 1);
+  udp.send_to("127.0.0.1", tid, tftp::serialise_error_packet(tftp::error_packet_t(tftp::error_t::NOT_DEFINED, "")));
+}
+
+TEST_F(tftp_server_test, copy_read_copies_every_byte_twice)
+{
+  std::filesystem::current_path(root);
+  std::vector<char> data;
+  const auto        stats = run_read_session(false, data);
+  EXPECT_EQ(data, read_file(FILENAME));
+  EXPECT_EQ(stats.payload_bytes, FILE_SIZE);
+  // Read into userspace, then copied into the socket buffer
+  EXPECT_EQ(stats.copied_bytes, 2 * FILE_SIZE);
+}
+
+TEST_F(tftp_server_test, zero_copy_read_copies_no_file_data_in_userspace)
+{
+  std::filesystem::current_path(root);
+  std::vector<char> data;
+  const auto        stats = run_read_session(true, data);
+  EXPECT_EQ(data, read_file(FILENAME));
+  EXPECT_EQ(stats.payload_bytes, FILE_SIZE);
+  // At most the kernel's copy, loopback always copies
+  EXPECT_LE(stats.copied_bytes, FILE_SIZE);
+}
+
+TEST_F(tftp_server_test, read_session_counts_disk_waits)
+{
+  std::filesystem::current_path(root);
+  std::vector<char>                    data;
+  tftp_server_connection::disk_stats_t copy_disk{};
+  run_read_session(false, data, &copy_disk);
+  // Every block is read on the event loop
+  EXPECT_EQ(copy_disk.waits, (FILE_SIZE / tftp::DATA_PKT_DATA_MAX_SIZE) + 1);
+
+  data.clear();
+  tftp_server_connection::disk_stats_t mapped_disk{};
+  run_read_session(true, data, &mapped_disk);
+  EXPECT_EQ(mapped_disk.waits, 0);
+  EXPECT_EQ(mapped_disk.wait_us, 0);
+}
+
+TEST_F(tftp_server_test, bad_netascii_upload_refused)
+{
+  const auto error = upload_netascii_error("bad.txt", "line\rx", TEST_PORT);
+  ASSERT_TRUE(error.has_value());
+  EXPECT_EQ(error->error_code, static_cast<uint16_t>(tftp::error_t::NOT_DEFINED));
+  std::filesystem::remove(root / "bad.txt");
+
+  ASSERT_TRUE(tftp_client::get_file(FILENAME, "127.0.0.1", tftp::mode_t::OCTET, "127.0.0.1", TEST_PORT));
+  EXPECT_EQ(read_file(FILENAME), read_file(root / FILENAME));
+}
+
+TEST_F(tftp_server_test, upload_larger_than_free_space_refused)
+{
+  tftp::rw_packet_t request("huge.bin", tftp::packet_t::WRITE, tftp::mode_t::OCTET);
+  request.options.push_back(std::make_pair("tsize", std::to_string(1ULL << 62)));
+  const auto error = request_error(request);
+  ASSERT_TRUE(error.has_value());
+  EXPECT_EQ(error->error_code, static_cast<uint16_t>(tftp::error_t::DISK_FULL));
+  EXPECT_FALSE(std::filesystem::exists(root / "huge.bin"));
+
+  // Space available, tsize is echoed
+  request.filename          = "small.bin";
+  request.options[0].second = "1000";
+  const auto oack           = request_oack(request);
+  ASSERT_TRUE(oack.has_value());
+  ASSERT_EQ(oack->options.size(), 1);
+  EXPECT_EQ(oack->options[0].first, "TSIZE");
+  EXPECT_EQ(oack->options[0].second, "1000");
+  std::filesystem::remove(root / "small.bin");
+}
+
+TEST(tftp_server_datagram_cache, hot_file_served_from_cache)
+{
+  ensure_console_logger();
+  const auto root = make_temp_dir("tftp_test_dgram_root_");
+  write_random_file(root / FILENAME, FILE_SIZE);
+  const auto out_dir = make_temp_dir("tftp_test_dgram_out_");
+  const auto old_cwd = std::filesystem::current_path();
+  std::filesystem::current_path(out_dir);
+  for (const size_t io_threads : {0, 2})
+  {
+    forked_server server([&root, io_threads]() {
+      auto options                 = local_server_options(root, TEST_PORT + 2);
+      options.io_threads           = io_threads;
+      options.datagram_cache_bytes = 1024 * 1024;
+      return std::make_unique<tftp_server>(options);
+    });
+    // The first get fills the cache, the rest are served from it
+    for (const uint16_t window_size : {1, 8, 8})
+    {
+      std::filesystem::remove(FILENAME);
+      ASSERT_TRUE(tftp_client::get_file(FILENAME, "127.0.0.1", tftp::mode_t::OCTET, "127.0.0.1", TEST_PORT + 2,
+                                        window_size));
+      EXPECT_EQ(read_file(FILENAME), read_file(root / FILENAME));
+    }
+    lossy_relay relay("127.0.0.1", TEST_PORT + 2, 0.02, 8);
+    std::filesystem::remove(FILENAME);
+    ASSERT_TRUE(tftp_client::get_file(FILENAME, "127.0.0.1", tftp::mode_t::OCTET, "127.0.0.1", relay.port(), 8));
+    EXPECT_EQ(read_file(FILENAME), read_file(root / FILENAME));
+  }
+  std::filesystem::current_path(old_cwd);
+  std::filesystem::remove_all(out_dir);
+  std::filesystem::remove_all(root);
+}
+
+TEST(tftp_server_metadata_cache, requests_checked_from_cache)
+{
+  ensure_console_logger();
+  const uint16_t port = TEST_PORT + 3;
+  const auto     root = make_temp_dir("tftp_test_meta_root_");
+  write_random_file(root / FILENAME, FILE_SIZE);
+  const auto out_dir = make_temp_dir("tftp_test_meta_out_");
+  const auto old_cwd = std::filesystem::current_path();
+  std::filesystem::current_path(out_dir);
+  {
+    forked_server server([&root, port]() {
+      auto options                   = local_server_options(root, port);
+      options.metadata_cache_entries = 64;
+      return std::make_unique<tftp_server>(options);
+    });
+    const bool watching = metadata_cache(root, 1).watching();
+    auto       wait_for_refresh = [watching]() {
+      if (!watching)
+      {
+        std::this_thread::sleep_for(std::chrono::milliseconds(metadata_cache::DEFAULT_TTL_MS + 100));
+      }
+    };
+
+    tftp::rw_packet_t read_request(FILENAME, tftp::packet_t::READ, tftp::mode_t::OCTET);
+    read_request.options.push_back(std::make_pair("tsize", "0"));
+    for (int i = 0; i < 2; ++i)
+    {
+      const auto oack = request_oack(read_request, port);
+      ASSERT_TRUE(oack.has_value());
+      EXPECT_EQ(oack->options[0].second, std::to_string(FILE_SIZE));
+      ASSERT_TRUE(tftp_client::get_file(FILENAME, "127.0.0.1", tftp::mode_t::OCTET, "127.0.0.1", port));
+      EXPECT_EQ(read_file(FILENAME), read_file(root / FILENAME));
+      std::filesystem::remove(FILENAME);
+    }
+
+    // A file changed behind the server's back is seen
+    write_random_file(root / FILENAME, 1000);
+    wait_for_refresh();
+    const auto oack = request_oack(read_request, port);
+    ASSERT_TRUE(oack.has_value());
+    EXPECT_EQ(oack->options[0].second, "1000");
+
+    // Missing and outside the root
+    for (const auto &name : {"missing.bin", "../escape.bin"})
+    {
+      const auto error = request_error(tftp::rw_packet_t(name, tftp::packet_t::READ, tftp::mode_t::OCTET), port);
+      ASSERT_TRUE(error.has_value());
+      EXPECT_EQ(error->error_code, static_cast<uint16_t>(tftp::error_t::ACCESS_ERROR));
+    }
+
+    // An upload makes the file it creates visible straight away
+    const tftp::rw_packet_t upload_request("upload.bin", tftp::packet_t::READ, tftp::mode_t::OCTET);
+    EXPECT_TRUE(request_error(upload_request, port).has_value());
+    write_random_file("upload.bin", 5000);
+    ASSERT_TRUE(tftp_client::send_file("upload.bin", "127.0.0.1", tftp::mode_t::OCTET, "127.0.0.1", port));
+    EXPECT_EQ(read_file(root / "upload.bin"), read_file("upload.bin"));
+    const auto exists =
+        request_error(tftp::rw_packet_t("upload.bin", tftp::packet_t::WRITE, tftp::mode_t::OCTET), port);
+    ASSERT_TRUE(exists.has_value());
+    EXPECT_EQ(exists->error_code, static_cast<uint16_t>(tftp::error_t::FILE_EXISTS));
+    std::filesystem::rename("upload.bin", "sent.bin");
+    ASSERT_TRUE(tftp_client::get_file("upload.bin", "127.0.0.1", tftp::mode_t::OCTET, "127.0.0.1", port));
+    EXPECT_EQ(read_file("upload.bin"), read_file("sent.bin"));
+  }
+  std::filesystem::current_path(old_cwd);
+  std::filesystem::remove_all(out_dir);
+  std::filesystem::remove_all(root);
+}
+
+TEST(tftp_server_pack, reads_served_from_pack)
+{
+  ensure_console_logger();
+  const uint16_t port = TEST_PORT + 4;
+  const auto     root = make_temp_dir("tftp_test_pack_root_");
+  const auto     src  = make_temp_dir("tftp_test_pack_src_");
+  const auto     pack = src / "files.pack";
+  write_random_file(root / "disk.bin", 3000);
+  std::filesystem::create_directories(src / "tree");
+  write_random_file(src / "tree" / FILENAME, FILE_SIZE);
+  std::ofstream(src / "tree" / "motd.txt") << "line one\nline two\n";
+  pack_file::build(src / "tree", pack);
+  const auto out_dir = make_temp_dir("tftp_test_pack_out_");
+  const auto old_cwd = std::filesystem::current_path();
+  std::filesystem::current_path(out_dir);
+  {
+    forked_server server([&root, &pack, port]() {
+      auto options      = local_server_options(root, port);
+      options.pack_path = pack;
+      return std::make_unique<tftp_server>(options);
+    });
+    for (const uint16_t window_size : {1, 8})
+    {
+      ASSERT_TRUE(tftp_client::get_file(FILENAME, "127.0.0.1", tftp::mode_t::OCTET, "127.0.0.1", port, window_size));
+      EXPECT_EQ(read_file(FILENAME), read_file(src / "tree" / FILENAME));
+      std::filesystem::remove(FILENAME);
+    }
+    ASSERT_TRUE(tftp_client::get_file("motd.txt", "127.0.0.1", tftp::mode_t::NETASCII, "127.0.0.1", port));
+    EXPECT_EQ(read_file("motd.txt"), read_file(src / "tree" / "motd.txt"));
+
+    // Files not in the pack come from the root
+    ASSERT_TRUE(tftp_client::get_file("disk.bin", "127.0.0.1", tftp::mode_t::OCTET, "127.0.0.1", port));
+    EXPECT_EQ(read_file("disk.bin"), read_file(root / "disk.bin"));
+
+    tftp::rw_packet_t read_request(FILENAME, tftp::packet_t::READ, tftp::mode_t::OCTET);
+    read_request.options.push_back(std::make_pair("tsize", "0"));
+    auto oack = request_oack(read_request, port);
+    ASSERT_TRUE(oack.has_value());
+    EXPECT_EQ(oack->options[0].second, std::to_string(FILE_SIZE));
+
+    // A pack renamed over the old one is picked up without a restart
+    write_random_file(src / "tree" / FILENAME, 1000);
+    pack_file::build(src / "tree", pack);
+    std::this_thread::sleep_for(std::chrono::milliseconds(pack_store::RECHECK_MS + 100));
+    oack = request_oack(read_request, port);
+    ASSERT_TRUE(oack.has_value());
+    EXPECT_EQ(oack->options[0].second, "1000");
+    ASSERT_TRUE(tftp_client::get_file(FILENAME, "127.0.0.1", tftp::mode_t::OCTET, "127.0.0.1", port));
+    EXPECT_EQ(read_file(FILENAME), read_file(src / "tree" / FILENAME));
+
+    const auto error =
+        request_error(tftp::rw_packet_t("../escape.bin", tftp::packet_t::READ, tftp::mode_t::OCTET), port);
+    ASSERT_TRUE(error.has_value());
+    EXPECT_EQ(error->error_code, static_cast<uint16_t>(tftp::error_t::ACCESS_ERROR));
+  }
+  std::filesystem::current_path(old_cwd);
+  std::filesystem::remove_all(out_dir);
+  std::filesystem::remove_all(src);
+  std::filesystem::remove_all(root);
+}
+
+TEST(tftp_server_mmap, reads_through_mapping)
+{
+  ensure_console_logger();
+  const uint16_t port = TEST_PORT + 5;
+  const auto     root = make_temp_dir("tftp_test_mmap_root_");
+  write_random_file(root / FILENAME, FILE_SIZE);
+  write_random_file(root / "small.bin", 1000);
+  const auto out_dir = make_temp_dir("tftp_test_mmap_out_");
+  const auto old_cwd = std::filesystem::current_path();
+  std::filesystem::current_path(out_dir);
+  for (const size_t io_threads : {0, 2})
+  {
+    forked_server server([&root, port, io_threads]() {
+      auto options           = local_server_options(root, port);
+      options.io_threads     = io_threads;
+      options.mmap_min_bytes = 4096;
+      return std::make_unique<tftp_server>(options);
+    });
+    for (const auto &name : {FILENAME, "small.bin"})
+    {
+      for (const uint16_t window_size : {1, 8})
+      {
+        ASSERT_TRUE(tftp_client::get_file(name, "127.0.0.1", tftp::mode_t::OCTET, "127.0.0.1", port, window_size));
+        EXPECT_EQ(read_file(name), read_file(root / name));
+        std::filesystem::remove(name);
+      }
+    }
+    lossy_relay relay("127.0.0.1", port, 0.02, 8);
+    ASSERT_TRUE(tftp_client::get_file(FILENAME, "127.0.0.1", tftp::mode_t::OCTET, "127.0.0.1", relay.port(), 8));
+    EXPECT_EQ(read_file(FILENAME), read_file(root / FILENAME));
+    std::filesystem::remove(FILENAME);
+  }
+  std::filesystem::current_path(old_cwd);
+  std::filesystem::remove_all(out_dir);
+  std::filesystem::remove_all(root);
+}
+
+TEST(tftp_server_multicast, clients_share_one_group)
+{
+  ensure_console_logger();
+  const uint16_t port = TEST_PORT + 6;
+  const auto     root = make_temp_dir("tftp_test_multicast_root_");
+  write_random_file(root / FILENAME, 200 * 1024);
+  write_random_file(root / "empty.bin", 0);
+  const auto out_dir = make_temp_dir("tftp_test_multicast_out_");
+  forked_server server([&root, port]() {
+    auto options            = local_server_options(root, port);
+    options.multicast_group = "239.255.69.1:17580";
+    return std::make_unique<tftp_server>(options);
+  });
+
+  // The first client is master, the others join late and pick up the blocks they missed afterwards
+  const size_t             clients = 4;
+  std::vector<std::thread> threads;
+  std::vector<char>        results(clients, 0);
+  for (size_t i = 0; i < clients; ++i)
+  {
+    threads.emplace_back([&out_dir, &results, port, i]() {
+      const auto local = out_dir / ("copy" + std::to_string(i) + ".bin");
+      results[i]       = tftp_client::get_file_multicast(FILENAME, "127.0.0.1", "127.0.0.1", port, local);
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  }
+  for (auto &thread : threads)
+  {
+    thread.join();
+  }
+  for (size_t i = 0; i < clients; ++i)
+  {
+    ASSERT_TRUE(results[i]) << "client " << i;
+    EXPECT_EQ(read_file(out_dir / ("copy" + std::to_string(i) + ".bin")), read_file(root / FILENAME));
+  }
+
+  ASSERT_TRUE(tftp_client::get_file_multicast("empty.bin", "127.0.0.1", "127.0.0.1", port, out_dir / "empty.bin"));
+  EXPECT_TRUE(read_file(out_dir / "empty.bin").empty());
+
+  tftp::rw_packet_t request(FILENAME, tftp::packet_t::READ, tftp::mode_t::OCTET);
+  request.options.push_back(std::make_pair("multicast", ""));
+  const auto oack = request_oack(request, port);
+  ASSERT_TRUE(oack.has_value());
+  ASSERT_EQ(oack->options.size(), 1);
+  EXPECT_EQ(oack->options[0].second, "239.255.69.1,17580,1");
+
+  // The block size is held to the MTU of the route to the group rather than to the client
+  udp_connection probe;
+  probe.set_multicast_interface("127.0.0.1");
+  probe.connect("239.255.69.1", 17580);
+  const size_t group_block_size = tftp::block_size_for_mtu(utils::get_mtu(probe.sd()));
+  request.options.push_back(std::make_pair("blksize", std::to_string(tftp::MAX_BLOCK_SIZE)));
+  const auto blksize_oack = request_oack(request, port);
+  ASSERT_TRUE(blksize_oack.has_value());
+  ASSERT_EQ(blksize_oack->options.size(), 2);
+  EXPECT_EQ(blksize_oack->options[0].second, std::to_string(group_block_size));
+  request.options.pop_back();
+
+  // Netascii is served by an ordinary session, which does not know the option
+  request.mode = tftp::mode_t::NETASCII;
+  request.options.push_back(std::make_pair("tsize", "0"));
+  const auto unicast_oack = request_oack(request, port);
+  ASSERT_TRUE(unicast_oack.has_value());
+  ASSERT_EQ(unicast_oack->options.size(), 1);
+  EXPECT_EQ(unicast_oack->options[0].first, "TSIZE");
+
+  request.filename = "missing.bin";
+  request.mode     = tftp::mode_t::OCTET;
+  const auto error = request_error(request, port);
+  ASSERT_TRUE(error.has_value());
+  EXPECT_EQ(error->error_code, static_cast<uint16_t>(tftp::error_t::ACCESS_ERROR));
+
+  std::filesystem::remove_all(out_dir);
+  std::filesystem::remove_all(root);
+}
+
+TEST(tftp_server_rollover, reads_past_65535_blocks)
+{
+  ensure_console_logger();
+  const uint16_t port = TEST_PORT + 7;
+  const auto     root = make_temp_dir("tftp_test_rollover_root_");
+  // Wraps the block number once, ending part way into a window
+  write_random_file(root / FILENAME, (65535 + 100) * 512 + 77);
+  const auto out_dir = make_temp_dir("tftp_test_rollover_out_");
+  const auto old_cwd = std::filesystem::current_path();
+  std::filesystem::current_path(out_dir);
+  forked_server server([&root, port]() {
+    auto options                 = local_server_options(root, port);
+    options.io_threads           = 2;
+    options.datagram_cache_bytes = 64 * 1024 * 1024;
+    return std::make_unique<tftp_server>(options);
+  });
+
+  for (const std::optional<uint16_t> rollover : {std::optional<uint16_t>{}, std::optional<uint16_t>{0},
+                                                 std::optional<uint16_t>{1}})
+  {
+    ASSERT_TRUE(
+        tftp_client::get_file(FILENAME, "127.0.0.1", tftp::mode_t::OCTET, "127.0.0.1", port, 64, rollover));
+    EXPECT_EQ(read_file(FILENAME), read_file(root / FILENAME));
+    std::filesystem::remove(FILENAME);
+  }
+
+  tftp::rw_packet_t request(FILENAME, tftp::packet_t::READ, tftp::mode_t::OCTET);
+  request.options.push_back(std::make_pair("rollover", "1"));
+  const auto oack = request_oack(request, port);
+  ASSERT_TRUE(oack.has_value());
+  ASSERT_EQ(oack->options.size(), 1);
+  EXPECT_EQ(oack->options[0].first, "ROLLOVER");
+  EXPECT_EQ(oack->options[0].second, "1");
+
+  std::filesystem::current_path(old_cwd);
+  std::filesystem::remove_all(out_dir);
+  std::filesystem::remove_all(root);
+}
+
+TEST(tftp_server_blksize, held_to_path_mtu)
+{
+  ensure_console_logger();
+  const uint16_t port = TEST_PORT + 8;
+  const auto     root = make_temp_dir("tftp_test_blksize_root_");
+  write_random_file(root / FILENAME, 1024 * 1024 + 5);
+  const auto out_dir = make_temp_dir("tftp_test_blksize_out_");
+  const auto old_cwd = std::filesystem::current_path();
+  std::filesystem::current_path(out_dir);
+
+  udp_connection udp;
+  udp.bind("127.0.0.1", 0);
+  udp.connect("127.0.0.1", port);
+  const size_t loopback_block_size = tftp::block_size_for_mtu(utils::get_mtu(udp.sd()));
+
+  for (const bool fragment : {false, true})
+  {
+    forked_server server([&root, port, fragment]() {
+      auto options                = local_server_options(root, port);
+      options.allow_fragmentation = fragment;
+      return std::make_unique<tftp_server>(options);
+    });
+
+    tftp::rw_packet_t request(FILENAME, tftp::packet_t::READ, tftp::mode_t::OCTET);
+    request.options.push_back(std::make_pair("BLKSIZE", "70000"));
+    auto oack = request_oack(request, port);
+    ASSERT_TRUE(oack.has_value());
+    ASSERT_EQ(oack->options.size(), 1);
+    EXPECT_EQ(oack->options[0].second,
+              std::to_string(fragment ? tftp::MAX_BLOCK_SIZE : loopback_block_size));
+
+    request.options[0].second = "1468";
+    oack                      = request_oack(request, port);
+    ASSERT_TRUE(oack.has_value());
+    ASSERT_EQ(oack->options.size(), 1);
+    EXPECT_EQ(oack->options[0].second, "1468");
+
+    // Below the minimum the option is ignored
+    request.options[0].second = "4";
+    request.options.push_back(std::make_pair("TSIZE", "0"));
+    oack = request_oack(request, port);
+    ASSERT_TRUE(oack.has_value());
+    ASSERT_EQ(oack->options.size(), 1);
+    EXPECT_EQ(oack->options[0].first, "TSIZE");
+
+    for (const size_t block_size : {size_t{1468}, size_t{8968}, tftp::MAX_BLOCK_SIZE})
+    {
+      ASSERT_TRUE(tftp_client::get_file(FILENAME, "127.0.0.1", tftp::mode_t::OCTET, "127.0.0.1", port, 8,
+                                        std::nullopt, block_size));
+      EXPECT_EQ(read_file(FILENAME), read_file(root / FILENAME));
+      std::filesystem::remove(FILENAME);
+    }
+  }
+
+  std::filesystem::current_path(old_cwd);
+  std::filesystem::remove_all(out_dir);
+  std::filesystem::remove_all(root);
+}
+
+TEST(tftp_server_retransmit, bytes_on_wire_near_file_size_under_jitter)
+{
+  ensure_console_logger();
+  const uint16_t port      = TEST_PORT + 9;
+  const size_t   file_size = 256 * 1024;
+  const auto     root      = make_temp_dir("tftp_test_jitter_root_");
+  write_random_file(root / FILENAME, file_size);
+  const auto out_dir = make_temp_dir("tftp_test_jitter_out_");
+  const auto old_cwd = std::filesystem::current_path();
+  std::filesystem::current_path(out_dir);
+  forked_server server([&root, port]() { return std::make_unique<tftp_server>(local_server_options(root, port)); });
+
+  // Every DATA packet once, headers included
+  const size_t blocks  = (file_size / tftp::DATA_PKT_DATA_MAX_SIZE) + 1;
+  const double minimum = static_cast<double>(file_size + (blocks * tftp::DATA_PKT_HEADER_SIZE));
+  for (const uint16_t window_size : {1, 8})
+  {
+    // One ACK in ten reaches the server twice, the copy after newer ACKs
+    lossy_relay relay("127.0.0.1", port, 0.0, window_size, 4, 0.1);
+    ASSERT_TRUE(
+        tftp_client::get_file(FILENAME, "127.0.0.1", tftp::mode_t::OCTET, "127.0.0.1", relay.port(), window_size));
+    EXPECT_EQ(read_file(FILENAME), read_file(root / FILENAME));
+    std::filesystem::remove(FILENAME);
+    EXPECT_GT(relay.duplicated(), 0);
+    const double ratio = static_cast<double>(relay.server_bytes()) / minimum;
+    EXPECT_LT(ratio, 1.1) << "windowsize " << window_size;
+  }
+
+  std::filesystem::current_path(old_cwd);
+  std::filesystem::remove_all(out_dir);
+  std::filesystem::remove_all(root);
+}
+
+TEST(tftp_server_uring, transfers_through_poller_io)
+{
+  ensure_console_logger();
+  const uint16_t port = TEST_PORT + 10;
+  const auto     root = make_temp_dir("tftp_test_uring_root_");
+  write_random_file(root / FILENAME, FILE_SIZE);
+  const auto out_dir = make_temp_dir("tftp_test_uring_out_");
+  const auto old_cwd = std::filesystem::current_path();
+  std::filesystem::current_path(out_dir);
+  forked_server server([&root, port]() {
+    auto options    = local_server_options(root, port);
+    options.backend = event_poller::backend_t::IO_URING;
+    return std::make_unique<tftp_server>(options);
+  });
+
+  // DATA and ACK packets are received and sent by the ring, lost ones recovered by the session timeouts
+  for (const uint16_t window_size : {1, 16})
+  {
+    lossy_relay relay("127.0.0.1", port, 0.02, window_size);
+    ASSERT_TRUE(
+        tftp_client::get_file(FILENAME, "127.0.0.1", tftp::mode_t::OCTET, "127.0.0.1", relay.port(), window_size));
+    EXPECT_EQ(read_file(FILENAME), read_file(root / FILENAME));
+    std::filesystem::remove(FILENAME);
+  }
+
+  // Blocks are read by the ring a batch at a time, a file ending on a batch ends with an empty block
+  for (const size_t size : {size_t(2 * 8 * 512), size_t(100), size_t(0)})
+  {
+    const std::string name = "sized_" + std::to_string(size) + ".bin";
+    write_random_file(root / name, size);
+    ASSERT_TRUE(tftp_client::get_file(name, "127.0.0.1", tftp::mode_t::OCTET, "127.0.0.1", port));
+    EXPECT_EQ(read_file(name), read_file(root / name));
+  }
+
+  const std::string upload = "upload.bin";
+  write_random_file(upload, FILE_SIZE);
+  ASSERT_TRUE(tftp_client::send_file(upload, "127.0.0.1", tftp::mode_t::OCTET, "127.0.0.1", port));
+  EXPECT_EQ(read_file(root / upload), read_file(upload));
+
+  std::filesystem::current_path(old_cwd);
+  std::filesystem::remove_all(out_dir);
+  std::filesystem::remove_all(root);
+}
+
+TEST(tftp_server_refusal, failed_session_answered_and_forgotten)
+{
+  ensure_console_logger();
+  const uint16_t port = TEST_PORT + 11;
+  const auto     root = make_temp_dir("tftp_test_refusal_root_");
+  write_random_file(root / FILENAME, FILE_SIZE);
+  forked_server server([&root, port]() {
+    auto started = std::make_unique<tftp_server>(local_server_options(root, port));
+    // No descriptor left for a session's socket
+    const int     next_fd = dup(0);
+    struct rlimit limit   = {static_cast<rlim_t>(next_fd), static_cast<rlim_t>(next_fd)};
+    close(next_fd);
+    setrlimit(RLIMIT_NOFILE, &limit);
+    return started;
+  });
+
+  // The same request from the same port is refused each time rather than dropped as a repeat
+  udp_connection          udp;
+  const tftp::rw_packet_t request(FILENAME, tftp::packet_t::READ, tftp::mode_t::OCTET);
+  udp.bind("127.0.0.1", 0);
+  for (int i = 0; i < 2; ++i)
+  {
+    udp.send_to("127.0.0.1", port, tftp::serialise_rw_packet(request));
+    pollfd pfd = {udp.sd(), POLLIN, 0};
+    ASSERT_GT(poll(&pfd, 1, 2000), 0);
+    std::string address;
+    uint16_t    tid   = 0;
+    const auto  error = tftp::deserialise_error_packet(udp.recv_from(address, tid, tftp::DATA_PKT_MAX_SIZE));
+    ASSERT_TRUE(error.has_value());
+    EXPECT_EQ(error->error_code, static_cast<uint16_t>(tftp::error_t::NOT_DEFINED));
+    EXPECT_EQ(tid, port);
+  }
+  std::filesystem::remove_all(root);
+}
@@ -5,6 +5,8 @@
 #include "common/tftp.hpp"
 #include "tests/test_utils.hpp"
 
+using namespace test_utils;
+
 TEST(tftp_serdes_tests, good_rw_packet_octect)
 {
   const std::vector<char> data = {0x00, 0x01, '/', 'r', 'o', 'o', 't', '/', 'd',
@@ -137,4 +139,107 @@ TEST(tftp_serdes_tests, rw_packet_with_3_options_pair)
   EXPECT_EQ(packet->options.at(1).second, uppercase(opt2_val));
   EXPECT_EQ(packet->options.at(2).first, uppercase(opt3_key));
   EXPECT_EQ(packet->options.at(2).second, uppercase(opt3_val));
-}
\ No newline at end of file
+}
+TEST(tftp_serdes_tests, rw_packet_round_trip_with_options)
+{
+  tftp::rw_packet_t request("file.bin", tftp::packet_t::READ, tftp::mode_t::OCTET);
+  request.options.push_back(std::make_pair("WINDOWSIZE", "16"));
+  request.options.push_back(std::make_pair("TSIZE", "0"));
+
+  const auto packet = tftp::deserialise_rw_packet(tftp::serialise_rw_packet(request));
+
+  ASSERT_TRUE(packet.has_value());
+  EXPECT_EQ(packet->type, tftp::packet_t::READ);
+  EXPECT_EQ(packet->filename, request.filename);
+  EXPECT_EQ(packet->mode, tftp::mode_t::OCTET);
+  EXPECT_EQ(packet->options, request.options);
+}
+
+TEST(tftp_serdes_tests, encoded_data_packet_matches_serialised)
+{
+  tftp::data_packet_t packet;
+  packet.block_number = 0x1234;
+  packet.data         = {'a', 'b', 'c'};
+
+  std::array<char, tftp::DATA_PKT_MAX_SIZE> buffer;
+  const size_t                              size = tftp::encode_data_packet(
+      packet.block_number, std::string_view(packet.data.data(), packet.data.size()), buffer.data(), buffer.size());
+  EXPECT_EQ(std::vector<char>(buffer.begin(), buffer.begin() + size), tftp::serialise_data_packet(packet));
+}
+
+TEST(tftp_serdes_tests, encode_into_small_buffer_fails)
+{
+  std::array<char, 8> buffer;
+  EXPECT_EQ(tftp::encode_data_packet(1, "123456789", buffer.data(), buffer.size()), 0);
+  EXPECT_EQ(tftp::encode_ack_packet(1, buffer.data(), 3), 0);
+  EXPECT_EQ(tftp::encode_error_packet(1, "long message", buffer.data(), buffer.size()), 0);
+}
+
+TEST(tftp_serdes_tests, decoded_views_point_into_packet)
+{
+  const std::vector<char> data{0, static_cast<char>(tftp::packet_t::DATA), '\xFF', '\x01', 'x', 'y'};
+  const auto              packet = tftp::decode_data_packet(std::string_view(data.data(), data.size()));
+  ASSERT_TRUE(packet.has_value());
+  EXPECT_EQ(packet->block_number, 0xFF01);
+  EXPECT_EQ(packet->data.data(), data.data() + 4);
+  EXPECT_EQ(packet->data, "xy");
+
+  EXPECT_FALSE(tftp::decode_ack_packet(std::string_view(data.data(), data.size())).has_value());
+  EXPECT_FALSE(tftp::decode_data_packet(std::string_view(data.data(), 3)).has_value());
+}
+
+TEST(tftp_serdes_tests, error_packet_without_terminator_is_rejected)
+{
+  const std::vector<char> data{0, static_cast<char>(tftp::packet_t::ERROR), 0, 1, 'x'};
+  EXPECT_FALSE(tftp::decode_error_packet(std::string_view(data.data(), data.size())).has_value());
+}
+
+TEST(tftp_serdes_tests, data_packet_buffer_patches_header_in_place)
+{
+  tftp::data_packet_buffer buffer;
+  buffer.resize_payload(3);
+  std::copy_n("abc", 3, buffer.payload());
+  buffer.set_block_number(0xABCD);
+  const char *const payload = buffer.payload();
+
+  tftp::data_packet_t packet;
+  packet.block_number = 0xABCD;
+  packet.data         = {'a', 'b', 'c'};
+  EXPECT_EQ(std::vector<char>(buffer.data(), buffer.data() + buffer.size()), tftp::serialise_data_packet(packet));
+  EXPECT_EQ(buffer.block_number(), 0xABCD);
+  EXPECT_EQ(buffer.data() + tftp::DATA_PKT_HEADER_SIZE, payload);
+
+  buffer.resize_payload(2);
+  buffer.set_block_number(1);
+  packet.block_number = 1;
+  packet.data.pop_back();
+  EXPECT_EQ(std::vector<char>(buffer.data(), buffer.data() + buffer.size()), tftp::serialise_data_packet(packet));
+}
+
+TEST(tftp_block_number_tests, wraps_to_rollover)
+{
+  EXPECT_EQ(tftp::next_block_number(1), 2);
+  EXPECT_EQ(tftp::next_block_number(65535), 0);
+  EXPECT_EQ(tftp::next_block_number(65535, 1), 1);
+  EXPECT_EQ(tftp::previous_block_number(0), 65535);
+  EXPECT_EQ(tftp::previous_block_number(1, 1), 65535);
+
+  EXPECT_EQ(tftp::block_distance(65530, 3), 9);
+  EXPECT_EQ(tftp::block_distance(65530, 3, 1), 8);
+  EXPECT_EQ(tftp::block_distance(3, 3, 1), 0);
+
+  // The first block of a transfer is index 0
+  EXPECT_EQ(tftp::block_number_at(0), 1);
+  EXPECT_EQ(tftp::block_number_at(65534), 65535);
+  EXPECT_EQ(tftp::block_number_at(65535), 0);
+  EXPECT_EQ(tftp::block_number_at(65535, 1), 1);
+  EXPECT_EQ(tftp::block_number_at(2 * 65535, 1), 1);
+}
+
+TEST(tftp_block_size_tests, fits_mtu)
+{
+  EXPECT_EQ(tftp::block_size_for_mtu(1500), 1468);
+  EXPECT_EQ(tftp::block_size_for_mtu(9000), 8968);
+  EXPECT_EQ(tftp::block_size_for_mtu(65536), tftp::MAX_BLOCK_SIZE);
+  EXPECT_EQ(tftp::block_size_for_mtu(20), tftp::MIN_BLOCK_SIZE);
+}
@@ -0,0 +1,99 @@
+#include <gtest/gtest.h>
+
+#include "common/tftp_write_file.hpp"
+#include "tests/test_utils.hpp"
+
+using namespace test_utils;
+
+namespace
+{
+  class tftp_write_file_test : public ::testing::Test
+  {
+  protected:
+    void SetUp() override
+    {
+      dir  = make_temp_dir("tftp_write_test_");
+      path = dir / "file.bin";
+    }
+
+    void TearDown() override
+    {
+      std::filesystem::remove_all(dir);
+    }
+
+    std::filesystem::path dir;
+    std::filesystem::path path;
+  };
+} // namespace
+
+TEST_F(tftp_write_file_test, blocks_gathered_into_batches)
+{
+  tftp_write_file   file(path, tftp::mode_t::OCTET);
+  std::vector<char> block(512, 'x');
+  file.write(block);
+  file.write(block);
+  // Still in the batch
+  EXPECT_EQ(std::filesystem::file_size(path), 0);
+  file.flush();
+  EXPECT_EQ(std::filesystem::file_size(path), 1024);
+  file.close();
+  EXPECT_FALSE(file.error());
+}
+
+TEST_F(tftp_write_file_test, data_spanning_batches_written_in_order)
+{
+  write_random_file(dir / "source.bin", (2 * tftp_write_file::WRITE_BATCH_BYTES) + 1000);
+  const auto source = read_file(dir / "source.bin");
+  {
+    tftp_write_file file(path, tftp::mode_t::OCTET, {tftp_write_file::sync_t::INTERVAL, 1024 * 1024});
+    for (size_t offset = 0; offset < source.size(); offset += 1428)
+    {
+      file.write(source.data() + offset, std::min<size_t>(1428, source.size() - offset));
+    }
+    EXPECT_EQ(std::filesystem::file_size(path), 2 * tftp_write_file::WRITE_BATCH_BYTES);
+  }
+  EXPECT_EQ(read_file(path), source);
+}
+
+TEST_F(tftp_write_file_test, preallocation_trimmed_on_close)
+{
+  tftp_write_file file(path, tftp::mode_t::OCTET, {tftp_write_file::sync_t::ON_CLOSE, 0});
+  ASSERT_TRUE(file.preallocate(1024 * 1024));
+  const std::vector<char> data(1000, 'y');
+  file.write(data);
+  file.close();
+  EXPECT_FALSE(file.error());
+  EXPECT_EQ(read_file(path), data);
+}
+
+TEST_F(tftp_write_file_test, netascii_converted_to_native)
+{
+  {
+    tftp_write_file   file(path, tftp::mode_t::NETASCII);
+    const std::string data("line\r\nnext\r\0");
+    file.write(data.data(), data.size() + 1);
+  }
+  const std::string expected("line\nnext\r");
+  EXPECT_EQ(read_file(path), std::vector<char>(expected.begin(), expected.end()));
+}
+
+TEST(tftp_write_file, sync_policy_parsed)
+{
+  const auto none = tftp_write_file::string_to_sync_policy("none");
+  ASSERT_TRUE(none.has_value());
+  EXPECT_EQ(none->sync, tftp_write_file::sync_t::NONE);
+
+  const auto on_close = tftp_write_file::string_to_sync_policy("CLOSE");
+  ASSERT_TRUE(on_close.has_value());
+  EXPECT_EQ(on_close->sync, tftp_write_file::sync_t::ON_CLOSE);
+
+  const auto interval = tftp_write_file::string_to_sync_policy("16");
+  ASSERT_TRUE(interval.has_value());
+  EXPECT_EQ(interval->sync, tftp_write_file::sync_t::INTERVAL);
+  EXPECT_EQ(interval->interval_bytes, 16 * 1024 * 1024);
+  EXPECT_EQ(tftp_write_file::sync_policy_to_string(*interval), "every 16 MiB");
+
+  EXPECT_FALSE(tftp_write_file::string_to_sync_policy("0").has_value());
+  EXPECT_FALSE(tftp_write_file::string_to_sync_policy("16mb").has_value());
+  EXPECT_FALSE(tftp_write_file::string_to_sync_policy("always").has_value());
+}
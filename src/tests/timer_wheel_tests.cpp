@@ -0,0 +1,200 @@
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include "common/timer.hpp"
+#include "common/timer_wheel.hpp"
+
+namespace
+{
+  struct fake_clock
+  {
+    uint64_t now_ms = 1000;
+
+    timer_wheel::clock_fn fn()
+    {
+      return [this]() { return now_ms; };
+    }
+  };
+} // namespace
+
+TEST(timer_wheel, empty_wheel_sleeps_for_max_timeout)
+{
+  fake_clock  clock;
+  timer_wheel wheel(clock.fn());
+
+  EXPECT_EQ(wheel.next_timeout_ms(1000), 1000);
+  EXPECT_EQ(wheel.size(), 0);
+}
+
+TEST(timer_wheel, timer_expires_at_deadline)
+{
+  fake_clock  clock;
+  timer_wheel wheel(clock.fn());
+  timer       t(wheel);
+  int         fired = 0;
+  t.set_callback([&]() { ++fired; });
+
+  t.arm_timer(50);
+  EXPECT_TRUE(t.is_armed());
+  EXPECT_EQ(wheel.next_timeout_ms(1000), 50);
+
+  clock.now_ms += 49;
+  wheel.advance();
+  EXPECT_EQ(fired, 0);
+  EXPECT_FALSE(t.has_expired());
+  EXPECT_EQ(wheel.next_timeout_ms(1000), 1);
+
+  clock.now_ms += 1;
+  wheel.advance();
+  EXPECT_EQ(fired, 1);
+  EXPECT_FALSE(t.is_armed());
+  EXPECT_TRUE(t.has_expired());
+  EXPECT_FALSE(t.has_expired());
+  EXPECT_EQ(wheel.size(), 0);
+}
+
+TEST(timer_wheel, disarmed_timer_does_not_fire)
+{
+  fake_clock  clock;
+  timer_wheel wheel(clock.fn());
+  timer       t(wheel);
+  int         fired = 0;
+  t.set_callback([&]() { ++fired; });
+
+  t.arm_timer(10);
+  t.disarm_timer();
+  EXPECT_EQ(wheel.size(), 0);
+
+  clock.now_ms += 100;
+  wheel.advance();
+  EXPECT_EQ(fired, 0);
+  EXPECT_FALSE(t.has_expired());
+}
+
+TEST(timer_wheel, rearming_moves_deadline)
+{
+  fake_clock  clock;
+  timer_wheel wheel(clock.fn());
+  timer       t(wheel);
+
+  t.arm_timer(10);
+  clock.now_ms += 5;
+  wheel.advance();
+  t.arm_timer(10);
+  EXPECT_EQ(wheel.size(), 1);
+
+  clock.now_ms += 9;
+  wheel.advance();
+  EXPECT_FALSE(t.has_expired());
+
+  clock.now_ms += 1;
+  wheel.advance();
+  EXPECT_TRUE(t.has_expired());
+}
+
+TEST(timer_wheel, long_timeouts_cascade_to_exact_deadline)
+{
+  const std::vector<uint64_t> timeouts = {255, 256, 257, 1000, 16383, 16384, 70000, 1048577, 5000000};
+
+  for (const auto timeout : timeouts)
+  {
+    fake_clock  clock;
+    timer_wheel wheel(clock.fn());
+    timer       t(wheel);
+
+    t.arm_timer(timeout);
+
+    // Walk the clock forward in uneven steps, stopping 1ms short of the deadline
+    const uint64_t deadline = clock.now_ms + timeout;
+    while (clock.now_ms + 1 < deadline)
+    {
+      clock.now_ms = std::min(clock.now_ms + 997, deadline - 1);
+      wheel.advance();
+      ASSERT_FALSE(t.has_expired()) << "timeout " << timeout << " fired early at " << clock.now_ms;
+    }
+
+    clock.now_ms = deadline;
+    wheel.advance();
+    EXPECT_TRUE(t.has_expired()) << "timeout " << timeout;
+  }
+}
+
+TEST(timer_wheel, timers_fire_in_deadline_order)
+{
+  fake_clock         clock;
+  timer_wheel        wheel(clock.fn());
+  std::vector<int>   order;
+  timer              a(wheel);
+  timer              b(wheel);
+  timer              c(wheel);
+  a.set_callback([&]() { order.push_back(1); });
+  b.set_callback([&]() { order.push_back(2); });
+  c.set_callback([&]() { order.push_back(3); });
+
+  c.arm_timer(3000);
+  a.arm_timer(10);
+  b.arm_timer(300);
+
+  for (int i = 0; i < 4000; ++i)
+  {
+    clock.now_ms += 1;
+    wheel.advance();
+  }
+  EXPECT_EQ(order, (std::vector<int>{1, 2, 3}));
+}
+
+TEST(timer_wheel, callback_can_cancel_other_due_timer)
+{
+  fake_clock  clock;
+  timer_wheel wheel(clock.fn());
+  timer       a(wheel);
+  timer       b(wheel);
+  int         b_fired = 0;
+  a.set_callback([&]() { b.disarm_timer(); });
+  b.set_callback([&]() { ++b_fired; });
+
+  a.arm_timer(5);
+  b.arm_timer(5);
+  clock.now_ms += 5;
+  wheel.advance();
+
+  EXPECT_EQ(b_fired, 0);
+  EXPECT_EQ(wheel.size(), 0);
+}
+
+TEST(timer_wheel, callback_can_rearm_itself)
+{
+  fake_clock  clock;
+  timer_wheel wheel(clock.fn());
+  timer       t(wheel);
+  int         fired = 0;
+  t.set_callback([&]() {
+    if (++fired < 3)
+    {
+      t.arm_timer(20);
+    }
+  });
+
+  t.arm_timer(20);
+  for (int i = 0; i < 100; ++i)
+  {
+    clock.now_ms += 1;
+    wheel.advance();
+  }
+  EXPECT_EQ(fired, 3);
+}
+
+TEST(timer_wheel, destroyed_timer_leaves_wheel)
+{
+  fake_clock  clock;
+  timer_wheel wheel(clock.fn());
+  {
+    timer t(wheel);
+    t.arm_timer(10);
+    EXPECT_EQ(wheel.size(), 1);
+  }
+  EXPECT_EQ(wheel.size(), 0);
+  clock.now_ms += 20;
+  wheel.advance();
+}
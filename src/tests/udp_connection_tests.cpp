@@ -0,0 +1,175 @@
+#include <gtest/gtest.h>
+
+#include <arpa/inet.h>
+#include <poll.h>
+
+#include "common/udp_connection.hpp"
+
+namespace
+{
+  struct sockaddr_in local_address(const udp_connection &udp)
+  {
+    struct sockaddr_in sa;
+    socklen_t          len = sizeof(sa);
+    getsockname(udp.sd(), (struct sockaddr *)&sa, &len);
+    return sa;
+  }
+} // namespace
+
+TEST(udp_connection, recv_batch_empty_socket)
+{
+  udp_connection listener;
+  listener.bind("127.0.0.1", 0);
+  datagram_batch batch(8, 64);
+
+  EXPECT_EQ(listener.recv_batch(batch), 0);
+  EXPECT_EQ(batch.size(), 0);
+}
+
+TEST(udp_connection, recv_batch_keeps_data_and_source_address)
+{
+  udp_connection listener;
+  udp_connection client_a;
+  udp_connection client_b;
+  listener.bind("127.0.0.1", 0);
+  client_a.bind("127.0.0.1", 0);
+  client_b.bind("127.0.0.1", 0);
+  const uint16_t port = ntohs(local_address(listener).sin_port);
+
+  client_a.send_to("127.0.0.1", port, {'a', 'b', 'c'});
+  client_b.send_to("127.0.0.1", port, {'d'});
+
+  datagram_batch batch(8, 64);
+  ASSERT_EQ(listener.recv_batch(batch), 2);
+  EXPECT_EQ(batch.data(0), (std::vector<char>{'a', 'b', 'c'}));
+  EXPECT_EQ(batch.data(1), (std::vector<char>{'d'}));
+  EXPECT_EQ(batch.address(0).sin_port, local_address(client_a).sin_port);
+  EXPECT_EQ(batch.address(1).sin_port, local_address(client_b).sin_port);
+  EXPECT_EQ(batch.address(0).sin_addr.s_addr, htonl(INADDR_LOOPBACK));
+}
+
+TEST(udp_connection, recv_batch_limited_to_capacity)
+{
+  udp_connection listener;
+  udp_connection client;
+  listener.bind("127.0.0.1", 0);
+  client.bind("127.0.0.1", 0);
+  const uint16_t port = ntohs(local_address(listener).sin_port);
+  for (char i = 0; i < 5; ++i)
+  {
+    client.send_to("127.0.0.1", port, {i});
+  }
+
+  datagram_batch batch(3, 64);
+  EXPECT_EQ(listener.recv_batch(batch), 3);
+  EXPECT_EQ(batch.data(2), (std::vector<char>{2}));
+  EXPECT_EQ(listener.recv_batch(batch), 2);
+  EXPECT_EQ(batch.data(1), (std::vector<char>{4}));
+}
+
+TEST(udp_connection, send_batch_sends_every_packet_in_order)
+{
+  udp_connection sink;
+  udp_connection sender;
+  sink.bind("127.0.0.1", 0);
+  sender.connect(local_address(sink));
+
+  const char              header[]  = {0, 3};
+  const char              payload[] = {'a', 'b', 'c'};
+  const std::vector<char> whole     = {1, 2, 3};
+  const datagram_view_t   views[]   = {{header, sizeof(header), payload, sizeof(payload)},
+                                       {whole.data(), whole.size(), nullptr, 0},
+                                       {header, sizeof(header), payload, 1}};
+  EXPECT_EQ(sender.send_batch(views, 3), 3);
+
+  datagram_batch batch(8, 64);
+  ASSERT_EQ(sink.recv_batch(batch), 3);
+  EXPECT_EQ(batch.data(0), (std::vector<char>{0, 3, 'a', 'b', 'c'}));
+  EXPECT_EQ(batch.data(1), whole);
+  EXPECT_EQ(batch.data(2), (std::vector<char>{0, 3, 'a'}));
+  EXPECT_EQ(sender.zerocopy_pending(), 0);
+}
+
+TEST(udp_connection, send_gather_sends_one_datagram)
+{
+  udp_connection sink;
+  udp_connection sender;
+  sink.bind("127.0.0.1", 0);
+  sender.connect(local_address(sink));
+
+  const char header[]  = {0, 3};
+  const char payload[] = {'a', 'b', 'c'};
+  EXPECT_EQ(sender.send_gather(header, sizeof(header), payload, sizeof(payload), false), 5);
+  EXPECT_EQ(sender.send_gather(header, sizeof(header), nullptr, 0, false), 2);
+
+  datagram_batch batch(8, 64);
+  ASSERT_EQ(sink.recv_batch(batch), 2);
+  EXPECT_EQ(batch.data(0), (std::vector<char>{0, 3, 'a', 'b', 'c'}));
+  EXPECT_EQ(batch.data(1), (std::vector<char>{0, 3}));
+  EXPECT_EQ(sender.zerocopy_pending(), 0);
+}
+
+TEST(udp_connection, zerocopy_completions_reported)
+{
+  udp_connection sink;
+  udp_connection sender;
+  sink.bind("127.0.0.1", 0);
+  sender.connect(local_address(sink));
+  if (!sender.enable_zerocopy())
+  {
+    GTEST_SKIP() << "SO_ZEROCOPY not supported";
+  }
+
+  const char              header[] = {0, 3};
+  const std::vector<char> payload(1000, 'x');
+  for (int i = 0; i < 3; ++i)
+  {
+    ASSERT_EQ(sender.send_gather(header, sizeof(header), payload.data(), payload.size(), true), 1002);
+  }
+  EXPECT_EQ(sender.zerocopy_pending(), 3);
+
+  datagram_batch batch(8, 2048);
+  ASSERT_EQ(sink.recv_batch(batch), 3);
+  EXPECT_EQ(batch.data(2).size(), 1002);
+
+  // Loopback delivery copies the payload, which the notification says
+  pollfd pfd = {sender.sd(), 0, 0};
+  ASSERT_EQ(poll(&pfd, 1, 1000), 1);
+  EXPECT_TRUE(pfd.revents & POLLERR);
+  const auto completions = sender.recv_zerocopy_completions();
+  EXPECT_EQ(completions.sends, 3);
+  EXPECT_EQ(completions.bytes, 3000);
+  EXPECT_EQ(completions.copied_bytes, 3000);
+  EXPECT_EQ(sender.zerocopy_pending(), 0);
+  EXPECT_EQ(sender.socket_error(), 0);
+}
+
+TEST(udp_connection, send_batch_zerocopy_completions_reported)
+{
+  udp_connection sink;
+  udp_connection sender;
+  sink.bind("127.0.0.1", 0);
+  sender.connect(local_address(sink));
+  if (!sender.enable_zerocopy())
+  {
+    GTEST_SKIP() << "SO_ZEROCOPY not supported";
+  }
+
+  const char              header[] = {0, 3};
+  const std::vector<char> payload(1000, 'x');
+  const datagram_view_t   views[]  = {{header, sizeof(header), payload.data(), payload.size()},
+                                      {header, sizeof(header), payload.data(), 500}};
+  ASSERT_EQ(sender.send_batch(views, 2, true), 2);
+  EXPECT_EQ(sender.zerocopy_pending(), 2);
+
+  datagram_batch batch(8, 2048);
+  ASSERT_EQ(sink.recv_batch(batch), 2);
+  EXPECT_EQ(batch.data(1).size(), 502);
+
+  pollfd pfd = {sender.sd(), 0, 0};
+  ASSERT_EQ(poll(&pfd, 1, 1000), 1);
+  const auto completions = sender.recv_zerocopy_completions();
+  EXPECT_EQ(completions.sends, 2);
+  EXPECT_EQ(completions.bytes, 1500);
+  EXPECT_EQ(sender.zerocopy_pending(), 0);
+}
@@ -1,6 +1,7 @@
 
 #include <gtest/gtest.h>
 
+#include "common/udp_connection.hpp"
 #include "common/utils.hpp"
 #include "tests/test_utils.hpp"
 
@@ -187,4 +188,13 @@ TEST(netascii_to_native, single_cr)
   EXPECT_THROW(
       const std::vector<char> ret = utils::netascii_to_native(input);,
                                                                      std::runtime_error);
-}
\ No newline at end of file
+}
+TEST(get_mtu, needs_connected_socket)
+{
+  udp_connection udp;
+  udp.bind("127.0.0.1", 0);
+  EXPECT_EQ(utils::get_mtu(udp.sd()), -1);
+
+  udp.connect("127.0.0.1", 9);
+  EXPECT_GE(utils::get_mtu(udp.sd()), 576);
+}